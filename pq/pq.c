@@ -30,6 +30,26 @@
 #include <search.h>
 #include <stdint.h>
 #include <xdr.h>
+#include <zlib.h>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+#ifdef __linux__
+    #include <linux/futex.h>
+    #include <linux/magic.h>
+    #include <linux/mempolicy.h>
+    #include <sys/syscall.h>
+    #include <sys/vfs.h>
+    /* Not declared by <unistd.h> when only _XOPEN_SOURCE is defined */
+    extern long syscall(long number, ...);
+    #ifdef HAVE_MMAP
+        /* Nor by <sys/mman.h> */
+        extern int madvise(void* addr, size_t length, int advice);
+        #ifndef MADV_HUGEPAGE
+            #define MADV_HUGEPAGE 14
+        #endif
+    #endif
+#endif
 
 #include "ldm.h"
 #include "pq.h"
@@ -684,16 +704,21 @@ tq_rel_tqelem(tqueue *const tq, int level, tqep_t p)
 /**
  * Adds an element to the time-queue.
  *
- * @param[in] tq      Pointer to time-queue.
- * @param[in] offset  Offset to data-portion of element to be added to
- *                    time-queue.
- * @retval    0       Success
- * @retval    ENOSPC  No more fblk-s: too many products in queue.
+ * @param[in]  tq      Pointer to time-queue.
+ * @param[in]  offset  Offset to data-portion of element to be added to
+ *                     time-queue.
+ * @param[in]  when    Insertion-time of the element or NULL for the current
+ *                     time. Incremented if it's not unique.
+ * @param[out] tvp     Insertion-time of the added element or NULL.
+ * @retval     0       Success
+ * @retval     ENOSPC  No more fblk-s: too many products in queue.
  */
 static int
 tq_add(
-    tqueue* const       tq,
-    const off_t         offset)
+    tqueue* const            tq,
+    const off_t              offset,
+    const timestampt* const  when,
+    timestampt* const        tvp)
 {
     fb*         fbp = (fb*)((char*)tq + tq->fbp_off);
 
@@ -722,7 +747,14 @@ tq_add(
     #define TQE_GET_NEXT(elt, k)    TQE_PTR(TQE_INDEX_NEXT(elt, k))
 
     tqelem*     tp = TQE_PTR(tpix); // pointer to element to be inserted
-    int         status = set_timestamp(&tp->tv); // set insertion-time to now
+    int         status = ENOERR;
+
+    if (when != NULL) {
+        tp->tv = *when;
+    }
+    else {
+        status = set_timestamp(&tp->tv); // set insertion-time to now
+    }
 
     if (status == ENOERR) {
         /*
@@ -810,6 +842,9 @@ tq_add(
                 TQE_INDEX_NEXT(tp, k) = TQE_INDEX_NEXT(tpp, k);
                 TQE_INDEX_NEXT(tpp, k) = tpix;
             } while(--k >= 0);
+
+            if (tvp)
+                *tvp = tp->tv;
         }
     }                                   /* insertion-time set */
 
@@ -823,7 +858,10 @@ tq_add(
  * is TV_LT, TV_EQ, or TV_GT.  ASSUMPTION: All keys in the time-queue are 
  * unique.
  *
- * Returns the tqelem or NULL if no match.
+ * Because the tqueue might be modified while it's being searched (see
+ * PQ_SEQLOCK), indexes are range-checked and the number of steps is bounded.
+ *
+ * Returns the tqelem or NULL if no match or the tqueue is inconsistent.
  */
 static tqelem *
 tqe_find(const tqueue *const tq, const timestampt *const key, const pq_match mt)
@@ -834,6 +872,8 @@ tqe_find(const tqueue *const tq, const timestampt *const key, const pq_match mt)
     const tqelem *tpp;
     const tqelem *tqp;
     fb *fbp = (fb *)((char *)tq + tq->fbp_off);
+    const tqep_t qend = (tqep_t)(tq->nalloc + TQ_OVERHEAD_ELEMS);
+    size_t nsteps = 0;
 
     if(tq->nelems - TQ_OVERHEAD_ELEMS == 0) {
         return NULL;
@@ -842,17 +882,35 @@ tqe_find(const tqueue *const tq, const timestampt *const key, const pq_match mt)
     p = TQ_HEAD;                /* header of skip list */
     tpp = &tq->tqep[p];
     k = tq->level;              /* level of skip list and header */
+    if(k < 0 || k >= MAXLEVELS) {
+        return NULL;
+    }
     do {
         /* q = p->forward[k]; */
         /* same as *(fbp->fblks + tpp->fblk + k) */
+        if(tpp->fblk + k >= fbp->arena_sz) {
+            return NULL;
+        }
         q = fbp->fblks[tpp->fblk + k];
+        if(q < 0 || q >= qend) {
+            return NULL;
+        }
         tqp = &tq->tqep[q];
         /* while(q->key < key) {...} */
         while(TV_CMP_LT(tqp->tv, *key)) {
+            if(++nsteps > (size_t)qend * MAXLEVELS) {
+                return NULL;
+            }
             p = q;
             tpp = &tq->tqep[p];
             /* q = p->forward[k]; */
+            if(tpp->fblk + k >= fbp->arena_sz) {
+                return NULL;
+            }
             q = fbp->fblks[tpp->fblk + k];
+            if(q < 0 || q >= qend) {
+                return NULL;
+            }
             tqp = &tq->tqep[q];
         }
     } while(--k >= 0);
@@ -874,7 +932,13 @@ tqe_find(const tqueue *const tq, const timestampt *const key, const pq_match mt)
             return NULL;
         } /* else */
         if(TV_CMP_EQ(tqp->tv, *key)) {
+            if(tqp->fblk >= fbp->arena_sz) {
+                return NULL;
+            }
             q = fbp->fblks[tqp->fblk];
+            if(q < 0 || q >= qend) {
+                return NULL;
+            }
             tqp = &tq->tqep[q];
             if(q == TQ_NIL) {
                 return NULL;
@@ -907,8 +971,11 @@ tqe_first(const tqueue *const tq)
     tpp = &tq->tqep[p];
     /* q = p->forward[0]; */
     /* same as *(fbp->fblks + tpp->fblk) */
+    if(tpp->fblk >= fbp->arena_sz) {
+        return NULL;            /* inconsistent (see tqe_find()) */
+    }
     q = fbp->fblks[tpp->fblk];
-    if(q == TQ_NIL) {
+    if(q == TQ_NIL || q < 0 || q >= (tqep_t)(tq->nalloc + TQ_OVERHEAD_ELEMS)) {
         return NULL;
     }
     tqp = &tq->tqep[q];
@@ -1009,6 +1076,257 @@ tq_next(const tqueue *const tq, const tqelem *const tqep)
 
 
 /* End tqueue */
+/* Begin tr */
+
+/*
+ * The optional time-ring (see PQ_TIMERING) is a second, read-mostly index of
+ * the time-queue: a circular array of (insertion-time, offset) pairs sorted by
+ * insertion-time. Because insertion-times are nearly monotonic, an addition is
+ * almost always an append; an out-of-order addition shifts the later entries.
+ * A deletion marks its entry (offset OFF_NONE) and deleted entries are trimmed
+ * from the ends and, when the ring is full, compacted away. Lookups are binary
+ * searches of contiguous memory rather than walks of the skip list.
+ *
+ * The tqueue remains authoritative: the time-ring is maintained alongside it
+ * and is only used for lookups by readers.
+ */
+
+typedef struct {
+    timestampt tv;
+    off_t      offset;                  /* OFF_NONE => deleted */
+} trelem;
+
+struct tr {
+#define TR_MAGIC        0x54524e47      /* "TRNG" */
+    size_t magic;
+    size_t nalloc;                      /* capacity in entries */
+    size_t head;                        /* physical index of oldest entry */
+    size_t nelems;                      /* number of entries, incl. deleted */
+    size_t ndeleted;                    /* number of deleted entries */
+    trelem elems[1];                    /* actually nalloc long */
+};
+typedef struct tr tr;
+
+#define TR_NONE ((size_t)(-1))
+
+/*
+ * Returns the capacity of the time-ring, in entries, for a product-queue that
+ * can hold 'nelems' products. The slack bounds the frequency of compaction.
+ */
+static size_t
+tr_nalloc(const size_t nelems)
+{
+    return nelems + nelems/8 + 1;
+}
+
+/*
+ * Returns the size, in bytes, of the time-ring for a product-queue that can
+ * hold 'nelems' products.
+ */
+static size_t
+tr_sz(const size_t nelems)
+{
+    return sizeof(tr) + (tr_nalloc(nelems) - 1)*sizeof(trelem);
+}
+
+static void
+tr_init(tr *const trp, const size_t nelems)
+{
+    trp->magic = TR_MAGIC;
+    trp->nalloc = tr_nalloc(nelems);
+    trp->head = 0;
+    trp->nelems = 0;
+    trp->ndeleted = 0;
+}
+
+/*
+ * Returns a pointer to the i-th oldest entry of the time-ring.
+ */
+static inline trelem *
+tr_at(const tr *const trp, const size_t i)
+{
+    size_t j = trp->head + i;
+
+    if(j >= trp->nalloc)
+        j -= trp->nalloc;
+    return (trelem *)&trp->elems[j];
+}
+
+/*
+ * Indicates if the header of the time-ring is consistent. Necessary because
+ * the time-ring might be read while it's being modified (see PQ_SEQLOCK).
+ */
+static inline bool
+tr_isSane(const tr *const trp)
+{
+    return trp->magic == TR_MAGIC && trp->head < trp->nalloc &&
+            trp->nelems <= trp->nalloc;
+}
+
+/*
+ * Returns the logical index of the first entry whose time is greater than
+ * (if 'after') or greater than or equal to (otherwise) 'key'. Returns
+ * trp->nelems if there's no such entry.
+ */
+static size_t
+tr_bound(const tr *const trp, const timestampt *const key, const bool after)
+{
+    size_t lo = 0;
+    size_t hi = trp->nelems;
+
+    while(lo < hi) {
+        const size_t mid = lo + (hi - lo)/2;
+        const trelem *const ep = tr_at(trp, mid);
+
+        if(after ? TV_CMP_LE(ep->tv, *key) : TV_CMP_LT(ep->tv, *key)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Removes the deleted entries from the time-ring, preserving order.
+ */
+static void
+tr_compact(tr *const trp)
+{
+    size_t n = 0;
+
+    for(size_t i = 0; i < trp->nelems; i++) {
+        const trelem *const ep = tr_at(trp, i);
+
+        if(ep->offset != OFF_NONE)
+            *tr_at(trp, n++) = *ep;
+    }
+    trp->nelems = n;
+    trp->ndeleted = 0;
+}
+
+/*
+ * Adds an entry to the time-ring. The time-queue must have room for the
+ * entry, which guarantees room in the time-ring after compaction.
+ */
+static void
+tr_add(tr *const trp, const timestampt *const tvp, const off_t offset)
+{
+    log_assert(trp->magic == TR_MAGIC);
+
+    if(trp->nelems == trp->nalloc)
+        tr_compact(trp);
+    log_assert(trp->nelems < trp->nalloc);
+
+    size_t i = trp->nelems;
+
+    if(i > 0 && TV_CMP_LT(*tvp, tr_at(trp, i - 1)->tv)) {
+        /* Out-of-order: shift later entries toward the tail */
+        const size_t pos = tr_bound(trp, tvp, true);
+
+        for(; i > pos; i--)
+            *tr_at(trp, i) = *tr_at(trp, i - 1);
+    }
+    tr_at(trp, i)->tv = *tvp;
+    tr_at(trp, i)->offset = offset;
+    trp->nelems++;
+}
+
+/*
+ * Deletes the entry with the given time and offset from the time-ring. Does
+ * nothing if there's no such entry.
+ */
+static void
+tr_delete(tr *const trp, const timestampt *const tvp, const off_t offset)
+{
+    log_assert(trp->magic == TR_MAGIC);
+
+    for(size_t i = tr_bound(trp, tvp, false); i < trp->nelems; i++) {
+        trelem *const ep = tr_at(trp, i);
+
+        if(!TV_CMP_EQ(ep->tv, *tvp))
+            return;                     /* not found */
+        if(ep->offset == offset) {
+            ep->offset = OFF_NONE;
+            trp->ndeleted++;
+            break;
+        }
+    }
+
+    /* Trim deleted entries from both ends */
+    while(trp->nelems > 0 && tr_at(trp, 0)->offset == OFF_NONE) {
+        trp->head = (trp->head + 1 == trp->nalloc) ? 0 : trp->head + 1;
+        trp->nelems--;
+        trp->ndeleted--;
+    }
+    while(trp->nelems > 0 && tr_at(trp, trp->nelems - 1)->offset == OFF_NONE) {
+        trp->nelems--;
+        trp->ndeleted--;
+    }
+}
+
+/*
+ * Search the time-ring for the entry whose time is greatest less than, equal
+ * to, or least greater than 'key', according to whether 'mt' is TV_LT, TV_EQ,
+ * or TV_GT. The analogue of tqe_find().
+ *
+ * Returns the entry or NULL if no match or the time-ring is inconsistent.
+ */
+static const trelem *
+tr_find(const tr *const trp, const timestampt *const key, const pq_match mt)
+{
+    size_t i;
+
+    if(!tr_isSane(trp))
+        return NULL;
+
+    switch (mt) {
+    case TV_LT:
+        for(i = tr_bound(trp, key, false); i-- > 0;) {
+            const trelem *const ep = tr_at(trp, i);
+            if(ep->offset != OFF_NONE)
+                return ep;
+        }
+        return NULL;
+    case TV_EQ:
+        for(i = tr_bound(trp, key, false); i < trp->nelems; i++) {
+            const trelem *const ep = tr_at(trp, i);
+            if(!TV_CMP_EQ(ep->tv, *key))
+                break;
+            if(ep->offset != OFF_NONE)
+                return ep;
+        }
+        return NULL;
+    case TV_GT:
+        for(i = tr_bound(trp, key, true); i < trp->nelems; i++) {
+            const trelem *const ep = tr_at(trp, i);
+            if(ep->offset != OFF_NONE)
+                return ep;
+        }
+        return NULL;
+    }
+    log_error("bad value for mt: %d", mt);
+    return NULL;
+}
+
+/*
+ * Returns the oldest entry in the time-ring or NULL if there is none.
+ */
+static const trelem *
+tr_first(const tr *const trp)
+{
+    if(!tr_isSane(trp))
+        return NULL;
+    for(size_t i = 0; i < trp->nelems; i++) {
+        const trelem *const ep = tr_at(trp, i);
+        if(ep->offset != OFF_NONE)
+            return ep;
+    }
+    return NULL;
+}
+
+/* End tr */
 /* Begin region */
 
 /*
@@ -1090,7 +1408,14 @@ typedef struct region region;
 #define clear_IsAlloc(rp)       (fClr((rp)->extent, ISALLOC))
 #define IsAlloc(rp)     (fIsSet((rp)->extent, ISALLOC))
 #define IsFree(rp)      (!IsAlloc(rp))
-#define Extent(rp)      (fMask((rp)->extent, ISALLOC))
+#define ISZIP    ((unsigned)0x2)        /* extent field of an allocated region
+                                         * is or'd with ISZIP when its product's
+                                         * data is compressed (see PQ_COMPRESS)
+                                         */
+#define set_IsZip(rp)           (fSet((rp)->extent, ISZIP))
+#define clear_IsZip(rp)         (fClr((rp)->extent, ISZIP))
+#define IsZip(rp)       (fIsSet((rp)->extent, ISZIP))
+#define Extent(rp)      (fMask((rp)->extent, ISALLOC|ISZIP))
 
 /* End region */
 /* Begin regionl */
@@ -1484,6 +1809,277 @@ rl_HasSpace(const regionl *const rl)
         return (rl->nempty > 0);
 }
 
+/*
+ * Newer product-queues index their free regions by extent with segregated
+ * size-class bins rather than with a skip list: each bin is a doubly-linked
+ * list of the free regions whose extents lie in its range, and a bitmap
+ * records the non-empty bins.  Adding or deleting a free region is O(1), and
+ * so is finding a free region for an extent: the bin of the extent is
+ * searched for the best fit and, failing that, the first region of the next
+ * non-empty bin -- all of whose regions fit -- is taken.  The free regions
+ * are still indexed by offset with a skip list for consolidation.
+ *
+ * The bins follow the other indexes.  Such a region list has the
+ * pseudo-region RL_FEXT_HD, which is otherwise unused, mark them.
+ */
+
+/* Links of a free region on the list of its bin */
+struct rblink {
+    size_t next;
+    size_t prev;
+};
+typedef struct rblink rblink;
+
+struct rb {
+#define RB_MAGIC        0x5242494e      /* "RBIN"; even, so IsFree() */
+    size_t   magic;
+#define RB_SLBITS       3               /* log2(bins per power of 2) */
+#define RB_NBINS        512
+#define RB_NWORDS       (RB_NBINS/64)
+    uint64_t map[RB_NWORDS];            /* bit set => bin is non-empty */
+    size_t   heads[RB_NBINS];           /* first region of each bin */
+#define RB_NALLOC_INITIAL       1
+    rblink   links[RB_NALLOC_INITIAL];  /* one per region slot */
+};
+typedef struct rb rb;
+
+/* Maximum number of regions examined in the bin of an extent */
+#define RB_SCAN_MAX     16
+
+/*
+ * Returns the amount of space needed by the bins of a region list which is
+ * nelems long.
+ */
+static size_t
+rb_sz(size_t const nelems)
+{
+    return sizeof(rb) - sizeof(rblink) * RB_NALLOC_INITIAL
+        + (nelems + RL_FREE_OVERHEAD) * sizeof(rblink);
+}
+
+/*
+ * Returns the index of the lowest set bit of a non-zero word.
+ */
+static inline unsigned
+rb_ffs(uint64_t const bits)
+{
+#ifdef __GNUC__
+    return (unsigned)__builtin_ctzll(bits);
+#else
+    unsigned i = 0;
+
+    while (!(bits & ((uint64_t)1 << i)))
+        i++;
+    return i;
+#endif
+}
+
+/*
+ * Returns the index of the highest set bit of a non-zero word.
+ */
+static inline unsigned
+rb_fls(uint64_t const bits)
+{
+#ifdef __GNUC__
+    return 63 - (unsigned)__builtin_clzll(bits);
+#else
+    unsigned i = 63;
+
+    while (!(bits & ((uint64_t)1 << i)))
+        i--;
+    return i;
+#endif
+}
+
+/*
+ * Returns the bin of an extent. There are 2^RB_SLBITS bins per power of 2.
+ */
+static inline unsigned
+rb_bin(size_t const extent)
+{
+    unsigned fl = 0;
+
+    if (extent < ((size_t)1 << RB_SLBITS))
+        return (unsigned)extent;
+    for (size_t e = extent; e >>= 1; )
+        fl++;
+    return ((fl - RB_SLBITS + 1) << RB_SLBITS) +
+            (unsigned)((extent >> (fl - RB_SLBITS)) &
+                    (((size_t)1 << RB_SLBITS) - 1));
+}
+
+/*
+ * Returns the first non-empty bin at or after a given one or RB_NBINS if
+ * there is none.
+ */
+static inline unsigned
+rb_nextBin(const rb *const rbp, unsigned const bin)
+{
+    unsigned w = bin / 64;
+    uint64_t bits;
+
+    if (bin >= RB_NBINS)
+        return RB_NBINS;
+    bits = rbp->map[w] & (~(uint64_t)0 << (bin % 64));
+    while (bits == 0) {
+        if (++w == RB_NWORDS)
+            return RB_NBINS;
+        bits = rbp->map[w];
+    }
+    return w * 64 + rb_ffs(bits);
+}
+
+/*
+ * Returns the last non-empty bin or RB_NBINS if all are empty.
+ */
+static inline unsigned
+rb_lastBin(const rb *const rbp)
+{
+    for (int w = RB_NWORDS - 1; w >= 0; w--)
+        if (rbp->map[w])
+            return w * 64 + rb_fls(rbp->map[w]);
+    return RB_NBINS;
+}
+
+/*
+ * Initializes the bins of a region list which is nelems long: all empty.
+ */
+static void
+rb_init(rb *const rbp, size_t const nelems)
+{
+    rbp->magic = RB_MAGIC;
+    (void)memset(rbp->map, 0, sizeof(rbp->map));
+    for (unsigned i = 0; i < RB_NBINS; i++)
+        rbp->heads[i] = RL_NONE;
+    for (size_t i = 0; i < nelems + RL_FREE_OVERHEAD; i++)
+        rbp->links[i].next = rbp->links[i].prev = RL_NONE;
+}
+
+/*
+ * Returns the bins of a region list or NULL if it uses the skip list by
+ * extent.
+ */
+static inline rb *
+rl_bins(regionl *const rl)
+{
+    const region *const hd = rl->rp + RL_FEXT_HD;
+
+    return hd->extent == RB_MAGIC ? (rb *)((char *)rl + hd->offset) : NULL;
+}
+
+/*
+ * Makes a region list use bins rather than the skip list by extent. Must be
+ * called before any region is added.
+ */
+static void
+rl_setBins(regionl *const rl, rb *const rbp)
+{
+    region *const hd = rl->rp + RL_FEXT_HD;
+
+    rb_init(rbp, rl->nalloc);
+    hd->offset = (char *)rbp - (char *)rl;
+    hd->extent = RB_MAGIC;
+}
+
+/*
+ * Adds free region rlix to its bin in O(1) time.
+ */
+static void
+rb_add(regionl *const rl, rb *const rbp, size_t const rlix)
+{
+    const unsigned bin = rb_bin(rl->rp[rlix].extent);
+    const size_t   head = rbp->heads[bin];
+
+    rbp->links[rlix].prev = RL_NONE;
+    rbp->links[rlix].next = head;
+    if (head != RL_NONE)
+        rbp->links[head].prev = rlix;
+    rbp->heads[bin] = rlix;
+    rbp->map[bin / 64] |= (uint64_t)1 << (bin % 64);
+}
+
+/*
+ * Deletes free region rlix from its bin in O(1) time. The extent of the region
+ * must not have changed since it was added.
+ */
+static void
+rb_del(regionl *const rl, rb *const rbp, size_t const rlix)
+{
+    const unsigned bin = rb_bin(rl->rp[rlix].extent);
+    rblink *const  link = rbp->links + rlix;
+
+    if (link->prev != RL_NONE) {
+        rbp->links[link->prev].next = link->next;
+    }
+    else {
+        log_assert(rbp->heads[bin] == rlix);
+        rbp->heads[bin] = link->next;
+        if (link->next == RL_NONE)
+            rbp->map[bin / 64] &= ~((uint64_t)1 << (bin % 64));
+    }
+    if (link->next != RL_NONE)
+        rbp->links[link->next].prev = link->prev;
+    link->next = link->prev = RL_NONE;
+}
+
+/*
+ * Finds a free region for an extent in O(1) time.  Returns RL_NONE if there
+ * is none.
+ */
+static size_t
+rb_find(regionl *const rl, const rb *const rbp, size_t const extent)
+{
+    const region *const rlrp = rl->rp;
+    const unsigned      bin = rb_bin(extent);
+    size_t              best = RL_NONE;
+    size_t              nscanned = 0;
+    size_t              rlix;
+
+    /* Best fit among the first regions of the extent's bin */
+    for (rlix = rbp->heads[bin]; rlix != RL_NONE && nscanned < RB_SCAN_MAX;
+            rlix = rbp->links[rlix].next, nscanned++) {
+        const size_t ext = rlrp[rlix].extent;
+
+        if (ext >= extent && (best == RL_NONE || ext < rlrp[best].extent)) {
+            best = rlix;
+            if (ext == extent)
+                return best;
+        }
+    }
+    if (best != RL_NONE)
+        return best;
+
+    /* Every region of a larger bin fits */
+    const unsigned next = rb_nextBin(rbp, bin + 1);
+    if (next < RB_NBINS)
+        return rbp->heads[next];
+
+    /* Rest of the extent's bin */
+    for (; rlix != RL_NONE; rlix = rbp->links[rlix].next)
+        if (rlrp[rlix].extent >= extent)
+            return rlix;
+
+    return RL_NONE;
+}
+
+/*
+ * Returns the maximum extent of all the free regions.
+ */
+static size_t
+rb_maxfextent(regionl *const rl, const rb *const rbp)
+{
+    const unsigned bin = rb_lastBin(rbp);
+    size_t         max = 0;
+
+    if (bin < RB_NBINS) {
+        for (size_t rlix = rbp->heads[bin]; rlix != RL_NONE;
+                rlix = rbp->links[rlix].next)
+            if (rl->rp[rlix].extent > max)
+                max = rl->rp[rlix].extent;
+    }
+    return max;
+}
+
 
 /*
  * Find previous region by extent on freelist using extent skip list, in 
@@ -1693,6 +2289,22 @@ rl_fext_del(regionl *rl, size_t rlix)
 }
 
 
+/*
+ * Deletes free region rlix from the index of free regions by extent.
+ */
+static void
+rl_ext_del(regionl *const rl, size_t rlix)
+{
+    rb *const rbp = rl_bins(rl);
+
+    if (rbp == NULL) {
+        rl_fext_del(rl, rlix);
+    }
+    else {
+        rb_del(rl, rbp, rlix);
+    }
+}
+
 /*
  * Find best-fit free region from skip list by extent in O(log(nfree)) time.
  */
@@ -1743,23 +2355,27 @@ rl_get(regionl *const rl, size_t extent)
     region *rlrp = rl->rp;
     region *rep;
 
+    rb *const rbp = rl_bins(rl);
+
     if(extent > rl->maxfextent)
         return RL_NONE;
 
-    size_t sqbest = rl_fext_find(rl, extent);      /* index of best fit */
-    if(sqbest == RL_FEXT_TL) {
+    size_t sqbest = rbp
+            ? rb_find(rl, rbp, extent)
+            : rl_fext_find(rl, extent);     /* index of best fit */
+    if(sqbest == RL_FEXT_TL || sqbest == RL_NONE) {
         return RL_NONE;
     }
     rep = rlrp + sqbest;
 
-    /* Remove free region from offset and extent skip lists */
+    /* Remove free region from offset and extent indexes */
     rl_foff_del(rl, sqbest);
-    rl_fext_del(rl, sqbest);
+    rl_ext_del(rl, sqbest);
 
     rl->nfree--;
     if(rep->extent == rl->maxfextent) { /* recompute maxfextent from remaining 
                                            freelist regions */
-        rl->maxfextent = rl_maxfextent(rl);
+        rl->maxfextent = rbp ? rb_maxfextent(rl, rbp) : rl_maxfextent(rl);
     }
     rl->nelems++;
     if (rl->nelems > rl->maxelems)
@@ -1980,7 +2596,28 @@ rl_foff_dump(regionl *const rl)
 
 
 /**
- * Return region with index rlix to the free list.
+ * Adds free region rlix to the index of free regions by extent: the bins if
+ * the region list has them; otherwise, the skip list.
+ *
+ * @param[in,out] rl    Region list
+ * @param[in]     rlix  Offset of region entry
+ * @retval PQ_SYSTEM    Couldn't get new skip-list node. `log_error()` called.
+ * @retval 0            Success
+ */
+static int
+rl_ext_add(regionl *const rl, size_t rlix)
+{
+    rb *const rbp = rl_bins(rl);
+
+    if (rbp == NULL)
+        return rl_fext_add(rl, rlix);
+
+    rb_add(rl, rbp, rlix);
+    return 0;
+}
+
+/**
+ * Return region with index rlix to the free list.
  *
  * @param[in,out] rl    Region list
  * @param[in]     rlix  Offset of region entry
@@ -1996,8 +2633,8 @@ rl_rel(regionl *const rl, size_t rlix)
         log_error("Couldn't add to offset free-list");
     }
     else {
-        // Add to freelist skip list by extent
-        status = rl_fext_add(rl, rlix);
+        // Add to freelist index by extent
+        status = rl_ext_add(rl, rlix);
         if (status) {
             log_error("Couldn't add to extent free-list");
             rl_foff_del(rl, rlix);
@@ -2112,12 +2749,12 @@ rl_consolidate(regionl *const rl, size_t rpix)
     if(rghtix != RL_FOFF_TL) { /* not last free region */
         region *rght = rlrp + rghtix;
         if(rep->offset + rep->extent == rght->offset) { /* mergeable */
-            rl_fext_del(rl, rpix); /* since extent will change, delete from extent skip list first */
+            rl_ext_del(rl, rpix); /* since extent will change, delete from extent index first */
             rep->extent += rght->extent;
-            rl_fext_add(rl, rpix); /* reinsert to keep extent skip list sorted by extent */
+            rl_ext_add(rl, rpix); /* reinsert to keep extent index sorted by extent */
             rl->nfree--;
             rl_foff_del(rl, rghtix);
-            rl_fext_del(rl, rghtix);
+            rl_ext_del(rl, rghtix);
             rp_rel(rl, rghtix); /* now put right back in empty region slots */
             nmerges++;
         }
@@ -2125,12 +2762,12 @@ rl_consolidate(regionl *const rl, size_t rpix)
     if(leftix != RL_FOFF_HD) { /* not first region */
         region *left = rlrp + leftix;
         if(left->offset + left->extent == rep->offset) /* mergeable */ {
-            rl_fext_del(rl, leftix); /* since extent will change, delete from extent skip list first */
+            rl_ext_del(rl, leftix); /* since extent will change, delete from extent index first */
             left->extent += rep->extent;
-            rl_fext_add(rl, leftix); /* reinsert to keep extent skip list sorted by extent */
+            rl_ext_add(rl, leftix); /* reinsert to keep extent index sorted by extent */
             rl->nfree--;
             rl_foff_del(rl, rpix);
-            rl_fext_del(rl, rpix);
+            rl_ext_del(rl, rpix);
             rp_rel(rl, rpix); /* put back in empty region slots */
             nmerges++;
             rep = left;
@@ -2196,6 +2833,45 @@ rl_r_find(regionl *const rl, off_t const offset, region **rpp)
 }
 
 
+/*
+ * Like rl_r_find() but for a regionl that might be modified while it's being
+ * searched (see PQ_SEQLOCK): indexes are range-checked, the number of steps
+ * is bounded, and a match that isn't in use is ignored rather than asserted
+ * against. The result must be validated by the caller.
+ */
+static int
+rl_r_findUnlocked(regionl *const rl, off_t const offset, region **rpp)
+{
+    const size_t nregions = rl->nalloc + RL_FREE_OVERHEAD;
+    const rlhash *rlhp = RLHASHP(rl);
+    size_t next;
+    size_t nsteps;
+
+    *rpp = NULL;
+    if(rlhp->magic != RL_MAGIC) {
+        return 0;
+    }
+    next = rlhp->chains[rl_hash(rl->nchains, offset)];
+    for(nsteps = 0; next != RL_NONE && nsteps < nregions; nsteps++) {
+        region *rep;
+
+        if(next >= nregions) {
+            return 0;
+        }
+        rep = rl->rp + next;
+        if(offset == rep->offset) {
+            if(!IsAlloc(rep)) {
+                return 0;
+            }
+            *rpp = rep;
+            return 1;
+        }
+        next = rep->next;
+    }
+    return 0;
+}
+
+
 /*
  * Add in-use region to region hashtable by offset. This function is the
  * complement of `rlhash_del()`.
@@ -2342,6 +3018,7 @@ rl_free(regionl *const rl, size_t rpix)
     region *rlrp = rl->rp;
     region *rep = rlrp + rpix;
 
+    clear_IsZip(rep);
     clear_IsAlloc(rep);
     rl->nbytes -= rep->extent;
     rlhash_del(rl, rpix);
@@ -2354,7 +3031,134 @@ rl_free(regionl *const rl, size_t rpix)
         rl->maxfree = rl->nfree;
     log_assert(rl->nelems + rl->nfree + rl->nempty == rl->nalloc);
 }
+
+/*
+ * Allocate a new region and add it to the in-use regions. Used when the
+ * region list is rebuilt (see `ix_rebuild()`).
+ * Returns the index of the region or RL_NONE if no more region slots left.
+ */
+static size_t
+rl_addAlloc(regionl *const rl, off_t const offset, size_t const extent)
+{
+    size_t rpix = rp_get(rl);
+
+    if (rpix != RL_NONE) {
+        region *rep = rl->rp + rpix;
+
+        rep->offset = offset;
+        rep->extent = extent;
+        set_IsAlloc(rep);
+        rlhash_add(rl, rpix);
+
+        rl->nelems++;
+        if (rl->nelems > rl->maxelems)
+            rl->maxelems = rl->nelems;
+        rl->nbytes += extent;
+        if (rl->nbytes > rl->maxbytes)
+            rl->maxbytes = rl->nbytes;
+    }
+    return rpix;
+}
 /* End regionl */
+/* Begin md */
+
+/*
+ * The metadata sidecar is an array of fixed-layout, pre-decoded copies of the
+ * information of the products in the queue, indexed like the region list. A
+ * record is written when its product is added to the time index(es) so that a
+ * reader can reject a product whose feedtype or creation-time doesn't match
+ * its class without locking, decoding, or even touching the product's region.
+ * The data-regions remain authoritative: a record can only rule a product out.
+ */
+
+typedef struct {
+    timestampt arrival;                 /* creation-time of product */
+    feedtypet  feedtype;
+    uint32_t   sz;                      /* size of data in bytes */
+    uint32_t   seqno;
+    uint16_t   identOff;                /* offset of encoded identifier; 0 =>
+                                           record is unknown */
+    uint16_t   identLen;                /* length of identifier in bytes */
+    signaturet signature;
+} mdrec;
+
+struct md {
+#define MD_MAGIC        0x4d445343      /* "MDSC" */
+    size_t magic;
+    size_t nalloc;                      /* capacity in records */
+    mdrec  recs[1];                     /* actually nalloc long */
+};
+typedef struct md md;
+
+/*
+ * Returns the size, in bytes, of the metadata sidecar for a product-queue that
+ * can hold 'nelems' products. There's a record for every slot of the region
+ * list.
+ */
+static size_t
+md_sz(const size_t nelems)
+{
+    return sizeof(md) + (nelems + RL_FREE_OVERHEAD - 1)*sizeof(mdrec);
+}
+
+static void
+md_init(md *const mdp, const size_t nelems)
+{
+    mdp->magic = MD_MAGIC;
+    mdp->nalloc = nelems + RL_FREE_OVERHEAD;
+    (void)memset(mdp->recs, 0, mdp->nalloc*sizeof(mdrec));
+}
+
+/*
+ * Sets the record of region 'rlix' from the information of its product. If
+ * 'info' is NULL, then the record is marked unknown.
+ */
+static void
+md_set(md *const mdp, const size_t rlix, const prod_info *const info)
+{
+    log_assert(rlix < mdp->nalloc);
+
+    mdrec *const rec = mdp->recs + rlix;
+
+    if(info == NULL) {
+        rec->identOff = 0;
+        return;
+    }
+
+    /* XDR: arrival, signature, origin, feedtype, seqno, ident length */
+    const size_t identOff = 8 + sizeof(signaturet) +
+            4 + _RNDUP(strlen(info->origin), 4) + 4 + 4 + 4;
+    const size_t identLen = strlen(info->ident);
+
+    rec->arrival = info->arrival;
+    rec->feedtype = info->feedtype;
+    rec->sz = info->sz;
+    rec->seqno = info->seqno;
+    (void)memcpy(rec->signature, info->signature, sizeof(signaturet));
+    rec->identLen = identLen > UINT16_MAX ? UINT16_MAX : (uint16_t)identLen;
+    rec->identOff = identOff > UINT16_MAX ? 0 : (uint16_t)identOff;
+}
+
+/*
+ * Indicates if the product of a record might be in a class. Returns false only
+ * if the record is known and the product's feedtype or creation-time rules it
+ * out; the identifier must still be matched against the class's patterns.
+ */
+static bool
+md_mightMatch(const mdrec *const rec, const prod_class_t *const clss)
+{
+    if(rec->identOff == 0 || clss == PQ_CLASS_ALL)
+        return true;
+    if(!timeInClass(clss, &rec->arrival))
+        return false;
+    for(u_int i = 0; i < clss->psa.psa_len; i++) {
+        if(rec->feedtype & clss->psa.psa_val[i].feedtype)
+            return true;
+    }
+    return false;
+}
+
+/* End md */
 /* Begin sx */
 
 /*
@@ -2364,9 +3168,17 @@ rl_free(regionl *const rl, size_t rpix)
  * This index is used for duplicate detection and
  * suppression.
  *
- * The implementation uses hashing with chaining.  (Open chaining
+ * Older product-queues use hashing with chaining.  (Open chaining
  * using double hashing won't work, because deletions are as common
  * as searching and insertion; every signature is eventually deleted.)  
+ *
+ * Newer product-queues use open addressing over cache-line sized buckets
+ * (see `sxbucket`), which doesn't need tombstones either: each bucket counts
+ * the entries that probed past it, so a search stops at the first bucket that
+ * nothing has overflowed.  A bucket holds a 16-bit fingerprint of each of its
+ * signatures, and all of them are compared at once, so that an unsuccessful
+ * search -- the usual case on insertion -- typically reads one cache-line.
+ * Such a signature-index has `nchains == 0`.
  */
 
 #define SX_NONE ((size_t)(-1))
@@ -2392,7 +3204,7 @@ struct sx {
 #define SX_NALLOC_INITIAL       9
   size_t nalloc;                  /* including free list elements */
   size_t nelems;                  /* current number of signatures  */
-  size_t nchains;                 /* actual number of chain slots */
+  size_t nchains;                 /* actual number of chain slots or 0 */
   size_t free;                    /* index of free list for signatures */
   size_t nfree;                   /* number of free slots left */
   sxelem sxep[SX_NALLOC_INITIAL]; /* actually nalloc long */
@@ -2410,6 +3222,31 @@ struct sxhash {
 };
 typedef struct sxhash sxhash;
 
+/* A bucket of an open-addressing signature-index. The size of this struct is
+ * one cache-line. */
+struct sxbucket {
+#define SX_BUCKET_LEN   8       /* entries per bucket */
+#define SX_BUCKET_LOAD  6       /* maximum expected entries per bucket */
+  uint16_t tags[SX_BUCKET_LEN]; /* signature fingerprints; 0 => empty */
+  uint32_t ixs[SX_BUCKET_LEN];  /* indexes of corresponding sxelems */
+  uint32_t overflow;            /* entries stored beyond that probed this one */
+  uint32_t unused[3];
+};
+typedef struct sxbucket sxbucket;
+
+/* Header of the buckets of an open-addressing signature-index. It is placed
+ * directly after the sx struct; the buckets follow, aligned on a multiple of
+ * their size relative to the start of the sx struct. */
+struct sxtable {
+#define SXT_MAGIC       0x53585442      /* "SXTB" */
+  size_t magic;                 /* check alignment, endianness */
+  size_t nbuckets;              /* number of buckets */
+};
+typedef struct sxtable sxtable;
+
+/* Maximum number of signatures in an open-addressing signature-index */
+#define SXT_NALLOC_MAX  ((size_t)UINT32_MAX)
+
 /*
  * Returns number of chains required for the specified number of elements.
  */
@@ -2448,19 +3285,46 @@ typedef struct {
     size_t size;
 } SxPar;
 
+/*
+ * Returns the number of buckets of an open-addressing signature-index for
+ * the specified number of elements.
+ */
+static inline size_t
+sxt_nbuckets(size_t const nelems)
+{
+  return nelems / SX_BUCKET_LOAD + 1;
+}
+
+/*
+ * Returns the offset, in bytes, of the buckets of an open-addressing
+ * signature-index from the start of its sx struct.
+ */
+static inline size_t
+sxt_bucketo(size_t const nelems)
+{
+  return _RNDUP(sxwo_sz(nelems) + sizeof(sxtable), sizeof(sxbucket));
+}
+
 /*
  * For a sx which is nelems long, return how much space it will
- * consume, including the auxilliary sxhash structure.
+ * consume, including the auxilliary sxhash or sxtable structure.
+ *
+ * @param[in] nelems  Number of elements
+ * @param[in] table   Whether the signature-index is an open-addressing table
  */
 static size_t
-sx_sz(const size_t nelems)
+sx_sz(const size_t nelems, const bool table)
 {
     log_assert(nelems);
     static size_t prev_nelems = 0;
+    static bool   prev_table;
     static size_t size;
-    if (nelems != prev_nelems) {
+    if (nelems != prev_nelems || table != prev_table) {
         prev_nelems = nelems;
-        size = sxwo_sz(nelems) + sxhash_sz(nchains(nelems));
+        prev_table = table;
+        size = table
+            ? sxt_bucketo(nelems) + sxt_nbuckets(nelems) * sizeof(sxbucket)
+            : sxwo_sz(nelems) + sxhash_sz(nchains(nelems));
     }
     return size;
 }
@@ -2499,26 +3363,50 @@ sxhash_init(sxhash *const sxhp, size_t const nchains)
 
 
 /*
- * Initialize an sx (and its associated sxhash).
+ * Returns the buckets of an open-addressing signature-index.
+ */
+static inline sxbucket *
+sxt_buckets(sx *const sx)
+{
+  return (sxbucket *)((char *)sx + sxt_bucketo(sx->nalloc));
+}
+
+/*
+ * Initialize an sx (and its associated sxhash or sxtable).
  * We define number of chains so that expected length of each chain will be
  * SX_EXP_CHAIN_LEN.
  */
 static void
-sx_init(sx *const sx, size_t const nalloc)
+sx_init(sx *const sx, size_t const nalloc, const bool table)
 {
         sxelem *sxep;
         sxelem *const end = &sx->sxep[nalloc];
-        sxhash *sxhp;
         off_t isx = 1;
 
-        sxhp = (sxhash *)end;   /* associated chains */
-
         sx->nalloc = nalloc;
         sx->nelems = 0;
-        sx->nchains = nchains(nalloc);
-        sxhash_init(sxhp, sx->nchains);
 
-        log_assert(sxhp->magic == SX_MAGIC); /* sanity check */
+        if(table)
+        {
+                sxtable *const sxtp = (sxtable *)end;
+
+                log_assert(sizeof(sxbucket) == 64);
+                log_assert(nalloc <= SXT_NALLOC_MAX);
+                sx->nchains = 0;
+                sxtp->magic = SXT_MAGIC;
+                sxtp->nbuckets = sxt_nbuckets(nalloc);
+                (void)memset(sxt_buckets(sx), 0,
+                        sxtp->nbuckets * sizeof(sxbucket));
+        }
+        else
+        {
+                sxhash *const sxhp = (sxhash *)end; /* associated chains */
+
+                sx->nchains = nchains(nalloc);
+                sxhash_init(sxhp, sx->nchains);
+
+                log_assert(sxhp->magic == SX_MAGIC); /* sanity check */
+        }
 
         for(sxep = &sx->sxep[0]; sxep < end; sxep++, isx++)
         {
@@ -2576,6 +3464,189 @@ sxelem_free(sx *const sx, size_t sxix)
     sx->nfree++;
 }
 
+/*
+ * Hash function for signature in an open-addressing signature-index. Mixes
+ * all the bits because signatures needn't be MD5 checksums.
+ */
+static inline uint64_t
+sxt_hash(const signaturet sig)
+{
+    uint64_t h;
+    uint64_t l;
+
+    (void)memcpy(&h, sig, sizeof(h));
+    (void)memcpy(&l, sig + sizeof(h), sizeof(l));
+    h ^= l;
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Returns the index of the first bucket to probe for a hash value.
+ */
+static inline size_t
+sxt_home(const uint64_t h, const size_t nbuckets)
+{
+    return (size_t)(((h >> 32) * nbuckets) >> 32);
+}
+
+/*
+ * Returns the (non-zero) fingerprint of a hash value.
+ */
+static inline unsigned
+sxt_tag(const uint64_t h)
+{
+    const unsigned tag = (uint16_t)h;
+    return tag ? tag : 1;
+}
+
+/*
+ * Compares a fingerprint with those of all the entries of a bucket.
+ * Returns a mask with bit `2*i` set if `bp->tags[i] == tag`.
+ */
+static inline unsigned
+sxt_match(const sxbucket *const bp, const unsigned tag)
+{
+#ifdef __SSE2__
+    const __m128i tags = _mm_loadu_si128((const __m128i *)bp->tags);
+
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(tags,
+            _mm_set1_epi16((short)tag))) & 0x5555u;
+#else
+    unsigned mask = 0;
+    int i;
+
+    for(i = 0; i < SX_BUCKET_LEN; i++)
+        if(bp->tags[i] == tag)
+            mask |= 1u << (2*i);
+    return mask;
+#endif
+}
+
+/*
+ * Returns the bucket entry of the lowest bit of a non-zero mask from
+ * sxt_match().
+ */
+static inline int
+sxt_lane(const unsigned mask)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(mask) / 2;
+#else
+    int i = 0;
+
+    while(!(mask & (1u << (2*i))))
+        i++;
+    return i;
+#endif
+}
+
+/*
+ * Locates a signature in an open-addressing signature-index.
+ *
+ * @param[in]  sx    The signature-index.
+ * @param[in]  sig   The signature to find.
+ * @param[out] home  Index of the first bucket probed.
+ * @param[out] bix   Index of the bucket containing `sig`.
+ * @param[out] lane  Entry of bucket `*bix` containing `sig`.
+ * @retval 1         Found. `*home`, `*bix`, and `*lane` are set.
+ * @retval 0         Not found. `*home` is set.
+ */
+static int
+sxt_locate(
+        sx *const     sx,
+        const signaturet sig,
+        size_t *const home,
+        size_t *const bix,
+        int *const    lane)
+{
+    sxbucket *const buckets = sxt_buckets(sx);
+    const size_t    nbuckets = sxt_nbuckets(sx->nalloc);
+    const uint64_t  h = sxt_hash(sig);
+    const unsigned  tag = sxt_tag(h);
+    size_t          i = sxt_home(h, nbuckets);
+    size_t          nprobes;
+
+    *home = i;
+    for(nprobes = 0; nprobes < nbuckets; nprobes++) {
+        const sxbucket *const bp = &buckets[i];
+        unsigned mask;
+
+        for(mask = sxt_match(bp, tag); mask; mask &= mask - 1) {
+            const int l = sxt_lane(mask);
+
+            if(sx_compare(sig, sx->sxep[bp->ixs[l]].sxi)) { /* found */
+                *bix = i;
+                *lane = l;
+                return 1;
+            }
+        }
+        if(bp->overflow == 0)
+            break;
+        if(++i == nbuckets)
+            i = 0;
+    }
+    return 0;
+}
+
+/*
+ * Adds an sxelem to an open-addressing signature-index.
+ */
+static void
+sxt_link(sx *const sx, const signaturet sig, size_t const sxix)
+{
+    sxbucket *const buckets = sxt_buckets(sx);
+    const size_t    nbuckets = sxt_nbuckets(sx->nalloc);
+    const uint64_t  h = sxt_hash(sig);
+    size_t          i = sxt_home(h, nbuckets);
+
+    /* There are more bucket entries than sxelems; so this terminates */
+    for(;;) {
+        sxbucket *const bp = &buckets[i];
+        const unsigned  mask = sxt_match(bp, 0);
+
+        if(mask) {
+            const int l = sxt_lane(mask);
+
+            bp->tags[l] = (uint16_t)sxt_tag(h);
+            bp->ixs[l] = (uint32_t)sxix;
+            return;
+        }
+        bp->overflow++;
+        if(++i == nbuckets)
+            i = 0;
+    }
+}
+
+/*
+ * Find and then delete from an open-addressing signature-index.
+ * Returns 1 if found and deleted, returns 0 if not found.
+ */
+static int
+sxt_find_delete(sx *const sx, const signaturet sig)
+{
+    sxbucket *const buckets = sxt_buckets(sx);
+    const size_t    nbuckets = sxt_nbuckets(sx->nalloc);
+    size_t          home;
+    size_t          bix;
+    size_t          i;
+    int             lane;
+
+    if(!sxt_locate(sx, sig, &home, &bix, &lane))
+        return 0;
+
+    sxelem_free(sx, buckets[bix].ixs[lane]);
+    buckets[bix].tags[lane] = 0;
+    for(i = home; i != bix; i = (i + 1 == nbuckets) ? 0 : i + 1)
+        buckets[i].overflow--;
+    sx->nelems--;
+    return 1;
+}
+
 /**
  * Searches the signature-index for an entry.
  *
@@ -2593,6 +3664,20 @@ sx_find(sx *const sx, const signaturet sig, sxelem **sxepp)
     size_t next;
     sxhash *sxhp;
     int status = 0;
+
+    if (sx->nchains == 0) {
+        size_t home;
+        size_t bix;
+        int    lane;
+
+        if (!sxt_locate(sx, sig, &home, &bix, &lane)) {
+            *sxepp = (sxelem *) 0;
+            return 0;
+        }
+        *sxepp = &sx->sxep[sxt_buckets(sx)[bix].ixs[lane]];
+        return 1;
+    }
+
         /* sxhp = (sxhash *)((char *)(sx) + sxwo_sz(sx->nalloc)); */
     sxhp = (sxhash *)(&sx->sxep[sx->nalloc]);
     log_assert(sxhp->magic == SX_MAGIC);
@@ -2630,9 +3715,6 @@ sx_add(sx *const sx, const signaturet sig, off_t const offset)
     size_t try;
     size_t next;                /* head of a list of signatures */
     sxhash *sxhp;
-    /* sxhp = (sxhash *)((char *)(sx) + sxwo_sz(sx->nalloc)); */
-    sxhp = (sxhash *)(&sx->sxep[sx->nalloc]);
-    log_assert(sxhp->magic == SX_MAGIC);
 
     log_assert(sx->nalloc != 0);
     log_assert(sx->nfree + sx->nelems == sx->nalloc);
@@ -2647,11 +3729,20 @@ sx_add(sx *const sx, const signaturet sig, off_t const offset)
     memcpy((void *)sxep->sxi, (void *)sig, sizeof(signaturet));
     sxep->offset = offset;
 
-    try = sx_hash(sx->nchains, sig);
-    /* link new element on front of chain */
-    next = sxhp->chains[try];
-    sxep->next = next;
-    sxhp->chains[try] = sxix;
+    if (sx->nchains == 0) {
+        sxt_link(sx, sig, sxix);
+    }
+    else {
+        /* sxhp = (sxhash *)((char *)(sx) + sxwo_sz(sx->nalloc)); */
+        sxhp = (sxhash *)(&sx->sxep[sx->nalloc]);
+        log_assert(sxhp->magic == SX_MAGIC);
+
+        try = sx_hash(sx->nchains, sig);
+        /* link new element on front of chain */
+        next = sxhp->chains[try];
+        sxep->next = next;
+        sxhp->chains[try] = sxix;
+    }
 
     sx->nelems++;
 
@@ -2676,10 +3767,14 @@ sx_find_delete(sx *const sx, const signaturet sig)
     size_t try;
     size_t next;
     sxhash *sxhp;
+
+    log_assert(sx->nfree + sx->nelems == sx->nalloc);
+    if (sx->nchains == 0)
+        return sxt_find_delete(sx, sig);
+
     /* sxhp = (sxhash *)((char *)(sx) + sxwo_sz(sx->nalloc)); */
     sxhp = (sxhash *)(&sx->sxep[sx->nalloc]);
     log_assert(sxhp->magic == SX_MAGIC);
-    log_assert(sx->nfree + sx->nelems == sx->nalloc);
 
     /* find chain */
     try = sx_hash(sx->nchains, sig);
@@ -2725,20 +3820,39 @@ typedef struct {
     size_t sx_size;
 } IxPar;
 
+/*
+ * Returns the offset of the signature-index from the start of the index
+ * region given the offset that the preceding indexes would give it. The
+ * buckets of an open-addressing signature-index are aligned on a cache-line
+ * relative to the file.
+ */
+static inline size_t
+ix_sxo(const size_t sxo, const bool sxTable)
+{
+    return sxTable ? _RNDUP(sxo, sizeof(sxbucket)) : sxo;
+}
+
 /*
  * Return the amount of space required to store a
  * collection of indices, each of 'nelems'.
+ *
+ * @param[in] nelems   Number of elements in each index
+ * @param[in] align    Alignment parameter in bytes
+ * @param[in] sxTable  Whether the signature-index is an open-addressing table
  */
 static size_t
-ix_sz(const size_t nelems, const size_t align)
+ix_sz(const size_t nelems, const size_t align, const bool sxTable)
 {
     log_assert(nelems);
     static size_t prev_nelems;
+    static bool   prev_sxTable;
     static size_t size;
-    if (nelems != prev_nelems) {
+    if (nelems != prev_nelems || sxTable != prev_sxTable) {
         prev_nelems = nelems;
-        size = _RNDUP(rl_sz(nelems), align) + _RNDUP(tq_sz(nelems), align)
-           + _RNDUP(fb_sz(nelems), align) + _RNDUP(sx_sz(nelems), align);
+        prev_sxTable = sxTable;
+        size = ix_sxo(_RNDUP(rl_sz(nelems), align) +
+                _RNDUP(tq_sz(nelems), align) + _RNDUP(fb_sz(nelems), align),
+                sxTable) + _RNDUP(sx_sz(nelems, sxTable), align);
     }
     return size;
 }
@@ -2751,6 +3865,7 @@ ix_sz(const size_t nelems, const size_t align)
  * @param[in]  ixsz    Extent of the index region in bytes
  * @param[in]  nelems  Capacity of product-queue in number of products
  * @param[in]  align   Alignment parameter in bytes
+ * @param[in]  sxTable Whether the signature index is an open-addressing table
  * @param[out] rlpp    Pointer to region index
  * @param[out] tqpp    Pointer to time index
  * @param[out] fbpp    Pointer to "fblk" index
@@ -2764,6 +3879,7 @@ ix_ptrs(
         const size_t             ixsz,
         const size_t             nelems,
         const size_t             align,
+        const bool               sxTable,
         regionl** const restrict rlpp,
         tqueue** const restrict  tqpp,
         fb** const restrict      fbpp,
@@ -2776,21 +3892,24 @@ ix_ptrs(
      * rl_sz() and sx_sz(); thus, the following optimization. SRE 2016-06-21
      */
     static size_t prev_nelems = 0;
+    static bool   prev_sxTable;
     static size_t rl_size;
     static size_t tq_size;
     static size_t fb_size;
     static size_t sx_size;
-    if (nelems != prev_nelems) {
+    if (nelems != prev_nelems || sxTable != prev_sxTable) {
         prev_nelems = nelems;
+        prev_sxTable = sxTable;
         rl_size = rl_sz(nelems);
         tq_size = tq_sz(nelems);
         fb_size = fb_sz(nelems);
-        sx_size = sx_sz(nelems);
+        sx_size = sx_sz(nelems, sxTable);
     }
     *rlpp = (regionl*)ix;
     *tqpp =  (tqueue*)_RNDUP((intptr_t)((char*)(*rlpp) + rl_size), align);
     *fbpp =      (fb*)_RNDUP((intptr_t)((char*)(*tqpp) + tq_size), align);
     *sxpp =      (sx*)_RNDUP((intptr_t)((char*)(*fbpp) + fb_size), align);
+    *sxpp = (sx*)((char*)ix + ix_sxo((char*)(*sxpp) - (char*)ix, sxTable));
     /*
      * Can't set cached `tq->fbp` and `rl->fbp` here because they are in a
      * memory-mapped file, which might be open read-only.
@@ -2810,6 +3929,110 @@ ix_ptrs(
     return 1;
 }
 
+/**
+ * Returns the size, in bytes, of the index region of a product-queue: the
+ * indexes proper, the optional time-ring, the bins of free regions, and the
+ * metadata sidecar.
+ *
+ * @param[in] nelems    Capacity of product-queue in number of products
+ * @param[in] align     Alignment parameter in bytes
+ * @param[in] sxTable   Whether the signature index is an open-addressing table
+ * @param[in] timeRing  Whether the product-queue has a time-ring index
+ * @param[in] pagesz    Page size in bytes
+ * @return              Size of the index region in bytes. A multiple of
+ *                      `pagesz`.
+ */
+static size_t
+ix_totalSz(
+        const size_t nelems,
+        const size_t align,
+        const bool   sxTable,
+        const bool   timeRing,
+        const size_t pagesz)
+{
+    size_t size = ix_sz(nelems, align, sxTable);
+
+    if (timeRing)
+        size += tr_sz(nelems); // Follows the other indexes
+    size = _RNDUP(size, M_RND_UNIT) + rb_sz(nelems);
+    size = _RNDUP(size, M_RND_UNIT) + md_sz(nelems);
+
+    return _RNDUP(size, pagesz);
+}
+
+/**
+ * Initializes the index region of a product-queue that has neither products
+ * nor free regions.
+ *
+ * @param[in]  ix        Start of index region. Shall be aligned like the
+ *                       index region of the product-queue file.
+ * @param[in]  ixsz      Extent of the index region in bytes. Shall be at least
+ *                       `ix_totalSz(nelems, align, sxTable, timeRing, ...)`
+ *                       for the metadata sidecar to be created.
+ * @param[in]  nelems    Capacity of product-queue in number of products
+ * @param[in]  align     Alignment parameter in bytes
+ * @param[in]  sxTable   Whether the signature index is an open-addressing table
+ * @param[in]  timeRing  Whether the product-queue has a time-ring index
+ * @param[out] rlpp      Pointer to region index
+ * @param[out] tqpp      Pointer to time index
+ * @param[out] fbpp      Pointer to "fblk" index
+ * @param[out] sxpp      Pointer to signature index
+ * @param[out] trpp      Pointer to time-ring index or NULL if `!timeRing`
+ * @param[out] mdpp      Pointer to metadata sidecar or NULL if there's no room
+ *                       for it
+ */
+static void
+ix_init(
+        void* const restrict     ix,
+        const size_t             ixsz,
+        const size_t             nelems,
+        const size_t             align,
+        const bool               sxTable,
+        const bool               timeRing,
+        regionl** const restrict rlpp,
+        tqueue** const restrict  tqpp,
+        fb** const restrict      fbpp,
+        sx** const restrict      sxpp,
+        tr** const restrict      trpp,
+        md** const restrict      mdpp)
+{
+    (void)ix_ptrs(ix, ixsz, nelems, align, sxTable, rlpp, tqpp, fbpp, sxpp);
+
+    /* initialize fb for skip list blocks */
+    fb_init(*fbpp, nelems);
+
+    /* initialize tqueue */
+    tq_init(*tqpp, nelems, *fbpp);
+
+    /* initialize optional time-ring */
+    size_t rbo = ix_sz(nelems, align, sxTable);
+
+    *trpp = NULL;
+    if (timeRing) {
+        log_assert(rbo + tr_sz(nelems) <= ixsz);
+        *trpp = (tr*)((char*)ix + rbo);
+        tr_init(*trpp, nelems);
+        rbo += tr_sz(nelems);
+    }
+
+    /* initialize regionl. New product-queues bin free regions by extent */
+    rl_init(*rlpp, nelems, *fbpp);
+    rbo = _RNDUP(rbo, M_RND_UNIT);
+    log_assert(rbo + rb_sz(nelems) <= ixsz);
+    rl_setBins(*rlpp, (rb*)((char*)ix + rbo));
+
+    /* New product-queues have a metadata sidecar after the bins */
+    const size_t mdo = _RNDUP(rbo + rb_sz(nelems), M_RND_UNIT);
+
+    *mdpp = NULL;
+    if (mdo + md_sz(nelems) <= ixsz) {
+        *mdpp = (md*)((char*)ix + mdo);
+        md_init(*mdpp, nelems);
+    }
+
+    sx_init(*sxpp, nelems, sxTable);
+}
+
 /* End ix */
 /* Begin bsrch */
 /*
@@ -2879,12 +4102,15 @@ bsrch(const void *key,
  * 'extent' is it's size,
  * 'vp' is the memory handle being used to access the region,
  * and 'rflags' stashes the RGN_* flags with which the region was gotten.
+ * 'zbuf', if not NULL, is the inflated data-product of a compressed region; it
+ * is freed when the region is released (see zp_get()).
  */
 struct riu {
         off_t offset;
         size_t extent;
         void *vp;
         int rflags;
+        void *zbuf;
 };
 typedef struct riu riu;
 
@@ -2955,6 +4181,7 @@ riul_init(riul *const rl, size_t const nelems, size_t sz)
                 rp->extent = 0;
                 rp->vp = NULL;
                 rp->rflags = 0;
+                rp->zbuf = NULL;
         }
 }
 
@@ -3101,6 +4328,7 @@ riul_add(
         rp->extent = extent;
         rp->vp = vp;
         rp->rflags = rflags;
+        rp->zbuf = NULL;
 
         *rpp = rp;
 
@@ -3129,6 +4357,7 @@ riul_delete(
 
         log_assert(&rl->rp[0] <= rp && rp < end);
 
+        free(rp->zbuf);
         if(rght < end)
         {
                 /* shuffle left */
@@ -3141,6 +4370,7 @@ riul_delete(
         end->extent = 0;
         end->vp = NULL;
         end->rflags = 0;
+        end->zbuf = NULL;
         rl->nelems--;
 }
 
@@ -3148,16 +4378,61 @@ riul_delete(
 /* Begin pqctl */
 
 /*
- * Shared, on disk, pq control structure.
- * Fixed size, never grows.
- * At beginning of file.
+ * Intent of an index-modification (see jn_begin()).
  */
-struct pqctl {
-#define PQ_MAGIC        0x50515545      /* PQUE */
-        size_t          magic;
-#define PQ_VERSION      7
-        size_t          version;
-        off_t           datao;          /* beginning of data segment */
+typedef struct {
+#define JN_NONE         0
+#define JN_RESERVE      1       /* reserving a region for a product */
+#define JN_INSERT       2       /* adding a product to the time index(es) */
+#define JN_DELETE       3       /* deleting a product */
+        int             op;
+        pid_t           pid;    /* process modifying the indexes */
+        off_t           offset; /* affected region or OFF_NONE if unknown */
+} pqjournal;
+
+/*
+ * Maximum number of reservations that aren't yet in the time-queue and are
+ * rolled back if their process dies (see jn_openReserve()). Limited by the size
+ * of the control-header.
+ */
+#define PQ_MAX_PENDING  64
+
+/*
+ * Layout of a resized product-queue whose new indexes are being copied over
+ * its old ones (see resize_commit()).
+ */
+typedef struct {
+        off_t           stage;  /* offset to a copy of the new indexes or 0 */
+        off_t           ixo;    /* new offset to the indexes */
+        size_t          ixsz;   /* new extent of the indexes */
+        size_t          nalloc; /* new number of slots */
+        size_t          mdo;    /* new offset to the metadata sidecar or 0 */
+        int             sxTable;/* whether the new signature index is a table */
+} pqresize;
+
+/*
+ * Registered reader of a product-queue (see pq_registerReader()).
+ */
+typedef struct {
+        pid_t           pid;    /* reader process or 0 if the slot is free */
+        uint32_t        nmissed;/* products evicted ahead of the cursor */
+#define RD_NONE         INT64_MIN
+        int64_t         cursor; /* insertion-time, in µs, of the last product
+                                 * read or RD_NONE */
+} rdslot;
+
+/*
+ * Shared, on disk, pq control structure.
+ * Fixed size, never grows.
+ * At beginning of file.
+ */
+struct pqctl {
+#define PQ_MAGIC        0x50515545      /* PQUE */
+        size_t          magic;
+#define PQ_VERSION      7
+#define PQ_ZVERSION     8               /* PQ_COMPRESS: older LDM-s can't read */
+        size_t          version;
+        off_t           datao;          /* beginning of data segment */
         off_t           ixo;            /* beginning of index segment */
         size_t          ixsz;           /* size of index segement */
         size_t          nalloc;         /* slots allocated for products */
@@ -3178,6 +4453,102 @@ struct pqctl {
         unsigned        metrics_magic_2;
         off_t           mvrtSize;       /* data-usage in bytes when MVRT set */
         size_t          mvrtSlots;      /* slot-usage when MVRT set */
+#define INSERT_SEQ_MAGIC        (PQ_MAGIC+3)
+        unsigned        insert_seq_magic;
+        /*
+         * Incremented on every insertion. Readers wait on this word (via
+         * futex(2) where available) instead of on SIGCONT.
+         */
+        uint32_t        insertSeq;
+#define FEED_RING_MAGIC         (PQ_MAGIC+4)
+        unsigned        feed_ring_magic;
+#define FEED_RING_SIZE          64      /* must be a power of 2 */
+        /*
+         * Feedtypes of the most recent insertions indexed by insertion
+         * sequence-number modulo FEED_RING_SIZE. Written before the
+         * sequence-number is incremented; read without locking.
+         */
+        feedtypet       feedRing[FEED_RING_SIZE];
+#define SEQLOCK_MAGIC           (PQ_MAGIC+5)
+        unsigned        seqlock_magic;  /* == SEQLOCK_MAGIC => PQ_SEQLOCK */
+        /*
+         * Sequence-lock. Odd while a writer has the control-header; even
+         * otherwise. Readers of a sequence-locked product-queue don't lock the
+         * control-header but verify that this value didn't change.
+         */
+        uint32_t        seqlock;
+#define TIME_RING_MAGIC         (PQ_MAGIC+6)
+        unsigned        time_ring_magic; /* == TIME_RING_MAGIC => PQ_TIMERING */
+#define SX_TABLE_MAGIC          (PQ_MAGIC+7)
+        unsigned        sx_table_magic; /* == SX_TABLE_MAGIC => PQ_SXTABLE */
+#define EVICT_MAGIC             (PQ_MAGIC+8)
+        unsigned        evict_magic;
+        uint64_t        nevicted;       /* products deleted to make room */
+        uint64_t        nevictedForSlot;/* ... of which for a product-slot */
+        uint64_t        evictedBytes;   /* data-bytes of deleted products */
+#define MAP_ADVICE_MAGIC        (PQ_MAGIC+9)
+        unsigned        map_advice_magic;
+        int             mapAdvice;      /* PQ_HUGEPAGES and/or PQ_INTERLEAVE */
+#define METADATA_MAGIC          (PQ_MAGIC+10)
+        unsigned        metadata_magic; /* == METADATA_MAGIC => sidecar */
+        size_t          mdo;            /* offset of sidecar in index */
+#define JOURNAL_MAGIC           (PQ_MAGIC+11)
+        unsigned        journal_magic;
+        /*
+         * Intent of the index-modification in progress. Set before the
+         * indexes are modified and cleared afterwards; consequently, a writer
+         * that obtains the control-header only sees it set if the previous
+         * writer died in the middle of a modification.
+         */
+        pqjournal       journal;
+        uint64_t        nrecovered;     /* recoveries from such deaths */
+#define COMPRESS_MAGIC          (PQ_MAGIC+12)
+        unsigned        compress_magic; /* == COMPRESS_MAGIC => PQ_COMPRESS */
+        uint64_t        nzipped;        /* products stored compressed */
+        uint64_t        zipRawBytes;    /* ... their inflated data-bytes */
+        uint64_t        zipBytes;       /* ... their deflated data-bytes */
+#define TELEMETRY_MAGIC         (PQ_MAGIC+13)
+        unsigned        telemetry_magic;
+        /*
+         * Activity of the writers indexed by second modulo PQ_TELEMETRY_SIZE.
+         * Written while the control-header is write-locked; read without
+         * locking (see pq_getTelemetry()).
+         */
+        pq_telemetry    telemetry[PQ_TELEMETRY_SIZE];
+#define READER_MAGIC            (PQ_MAGIC+14)
+        unsigned        reader_magic;
+        /*
+         * Registered readers. A slot is claimed and released by its reader
+         * without locking. Its cursor is written by the reader and its
+         * missed-count by writers while the control-header is write-locked.
+         */
+        rdslot          readers[PQ_MAX_READERS];
+#define SHARD_MAGIC             (PQ_MAGIC+15)
+        unsigned        shard_magic;
+        unsigned        nshards;        /* number of shards of the queue */
+        unsigned        shard;          /* index of this shard */
+        /*
+         * Incremented on every insertion into any shard. Only used in the
+         * first shard, whose readers wait on it (see pq_waitForNewer()).
+         */
+        uint32_t        shardSeq;
+#define PENDING_MAGIC           (PQ_MAGIC+16)
+        unsigned        pending_magic;
+        unsigned        npending;       /* occupied slots of "pending" */
+        /*
+         * Reservations that aren't yet in the time-queue (e.g., because their
+         * data-products are being encoded or received). A slot is claimed and
+         * cleared while the control-header is write-locked; the reservation of
+         * a process that died in between is rolled back by a later writer.
+         */
+        pqjournal       pending[PQ_MAX_PENDING];
+#define RESIZE_MAGIC            (PQ_MAGIC+17)
+        unsigned        resize_magic;
+        /*
+         * Set while the new indexes of a resize overwrite the old ones, so
+         * that the resize can be finished if its process dies meanwhile.
+         */
+        pqresize        resize;
 };
 typedef struct pqctl pqctl;
 
@@ -3201,8 +4572,24 @@ typedef int ftomFunc(pqueue *const pq,
 /*
  * The process private pq info. (Internal structure)
  */
+/*
+ * A memory-mapping of the whole product-queue file that was superseded by a
+ * larger one after the product-queue was resized. It's kept until the
+ * product-queue is closed because pointers into it might still be in use.
+ */
+typedef struct retiredMap {
+        void*              base;
+        size_t             size;
+        struct retiredMap* next;
+} retiredMap;
+
 struct pqueue {
 #define PQ_SIGSBLOCKED  0x1000  /* sav_set is valid */
+#define PQ_SEQREAD      0x2000  /* control-header obtained without lock */
+#define PQ_SEQWRITE     0x4000  /* sequence-lock incremented by ctl_get() */
+#define PQ_SXTABLE      0x8000  /* open-addressing signature-index */
+#define PQ_IXCHECK      0x40000 /* indexes not yet validated (PQ_FASTOPEN) */
+#define PQ_SHARD        0x200000 /* opened by the first shard (pq_open()) */
         /**
          * Product-queue flags. Bitwise OR of
          * - Persistent flags:
@@ -3215,8 +4602,20 @@ struct pqueue {
          *                     `MAP_SHARED`.
          *   + PQ_READONLY     Product-queue is read-only. Default is
          *                     read/write.
-         * - Transient flag:
+         *   + PQ_SEQLOCK      Product-queue is sequence-locked
+         *   + PQ_TIMERING     Product-queue has a time-ring index
+         *   + PQ_SXTABLE      Signature-index is an open-addressing table
+         *   + PQ_HUGEPAGES    Huge pages are requested for the mapping
+         *   + PQ_INTERLEAVE   NUMA interleaving is requested for the mapping
+         *   + PQ_FASTOPEN     Product-queue was opened without validating the
+         *                     indexes
+         * - Transient flags:
          *   + PQ_SIGSBLOCKED  Critical-section signals are blocked
+         *   + PQ_SEQREAD      Control-header obtained without a lock
+         *   + PQ_SEQWRITE     Sequence-lock is odd because of this process
+         *   + PQ_IXCHECK      Indexes must be validated when next obtained
+         *   + PQ_SHARD        Opened as a shard by the first shard of a sharded
+         *                     product-queue
          */
         int              pflags;
         size_t           pagesz;
@@ -3232,6 +4631,10 @@ struct pqueue {
         off_t            datao;
         /// start of memory-mapped file
         void*            base;
+        /// Extent of the memory-mapping at `base` in bytes
+        size_t           mapsz;
+        /// Superseded memory-mappings of the file
+        retiredMap*      retired;
 
         /// Where are the indexes
         off_t            ixo;
@@ -3248,6 +4651,10 @@ struct pqueue {
         fb*              fbp;
         /// Signature index
         sx*              sxp;
+        /// Optional time-ring index (see PQ_TIMERING) or NULL
+        tr*              trp;
+        /// Optional metadata sidecar or NULL
+        md*              mdp;
         /// Private, current position in queue
         timestampt       cursor;
         /// Private, current offset in queue
@@ -3266,6 +4673,36 @@ struct pqueue {
         pthread_mutex_t  mutex;
         /// Thread cancellation state
 		int              cancelState;
+        /// Read-only mapping of the control-header for insertion-notification
+        void*            seqMap;
+        /// Feedtypes whose insertion wakes this instance in pq_waitForNewer()
+        feedtypet        wakeFeedtypes;
+        /// How the product-queue is memory-mapped (see pq_getMapMode())
+        int              mapMode;
+        /// Duration of pq_open() in seconds (see pq_getOpenLatency())
+        double           openLatency;
+        /// Writable mapping of the control-header for the reader-registry
+        void*            rdMap;
+        /// Slot of this instance in the reader-registry or NULL
+        volatile rdslot* rdSlot;
+        /// Missed-count of `rdSlot` when last seen
+        uint32_t         rdMissed;
+        /// Shards of a sharded product-queue (the first is this one) or NULL
+        pqueue**         shards;
+        /// Number of elements in `shards`
+        unsigned         nshards;
+        /// Index of this instance's shard
+        unsigned         shIndex;
+        /// First shard of the product-queue to which this shard belongs or NULL
+        pqueue*          shFirst;
+        /// Writable mapping of the first shard's control-header or NULL
+        void*            shMap;
+        /// Shard of the data-product at the cursor
+        unsigned         shCursor;
+        /// Whether `shCursor` is valid (i.e., the cursor is at a data-product)
+        bool             shTie;
+        /// When pending reservations were last checked (see ctl_get())
+        time_t           pendingCheck;
 };
 
 /* The total size of a product-queue in bytes: */
@@ -3294,6 +4731,55 @@ pagesize(void)
 #endif
 }
 
+#ifdef __linux__
+/*
+ * Sets the bits of the online NUMA nodes in a node-mask.
+ *
+ * Arguments:
+ *      mask    The node-mask.
+ *      nbits   The number of bits in the node-mask.
+ * Returns:
+ *      The number of online NUMA nodes that fit in the node-mask. 0 if they
+ *      can't be determined.
+ */
+static unsigned
+numaOnlineNodes(
+        unsigned long* const mask,
+        const size_t         nbits)
+{
+        const size_t    bitsPerLong = sizeof(*mask) * CHAR_BIT;
+        unsigned        nnodes = 0;
+        char            buf[256];
+        FILE*           file = fopen("/sys/devices/system/node/online", "r");
+
+        (void)memset(mask, 0, nbits / bitsPerLong * sizeof(*mask));
+        if (file == NULL)
+                return 0;
+
+        if (fgets(buf, sizeof(buf), file) != NULL) {
+                /* Format is, e.g., "0-3,8" */
+                for (char* cp = buf; *cp >= '0' && *cp <= '9'; ) {
+                        unsigned long first = strtoul(cp, &cp, 10);
+                        unsigned long last = first;
+
+                        if (*cp == '-')
+                                last = strtoul(cp + 1, &cp, 10);
+                        for (unsigned long node = first;
+                                        node <= last && node < nbits; node++) {
+                                mask[node / bitsPerLong] |=
+                                        1ul << (node % bitsPerLong);
+                                nnodes++;
+                        }
+                        if (*cp == ',')
+                                cp++;
+                }
+        }
+        (void)fclose(file);
+
+        return nnodes;
+}
+#endif
+
 /*
  * Sortof like ftruncate, except won't make the
  * file shorter.
@@ -3689,6 +5175,8 @@ rgn2_lock(pqueue *const pq,
 #ifndef NDEBUG
         if(offset == pq->ixo && extent == pq->ixsz)
                 log_assert(fIsSet(rflags, RGN_NOLOCK));
+        else if(offset == 0 && fIsSet(pq->pflags, PQ_SEQLOCK))
+                ; /* control-header of sequence-locked product-queue */
         else
                 log_assert(!fIsSet(rflags, RGN_NOLOCK));
 #endif
@@ -3848,8 +5336,10 @@ rgn2_release(
 
         size_t extent = rp->extent;
 
-        log_assert(pq->base == NULL || (rp->vp != NULL
-                 && pq->base <= rp->vp
+        /* The region might be in a mapping retired by `ctl_adoptLayout()` */
+        log_assert(pq->base == NULL || rp->vp != NULL);
+        log_assert(pq->retired != NULL || pq->base == NULL
+                || (pq->base <= rp->vp
                 && (char *)rp->vp <= (char *)pq->base + pq->ixo));
         log_assert(pIf(fIsSet(rflags, RGN_MODIFIED),
                         fIsSet(rp->rflags, RGN_WRITE)));
@@ -4293,6 +5783,7 @@ mm0_map(pqueue *const pq)
         log_assert(vp != NULL);
         log_assert(pIf(pq->base != NULL, pq->base == vp));
         pq->base = vp;
+        pq->mapsz = (size_t)st_size;
         return status;
 }
 
@@ -4597,1929 +6088,5951 @@ xproduct(void *buf, size_t size, enum xdr_op op, product *prod)
 }
 
 /******************************************************************************
- * Lower-Level Product-Queue Functions:
+ * Compression Functions:
+ *
+ * The data of a data-product that's inserted into a product-queue created with
+ * PQ_COMPRESS is deflated by zlib(3) if that makes the data-product's region
+ * smaller. The region is then flagged in the region-list (see ISZIP) and
+ * contains the XDR-encoded product-information -- whose `sz` member is the size
+ * of the inflated data -- followed by the deflated data as XDR variable-length
+ * opaque data. A data-product written into a region reserved by pqe_new() is
+ * deflated in place by pqe_insert() and the remainder of the region freed.
+ * Data-products reserved by pqe_newDirect() are stored as is because their
+ * XDR-encoding is opaque to the product-queue.
+ *
+ * Readers are passed the inflated data-product in a buffer that's freed when
+ * the data-product's region is released unless the product-queue was opened
+ * with PQ_NOINFLATE.
  ******************************************************************************/
 
+/*
+ * Data of fewer bytes isn't worth compressing.
+ */
+#define ZP_MIN_SIZE     512
+
+/*
+ * Deflated data of a data-product that's being inserted.
+ */
+typedef struct {
+        Bytef*  buf;    /* deflated data or NULL => data-product stored as is */
+        uLongf  len;    /* length of deflated data in bytes */
+        size_t  extent; /* extent of the data-product's region in bytes */
+} zdata;
+
 /**
- * Deletes a data-product if the product is not locked.
+ * Deflates the data of a data-product that's to be inserted into a
+ * product-queue if the product-queue stores data-products compressed and if
+ * doing so makes the data-product's region smaller. Called before the
+ * control-header is locked.
  *
- * @param[in]  pq          The product-queue.
- * @param[in]  tqep        The entry in the time-map.
- * @param[in]  rlix        The index of the entry in the region-map.
- * @param[out] info        The data-product metadata. On success, caller should
- *                         unconditionally call `xdr_free(xdr_prod_info,
- *                         (char*)info)` when it's no longer needed.
- * @retval     0           Success. `*info` is set. Caller should
- *                         unconditionally call `xdr_free(xdr_prod_info,
- *                         (char*)info)` when it's no longer needed.
- * @retval     EACCES      Product is locked (alias "Permission denied")
- * @retval     PQ_CORRUPT  The product-queue is corrupt. Error-messaged logged.
- * @retval     PQ_SYSTEM   System error. Error-message logged.
+ * @param[in]  pq    Product-queue
+ * @param[in]  prod  Data-product
+ * @param[out] zd    Deflated data. `zd->buf` is NULL if the data-product is
+ *                   to be stored as is; otherwise, the caller should call
+ *                   `free(zd->buf)` when it's no longer needed.
+ * @return           Extent of the data-product's region in bytes (i.e.,
+ *                   `zd->extent`)
  */
-static int
-pq2_try_del_prod(
-    pqueue* const restrict    pq,
-    tqelem* const restrict    tqep,
-    size_t                    rlix,
-    prod_info* const restrict info)
+static size_t
+zp_deflate(
+        const pqueue* const restrict  pq,
+        const product* const restrict prod,
+        zdata* const restrict         zd)
 {
-    region* const rep = pq->rlp->rp + rlix;
-    const off_t   offset = rep->offset;
-    int           status;
+        const size_t xlen = xlen_product(prod);
 
-    if (offset != tqep->offset) {
-        log_error("Offset-to-region mismatch: time-entry=%ld, "
-                "region-entry=%ld", (long)tqep->offset, (long)offset);
-        status = PQ_CORRUPT;
-    }
-    else {
-        void* vp;
+        zd->buf = NULL;
+        zd->extent = xlen;
+        if(!fIsSet(pq->pflags, PQ_COMPRESS) || prod->info.sz < ZP_MIN_SIZE)
+                return xlen;
 
-        status = rgn_get(pq, offset, Extent(rep), RGN_WRITE|RGN_NOWAIT, &vp);
-        if (status) {
-            if (status == EACCES || status == EAGAIN) {
-                log_clear();
-                status = EACCES;
-            }
-            else {
-                log_syserr("Couldn't get region (offset=%ld,extent=%zu)", offset, Extent(rep));
-                status = PQ_SYSTEM;
-            }
+        uLongf len = compressBound(prod->info.sz);
+        Bytef* buf = malloc(len);
+
+        if(buf == NULL) {
+                log_debug("Couldn't allocate %lu-byte buffer; storing "
+                        "data-product as is", (unsigned long)len);
+                return xlen;
+        }
+        if(compress2(buf, &len, prod->data, prod->info.sz, Z_BEST_SPEED)
+                        != Z_OK) {
+                free(buf);
+                return xlen;
         }
-        else {
-            /* Get the metadata of the data-product. */
-            XDR xdrs;
 
-            xdrmem_create(&xdrs, vp, Extent(rep), XDR_DECODE);
-            // Necessary for `xdr_prod_info()`
-            (void)memset(info, 0, sizeof(prod_info));
+        const size_t zlen = xlen_prod_info(&prod->info) + 4 + _RNDUP(len, 4);
 
-            if (!xdr_prod_info(&xdrs, info)) {
-                log_error("Couldn't XDR_DECODE data-product metadata");
-                status = PQ_CORRUPT;
-            }
-            else {
-                /*
-                 * Remove the corresponding entry from the signature-map.
-                 */
-                if (sx_find_delete(pq->sxp, info->signature) == 0) {
-                    log_error("pq_try_del_prod(): signature %s: Not Found",
-                            s_signaturet(NULL, 0, info->signature));
-                    status = PQ_CORRUPT;
-                }
-                else {
-                    /*
-                     * Remove the corresponding entry from the time-map.
-                     */
-                    tq_delete(pq->tqp, tqep);
+        if(M_RNDUP(zlen) >= M_RNDUP(xlen)) {
+                free(buf);
+                return xlen;
+        }
 
-                    /*
-                     * Remove the corresponding entry from the region-map.
-                     */
-                    rl_free(pq->rlp, rlix);
-                }
+        zd->buf = buf;
+        zd->len = len;
+        zd->extent = zlen;
 
-                if (status)
-                    xdr_free(xdr_prod_info, (char*)info);
-            } // `xdr_prod_info()` successful
+        return zlen;
+}
 
-            xdr_destroy(&xdrs);
+/**
+ * XDR-encodes a data-product into its region.
+ *
+ * @param[out] vp      Start of the region
+ * @param[in]  extent  Extent of the region in bytes (see `zp_deflate()`)
+ * @param[in]  prod    Data-product
+ * @param[in]  zd      Deflated data of the data-product
+ * @retval     0       Success
+ * @retval     EIO     Encoding failure. `log_error()` called.
+ */
+static int
+zp_encode(
+        void* const restrict          vp,
+        const size_t                  extent,
+        const product* const restrict prod,
+        const zdata* const restrict   zd)
+{
+        if(zd->buf == NULL)                     /* cast away const'ness */
+                return xproduct(vp, extent, XDR_ENCODE, (product*)prod)
+                        ? 0
+                        : EIO;
+
+        XDR    xdrs;
+        char*  data = (char*)zd->buf;
+        u_int  len = (u_int)zd->len;
+        bool   success;
+
+        xdrmem_create(&xdrs, vp, (u_int)extent, XDR_ENCODE);
+        success = xdr_prod_info(&xdrs, (prod_info*)&prod->info) &&
+                xdr_bytes(&xdrs, &data, &len, len);
+        xdr_destroy(&xdrs);
 
-            /* Release the data-region. */
-            (void)rgn_rel(pq, offset, 0);
-        } // `rgn_get()` successful
-    } // region-offsets match
+        if(!success) {
+                log_error("%s: Couldn't encode compressed data-product",
+                        prod->info.ident);
+                return EIO;
+        }
 
-    return status;
+        return 0;
 }
 
+/**
+ * Deflates, in place, a data-product that was written into a region reserved
+ * by pqe_new() if the product-queue stores data-products compressed and if
+ * doing so makes the data-product's region smaller. Called before the
+ * control-header is locked.
+ *
+ * @param[in]     pq    Product-queue
+ * @param[in]     info  Decoded product-information of the data-product
+ * @param[in]     xdrs  XDR stream of the region positioned after `info`
+ * @param[in,out] vp    Start of the region
+ * @param[out]    zd    Deflated data. `zd->buf` is NULL if the data-product is
+ *                      stored as is; otherwise, the caller should call
+ *                      `free(zd->buf)` when it's no longer needed.
+ * @retval        0     Success
+ * @retval        EIO   Encoding failure. The region is invalid. `log_error()`
+ *                      called.
+ */
+static int
+zp_deflateRegion(
+        const pqueue* const restrict    pq,
+        const prod_info* const restrict info,
+        const XDR* const restrict       xdrs,
+        void* const restrict            vp,
+        zdata* const restrict           zd)
+{
+        product prod;
+
+        prod.info = *info;
+        prod.data = xdrs->x_private;
+
+        (void)zp_deflate(pq, &prod, zd);
+        if(zd->buf == NULL)
+                return 0;
+
+        /* The deflated data is in its own buffer: the region can be reused */
+        const int status = zp_encode(vp, zd->extent, &prod, zd);
+
+        if(status) {
+                free(zd->buf);
+                zd->buf = NULL;
+        }
+
+        return status;
+}
 
 /**
- * Set the minimum virtual residence time metrics if appropriate.
+ * Flags the region of a data-product as compressed if it is.
  *
- * @param[in] pq             The product-queue.
- * @param[in] receptionTime  The time the data-product was inserted into the
- *                           product-queue.
- * @param[in] info           The data-product metadata.
+ * @pre                The control-header is write-locked
+ * @param[in,out] pq      Product-queue
+ * @param[in]     offset  Offset of the region
+ * @param[in]     info    Product-information of the data-product
+ * @param[in]     zd      Deflated data of the data-product
  */
 static void
-pq2_set_mvrt(
-    pqueue* const restrict     pq,
-    timestampt* const restrict receptionTime,
-    prod_info* const restrict  info)
+zp_setZipped(
+        pqueue* const restrict          pq,
+        const off_t                     offset,
+        const prod_info* const restrict info,
+        const zdata* const restrict     zd)
 {
-    const timestampt*           creationTime = &info->arrival;
-    timestampt                  now;
-
-    /*
-     * If the product was received before it was created, then use the product's
-     * reception-time as its creation-time in the computation of the product's
-     * virtual residence-time.
-     */
-    if (TV_CMP_LT(*receptionTime, *creationTime))
-        creationTime = receptionTime;
+        if(zd->buf == NULL)
+                return;
 
-    (void)set_timestamp(&now);
+        const size_t rlix = rl_find(pq->rlp, offset);
 
-    /*
-     * Compute the product's residence time only if the product was
-     * created before now.
-     */
-    if (TV_CMP_LT(*creationTime, now)) {
-        timestampt      virtResTime = diff_timestamp(&now, creationTime);
+        log_assert(rlix != RL_NONE);
+        set_IsZip(pq->rlp->rp + rlix);
 
-        if (tvIsNone(pq->ctlp->minVirtResTime) ||
-                TV_CMP_LT(virtResTime, pq->ctlp->minVirtResTime)) {
-            log_info("MVRT product: %s",
-                    s_prod_info(NULL, 0, info, log_is_enabled_debug));
-            pq->ctlp->minVirtResTime = virtResTime;
-            pq->ctlp->mvrtSize = pq->rlp->nbytes;
-            pq->ctlp->mvrtSlots = pq->rlp->nelems;
+        if(COMPRESS_MAGIC == pq->ctlp->compress_magic) {
+                pq->ctlp->nzipped++;
+                pq->ctlp->zipRawBytes += info->sz;
+                pq->ctlp->zipBytes += zd->len;
         }
-    }
 }
 
 /**
- * Deletes the oldest product in a product queue that is not locked.  In the
- * unlikely event that all the products in the queue are locked or a deadlock
- * is detected, returns an error status other than ENOERR.  Sets the "isFull",
- * "minVirtResTime", "mvrtSize", and "mvrtSlots" members of the product-queue
- * control block on success.
+ * Inflates XDR-encoded deflated data into a buffer.
  *
- * @param[in] pq          Pointer to the product-queue object.  Shall not be
- *                        NULL.
- * @retval    0           Success.  "pq->ctlp->isFull" set to true.
- * @retval    EACESS      No unlocked products left to delete. Error-message
- *                        logged.
- * @retval    PQ_CORRUPT  The product-queue is corrupt. Error message logged.
- * @retval    PQ_SYSTEM   System error. Error-message logged.
+ * @param[out] buf      Buffer for the data
+ * @param[in]  sz       Size of the inflated data in bytes
+ * @param[in]  xdrs     XDR stream positioned at the deflated data
+ * @retval     0        Success
+ * @retval     PQ_CORRUPT  The deflated data is invalid. `log_add()` called.
  */
 static int
-pq2_del_oldest(
-    pqueue* const pq)
+zp_inflateInto(
+        void* const restrict buf,
+        const u_int          sz,
+        XDR* const restrict  xdrs)
 {
-    int status = EACCES;
+        u_int len;
 
-    log_assert(pq != NULL);
-    log_assert(pq->ctlp != NULL && pq->tqp != NULL);
-
-    /* Delete the oldest unlocked data-product. */
-    size_t  rlix;
-    size_t  numLocked = 0;
-    for (tqelem* tqep = tqe_first(pq->tqp);
-            tqep && (rlix = rl_find(pq->rlp, tqep->offset)) != RL_NONE;
-            tqep = tq_next(pq->tqp, tqep)) {
-        prod_info  info;
-        timestampt insertionTime = tqep->tv;
-        status = pq2_try_del_prod(pq, tqep, rlix, &info);
-        if (status == 0) {
-            pq->ctlp->isFull = 1; // Mark the queue as full.
-            /* Adjust the minimum virtual residence time. */
-            pq2_set_mvrt(pq, &insertionTime, &info);
-            xdr_free(xdr_prod_info, (char*)&info);
-            return 0;
+        if(!xdr_u_int(xdrs, &len) || len > xdrs->x_handy) {
+                log_add("Invalid length of compressed data");
+                return PQ_CORRUPT;
         }
-        if (status != EACCES)
-            return status;
 
-        ++numLocked;
-    }
+        uLongf    nbytes = sz;
+        const int zstat = uncompress(buf, &nbytes, (Bytef*)xdrs->x_private,
+                len);
 
-    log_error("All %zu products are locked. No unlocked products left to delete!",
-            numLocked);
+        if(zstat != Z_OK || nbytes != sz) {
+                log_add("Couldn't inflate compressed data: %s",
+                        zstat == Z_OK ? "wrong length" : zError(zstat));
+                return PQ_CORRUPT;
+        }
 
-    return status;
+        return 0;
+}
 
-#if 0
-    tqelem*             tqep = tqe_first(pq->tqp);
-    int                 status = ENOERR;
-    void*               vp = NULL;
-    region*             rep = NULL;
-    size_t              rlix;
-
-    rlix = rl_find(pq->rlp, tqep->offset);
-    log_assert(rlix != RL_NONE);
-    rep = pq->rlp->rp + rlix;
-    status = rgn_get(pq, rep->offset, Extent(rep), RGN_WRITE|RGN_NOWAIT, &vp);
-
-    while (status != ENOERR) {
-        /*
-         * The current data-product is locked.  Try the next one.
-         */
-        tqep = tq_next(pq->tqp, tqep);
-        rlix = rl_find(pq->rlp, tqep->offset);
+int
+pq_inflate(
+        const prod_info* const restrict info,
+        const void* const restrict      xprod,
+        const size_t                    size,
+        void* const restrict            buf)
+{
+        const size_t xlen = xlen_prod_i(info);
 
-        if (rlix == RL_NONE) {
-            log_error("no unlocked products left to delete!");
-            break;
+        if(size == xlen) {
+                (void)memcpy(buf, xprod, xlen);
+                return 0;
         }
 
-        rep = pq->rlp->rp + rlix;
-        status =
-            rgn_get(pq, rep->offset, Extent(rep), RGN_WRITE|RGN_NOWAIT, &vp);
-    }
-
-    if (status == ENOERR) {
-        /*
-         * Got the data region.  Start releasing associated entries.
-         */
-        off_t           offset = rep->offset;
-        unsigned char*  signature;
-        InfoBuf         infoBuf;
-
-        /*
-         * Get the metadata of the data-product.
-         */
-        (void)xinfo_i(vp, Extent(rep), XDR_DECODE, ib_init(&infoBuf));
-
-        /*
-         * Set the minimum virtual residence time metrics if appropriate.
-         */
-        {
-            const timestampt*           creationTime = &infoBuf.info.arrival;
-            const timestampt* const     receptionTime = &tqep->tv;
-            timestampt                  now;
-
-            /*
-             * If the product was received before it was created, then use the
-             * product's reception-time as its creation-time in the computation
-             * of the product's virtual residence-time.
-             */
-            if ((TV_CMP_LT(*receptionTime, *creationTime))) {
-                creationTime = receptionTime;
-            }
-
-            (void)set_timestamp(&now);
-
-            /*
-             * Compute the product's residence time only if the product was
-             * created before now.
-             */
-            if (TV_CMP_LT(*creationTime, now)) {
-                timestampt      virtResTime =
-                    diff_timestamp(&now, creationTime);
+        InfoBuf    infoBuf;
+        prod_info* decoded = ib_init(&infoBuf);
+        XDR        xdrs;
+        int        status;
 
-                if (tvIsNone(pq->ctlp->minVirtResTime) ||
-                        (TV_CMP_LT(virtResTime, pq->ctlp->minVirtResTime)))  {
-                    log_info("MVRT product: %s",
-                            s_prod_info(NULL, 0, &infoBuf.info, ulogIsDebug()));
-                    pq->ctlp->minVirtResTime = virtResTime;
-                    pq->ctlp->mvrtSize = pq->rlp->nbytes;
-                    pq->ctlp->mvrtSlots = pq->rlp->nelems;
-                }
-            }
+        xdrmem_create(&xdrs, (caddr_t)xprod, (u_int)size, XDR_DECODE);
+        if(!xdr_prod_info(&xdrs, decoded) || decoded->sz != info->sz) {
+                log_add("Invalid product-information");
+                status = PQ_INVAL;
         }
+        else {
+                const size_t infoLen = (char*)xdrs.x_private - (char*)xprod;
 
-        /*
-         * Remove the corresponding entry from the time-list.
-         */
-        tq_delete(pq->tqp, tqep);
-
-        /*
-         * Remove the corresponding entry from the signature-list.
-         */
-        signature = infoBuf.info.signature;
-
-        if (sx_find_delete(pq->sxp, signature) == 0) {
-            log_error("signature %s: Not Found",
-                    s_signaturet(NULL, 0, signature));
-            status = EINVAL;
+                (void)memcpy(buf, xprod, infoLen);
+                (void)memset((char*)buf + xlen - 4, 0, 4);  /* XDR padding */
+                status = zp_inflateInto((char*)buf + infoLen, info->sz, &xdrs);
+                if(status == PQ_CORRUPT)
+                        status = PQ_INVAL;
         }
+        xdr_destroy(&xdrs);
 
-        /*
-         * Remove the corresponding entry from the region-list.
-         */
-        rl_free(pq->rlp, rlix);
-
-        /*
-         * Release the data region.
-         */
-        (void) rgn_rel(pq, offset, 0);
-
-        /*
-         * Mark the queue as full.
-         */
-        pq->ctlp->isFull = 1;
-    }                                   /* got data region */
-
-    return status;
-#endif
+        return status;
 }
 
-
 /******************************************************************************
- * Lower-Level Reserved Product-Region Functions:
+ * Journal Functions:
+ *
+ * An index-modification (reserving, inserting, or deleting a data-product)
+ * changes several linked structures and can't be made atomic. Instead, its
+ * intent is recorded in the control-header beforehand and cleared afterwards.
+ * Because the control-header is write-locked meanwhile, and the lock is
+ * released when a process dies, the next writer can tell that the previous one
+ * died in the middle of a modification and can rebuild the indexes without the
+ * affected data-product (see ctl_recover()).
+ *
+ * A reserved region isn't in the time-queue until its data-product has been
+ * written, which can happen after the control-header is released (a large
+ * data-product in pq_insertNoSig(), one received over the network between
+ * pqe_new() and pqe_insert()). Until then, the reservation's intent is kept in
+ * a separate slot; a writer that finds the slot's process dead rolls the
+ * reservation back.
+ *
+ * The intent is only durable if the control-header is memory-mapped shared;
+ * otherwise, nothing reaches the file until the control-header is released,
+ * by which time the modification is complete.
  ******************************************************************************/
 
-
 /*
- * Free a region, by offset
+ * Initializes the journal of a product-queue.
  */
-static int
-rpqe_free(pqueue *pq, off_t offset, const signaturet signature)
+static void
+jn_init(pqctl *const ctlp)
 {
-        region *rp = NULL;
-        size_t rlix;
+        ctlp->journal_magic = JOURNAL_MAGIC;
+        ctlp->journal.op = JN_NONE;
+        ctlp->journal.pid = 0;
+        ctlp->journal.offset = OFF_NONE;
+        ctlp->nrecovered = 0;
+}
 
-        rlix = rl_find(pq->rlp, offset);
-        if(rlix == RL_NONE)
+/*
+ * Initializes the pending reservations of a product-queue.
+ */
+static void
+jn_initPending(pqctl *const ctlp)
+{
+        ctlp->pending_magic = PENDING_MAGIC;
+        ctlp->npending = 0;
+        for(int i = 0; i < PQ_MAX_PENDING; i++)
         {
-                log_error("offset 0x%08lx: Not Found", (long)offset);
-                return EINVAL;
+                ctlp->pending[i].op = JN_NONE;
+                ctlp->pending[i].pid = 0;
+                ctlp->pending[i].offset = OFF_NONE;
         }
-        rp = pq->rlp->rp + rlix;
-        if(IsFree(rp))
+}
+
+/**
+ * Records the intent to modify the indexes of a product-queue. Intents nest:
+ * a deletion that makes room for a reservation replaces the intent of the
+ * reservation until `jn_end()` restores it.
+ *
+ * @pre                   The control-header is write-locked
+ * @param[in,out] pq      Product-queue
+ * @param[in]     op      JN_RESERVE, JN_INSERT, or JN_DELETE
+ * @param[in]     offset  Offset of the affected region or OFF_NONE if it's not
+ *                        yet known (see `jn_setOffset()`)
+ * @param[out]    outer   The enclosing intent for `jn_end()`
+ */
+static void
+jn_begin(
+        pqueue* const restrict    pq,
+        const int                 op,
+        const off_t               offset,
+        pqjournal* const restrict outer)
+{
+        pqctl *const ctlp = pq->ctlp;
+
+        if(JOURNAL_MAGIC != ctlp->journal_magic)
         {
-                log_error("0x%08lx: Already free", (long)offset);
-                return EINVAL;
+                outer->op = JN_NONE;
+                return;
         }
+        *outer = ctlp->journal;
+        ctlp->journal.pid = getpid();
+        ctlp->journal.offset = offset;
+        ctlp->journal.op = op;
+        __sync_synchronize(); /* before the indexes are modified */
+}
 
-        if(sx_find_delete(pq->sxp, signature) == 0)
+/**
+ * Records the offset of the region affected by the current index-modification
+ * once it's known.
+ *
+ * @pre                   `jn_begin()` was called
+ * @param[in,out] pq      Product-queue
+ * @param[in]     offset  Offset of the affected region
+ */
+static void
+jn_setOffset(pqueue *const pq, const off_t offset)
+{
+        if(JOURNAL_MAGIC == pq->ctlp->journal_magic)
         {
-                log_error("signature %s: Not Found",
-                        s_signaturet(NULL, 0, signature));
-                return EINVAL;
+                pq->ctlp->journal.offset = offset;
+                __sync_synchronize();
         }
-        rl_free(pq->rlp, rlix);
-
-        return ENOERR;
 }
 
+/**
+ * Records the end of an index-modification.
+ *
+ * @pre                   `jn_begin()` was called
+ * @param[in,out] pq      Product-queue
+ * @param[in]     outer   The enclosing intent returned by `jn_begin()`
+ */
+static void
+jn_end(pqueue *const restrict pq, const pqjournal *const restrict outer)
+{
+        if(JOURNAL_MAGIC == pq->ctlp->journal_magic)
+        {
+                __sync_synchronize(); /* after the indexes are modified */
+                pq->ctlp->journal = *outer;
+        }
+}
 
 /**
- * Delete oldest elements until you have space for 'extent' Returns in *rixp the
- * region list index for a suitable region. Increments the number of regions in
- * use if successful.
+ * Records that a reserved region isn't yet in the time-queue. If the process
+ * dies before `jn_closeReserve()`, then a later writer rolls back the
+ * reservation (see `ctl_recoverPending()`).
  *
- * @retval    0           Success.
- * @retval    ENOMEM      No data-products to delete.
- * @retval    EACESS      No unlocked products left to delete. Error-message
- *                        logged.
- * @retval    PQ_CORRUPT  The product-queue is corrupt. Error message logged.
- * @retval    PQ_SYSTEM   System error. Error-message logged.
+ * @pre                   The control-header is write-locked
+ * @param[in,out] pq      Product-queue
+ * @param[in]     offset  Offset of the reserved region
+ * @retval        -1      The product-queue doesn't support pending
+ *                        reservations or all slots are in use. The
+ *                        reservation isn't protected, so the control-header
+ *                        should be kept until it's committed.
+ * @return                Slot of the reservation for `jn_closeReserve()`
  */
 static int
-rpqe_mkspace(pqueue *const pq, size_t const extent, size_t *rixp)
+jn_openReserve(pqueue *const pq, const off_t offset)
 {
-        size_t rlix;
-
-        log_debug("%s:rpqe_mkspace(): Deleting oldest to make space for %ld bytes",
-                __FILE__, (long)extent);
-
-        do {
-                if(pq->rlp->nelems == 0)
-                        return ENOMEM;
-
-                int status = pq2_del_oldest(pq);
+        pqctl *const ctlp = pq->ctlp;
 
-                if(status != ENOERR)
-                        return status;
+        if(PENDING_MAGIC != ctlp->pending_magic ||
+                        ctlp->npending >= PQ_MAX_PENDING)
+                return -1;
 
-                rlix = rl_get(pq->rlp, extent);
-        } while (rlix == RL_NONE) ;
+        for(int i = 0; i < PQ_MAX_PENDING; i++)
+        {
+                pqjournal *const jn = ctlp->pending + i;
 
-        *rixp = rlix;
+                if(jn->op == JN_NONE)
+                {
+                        jn->pid = getpid();
+                        jn->offset = offset;
+                        jn->op = JN_RESERVE;
+                        ctlp->npending++;
+                        __sync_synchronize(); /* before the release */
+                        return i;
+                }
+        }
 
-        return ENOERR;
+        return -1;
 }
 
 /**
- * Delete oldest elements until a consolidation has occurred, making
- * an rl element available.  If this gets called much, you didn't
- * allocate enough product slots or a big enough queue.
+ * Returns the slot of a pending reservation of this process.
  *
- * @retval    0           Success.
- * @retval    ENOMEM      No data-products to delete.
- * @retval    EACESS      No unlocked products left to delete. Error-message
- *                        logged.
- * @retval    PQ_CORRUPT  The product-queue is corrupt. Error message logged.
- * @retval    PQ_SYSTEM   System error. Error-message logged.
+ * @pre                   The control-header is write-locked
+ * @param[in]     pq      Product-queue
+ * @param[in]     offset  Offset of the reserved region
+ * @retval        -1      No such reservation
+ * @return                Slot of the reservation for `jn_closeReserve()`
  */
 static int
-rpqe_mkslot(pqueue *const pq)
+jn_findReserve(const pqueue *const pq, const off_t offset)
 {
-        /* LOG_NOTICE("Deleting oldest to get a queue slot"); */
+        const pqctl *const ctlp = pq->ctlp;
 
-        do {
-                if(pq->rlp->nelems == 0)
-                        return ENOMEM;
+        if(PENDING_MAGIC != ctlp->pending_magic || ctlp->npending == 0)
+                return -1;
 
-                int status = pq2_del_oldest(pq);
+        const pid_t self = getpid();
 
-                if(status != ENOERR)
-                        return status;
+        for(int i = 0; i < PQ_MAX_PENDING; i++)
+        {
+                const pqjournal *const jn = ctlp->pending + i;
 
-        } while (!rl_HasSpace(pq->rlp)) ;
+                if(jn->op != JN_NONE && jn->offset == offset && jn->pid == self)
+                        return i;
+        }
 
-        return ENOERR;
+        return -1;
+}
+
+/**
+ * Clears a pending reservation once its region has been added to the
+ * time-queue or freed.
+ *
+ * @pre                   The control-header is write-locked
+ * @param[in,out] pq      Product-queue
+ * @param[in]     slot    Return value of `jn_openReserve()` or
+ *                        `jn_findReserve()`. Ignored if negative.
+ */
+static void
+jn_closeReserve(pqueue *const pq, const int slot)
+{
+        pqctl *const ctlp = pq->ctlp;
+
+        if(slot < 0)
+                return;
+
+        ctlp->pending[slot].op = JN_NONE;
+        ctlp->pending[slot].offset = OFF_NONE;
+        ctlp->npending--;
 }
 
+/******************************************************************************
+ * Telemetry Functions:
+ *
+ * The writers of a product-queue record their activity per second in a ring in
+ * the control-header so that a monitor can see, for example, that the residence
+ * time of evicted data-products is shrinking toward the lag of a downstream
+ * reader before the reader is overrun. Only writers record activity because
+ * only they may modify the control-header. A slot is reset when a writer first
+ * uses it in a new second; the time of the slot is zeroed beforehand and set
+ * afterwards so that lock-free readers can tell that it changed (see
+ * pq_getTelemetry()).
+ ******************************************************************************/
+
+/*
+ * Initializes the telemetry ring of a product-queue.
+ */
+static void
+tm_init(pqctl *const ctlp)
+{
+        ctlp->telemetry_magic = TELEMETRY_MAGIC;
+        (void)memset(ctlp->telemetry, 0, sizeof(ctlp->telemetry));
+}
 
 /**
- * Allocate a new region for a data-product from the data section (which may
- * eventually get handed to the user). Delete products in the queue, as
- * necessary, in order to make room. If successful, then
- * - A new region is added to the regions-in-use list;
- * - The number of regions in use is incremented;
- * - The number of bytes in use is incremented;
- * - The maximum number of regions in use is updated;
- * - The maximum number of bytes in use is updated;
- * - The data portion of the region is locked.
+ * Returns the slot of the telemetry ring of a product-queue for the current
+ * second.
  *
- * @param[in]  pq      The product-queue.
- * @param[in]  extent  The size of the product in bytes.
- * @param[in]  sxi     The signature of the product.
- * @param[out] vpp     Pointer to the start of the data region.
- * @param[out] sxepp   Pointer to the existing signature entry if the product
- *                     already exists in the product-queue.
- * @retval PQ_DUP      A product with the same signature already exists in the
- *                     product-queue.
- * @retval PQ_CORRUPT  The product-queue is corrupt. Error message logged.
- * @retval PQ_SYSTEM   System error. Error-message logged.
- * @retval ENOMEM      Insufficient memory is available.
- * @retval ENOMEM      There is insufficient room in the address space to effect
- *                     the necessary mapping.
- * @retval EACESS      No unlocked products left to delete.
- * @retval EAGAIN      A mapping could not be locked in memory, if required by
- *                     mlockall(), due to a lack of resources.
- * @retval EDEADLK     The region's lock is blocked by some lock from another
- *                     process and putting the calling process to sleep, waiting
- *                     for that lock to become free would cause a deadlock.
- * @retval EFBIG or EINVAL
- *                     The `extent` argument was greater than the maximum file
- *                     size.
- * @retval EINTR       A signal was caught during execution.
- * @retval EINVAL      `extent` is not valid, or "pq->fd" refers to a file
- *                     that does not support locking.
- * @retval EIO         An I/O error occurred while reading from the file system.
- * @retval EMFILE      The number of mapped regions would exceed an
- *                     implementation-dependent limit (per process or per
- *                     system).
- * @retval ENODEV      `pq->fd` refers to a file whose type is not supported by
- *                     `mmap()`.
- * @retval ENOLCK      Satisfying the request would result in the number of
- *                     locked regions in the system exceeding a system-imposed
- *                     limit.
+ * @pre                 The control-header is write-locked
+ * @param[in,out] ctlp  Control-header
+ * @retval        NULL  The product-queue doesn't have a telemetry ring
+ * @return              The slot for the current second
  */
-static int
-rpqe_new(pqueue *pq, size_t extent, const signaturet sxi,
-        void **vpp, sxelem **sxepp)
+static pq_telemetry*
+tm_slot(pqctl *const ctlp)
 {
-    int           status = ENOERR;
-    size_t        rlix;            /* region list index */
-    region*       hit = NULL;
+        if(TELEMETRY_MAGIC != ctlp->telemetry_magic)
+                return NULL;
 
-    /*
-     * Check for duplicate
-     */
-    // log_debug_1("Checking for duplicate");
-    if (sxi && sx_find(pq->sxp, sxi, sxepp) != 0) {
-        log_debug("PQ_DUP");
-        return PQ_DUP;
-    }
+        const int64_t       now = time(NULL);
+        pq_telemetry *const slot = ctlp->telemetry + now % PQ_TELEMETRY_SIZE;
 
-    /* We may need to split what we find */
-    if (!rl_HasSpace(pq->rlp)) {
-        /* get one slot */
-        // log_debug_1("Making a slot");
-        status = rpqe_mkslot(pq);
-        if (status != ENOERR)
-            return status;
-    }
+        if(slot->second != now)
+        {
+                slot->second = 0;
+                __sync_synchronize();
+                (void)memset(slot, 0, sizeof(*slot));
+                __sync_synchronize();
+                slot->second = now;
+        }
 
-    extent = _RNDUP(extent, pq->ctlp->align);
-    if (extent < pq->smallest_extent_seen)
-        pq->smallest_extent_seen = extent;
+        return slot;
+}
 
-    // log_debug_1("Getting a region");
-    rlix = rl_get(pq->rlp, extent);
-    if (rlix == RL_NONE) {
-        status = rpqe_mkspace(pq, extent, &rlix);
-        if (status != ENOERR)
-            return status;
-    }
-    hit = pq->rlp->rp + rlix;
-    log_assert(IsFree(hit));
-    #define PQ_FRAGMENT_HEURISTIC 64
-    /* Don't bother to split off tiny fragments too small for any
-       product we've seen */
-    if (extent + pq->smallest_extent_seen + PQ_FRAGMENT_HEURISTIC < hit->extent) {
-        // log_debug_1("Splitting region");
-        status = rl_split(pq->rlp, rlix, extent);
-        if (status != ENOERR)
-            goto rl_split_failure;
-    }
+/*
+ * Records the insertion of a data-product whose region has the given extent.
+ */
+static void
+tm_insert(pqctl *const ctlp, const size_t extent)
+{
+        pq_telemetry *const slot = tm_slot(ctlp);
 
-    log_assert((hit->offset % pq->ctlp->align) == 0);
-    set_IsAlloc(hit);
-    // log_debug_1("Adding region hash");
-    rlhash_add(pq->rlp, rlix);
+        if(slot)
+        {
+                slot->ninserted++;
+                slot->insertedBytes += extent;
+        }
+}
 
-    // log_debug_1("Getting region");
-    status = rgn_get(pq, hit->offset, Extent(hit), RGN_WRITE, vpp);
-    if (status != ENOERR)
-        goto rgn_get_failure;
+/*
+ * Records the eviction of a data-product whose region has the given extent,
+ * that was inserted at the given time, and that the given number of registered
+ * readers hadn't yet reached.
+ */
+static void
+tm_evict(
+        pqctl *const restrict            ctlp,
+        const size_t                     extent,
+        const timestampt *const restrict inserted,
+        const unsigned                   nmissed)
+{
+        pq_telemetry *const slot = tm_slot(ctlp);
 
-    if (sxi) {
-        // log_debug_1("Adding signature");
-        sxelem* const sxelem = sx_add(pq->sxp, sxi, hit->offset);
-        if (sxelem == NULL) {
-            log_error("sx_add() failure");
-            status = ENOMEM;
-            goto sx_add_failure;
+        if(slot)
+        {
+                timestampt now;
+                double     residence = set_timestamp(&now) == 0
+                        ? d_diff_timestamp(&now, inserted)
+                        : 0;
+                uint32_t   ms = residence <= 0
+                        ? 0
+                        : residence >= UINT32_MAX/1000.0
+                                ? UINT32_MAX
+                                : (uint32_t)(1000*residence);
+
+                if(slot->nevicted++ == 0 || ms < slot->minResidenceMs)
+                        slot->minResidenceMs = ms;
+                slot->evictedBytes += extent;
+                slot->nmissed += nmissed;
         }
-        *sxepp = sxelem;
-    }
+}
 
-    /* Update stats */
-    off_t         highwater = hit->offset + (off_t)Extent(hit) -
-            pq->ctlp->datao;
-    if (highwater > pq->ctlp->highwater)
-        pq->ctlp->highwater = highwater;
-    if (pq->rlp->nelems >  pq->ctlp->maxproducts)
-        pq->ctlp->maxproducts = pq->rlp->nelems;
-    pq->rlp->nbytes += (off_t)Extent(hit);
-    if (pq->rlp->nbytes > pq->rlp->maxbytes)
-        pq->rlp->maxbytes = pq->rlp->nbytes;
+/*
+ * Records the wait for the write-lock on the control-header that began at the
+ * given time of the monotonic clock.
+ */
+static void
+tm_lockWait(pqctl *const restrict ctlp, const struct timespec *const start)
+{
+        pq_telemetry *const slot = tm_slot(ctlp);
 
-    return status;
+        if(slot)
+        {
+                struct timespec stop;
+                (void)clock_gettime(CLOCK_MONOTONIC, &stop);
+                const int64_t us = (stop.tv_sec - start->tv_sec)*1000000 +
+                        (stop.tv_nsec - start->tv_nsec)/1000;
+                const uint32_t wait = us <= 0
+                        ? 0
+                        : us >= UINT32_MAX
+                                ? UINT32_MAX
+                                : (uint32_t)us;
 
-    sx_add_failure:
-        // log_debug_1("Releasing region");
-        (void)rgn_rel(pq, hit->offset, 0); // region's data portion unmodified
-    rgn_get_failure:
-        // log_debug_1("Deleting region hash");
-        rlhash_del(pq->rlp, rlix);
-        clear_IsAlloc(hit);
-    rl_split_failure:
-        // log_debug_1("Unsplitting region");
-        rl_put(pq->rlp, rlix); // undoes `rl_get()` and `rpqe_mkspace()`
-        return status;
+                slot->nlocks++;
+                slot->lockWaitUs += wait;
+                if(wait > slot->maxLockWaitUs)
+                        slot->maxLockWaitUs = wait;
+        }
 }
 
-
 /******************************************************************************
- * Control-Header Functions:
+ * Reader-Registry Functions:
+ *
+ * A reader may register its cursor in a slot of the control-header so that
+ * writers can count the data-products that they evict before the reader reaches
+ * them and so that monitors can list the slowest readers. Because readers
+ * usually open the product-queue read-only and mustn't delay writers, a reader
+ * claims its slot by compare-and-swap of the process identifier through a
+ * writable mapping of its own and updates the cursor without locking. A slot
+ * whose process no longer exists may be claimed by another reader.
  ******************************************************************************/
 
 /*
- * The 'ctl_xxx' functions deal with pqctl pq->ctlp AND
- * the indexes pq->rlp, pq->tqp, pq->sxp, pq->fbp via ixXXX.
- * Accesses to these areas operate on a single lock, the lock
- * on (0, pgsz), ctlp.
+ * Initializes the reader-registry of a product-queue.
+ */
+static void
+rd_init(pqctl *const ctlp)
+{
+        ctlp->reader_magic = READER_MAGIC;
+        for(int i = 0; i < PQ_MAX_READERS; i++)
+        {
+                ctlp->readers[i].pid = 0;
+                ctlp->readers[i].nmissed = 0;
+                ctlp->readers[i].cursor = RD_NONE;
+        }
+}
+
+/*
+ * Returns a time as microseconds for the reader-registry.
+ */
+static int64_t
+rd_time(const timestampt *const tvp)
+{
+        if(tvIsNone(*tvp))
+                return RD_NONE;
+        if(tvp->tv_sec >= INT64_MAX/1000000 - 1)
+                return INT64_MAX;
+
+        return (int64_t)tvp->tv_sec*1000000 + tvp->tv_usec;
+}
+
+/*
+ * Returns a time of the reader-registry as a timestamp.
  */
+static timestampt
+rd_timestamp(const int64_t time)
+{
+        timestampt ts;
+
+        if(time == RD_NONE)
+                return TS_NONE;
+
+        ts.tv_sec = time / 1000000;
+        ts.tv_usec = time % 1000000;
+
+        return ts;
+}
 
 /**
- * Release the ctl lock and write back any changes.
+ * Counts the eviction of a data-product against the registered readers that
+ * hadn't reached it.
  *
- * @retval EINVAL     The region could not be found in the list of in-use
- *                    regions.
- * @retval EBADF      The product-queue's file descriptor is invalid.
- * @retval EOVERFLOW  The (offset + extent) specification of the region is
- *                    invalid.
+ * @pre                 The control-header is write-locked
+ * @param[in,out] ctlp  Control-header
+ * @param[in]     tvp   Insertion-time of the evicted data-product
+ * @return              Number of registered readers that hadn't reached it
  */
-static int
-ctl_rel(pqueue *const pq, const int rflags)
+static unsigned
+rd_evict(pqctl *const restrict ctlp, const timestampt *const restrict tvp)
 {
-        int status = ENOERR;
+        if(READER_MAGIC != ctlp->reader_magic)
+                return 0;
 
-        log_assert(pq->ctlp != NULL);
-        log_assert(pq->ixp != NULL);
+        const int64_t inserted = rd_time(tvp);
+        unsigned      nmissed = 0;
 
-        if(pq->ixp != NULL)
+        for(int i = 0; i < PQ_MAX_READERS; i++)
         {
-                const int stat = (pq->mtof)(pq, pq->ixo, rflags|RGN_NOLOCK);
-                if(stat) {
-                        log_error("mtof() failure on indexes");
-                        status = stat;
+                volatile rdslot *const slot = ctlp->readers + i;
+
+                if(slot->pid != 0 && slot->cursor != RD_NONE &&
+                                slot->cursor < inserted)
+                {
+                        (void)__sync_fetch_and_add(&slot->nmissed, 1);
+                        nmissed++;
                 }
-                pq->ixp = NULL;
-                pq->rlp = NULL;
-                pq->tqp = NULL;
-                pq->sxp = NULL;
-                pq->fbp = NULL;
         }
-        
-        if(pq->ctlp != NULL)
+
+        return nmissed;
+}
+
+/*
+ * Publishes the cursor of a registered reader and logs the data-products that
+ * were evicted ahead of the reader since the last time.
+ */
+static void
+rd_setCursor(pqueue *const pq)
+{
+        volatile rdslot *const slot = pq->rdSlot;
+
+        slot->cursor = rd_time(&pq->cursor);
+
+        const uint32_t nmissed = slot->nmissed;
+
+        if(nmissed != pq->rdMissed)
         {
-                const int stat = (pq->mtof)(pq, 0, rflags);
-                if(stat) {
-                        log_error("mtof() failure on control block");
-                        if (status == 0)
-								status = stat;
-                }
-                pq->ctlp = NULL;
+                log_warning("%lu data-product(s) were deleted from "
+                        "product-queue %s before this process reached them",
+                        (unsigned long)(nmissed - pq->rdMissed), pq->pathname);
+                pq->rdMissed = nmissed;
         }
+}
 
-        if(fIsSet(pq->pflags, PQ_SIGSBLOCKED))
+/**
+ * Claims a slot of the reader-registry of a product-queue for this instance.
+ *
+ * @param[in,out] pq      Product-queue
+ * @retval        0       Success. `pq->rdSlot` is set.
+ * @retval        ENOSPC  All slots are claimed by existing processes.
+ *                        `log_add()` called.
+ * @return                `<errno.h>` error-code. `log_add()` called.
+ */
+static int
+rd_register(pqueue *const pq)
+{
+#ifdef HAVE_MMAP
+        const int fd = open(pq->pathname, O_RDWR, 0);
+
+        if(fd < 0)
         {
-                /* something was set, end critical section */
-                sigset_t sav_set = pq->sav_set;
+                log_add_syserr("Couldn't open product-queue %s for writing",
+                        pq->pathname);
+                return errno;
+        }
 
-                (void)sigemptyset(&pq->sav_set);
-                fClr(pq->pflags, PQ_SIGSBLOCKED);
+        void *const vp = mmap(NULL, pq->pagesz, PROT_READ|PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+        const int   status = vp == MAP_FAILED ? errno : 0;
 
-                (void) pthread_sigmask(SIG_SETMASK, &sav_set, NULL);
+        (void)close(fd);
+        if(status)
+        {
+                log_add_errno(status, "Couldn't map control-header of "
+                        "product-queue %s", pq->pathname);
+                return status;
         }
 
-        return status;
-}
+        pqctl *const ctlp = vp;
+        const pid_t  self = getpid();
+
+        for(int i = 0; i < PQ_MAX_READERS; i++)
+        {
+                volatile rdslot *const slot = ctlp->readers + i;
+                const pid_t            pid = slot->pid;
+
+                if((pid == 0 || (pid != self && kill(pid, 0) == -1 &&
+                                errno == ESRCH)) &&
+                                __sync_bool_compare_and_swap(&slot->pid, pid,
+                                        self))
+                {
+                        slot->cursor = rd_time(&pq->cursor);
+                        slot->nmissed = 0;
+                        pq->rdMap = vp;
+                        pq->rdSlot = slot;
+                        pq->rdMissed = 0;
+                        return 0;
+                }
+        }
+
+        (void)munmap(vp, pq->pagesz);
+        log_add("All %d reader-slots of product-queue %s are in use",
+                PQ_MAX_READERS, pq->pathname);
 
+        return ENOSPC;
+#else
+        log_add("Reader-registry requires memory-mapping");
+        return ENOSYS;
+#endif
+}
 
 /*
- * Initialize the on disk state (ctl and indexes) of a
- * new queue file. Called by pq_create().
+ * Releases the slot of the reader-registry of a product-queue that's claimed
+ * by this instance, if any.
  */
-static int
-ctl_init(pqueue *const pq, size_t const align)
+static void
+rd_release(pqueue *const pq)
 {
-        int status = ENOERR;
-        void *vp = NULL;
-        size_t nalloc;
+#ifdef HAVE_MMAP
+        if(pq->rdSlot != NULL)
+        {
+                /* A child process mustn't release its parent's slot */
+                if(pq->rdSlot->pid == getpid())
+                {
+                        pq->rdSlot->cursor = RD_NONE;
+                        __sync_synchronize();
+                        pq->rdSlot->pid = 0;
+                }
+                (void)munmap(pq->rdMap, pq->pagesz);
+                pq->rdMap = NULL;
+                pq->rdSlot = NULL;
+        }
+#endif
+}
 
-        log_assert(pq != NULL);
-        log_assert(pq->pagesz != 0);
-        log_assert(pq->datao > 0);
-        log_assert(pq->datao % pq->pagesz == 0);
-        log_assert(pq->ixo > pq->datao);
-        log_assert(pq->ixo % pq->pagesz == 0);
-        log_assert(pq->ixsz >= pq->pagesz);
-        log_assert(pq->ixsz % pq->pagesz == 0);
-        log_assert(align != 0);
+/******************************************************************************
+ * Lower-Level Product-Queue Functions:
+ ******************************************************************************/
 
-        /*
-         * The following isn't a critical section that's protected by
-         * `pthread_sigmask(SIG_BLOCK,...)` because any error (including EINTR)
-         * unlinks the created file.
-         */
+/**
+ * Adds a data-product to the time index(es) of a product-queue and sets its
+ * record in the metadata sidecar if the product-queue has one.
+ *
+ * @pre                   The control-header is write-locked.
+ * @param[in,out] pq      Product-queue
+ * @param[in]     offset  Offset to the data-product's region
+ * @param[in]     info    Information on the data-product or NULL if it isn't
+ *                        known
+ * @return                Return-value of `tq_add()`
+ */
+static int
+pq_tqAdd(pqueue *const pq, const off_t offset, const prod_info *const info)
+{
+        pqjournal outer;
+        jn_begin(pq, JN_INSERT, offset, &outer);
 
-        /*
-         * bring in the pqctl
-         * N.B. No wait. Another lock implies create collision, error
-         */
-        status = (pq->ftom)(pq,
-                         0, (size_t)pq->datao, RGN_WRITE|RGN_NOWAIT, &vp);
-#ifdef HAVE_MMAP
-        if(status == EIO && (pq->ftom == mm_ftom || pq->ftom == mm0_ftom))
+        if(pq->mdp != NULL)
         {
-                log_notice("EIO => remote file system");
-                /* try again */
-                pq->ftom = f_ftom;
-                pq->mtof = f_mtof;
-                status = (pq->ftom)(pq,
-                        0, (size_t)pq->datao, RGN_WRITE|RGN_NOWAIT, &vp);
-        }
-#endif
-        if(status != ENOERR)
-                return status;
-
-        pq->ctlp = (pqctl *)vp;
-        pq->ctlp->magic = PQ_MAGIC;
-        pq->ctlp->version = PQ_VERSION;
-        pq->ctlp->write_count_magic = WRITE_COUNT_MAGIC;
-        pq->ctlp->write_count = 1;              /* this process is writer */
-        pq->ctlp->datao = pq->datao;
-        pq->ctlp->ixo = pq->ixo;
-        pq->ctlp->ixsz = pq->ixsz;
-        pq->ctlp->nalloc = pq->nalloc;
-        pq->ctlp->highwater = 0;
-        pq->ctlp->maxproducts = 0;
-        pq->ctlp->align = align;
-        pq->ctlp->metrics_magic = METRICS_MAGIC;
-        pq->ctlp->mostRecent = TS_NONE;
-        pq->ctlp->minVirtResTime = TS_NONE;
-        pq->ctlp->isFull = 0;
-        pq->ctlp->metrics_magic_2 = METRICS_MAGIC_2;
-        pq->ctlp->mvrtSize = -1;
-        pq->ctlp->mvrtSlots = 0;
+                region *rp;
 
-        /* bring in the indexes */
-        status = (pq->ftom)(pq,
-                         pq->ixo, pq->ixsz, RGN_WRITE|RGN_NOLOCK, &pq->ixp);
-        if(status != ENOERR)
-        {
-                (void)(pq->mtof)(pq, 0, 0);
-                return status;
+                if(rl_r_find(pq->rlp, offset, &rp))
+                        md_set(pq->mdp, (size_t)(rp - pq->rlp->rp), info);
         }
 
-        (void)ix_ptrs(pq->ixp, pq->ixsz, pq->nalloc, align, &pq->rlp, &pq->tqp, &pq->fbp, &pq->sxp);
-        nalloc = pq->nalloc;    /* ix_ptrs computed this in version 3 */
-
-        /* initialize fb for skip list blocks */
-        fb_init(pq->fbp, nalloc);
+        timestampt tv;
+        int status = tq_add(pq->tqp, offset, NULL, &tv);
 
-        /* initialize tqueue */
-        tq_init(pq->tqp, nalloc, pq->fbp);
+        if(status == ENOERR && pq->trp != NULL)
+                tr_add(pq->trp, &tv, offset);
 
-        /* initialize regionl, adding one huge region for data */
-        rl_init(pq->rlp, nalloc, pq->fbp);
-        {
-                off_t  datasz = pq->ixo - pq->datao;
-
-                if (MAX_SIZE_T < datasz) {
-                    log_error("Data portion of file is too big for one region");
-                    return EFBIG;
-                }
-                {
-                    size_t extent0 = (size_t)datasz;
-                    region *rp = rl_add(pq->rlp, pq->datao, extent0);
-
-                    pq->rlp->maxfextent = extent0;
-                    log_assert(rp != NULL
-                            && rp->offset == pq->datao
-                            && rp->extent == extent0);
-                }
-        }
+        jn_end(pq, &outer);
 
-        sx_init(pq->sxp, nalloc);
-        
         return status;
 }
 
-/*
- * Sets the functions to be used to access the product-queue.
+/**
+ * Deletes an element from the time index(es) of a product-queue.
  *
- * Arguments:
- *      pq      Pointer to product-queue structure.  The following members
- *              must be set to their final values: pflags, ixo, ixsz.
+ * @pre                 The control-header is write-locked.
+ * @param[in,out] pq    Product-queue
+ * @param[in]     tqep  Element of the time-queue
  */
 static void
-ctl_setAccessFunctions(
-    pqueue* const       pq)
+pq_tqDelete(pqueue *const pq, tqelem *const tqep)
 {
-    const int           pflags = pq->pflags;
+        if(pq->trp != NULL)
+                tr_delete(pq->trp, &tqep->tv, tqep->offset);
+        tq_delete(pq->tqp, tqep);
+}
 
-    log_assert(NULL != pq);
+/**
+ * Deletes a data-product if the product is not locked.
+ *
+ * @param[in]  pq          The product-queue.
+ * @param[in]  tqep        The entry in the time-map.
+ * @param[in]  rlix        The index of the entry in the region-map.
+ * @param[out] info        The data-product metadata. On success, caller should
+ *                         unconditionally call `xdr_free(xdr_prod_info,
+ *                         (char*)info)` when it's no longer needed.
+ * @retval     0           Success. `*info` is set. Caller should
+ *                         unconditionally call `xdr_free(xdr_prod_info,
+ *                         (char*)info)` when it's no longer needed.
+ * @retval     EACCES      Product is locked (alias "Permission denied")
+ * @retval     PQ_CORRUPT  The product-queue is corrupt. Error-messaged logged.
+ * @retval     PQ_SYSTEM   System error. Error-message logged.
+ */
+static int
+pq2_try_del_prod(
+    pqueue* const restrict    pq,
+    tqelem* const restrict    tqep,
+    size_t                    rlix,
+    prod_info* const restrict info)
+{
+    region* const rep = pq->rlp->rp + rlix;
+    const off_t   offset = rep->offset;
+    int           status;
 
-#ifdef HAVE_MMAP
-    if (fIsSet(pflags, PQ_NOMAP)) {
-#endif
-        /*
-         * The product-queue will be accessed via read() and write().
-         */
-        pq->ftom = f_ftom;
-        pq->mtof = f_mtof;
-#ifdef HAVE_MMAP
+    if (offset != tqep->offset) {
+        log_error("Offset-to-region mismatch: time-entry=%ld, "
+                "region-entry=%ld", (long)tqep->offset, (long)offset);
+        status = PQ_CORRUPT;
     }
     else {
-        if (fIsSet(pflags, PQ_MAPRGNS) || isProductMappingNecessary(pq)) {
-            /*
-             * The product-queue will be accessed by being memory-mapped
-             * on a region-by-region basis.
-             */
-            pq->ftom = mm_ftom;
-            pq->mtof = mm_mtof;
-        }
-        else
-        {
-            /*
-             * The product-queue will be accessed by being memory-mapped
-             * once, in its entirety.
-             */
-            pq->ftom = mm0_ftom;
-            pq->mtof = mm0_mtof;
+        void* vp;
+
+        status = rgn_get(pq, offset, Extent(rep), RGN_WRITE|RGN_NOWAIT, &vp);
+        if (status) {
+            if (status == EACCES || status == EAGAIN) {
+                log_clear();
+                status = EACCES;
+            }
+            else {
+                log_syserr("Couldn't get region (offset=%ld,extent=%zu)", offset, Extent(rep));
+                status = PQ_SYSTEM;
+            }
         }
-    }
-#endif
+        else {
+            /* Get the metadata of the data-product. */
+            XDR xdrs;
+
+            xdrmem_create(&xdrs, vp, Extent(rep), XDR_DECODE);
+            // Necessary for `xdr_prod_info()`
+            (void)memset(info, 0, sizeof(prod_info));
+
+            if (!xdr_prod_info(&xdrs, info)) {
+                log_error("Couldn't XDR_DECODE data-product metadata");
+                status = PQ_CORRUPT;
+            }
+            else {
+                pqjournal outer;
+                jn_begin(pq, JN_DELETE, offset, &outer);
+
+                /*
+                 * Remove the corresponding entry from the signature-map.
+                 */
+                if (sx_find_delete(pq->sxp, info->signature) == 0) {
+                    log_error("pq_try_del_prod(): signature %s: Not Found",
+                            s_signaturet(NULL, 0, info->signature));
+                    status = PQ_CORRUPT;
+                }
+                else {
+                    /*
+                     * Remove the corresponding entry from the time-map.
+                     */
+                    pq_tqDelete(pq, tqep);
+
+                    /*
+                     * Remove the corresponding entry from the region-map.
+                     */
+                    rl_free(pq->rlp, rlix);
+                }
+                jn_end(pq, &outer);
+
+                if (status)
+                    xdr_free(xdr_prod_info, (char*)info);
+            } // `xdr_prod_info()` successful
+
+            xdr_destroy(&xdrs);
+
+            /* Release the data-region. */
+            (void)rgn_rel(pq, offset, 0);
+        } // `rgn_get()` successful
+    } // region-offsets match
+
+    return status;
 }
 
 
-/*
- * Initialize the in-memory state of pq from an existing file. Called by
- * pq_open().  On successful return, the control region (pq->ctlp) will be
- * mapped and/or locked.
- *
- * Arguments:
- *      pq      Pointer to product-queue structure to be set.
- *      path    Pathname of product-queue.
+/**
+ * Set the minimum virtual residence time metrics if appropriate.
  *
- * Returns:
- *      0           Success
- *      PQ_CORRUPT  The  product-queue is internally inconsistent.
- *      else        <errno.h> error-code.
+ * @param[in] pq             The product-queue.
+ * @param[in] receptionTime  The time the data-product was inserted into the
+ *                           product-queue.
+ * @param[in] info           The data-product metadata.
  */
-static int
-ctl_gopen(pqueue *const pq, const char *path)
+static void
+pq2_set_mvrt(
+    pqueue* const restrict     pq,
+    timestampt* const restrict receptionTime,
+    prod_info* const restrict  info)
 {
-        int status = ENOERR;
-        pqctl *ctlp;
-        size_t ctlsz; 
-        void *vp = NULL;
+    const timestampt*           creationTime = &info->arrival;
+    timestampt                  now;
 
-        log_assert(pq != NULL);
-        log_assert(pq->pagesz > 0);
-        log_assert(pq->ixp == NULL && pq->rlp == NULL && pq->tqp == NULL);
+    /*
+     * If the product was received before it was created, then use the product's
+     * reception-time as its creation-time in the computation of the product's
+     * virtual residence-time.
+     */
+    if (TV_CMP_LT(*receptionTime, *creationTime))
+        creationTime = receptionTime;
 
-        ctlsz = pq->pagesz;
+    (void)set_timestamp(&now);
 
-        /*FALLTHROUGH*/
-remap:
-        status = (pq->ftom)(pq, 0, ctlsz, 0, &vp);
-#ifdef HAVE_MMAP
-        if(status == EIO && (pq->ftom == mm_ftom || pq->ftom == mm0_ftom))
+    /*
+     * Compute the product's residence time only if the product was
+     * created before now.
+     */
+    if (TV_CMP_LT(*creationTime, now)) {
+        timestampt      virtResTime = diff_timestamp(&now, creationTime);
+
+        if (tvIsNone(pq->ctlp->minVirtResTime) ||
+                TV_CMP_LT(virtResTime, pq->ctlp->minVirtResTime)) {
+            log_info("MVRT product: %s",
+                    s_prod_info(NULL, 0, info, log_is_enabled_debug));
+            pq->ctlp->minVirtResTime = virtResTime;
+            pq->ctlp->mvrtSize = pq->rlp->nbytes;
+            pq->ctlp->mvrtSlots = pq->rlp->nelems;
+        }
+    }
+}
+
+/**
+ * Deletes the oldest product in a product queue that is not locked.  In the
+ * unlikely event that all the products in the queue are locked or a deadlock
+ * is detected, returns an error status other than ENOERR.  Sets the "isFull",
+ * "minVirtResTime", "mvrtSize", and "mvrtSlots" members of the product-queue
+ * control block on success.
+ *
+ * @param[in] pq          Pointer to the product-queue object.  Shall not be
+ *                        NULL.
+ * @retval    0           Success.  "pq->ctlp->isFull" set to true.
+ * @retval    EACESS      No unlocked products left to delete. Error-message
+ *                        logged.
+ * @retval    PQ_CORRUPT  The product-queue is corrupt. Error message logged.
+ * @retval    PQ_SYSTEM   System error. Error-message logged.
+ */
+static int
+pq2_del_oldest(
+    pqueue* const pq)
+{
+    int status = EACCES;
+
+    log_assert(pq != NULL);
+    log_assert(pq->ctlp != NULL && pq->tqp != NULL);
+
+    /* Delete the oldest unlocked data-product. */
+    size_t  rlix;
+    size_t  numLocked = 0;
+    for (tqelem* tqep = tqe_first(pq->tqp);
+            tqep && (rlix = rl_find(pq->rlp, tqep->offset)) != RL_NONE;
+            tqep = tq_next(pq->tqp, tqep)) {
+        prod_info  info;
+        timestampt insertionTime = tqep->tv;
+        const size_t extent = Extent(pq->rlp->rp + rlix);
+        status = pq2_try_del_prod(pq, tqep, rlix, &info);
+        if (status == 0) {
+            pq->ctlp->isFull = 1; // Mark the queue as full.
+            if (EVICT_MAGIC == pq->ctlp->evict_magic) {
+                pq->ctlp->nevicted++;
+                pq->ctlp->evictedBytes += extent;
+            }
+            tm_evict(pq->ctlp, extent, &insertionTime,
+                    rd_evict(pq->ctlp, &insertionTime));
+            /* Adjust the minimum virtual residence time. */
+            pq2_set_mvrt(pq, &insertionTime, &info);
+            xdr_free(xdr_prod_info, (char*)&info);
+            return 0;
+        }
+        if (status != EACCES)
+            return status;
+
+        ++numLocked;
+    }
+
+    log_error("All %zu products are locked. No unlocked products left to delete!",
+            numLocked);
+
+    return status;
+
+#if 0
+    tqelem*             tqep = tqe_first(pq->tqp);
+    int                 status = ENOERR;
+    void*               vp = NULL;
+    region*             rep = NULL;
+    size_t              rlix;
+
+    rlix = rl_find(pq->rlp, tqep->offset);
+    log_assert(rlix != RL_NONE);
+    rep = pq->rlp->rp + rlix;
+    status = rgn_get(pq, rep->offset, Extent(rep), RGN_WRITE|RGN_NOWAIT, &vp);
+
+    while (status != ENOERR) {
+        /*
+         * The current data-product is locked.  Try the next one.
+         */
+        tqep = tq_next(pq->tqp, tqep);
+        rlix = rl_find(pq->rlp, tqep->offset);
+
+        if (rlix == RL_NONE) {
+            log_error("no unlocked products left to delete!");
+            break;
+        }
+
+        rep = pq->rlp->rp + rlix;
+        status =
+            rgn_get(pq, rep->offset, Extent(rep), RGN_WRITE|RGN_NOWAIT, &vp);
+    }
+
+    if (status == ENOERR) {
+        /*
+         * Got the data region.  Start releasing associated entries.
+         */
+        off_t           offset = rep->offset;
+        unsigned char*  signature;
+        InfoBuf         infoBuf;
+
+        /*
+         * Get the metadata of the data-product.
+         */
+        (void)xinfo_i(vp, Extent(rep), XDR_DECODE, ib_init(&infoBuf));
+
+        /*
+         * Set the minimum virtual residence time metrics if appropriate.
+         */
         {
-                log_warning("Product-queue can't be memory-mapped!  "
-                    "Continuing with slower read/write I/O.");
-                /* try again */
-                pq->ftom = f_ftom;
-                pq->mtof = f_mtof;
-                status = (pq->ftom)(pq, 0, ctlsz, 0, &vp);
+            const timestampt*           creationTime = &infoBuf.info.arrival;
+            const timestampt* const     receptionTime = &tqep->tv;
+            timestampt                  now;
+
+            /*
+             * If the product was received before it was created, then use the
+             * product's reception-time as its creation-time in the computation
+             * of the product's virtual residence-time.
+             */
+            if ((TV_CMP_LT(*receptionTime, *creationTime))) {
+                creationTime = receptionTime;
+            }
+
+            (void)set_timestamp(&now);
+
+            /*
+             * Compute the product's residence time only if the product was
+             * created before now.
+             */
+            if (TV_CMP_LT(*creationTime, now)) {
+                timestampt      virtResTime =
+                    diff_timestamp(&now, creationTime);
+
+                if (tvIsNone(pq->ctlp->minVirtResTime) ||
+                        (TV_CMP_LT(virtResTime, pq->ctlp->minVirtResTime)))  {
+                    log_info("MVRT product: %s",
+                            s_prod_info(NULL, 0, &infoBuf.info, ulogIsDebug()));
+                    pq->ctlp->minVirtResTime = virtResTime;
+                    pq->ctlp->mvrtSize = pq->rlp->nbytes;
+                    pq->ctlp->mvrtSlots = pq->rlp->nelems;
+                }
+            }
+        }
+
+        /*
+         * Remove the corresponding entry from the time-list.
+         */
+        pq_tqDelete(pq, tqep);
+
+        /*
+         * Remove the corresponding entry from the signature-list.
+         */
+        signature = infoBuf.info.signature;
+
+        if (sx_find_delete(pq->sxp, signature) == 0) {
+            log_error("signature %s: Not Found",
+                    s_signaturet(NULL, 0, signature));
+            status = EINVAL;
         }
+
+        /*
+         * Remove the corresponding entry from the region-list.
+         */
+        rl_free(pq->rlp, rlix);
+
+        /*
+         * Release the data region.
+         */
+        (void) rgn_rel(pq, offset, 0);
+
+        /*
+         * Mark the queue as full.
+         */
+        pq->ctlp->isFull = 1;
+    }                                   /* got data region */
+
+    return status;
 #endif
-        if(status != ENOERR)
-                return status;
+}
 
-        ctlp = (pqctl *)vp;
-        if(ctlp->magic != PQ_MAGIC)
+
+/******************************************************************************
+ * Lower-Level Reserved Product-Region Functions:
+ ******************************************************************************/
+
+
+/*
+ * Free a region, by offset
+ */
+static int
+rpqe_free(pqueue *pq, off_t offset, const signaturet signature)
+{
+        region *rp = NULL;
+        size_t rlix;
+
+        rlix = rl_find(pq->rlp, offset);
+        if(rlix == RL_NONE)
         {
-                /* Not a product queue */
-                log_error("%s: Not a product queue", path);
-                status = EINVAL;
-                goto unwind_map;
+                log_error("offset 0x%08lx: Not Found", (long)offset);
+                return EINVAL;
         }
-        if (PQ_VERSION != ctlp->version && 7 != ctlp->version)
+        rp = pq->rlp->rp + rlix;
+        if(IsFree(rp))
         {
-                log_error("%s: Product queue is version %d instead of expected version %d",
-                       path, ctlp->version, PQ_VERSION);
-                status = EINVAL;
-                goto unwind_map;
+                log_error("0x%08lx: Already free", (long)offset);
+                return EINVAL;
         }
-        if(ctlp->datao % pq->pagesz != 0)
+
+        pqjournal outer;
+        int status = ENOERR;
+
+        jn_begin(pq, JN_DELETE, offset, &outer);
+        if(sx_find_delete(pq->sxp, signature) == 0)
         {
-                /* Can't align */
-                /* TODO: If we use read()/write() not fatal ??? */
-                log_error("%s: Can't align", path);
+                log_error("signature %s: Not Found",
+                        s_signaturet(NULL, 0, signature));
                 status = EINVAL;
-                goto unwind_map;
         }
-        if((size_t)ctlp->datao != ctlsz)
+        else
         {
-                /* we guessed wrong, try again */
-                if(ctlsz != pq->pagesz)
-                {
-                        /* don't try more than once */
-                        status = EINVAL;
-                        goto unwind_map;
-                }
-                ctlsz = (size_t)ctlp->datao;
-                (void)(pq->mtof)(pq, 0, 0);
-                goto remap;
+                rl_free(pq->rlp, rlix);
+        }
+        jn_end(pq, &outer);
+
+        return status;
+}
+
+
+/**
+ * Delete oldest elements until you have space for 'extent' Returns in *rixp the
+ * region list index for a suitable region. Increments the number of regions in
+ * use if successful.
+ *
+ * @retval    0           Success.
+ * @retval    ENOMEM      No data-products to delete.
+ * @retval    EACESS      No unlocked products left to delete. Error-message
+ *                        logged.
+ * @retval    PQ_CORRUPT  The product-queue is corrupt. Error message logged.
+ * @retval    PQ_SYSTEM   System error. Error-message logged.
+ */
+static int
+rpqe_mkspace(pqueue *const pq, size_t const extent, size_t *rixp)
+{
+        size_t rlix;
+
+        log_debug("%s:rpqe_mkspace(): Deleting oldest to make space for %ld bytes",
+                __FILE__, (long)extent);
+
+        do {
+                if(pq->rlp->nelems == 0)
+                        return ENOMEM;
+
+                int status = pq2_del_oldest(pq);
+
+                if(status != ENOERR)
+                        return status;
+
+                rlix = rl_get(pq->rlp, extent);
+        } while (rlix == RL_NONE) ;
+
+        *rixp = rlix;
+
+        return ENOERR;
+}
+
+/**
+ * Delete oldest elements until a consolidation has occurred, making
+ * an rl element available.  If this gets called much, you didn't
+ * allocate enough product slots or a big enough queue.
+ *
+ * @retval    0           Success.
+ * @retval    ENOMEM      No data-products to delete.
+ * @retval    EACESS      No unlocked products left to delete. Error-message
+ *                        logged.
+ * @retval    PQ_CORRUPT  The product-queue is corrupt. Error message logged.
+ * @retval    PQ_SYSTEM   System error. Error-message logged.
+ */
+static int
+rpqe_mkslot(pqueue *const pq)
+{
+        /* LOG_NOTICE("Deleting oldest to get a queue slot"); */
+
+        do {
+                if(pq->rlp->nelems == 0)
+                        return ENOMEM;
+
+                int status = pq2_del_oldest(pq);
+
+                if(status != ENOERR)
+                        return status;
+
+                if(EVICT_MAGIC == pq->ctlp->evict_magic)
+                        pq->ctlp->nevictedForSlot++;
+
+        } while (!rl_HasSpace(pq->rlp)) ;
+
+        return ENOERR;
+}
+
+
+/**
+ * Allocate a new region for a data-product from the data section (which may
+ * eventually get handed to the user). Delete products in the queue, as
+ * necessary, in order to make room. If successful, then
+ * - A new region is added to the regions-in-use list;
+ * - The number of regions in use is incremented;
+ * - The number of bytes in use is incremented;
+ * - The maximum number of regions in use is updated;
+ * - The maximum number of bytes in use is updated;
+ * - The data portion of the region is locked.
+ *
+ * @param[in]  pq      The product-queue.
+ * @param[in]  extent  The size of the product in bytes.
+ * @param[in]  sxi     The signature of the product.
+ * @param[out] vpp     Pointer to the start of the data region.
+ * @param[out] sxepp   Pointer to the existing signature entry if the product
+ *                     already exists in the product-queue.
+ * @retval PQ_DUP      A product with the same signature already exists in the
+ *                     product-queue.
+ * @retval PQ_CORRUPT  The product-queue is corrupt. Error message logged.
+ * @retval PQ_SYSTEM   System error. Error-message logged.
+ * @retval ENOMEM      Insufficient memory is available.
+ * @retval ENOMEM      There is insufficient room in the address space to effect
+ *                     the necessary mapping.
+ * @retval EACESS      No unlocked products left to delete.
+ * @retval EAGAIN      A mapping could not be locked in memory, if required by
+ *                     mlockall(), due to a lack of resources.
+ * @retval EDEADLK     The region's lock is blocked by some lock from another
+ *                     process and putting the calling process to sleep, waiting
+ *                     for that lock to become free would cause a deadlock.
+ * @retval EFBIG or EINVAL
+ *                     The `extent` argument was greater than the maximum file
+ *                     size.
+ * @retval EINTR       A signal was caught during execution.
+ * @retval EINVAL      `extent` is not valid, or "pq->fd" refers to a file
+ *                     that does not support locking.
+ * @retval EIO         An I/O error occurred while reading from the file system.
+ * @retval EMFILE      The number of mapped regions would exceed an
+ *                     implementation-dependent limit (per process or per
+ *                     system).
+ * @retval ENODEV      `pq->fd` refers to a file whose type is not supported by
+ *                     `mmap()`.
+ * @retval ENOLCK      Satisfying the request would result in the number of
+ *                     locked regions in the system exceeding a system-imposed
+ *                     limit.
+ */
+static int
+rpqe_new(pqueue *pq, size_t extent, const signaturet sxi,
+        void **vpp, sxelem **sxepp)
+{
+    int           status = ENOERR;
+    size_t        rlix;            /* region list index */
+    region*       hit = NULL;
+    pqjournal     outer;
+
+    /*
+     * Check for duplicate
+     */
+    // log_debug_1("Checking for duplicate");
+    if (sxi && sx_find(pq->sxp, sxi, sxepp) != 0) {
+        log_debug("PQ_DUP");
+        return PQ_DUP;
+    }
+
+    jn_begin(pq, JN_RESERVE, OFF_NONE, &outer);
+
+    /* We may need to split what we find */
+    if (!rl_HasSpace(pq->rlp)) {
+        /* get one slot */
+        // log_debug_1("Making a slot");
+        status = rpqe_mkslot(pq);
+        if (status != ENOERR)
+            goto mkroom_failure;
+    }
+
+    extent = _RNDUP(extent, pq->ctlp->align);
+    if (extent < pq->smallest_extent_seen)
+        pq->smallest_extent_seen = extent;
+
+    // log_debug_1("Getting a region");
+    rlix = rl_get(pq->rlp, extent);
+    if (rlix == RL_NONE) {
+        status = rpqe_mkspace(pq, extent, &rlix);
+        if (status != ENOERR)
+            goto mkroom_failure;
+    }
+    hit = pq->rlp->rp + rlix;
+    log_assert(IsFree(hit));
+    jn_setOffset(pq, hit->offset);
+    #define PQ_FRAGMENT_HEURISTIC 64
+    /* Don't bother to split off tiny fragments too small for any
+       product we've seen */
+    if (extent + pq->smallest_extent_seen + PQ_FRAGMENT_HEURISTIC < hit->extent) {
+        // log_debug_1("Splitting region");
+        status = rl_split(pq->rlp, rlix, extent);
+        if (status != ENOERR)
+            goto rl_split_failure;
+    }
+
+    log_assert((hit->offset % pq->ctlp->align) == 0);
+    set_IsAlloc(hit);
+    // log_debug_1("Adding region hash");
+    rlhash_add(pq->rlp, rlix);
+
+    // log_debug_1("Getting region");
+    status = rgn_get(pq, hit->offset, Extent(hit), RGN_WRITE, vpp);
+    if (status != ENOERR)
+        goto rgn_get_failure;
+
+    if (sxi) {
+        // log_debug_1("Adding signature");
+        sxelem* const sxelem = sx_add(pq->sxp, sxi, hit->offset);
+        if (sxelem == NULL) {
+            log_error("sx_add() failure");
+            status = ENOMEM;
+            goto sx_add_failure;
+        }
+        *sxepp = sxelem;
+    }
+
+    /* Update stats */
+    off_t         highwater = hit->offset + (off_t)Extent(hit) -
+            pq->ctlp->datao;
+    if (highwater > pq->ctlp->highwater)
+        pq->ctlp->highwater = highwater;
+    if (pq->rlp->nelems >  pq->ctlp->maxproducts)
+        pq->ctlp->maxproducts = pq->rlp->nelems;
+    pq->rlp->nbytes += (off_t)Extent(hit);
+    if (pq->rlp->nbytes > pq->rlp->maxbytes)
+        pq->rlp->maxbytes = pq->rlp->nbytes;
+
+    jn_end(pq, &outer);
+    return status;
+
+    sx_add_failure:
+        // log_debug_1("Releasing region");
+        (void)rgn_rel(pq, hit->offset, 0); // region's data portion unmodified
+    rgn_get_failure:
+        // log_debug_1("Deleting region hash");
+        rlhash_del(pq->rlp, rlix);
+        clear_IsAlloc(hit);
+    rl_split_failure:
+        // log_debug_1("Unsplitting region");
+        rl_put(pq->rlp, rlix); // undoes `rl_get()` and `rpqe_mkspace()`
+    mkroom_failure:
+        jn_end(pq, &outer);
+        return status;
+}
+
+
+/**
+ * Shrinks an in-use region whose data-product was deflated after the region was
+ * reserved and returns the remainder to the free regions. The region is left
+ * as is if the remainder would be a tiny fragment or if there's no slot for
+ * it.
+ *
+ * @pre               The control-header is write-locked
+ * @param[in,out] pq      The product-queue.
+ * @param[in]     offset  Offset of the region.
+ * @param[in]     extent  Size of the deflated data-product in bytes.
+ * @return                Extent of the region in bytes.
+ */
+static size_t
+rpqe_shrink(pqueue *pq, off_t offset, size_t extent)
+{
+    const size_t rlix = rl_find(pq->rlp, offset);
+    log_assert(rlix != RL_NONE);
+    region* const hit = pq->rlp->rp + rlix;
+    log_assert(IsAlloc(hit));
+
+    extent = _RNDUP(extent, pq->ctlp->align);
+    if (extent + PQ_FRAGMENT_HEURISTIC >= Extent(hit) ||
+            !rl_HasSpace(pq->rlp))
+        return Extent(hit);
+
+    const size_t  rem = Extent(hit) - extent;
+    region* const tail = rl_add(pq->rlp, offset + (off_t)extent, rem);
+    if (tail == NULL)
+        return Extent(hit);
+
+    hit->extent -= rem; /* keeps the ISALLOC and ISZIP flags */
+    rl_consolidate(pq->rlp, (size_t)(tail - pq->rlp->rp));
+    pq->rlp->nbytes -= rem;
+
+    return extent;
+}
+
+
+/******************************************************************************
+ * Control-Header Functions:
+ ******************************************************************************/
+
+/*
+ * The 'ctl_xxx' functions deal with pqctl pq->ctlp AND
+ * the indexes pq->rlp, pq->tqp, pq->sxp, pq->fbp via ixXXX.
+ * Accesses to these areas operate on a single lock, the lock
+ * on (0, pgsz), ctlp.
+ */
+
+/**
+ * Release the ctl lock and write back any changes.
+ *
+ * @retval EINVAL     The region could not be found in the list of in-use
+ *                    regions.
+ * @retval EBADF      The product-queue's file descriptor is invalid.
+ * @retval EOVERFLOW  The (offset + extent) specification of the region is
+ *                    invalid.
+ */
+static int
+ctl_rel(pqueue *const pq, int rflags)
+{
+        int status = ENOERR;
+
+        log_assert(pq->ctlp != NULL);
+
+        if(fIsSet(pq->pflags, PQ_SEQWRITE))
+        {
+                /* end write-side of sequence-lock before unlocking */
+                __sync_synchronize();
+                pq->ctlp->seqlock++;
+                fClr(pq->pflags, PQ_SEQWRITE);
+        }
+        if(fIsSet(pq->pflags, PQ_SEQREAD))
+        {
+                /* control-header was obtained by ctl_getRead() without lock */
+                fSet(rflags, RGN_NOLOCK);
+                fClr(pq->pflags, PQ_SEQREAD);
+        }
+
+        if(pq->ixp != NULL)
+        {
+                const int stat = (pq->mtof)(pq, pq->ixo, rflags|RGN_NOLOCK);
+                if(stat) {
+                        log_error("mtof() failure on indexes");
+                        status = stat;
+                }
+                pq->ixp = NULL;
+                pq->rlp = NULL;
+                pq->tqp = NULL;
+                pq->sxp = NULL;
+                pq->fbp = NULL;
+                pq->trp = NULL;
+                pq->mdp = NULL;
+        }
+        
+        if(pq->ctlp != NULL)
+        {
+                const int stat = (pq->mtof)(pq, 0, rflags);
+                if(stat) {
+                        log_error("mtof() failure on control block");
+                        if (status == 0)
+								status = stat;
+                }
+                pq->ctlp = NULL;
+        }
+
+        if(fIsSet(pq->pflags, PQ_SIGSBLOCKED))
+        {
+                /* something was set, end critical section */
+                sigset_t sav_set = pq->sav_set;
+
+                (void)sigemptyset(&pq->sav_set);
+                fClr(pq->pflags, PQ_SIGSBLOCKED);
+
+                (void) pthread_sigmask(SIG_SETMASK, &sav_set, NULL);
+        }
+
+        return status;
+}
+
+
+/**
+ * Sets the pointer to the optional time-ring index of a product-queue (see
+ * `PQ_TIMERING`). The time-ring follows the other indexes.
+ *
+ * @pre               The control-header and indexes are in memory.
+ * @param[in,out] pq  Product-queue. `pq->trp` is set to the time-ring or NULL
+ *                    if the product-queue doesn't have one.
+ */
+static void
+ctl_setTrp(pqueue *const pq)
+{
+        pq->trp = NULL;
+
+        if(TIME_RING_MAGIC == pq->ctlp->time_ring_magic)
+        {
+                tr *const trp = (tr *)((char *)pq->ixp +
+                        ix_sz(pq->nalloc, pq->ctlp->align,
+                                fIsSet(pq->pflags, PQ_SXTABLE)));
+
+                if((char *)trp + tr_sz(pq->nalloc) <=
+                                (char *)pq->ixp + pq->ixsz)
+                        pq->trp = trp;
+        }
+}
+
+
+/**
+ * Sets the pointer to the optional metadata sidecar of a product-queue.
+ *
+ * @pre               The control-header and indexes are in memory.
+ * @param[in,out] pq  Product-queue. `pq->mdp` is set to the sidecar or NULL if
+ *                    the product-queue doesn't have one.
+ */
+static void
+ctl_setMdp(pqueue *const pq)
+{
+        pq->mdp = NULL;
+
+        if(METADATA_MAGIC == pq->ctlp->metadata_magic &&
+                        pq->ctlp->mdo + md_sz(pq->nalloc) <= pq->ixsz)
+        {
+                md *const mdp = (md *)((char *)pq->ixp + pq->ctlp->mdo);
+
+                if(mdp->magic == MD_MAGIC &&
+                                mdp->nalloc == pq->nalloc + RL_FREE_OVERHEAD)
+                        pq->mdp = mdp;
+        }
+}
+
+
+/**
+ * Indicates if the sequence-lock of a product-queue will be seen by other
+ * processes as soon as it's modified by this one (i.e., the control-header is
+ * memory-mapped shared).
+ *
+ * @param[in] pq     Product-queue
+ * @retval    true   Sequence-lock is shared
+ * @retval    false  Sequence-lock isn't shared
+ */
+static bool
+ctl_isSeqlockShared(const pqueue *const pq)
+{
+#ifdef HAVE_MMAP
+        return !fIsSet(pq->pflags, PQ_PRIVATE) &&
+                (pq->ftom == mm0_ftom || pq->ftom == mm_ftom);
+#else
+        return false;
+#endif
+}
+
+
+/**
+ * Advises the operating-system on how to back the memory-mapping of the
+ * product-queue according to the `PQ_HUGEPAGES` and `PQ_INTERLEAVE` flags and
+ * records the result in `pq->mapMode`. Does nothing if the product-queue isn't
+ * memory-mapped in its entirety. Failures aren't fatal: they're logged at the
+ * debug level.
+ *
+ * @param[in,out] pq  Product-queue
+ */
+static void
+ctl_adviseMapping(pqueue *const pq)
+{
+        const size_t len = (size_t)TOTAL_SIZE(pq);
+
+        if(pq->base == NULL)
+                return;
+
+#if defined(HAVE_MMAP) && defined(MADV_HUGEPAGE)
+        /* A hugetlbfs(5) file is already mapped by huge pages */
+        if(fIsSet(pq->pflags, PQ_HUGEPAGES) &&
+                        !fIsSet(pq->mapMode, PQ_MAP_HUGETLBFS))
+        {
+                if(madvise(pq->base, len, MADV_HUGEPAGE))
+                {
+                        log_debug("madvise(MADV_HUGEPAGE) failure on "
+                                "product-queue: %s", strerror(errno));
+                }
+                else
+                {
+                        fSet(pq->mapMode, PQ_MAP_THP);
+                }
+        }
+#endif
+
+#if defined(__linux__) && defined(SYS_mbind)
+        if(fIsSet(pq->pflags, PQ_INTERLEAVE))
+        {
+#define NUMA_MASK_LONGS 16      /* 1024 nodes on 64-bit systems */
+                unsigned long mask[NUMA_MASK_LONGS];
+                const size_t  nbits = sizeof(mask) * CHAR_BIT;
+
+                /* Interleaving across one node is pointless */
+                if(numaOnlineNodes(mask, nbits) > 1)
+                {
+                        if(syscall(SYS_mbind, pq->base, len, MPOL_INTERLEAVE,
+                                        mask, nbits + 1, 0))
+                        {
+                                log_debug("mbind(MPOL_INTERLEAVE) failure on "
+                                        "product-queue: %s", strerror(errno));
+                        }
+                        else
+                        {
+                                fSet(pq->mapMode, PQ_MAP_INTERLEAVE);
+                        }
+                }
+        }
+#endif
+
+        (void)len;
+}
+
+
+/**
+ * Adopts the layout of the indexes recorded in the control-header after the
+ * product-queue was resized by `pq_resize()`. Data-products don't move when a
+ * product-queue is resized; consequently, if the product-queue is
+ * memory-mapped in its entirety, then the current mapping is retired rather
+ * than unmapped so that pointers to data-products remain valid.
+ *
+ * @pre               The control-header is in memory but the indexes aren't.
+ * @param[in,out] pq  Product-queue
+ * @retval ENOERR     Success
+ * @return            Return-value of `mm0_map()`. `log_error()` called.
+ */
+static int
+ctl_adoptLayout(pqueue *const pq)
+{
+        const pqctl *const ctlp = pq->ctlp;
+        int status = ENOERR;
+
+        log_assert(pq->ixp == NULL);
+
+        pq->ixo = ctlp->ixo;
+        pq->ixsz = ctlp->ixsz;
+        pq->nalloc = ctlp->nalloc;
+        if(SX_TABLE_MAGIC == ctlp->sx_table_magic)
+                fSet(pq->pflags, PQ_SXTABLE);
+        else
+                fClr(pq->pflags, PQ_SXTABLE);
+
+#ifdef HAVE_MMAP
+        if(pq->base != NULL && pq->ftom == mm0_ftom &&
+                        (size_t)TOTAL_SIZE(pq) > pq->mapsz)
+        {
+                retiredMap *const map = malloc(sizeof(retiredMap));
+
+                if(map == NULL)
+                {
+                        log_syserr("Couldn't allocate retired mapping");
+                        return ENOMEM;
+                }
+                map->base = pq->base;
+                map->size = pq->mapsz;
+
+                pq->base = NULL;
+                status = mm0_map(pq);
+                if(status)
+                {
+                        log_errno(status, "Couldn't map resized product-queue");
+                        pq->base = map->base;
+                        free(map);
+                }
+                else
+                {
+                        map->next = pq->retired;
+                        pq->retired = map;
+                        ctl_adviseMapping(pq);
+                }
+        }
+#endif
+
+        log_debug("Adopted layout: ixo=%ld, ixsz=%zu, nalloc=%zu",
+                (long)pq->ixo, pq->ixsz, pq->nalloc);
+        return status;
+}
+
+
+/**
+ * Writes an index region to the product-queue file.
+ *
+ * @param[in] pq      Product-queue
+ * @param[in] ix      Index region
+ * @param[in] ixsz    Extent of the index region in bytes
+ * @param[in] offset  Offset in the file
+ * @retval    0       Success
+ * @return            `<errno.h>` error-code. `log_error()` called.
+ */
+static int
+ctl_writeIndexes(
+        const pqueue* const restrict pq,
+        const void* const restrict   ix,
+        const size_t                 ixsz,
+        const off_t                  offset)
+{
+        const ssize_t nwrote = pwrite(pq->fd, ix, ixsz, offset);
+
+        if(nwrote == -1)
+        {
+                log_syserr("Couldn't write %zu bytes of indexes at offset %ld",
+                        ixsz, (long)offset);
+                return errno;
+        }
+        if((size_t)nwrote != ixsz)
+        {
+                log_error("Wrote %ld bytes of indexes at offset %ld; expected "
+                        "to write %zu", (long)nwrote, (long)offset, ixsz);
+                return EIO;
+        }
+
+        return ENOERR;
+}
+
+
+/**
+ * Records the layout of resized indexes in the control-header. The indexes
+ * themselves must already be in place.
+ *
+ * @pre               The control-header is write-locked.
+ * @param[in,out] pq  Product-queue
+ * @param[in]     rs  New layout
+ */
+static void
+ctl_setLayout(pqueue *const pq, const pqresize *const rs)
+{
+        pqctl *const ctlp = pq->ctlp;
+
+        ctlp->ixo = rs->ixo;
+        ctlp->ixsz = rs->ixsz;
+        ctlp->nalloc = rs->nalloc;
+        ctlp->sx_table_magic = rs->sxTable ? SX_TABLE_MAGIC : 0;
+        ctlp->mdo = rs->mdo;
+        ctlp->metadata_magic = rs->mdo ? METADATA_MAGIC : 0;
+        if(ctlp->highwater > rs->ixo - pq->datao)
+                ctlp->highwater = rs->ixo - pq->datao;
+        /* The capacity-dependent metrics start over */
+        ctlp->isFull = 0;
+        ctlp->minVirtResTime = TS_NONE;
+        ctlp->mvrtSize = -1;
+        ctlp->mvrtSlots = 0;
+}
+
+
+/**
+ * Indicates if a resize was interrupted while its new indexes were being
+ * copied over the old ones, i.e., if the indexes can't be used until the
+ * resize is finished by `ctl_finishResize()`.
+ */
+static bool
+ctl_isResizing(const pqctl *const ctlp)
+{
+        return RESIZE_MAGIC == ctlp->resize_magic && ctlp->resize.stage != 0;
+}
+
+
+/**
+ * Finishes a resize whose process died while the new indexes were being
+ * copied over the old ones (see `resize_commit()`). The copy is redone from
+ * the staged indexes, which were completely written before the copy began.
+ *
+ * @pre               The control-header is write-locked and the indexes aren't
+ *                    in memory.
+ * @param[in,out] pq  Product-queue
+ * @retval ENOERR     Success. The control-header has the new layout.
+ * @return            `<errno.h>` error-code. `log_error()` called.
+ */
+static int
+ctl_finishResize(pqueue *const pq)
+{
+        pqctl *const    ctlp = pq->ctlp;
+        const pqresize  rs = ctlp->resize;
+        void           *ix;
+        int             status = posix_memalign(&ix, pq->pagesz, rs.ixsz);
+
+        log_assert(pq->ixp == NULL);
+
+        if(status)
+        {
+                log_errno(status, "Couldn't allocate %zu bytes for staged "
+                        "indexes", rs.ixsz);
+                return status;
+        }
+
+        const ssize_t nread = pread(pq->fd, ix, rs.ixsz, rs.stage);
+
+        if(nread == -1)
+        {
+                log_syserr("Couldn't read staged indexes at offset %ld",
+                        (long)rs.stage);
+                status = errno;
+        }
+        else if((size_t)nread != rs.ixsz)
+        {
+                log_error("Read %ld bytes of staged indexes at offset %ld; "
+                        "expected %zu", (long)nread, (long)rs.stage, rs.ixsz);
+                status = PQ_CORRUPT;
+        }
+        else
+        {
+                status = ctl_writeIndexes(pq, ix, rs.ixsz, rs.ixo);
+        }
+        free(ix);
+
+        if(status == ENOERR)
+        {
+                ctl_setLayout(pq, &rs);
+                ctlp->resize.stage = 0;
+                if(ftruncate(pq->fd, rs.stage))
+                        log_warning("Couldn't remove staged indexes from "
+                                "product-queue %s: %s", pq->pathname,
+                                strerror(errno));
+                ctlp->nrecovered++;
+                log_warning("Finished interrupted resize of product-queue %s: "
+                        "slots=%zu", pq->pathname, rs.nalloc);
+        }
+
+        return status;
+}
+
+
+/*
+ * Initialize the on disk state (ctl and indexes) of a
+ * new queue file. Called by pq_create().
+ */
+static int
+ctl_init(pqueue *const pq, size_t const align)
+{
+        int status = ENOERR;
+        void *vp = NULL;
+        size_t nalloc;
+
+        log_assert(pq != NULL);
+        log_assert(pq->pagesz != 0);
+        log_assert(pq->datao > 0);
+        log_assert(pq->datao % pq->pagesz == 0);
+        log_assert(pq->ixo > pq->datao);
+        log_assert(pq->ixo % pq->pagesz == 0);
+        log_assert(pq->ixsz >= pq->pagesz);
+        log_assert(pq->ixsz % pq->pagesz == 0);
+        log_assert(align != 0);
+
+        /*
+         * The following isn't a critical section that's protected by
+         * `pthread_sigmask(SIG_BLOCK,...)` because any error (including EINTR)
+         * unlinks the created file.
+         */
+
+        /*
+         * bring in the pqctl
+         * N.B. No wait. Another lock implies create collision, error
+         */
+        status = (pq->ftom)(pq,
+                         0, (size_t)pq->datao, RGN_WRITE|RGN_NOWAIT, &vp);
+#ifdef HAVE_MMAP
+        if(status == EIO && (pq->ftom == mm_ftom || pq->ftom == mm0_ftom))
+        {
+                log_notice("EIO => remote file system");
+                /* try again */
+                pq->ftom = f_ftom;
+                pq->mtof = f_mtof;
+                status = (pq->ftom)(pq,
+                        0, (size_t)pq->datao, RGN_WRITE|RGN_NOWAIT, &vp);
+        }
+#endif
+        if(status != ENOERR)
+                return status;
+
+        if(fIsSet(pq->pflags, PQ_SEQLOCK) && !ctl_isSeqlockShared(pq))
+        {
+                log_error("Sequence-locked product-queue must be "
+                        "memory-mapped shared");
+                (void)(pq->mtof)(pq, 0, 0);
+                return EINVAL;
+        }
+
+        /* Before the indexes are touched so that they're backed as advised */
+        ctl_adviseMapping(pq);
+
+        pq->ctlp = (pqctl *)vp;
+        pq->ctlp->magic = PQ_MAGIC;
+        pq->ctlp->version = fIsSet(pq->pflags, PQ_COMPRESS)
+                ? PQ_ZVERSION
+                : PQ_VERSION;
+        pq->ctlp->write_count_magic = WRITE_COUNT_MAGIC;
+        pq->ctlp->write_count = 1;              /* this process is writer */
+        pq->ctlp->datao = pq->datao;
+        pq->ctlp->ixo = pq->ixo;
+        pq->ctlp->ixsz = pq->ixsz;
+        pq->ctlp->nalloc = pq->nalloc;
+        pq->ctlp->highwater = 0;
+        pq->ctlp->maxproducts = 0;
+        pq->ctlp->align = align;
+        pq->ctlp->metrics_magic = METRICS_MAGIC;
+        pq->ctlp->mostRecent = TS_NONE;
+        pq->ctlp->minVirtResTime = TS_NONE;
+        pq->ctlp->isFull = 0;
+        pq->ctlp->metrics_magic_2 = METRICS_MAGIC_2;
+        pq->ctlp->mvrtSize = -1;
+        pq->ctlp->mvrtSlots = 0;
+        pq->ctlp->insert_seq_magic = INSERT_SEQ_MAGIC;
+        pq->ctlp->insertSeq = 0;
+        pq->ctlp->feed_ring_magic = FEED_RING_MAGIC;
+        (void)memset(pq->ctlp->feedRing, 0, sizeof(pq->ctlp->feedRing));
+        pq->ctlp->seqlock_magic =
+                fIsSet(pq->pflags, PQ_SEQLOCK) ? SEQLOCK_MAGIC : 0;
+        pq->ctlp->seqlock = 0;
+        pq->ctlp->time_ring_magic =
+                fIsSet(pq->pflags, PQ_TIMERING) ? TIME_RING_MAGIC : 0;
+        pq->ctlp->sx_table_magic =
+                fIsSet(pq->pflags, PQ_SXTABLE) ? SX_TABLE_MAGIC : 0;
+        pq->ctlp->evict_magic = EVICT_MAGIC;
+        pq->ctlp->nevicted = 0;
+        pq->ctlp->nevictedForSlot = 0;
+        pq->ctlp->evictedBytes = 0;
+        pq->ctlp->map_advice_magic = MAP_ADVICE_MAGIC;
+        pq->ctlp->mapAdvice = pq->pflags & (PQ_HUGEPAGES | PQ_INTERLEAVE);
+        pq->ctlp->metadata_magic = 0;   /* set below if there's room */
+        pq->ctlp->mdo = 0;
+        jn_init(pq->ctlp);
+        jn_initPending(pq->ctlp);
+        pq->ctlp->compress_magic =
+                fIsSet(pq->pflags, PQ_COMPRESS) ? COMPRESS_MAGIC : 0;
+        pq->ctlp->nzipped = 0;
+        pq->ctlp->zipRawBytes = 0;
+        pq->ctlp->zipBytes = 0;
+        tm_init(pq->ctlp);
+        rd_init(pq->ctlp);
+        pq->ctlp->shard_magic = SHARD_MAGIC;
+        pq->ctlp->nshards = 1;          /* see pq_createSharded() */
+        pq->ctlp->shard = 0;
+        pq->ctlp->shardSeq = 0;
+
+        /* bring in the indexes */
+        status = (pq->ftom)(pq,
+                         pq->ixo, pq->ixsz, RGN_WRITE|RGN_NOLOCK, &pq->ixp);
+        if(status != ENOERR)
+        {
+                (void)(pq->mtof)(pq, 0, 0);
+                return status;
+        }
+
+        nalloc = pq->nalloc;
+        {
+                md *mdp;
+
+                ix_init(pq->ixp, pq->ixsz, nalloc, align,
+                        fIsSet(pq->pflags, PQ_SXTABLE),
+                        TIME_RING_MAGIC == pq->ctlp->time_ring_magic,
+                        &pq->rlp, &pq->tqp, &pq->fbp, &pq->sxp, &pq->trp,
+                        &mdp);
+                if(mdp != NULL)
+                {
+                        pq->ctlp->mdo = (char *)mdp - (char *)pq->ixp;
+                        pq->ctlp->metadata_magic = METADATA_MAGIC;
+                        ctl_setMdp(pq);
+                }
+        }
+
+        /* add one huge region for data */
+        {
+                off_t  datasz = pq->ixo - pq->datao;
+
+                if (MAX_SIZE_T < datasz) {
+                    log_error("Data portion of file is too big for one region");
+                    return EFBIG;
+                }
+                {
+                    size_t extent0 = (size_t)datasz;
+                    region *rp = rl_add(pq->rlp, pq->datao, extent0);
+
+                    pq->rlp->maxfextent = extent0;
+                    log_assert(rp != NULL
+                            && rp->offset == pq->datao
+                            && rp->extent == extent0);
+                }
+        }
+
+        return status;
+}
+
+/*
+ * Sets the functions to be used to access the product-queue.
+ *
+ * Arguments:
+ *      pq      Pointer to product-queue structure.  The following members
+ *              must be set to their final values: pflags, ixo, ixsz.
+ */
+static void
+ctl_setAccessFunctions(
+    pqueue* const       pq)
+{
+    const int           pflags = pq->pflags;
+
+    log_assert(NULL != pq);
+
+#ifdef HAVE_MMAP
+    if (fIsSet(pflags, PQ_NOMAP)) {
+#endif
+        /*
+         * The product-queue will be accessed via read() and write().
+         */
+        pq->ftom = f_ftom;
+        pq->mtof = f_mtof;
+#ifdef HAVE_MMAP
+    }
+    else {
+        if (fIsSet(pflags, PQ_MAPRGNS) || isProductMappingNecessary(pq)) {
+            /*
+             * The product-queue will be accessed by being memory-mapped
+             * on a region-by-region basis.
+             */
+            pq->ftom = mm_ftom;
+            pq->mtof = mm_mtof;
+        }
+        else
+        {
+            /*
+             * The product-queue will be accessed by being memory-mapped
+             * once, in its entirety.
+             */
+            pq->ftom = mm0_ftom;
+            pq->mtof = mm0_mtof;
+        }
+    }
+#endif
+}
+
+
+/**
+ * Starts reading the indexes of a product-queue into the page-cache in the
+ * background. The page-cache is shared; consequently, the many processes that
+ * open a product-queue at about the same time (e.g., when an LDM is started)
+ * don't each stall faulting-in the indexes page by page. Failure isn't fatal:
+ * it's logged at the debug level.
+ *
+ * @pre           The control-header has been read
+ * @param[in] pq  Product-queue
+ */
+static void
+ctl_prefetchIndexes(const pqueue *const pq)
+{
+#ifdef POSIX_FADV_WILLNEED
+        const int status = posix_fadvise(pq->fd, pq->ixo, (off_t)pq->ixsz,
+                        POSIX_FADV_WILLNEED);
+
+        if(status)
+                log_debug("posix_fadvise(POSIX_FADV_WILLNEED) failure on "
+                        "product-queue indexes: %s", strerror(status));
+#endif
+}
+
+
+/**
+ * Sets the pointers to the indexes of a product-queue and verifies that they
+ * agree with the control-header. Sets or clears `PQ_TIMERING` according to
+ * whether or not the product-queue has a time-ring.
+ *
+ * @pre                    The control-header and indexes are in memory
+ * @param[in,out] pq       Product-queue
+ * @retval     ENOERR      Success
+ * @retval     PQ_CORRUPT  The indexes are inconsistent. log_error() called.
+ */
+static int
+ctl_checkIndexes(pqueue *const pq)
+{
+        if (!ix_ptrs(pq->ixp, pq->ixsz, pq->nalloc, pq->ctlp->align,
+                fIsSet(pq->pflags, PQ_SXTABLE), &pq->rlp, &pq->tqp, &pq->fbp,
+                &pq->sxp)) {
+            return PQ_CORRUPT;
+        }
+
+        if (!(pq->rlp->nalloc == pq->nalloc && pq->tqp->nalloc == pq->nalloc
+                        && pq->sxp->nalloc == pq->nalloc)) { 
+                log_error("pq->rlp->nalloc=%lu, pq->nalloc=%lu, "
+                    "pq->tqp->nalloc=%lu, pq->sxp->nalloc=%lu",
+                    (unsigned long)pq->rlp->nalloc,
+                    (unsigned long)pq->nalloc, 
+                    (unsigned long)pq->tqp->nalloc, 
+                    (unsigned long)pq->sxp->nalloc);
+                return PQ_CORRUPT;
+        }
+
+        ctl_setTrp(pq);
+        if (pq->trp != NULL) {
+                fSet(pq->pflags, PQ_TIMERING);
+        }
+        else {
+                fClr(pq->pflags, PQ_TIMERING);
+        }
+        ctl_setMdp(pq);
+
+        return ENOERR;
+}
+
+
+/*
+ * Initialize the in-memory state of pq from an existing file. Called by
+ * pq_open().  On successful return, the control region (pq->ctlp) will be
+ * mapped and/or locked.
+ *
+ * Arguments:
+ *      pq      Pointer to product-queue structure to be set.
+ *      path    Pathname of product-queue.
+ *
+ * Returns:
+ *      0           Success
+ *      PQ_CORRUPT  The  product-queue is internally inconsistent.
+ *      else        <errno.h> error-code.
+ */
+static int
+ctl_gopen(pqueue *const pq, const char *path)
+{
+        int status = ENOERR;
+        pqctl *ctlp;
+        size_t ctlsz; 
+        void *vp = NULL;
+
+        log_assert(pq != NULL);
+        log_assert(pq->pagesz > 0);
+        log_assert(pq->ixp == NULL && pq->rlp == NULL && pq->tqp == NULL);
+
+        ctlsz = pq->pagesz;
+
+        /*FALLTHROUGH*/
+remap:
+        status = (pq->ftom)(pq, 0, ctlsz, 0, &vp);
+#ifdef HAVE_MMAP
+        if(status == EIO && (pq->ftom == mm_ftom || pq->ftom == mm0_ftom))
+        {
+                log_warning("Product-queue can't be memory-mapped!  "
+                    "Continuing with slower read/write I/O.");
+                /* try again */
+                pq->ftom = f_ftom;
+                pq->mtof = f_mtof;
+                status = (pq->ftom)(pq, 0, ctlsz, 0, &vp);
+        }
+#endif
+        if(status != ENOERR)
+                return status;
+
+        ctlp = (pqctl *)vp;
+        if(ctlp->magic != PQ_MAGIC)
+        {
+                /* Not a product queue */
+                log_error("%s: Not a product queue", path);
+                status = EINVAL;
+                goto unwind_map;
+        }
+        if (PQ_VERSION != ctlp->version && !(PQ_ZVERSION == ctlp->version
+                        && COMPRESS_MAGIC == ctlp->compress_magic))
+        {
+                log_error("%s: Product queue is version %d instead of expected version %d",
+                       path, ctlp->version, PQ_VERSION);
+                status = EINVAL;
+                goto unwind_map;
+        }
+        if(ctlp->datao % pq->pagesz != 0)
+        {
+                /* Can't align */
+                /* TODO: If we use read()/write() not fatal ??? */
+                log_error("%s: Can't align", path);
+                status = EINVAL;
+                goto unwind_map;
+        }
+        if((size_t)ctlp->datao != ctlsz)
+        {
+                /* we guessed wrong, try again */
+                if(ctlsz != pq->pagesz)
+                {
+                        /* don't try more than once */
+                        status = EINVAL;
+                        goto unwind_map;
+                }
+                ctlsz = (size_t)ctlp->datao;
+                (void)(pq->mtof)(pq, 0, 0);
+                goto remap;
+        }
+
+        pq->datao = ctlp->datao;
+        pq->ixo = ctlp->ixo;
+        pq->ixsz = ctlp->ixsz;
+        pq->nalloc = ctlp->nalloc;
+        pq->ctlp = ctlp;
+
+        if (!(pq->datao > 0) ||
+            !(pq->datao % pq->pagesz == 0) ||
+            !(pq->ixo > pq->datao) ||
+            !(pq->ixo % pq->pagesz == 0) ||
+            !(pq->ixsz >= pq->pagesz) ||
+            !(pq->ixsz % pq->pagesz == 0)) {
+
+            log_error("pq->datao=%lu, pq->pagesz=%lu, pq->ixo=%lu, "
+                "pq->ixsz=%lu",
+                (unsigned long)pq->datao, (unsigned long)pq->pagesz, 
+                (unsigned long)pq->ixo, (unsigned long)pq->ixsz);
+            status = PQ_CORRUPT;
+            goto unwind_map;
+        }
+
+        if (ctl_isResizing(ctlp)) {
+                /* A resizing process died while copying the new indexes */
+                if (fIsSet(pq->pflags, PQ_READONLY)) {
+                        log_error("%s: Product-queue must be opened for "
+                                "writing to finish an interrupted resize",
+                                path);
+                        status = PQ_CORRUPT;
+                        goto unwind_map;
+                }
+                (void)(pq->mtof)(pq, 0, 0);
+                pq->ctlp = NULL;
+                status = (pq->ftom)(pq, 0, ctlsz, RGN_WRITE, &vp);
+                if (status != ENOERR)
+                        return status;
+                pq->ctlp = (pqctl *)vp;
+                /* Another process might have finished it in the meantime */
+                if (ctl_isResizing(pq->ctlp))
+                        status = ctl_finishResize(pq);
+                (void)(pq->mtof)(pq, 0, status ? 0 : RGN_MODIFIED);
+                pq->ctlp = NULL;
+                if (status != ENOERR)
+                        return status;
+                goto remap;
+        }
+
+        /*
+         * Reset the product-queue access-functions based on the product-queue's
+         * actual size.
+         */
+        ctl_setAccessFunctions(pq);
+
+        if (fIsSet(pq->pflags, PQ_FASTOPEN)) {
+                /* Validated by the first ctl_get() instead */
+                ctl_prefetchIndexes(pq);
+                fSet(pq->pflags, PQ_IXCHECK);
+        }
+
+        /* bring in the indexes */
+        status = (pq->ftom)(pq, pq->ixo, pq->ixsz, RGN_NOLOCK, &pq->ixp);
+        if(status != ENOERR)
+                goto unwind_map;
+
+        if (SX_TABLE_MAGIC == ctlp->sx_table_magic) {
+                fSet(pq->pflags, PQ_SXTABLE);
+        }
+        else {
+                fClr(pq->pflags, PQ_SXTABLE);
+        }
+
+        if (PQ_ZVERSION == ctlp->version) {
+                fSet(pq->pflags, PQ_COMPRESS);
+        }
+        else {
+                fClr(pq->pflags, PQ_COMPRESS);
+        }
+
+        if (!fIsSet(pq->pflags, PQ_IXCHECK)) {
+                status = ctl_checkIndexes(pq);
+                if (status)
+                        goto unwind_map;
+        }
+        else if (TIME_RING_MAGIC == ctlp->time_ring_magic) {
+                fSet(pq->pflags, PQ_TIMERING);
+        }
+        else {
+                fClr(pq->pflags, PQ_TIMERING);
+        }
+
+        if (SEQLOCK_MAGIC != ctlp->seqlock_magic) {
+                fClr(pq->pflags, PQ_SEQLOCK);
+        }
+        else {
+                if (!fIsSet(pq->pflags, PQ_READONLY) &&
+                                !ctl_isSeqlockShared(pq)) {
+                        log_error("%s: Sequence-locked product-queue must be "
+                                "memory-mapped shared in order to be written",
+                                path);
+                        status = EINVAL;
+                        goto unwind_map;
+                }
+                fSet(pq->pflags, PQ_SEQLOCK);
+        }
+
+        /* Advice requested at creation persists; more may be requested now */
+        if (MAP_ADVICE_MAGIC == ctlp->map_advice_magic) {
+                fSet(pq->pflags,
+                        ctlp->mapAdvice & (PQ_HUGEPAGES | PQ_INTERLEAVE));
+        }
+        ctl_adviseMapping(pq);
+
+        return ENOERR;
+
+unwind_map:
+        (void)(pq->mtof)(pq, 0, 0);
+        return status;
+}
+
+
+/*
+ * An in-use region of a product-queue whose indexes are being rebuilt.
+ */
+typedef struct {
+    off_t  offset;
+    size_t extent;
+    size_t rlix;                ///< Index in the current region list
+    bool   zipped;              ///< Product's data is compressed
+    bool   hasTime;             ///< Added to the new time-queue
+    bool   hasSig;              ///< Added to the new signature index
+} ix_rgn;
+
+static int
+ix_cmpRgn(
+        const void* const a,
+        const void* const b)
+{
+    const off_t x = ((const ix_rgn*)a)->offset;
+    const off_t y = ((const ix_rgn*)b)->offset;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Returns the in-use region at a given offset.
+ *
+ * @param[in] rgns    In-use regions sorted by offset
+ * @param[in] nrgns   Number of regions
+ * @param[in] offset  Offset of the region
+ * @retval    NULL    No such region
+ * @return            The region
+ */
+static ix_rgn*
+ix_findRgn(
+        ix_rgn* const rgns,
+        const size_t  nrgns,
+        const off_t   offset)
+{
+    const ix_rgn key = {offset};
+
+    return bsearch(&key, rgns, nrgns, sizeof(ix_rgn), ix_cmpRgn);
+}
+
+/**
+ * Builds new indexes for a product-queue from its current ones. The
+ * data-products keep their offsets, insertion-times, and signatures. Regions
+ * that are in use but aren't in the time-queue (i.e., that are reserved by
+ * `pqe_new()`) are kept. The free regions are the gaps between the in-use
+ * ones.
+ *
+ * Only the array of regions, the array of signatures, and the lowest level of
+ * the time-queue's skip-list are read. Each of these is changed by single
+ * stores; consequently, the current indexes needn't be otherwise consistent
+ * (see `ctl_recover()`).
+ *
+ * @pre                    The control-header is write-locked. If the
+ *                         product-queue is being resized, then
+ *                         `resize_evict()` was successful.
+ * @param[in]  pq          Product-queue
+ * @param[out] ix          New index region. Shall be page-aligned and zeroed.
+ * @param[in]  ixsz        Extent of the new index region in bytes
+ * @param[in]  ixo         Offset to the new indexes
+ * @param[in]  nalloc      New number of slots
+ * @param[in]  sxTable     Whether the new signature index is an
+ *                         open-addressing table
+ * @param[in]  omit        Offset of a region to omit or OFF_NONE
+ * @param[out] mdo         Offset to the new metadata sidecar from `ix` or 0 if
+ *                         there isn't one
+ * @retval     0           Success
+ * @retval     ENOMEM      Out of memory or slots. `log_error()` called.
+ * @retval     PQ_CORRUPT  The product-queue is corrupt. `log_error()` called.
+ */
+static int
+ix_rebuild(
+        pqueue* const restrict pq,
+        void* const restrict   ix,
+        const size_t           ixsz,
+        const off_t            ixo,
+        const size_t           nalloc,
+        const bool             sxTable,
+        const off_t            omit,
+        size_t* const restrict mdo)
+{
+    const regionl* const old = pq->rlp;
+    const size_t         nslots = old->nalloc + RL_FREE_OVERHEAD;
+    size_t               nrgns = 0;
+
+    for (size_t rlix = RL_EMPTY_HD; rlix < nslots; rlix++) {
+        const region* const rep = old->rp + rlix;
+
+        if (rep->offset != OFF_NONE && IsAlloc(rep) && rep->offset != omit)
+            nrgns++;
+    }
+
+    ix_rgn* const rgns = malloc((nrgns ? nrgns : 1) * sizeof(ix_rgn));
+
+    if (rgns == NULL) {
+        log_syserr("Couldn't allocate %zu regions", nrgns);
+        return ENOMEM;
+    }
+
+    nrgns = 0;
+    for (size_t rlix = RL_EMPTY_HD; rlix < nslots; rlix++) {
+        const region* const rep = old->rp + rlix;
+
+        if (rep->offset != OFF_NONE && IsAlloc(rep) && rep->offset != omit) {
+            rgns[nrgns].offset = rep->offset;
+            rgns[nrgns].extent = Extent(rep);
+            rgns[nrgns].rlix = rlix;
+            rgns[nrgns].zipped = IsZip(rep);
+            rgns[nrgns].hasTime = false;
+            rgns[nrgns++].hasSig = false;
+        }
+    }
+    qsort(rgns, nrgns, sizeof(ix_rgn), ix_cmpRgn);
+
+    regionl* rl;
+    tqueue*  tq;
+    fb*      fbp;
+    sx*      sxp;
+    tr*      trp;
+    md*      mdp;
+    int      status = 0;
+
+    ix_init(ix, ixsz, nalloc, pq->ctlp->align, sxTable, pq->trp != NULL,
+            &rl, &tq, &fbp, &sxp, &trp, &mdp);
+    *mdo = mdp ? (size_t)((char*)mdp - (char*)ix) : 0;
+
+    // In-use regions and the free regions between them
+    off_t end = pq->datao;
+
+    for (size_t i = 0; status == 0 && i <= nrgns; i++) {
+        const off_t offset = i < nrgns ? rgns[i].offset : ixo;
+
+        if (offset < end) {
+            log_error("Overlapping regions at offset %ld", (long)offset);
+            status = PQ_CORRUPT;
+        }
+        else if (offset > end) {
+            const size_t extent = (size_t)(offset - end);
+
+            if (rl_add(rl, end, extent) == NULL) {
+                status = ENOMEM;
+            }
+            else if (extent > rl->maxfextent) {
+                rl->maxfextent = extent;
+            }
+        }
+        if (status == 0 && i < nrgns) {
+            const size_t rlix = rl_addAlloc(rl, rgns[i].offset,
+                    rgns[i].extent);
+
+            if (rlix == RL_NONE) {
+                log_error("Need more than %zu product slots", nalloc);
+                status = ENOMEM;
+            }
+            else {
+                if (rgns[i].zipped)
+                    set_IsZip(rl->rp + rlix);
+                if (mdp && pq->mdp)
+                    mdp->recs[rlix] = pq->mdp->recs[rgns[i].rlix];
+                end = rgns[i].offset + (off_t)rgns[i].extent;
+            }
+        }
+    }
+
+    /*
+     * Time entries in order of insertion so that the time-ring appends. The
+     * walk is bounded and range-checked like that of `tqe_find()`.
+     */
+    const tqueue* const otq = pq->tqp;
+    const fb* const     ofb = (const fb*)((const char*)otq + otq->fbp_off);
+    const tqep_t        qend = (tqep_t)(otq->nalloc + TQ_OVERHEAD_ELEMS);
+    const tqelem*       tqep = otq->tqep + TQ_HEAD;
+
+    for (size_t nsteps = 0; status == 0; nsteps++) {
+        const tqep_t q = tqep->fblk < ofb->arena_sz
+                ? (tqep_t)ofb->fblks[tqep->fblk]
+                : -1;
+
+        if (q == TQ_NIL)
+            break;
+        if (q <= TQ_HEAD || q >= qend || nsteps >= otq->nalloc) {
+            log_error("Time-queue is broken after %zu entries", nsteps);
+            status = PQ_CORRUPT;
+            break;
+        }
+        tqep = otq->tqep + q;
+
+        ix_rgn* const rgn = ix_findRgn(rgns, nrgns, tqep->offset);
+
+        if (rgn != NULL && !rgn->hasTime) {
+            timestampt tv;
+
+            status = tq_add(tq, tqep->offset, &tqep->tv, &tv);
+            if (status) {
+                log_error("tq_add() failure");
+            }
+            else {
+                if (trp != NULL)
+                    tr_add(trp, &tv, tqep->offset);
+                rgn->hasTime = true;
+            }
+        }
+    }
+
+    // Signatures, including those of reserved regions
+    for (size_t i = 0; status == 0 && i < pq->sxp->nalloc; i++) {
+        const sxelem* const sxep = pq->sxp->sxep + i;
+
+        if (sxep->offset != OFF_NONE) {
+            ix_rgn* const rgn = ix_findRgn(rgns, nrgns, sxep->offset);
+
+            if (rgn != NULL && !rgn->hasSig) {
+                if (sx_add(sxp, sxep->sxi, sxep->offset) == NULL) {
+                    status = ENOMEM;
+                }
+                else {
+                    rgn->hasSig = true;
+                }
+            }
+        }
+    }
+
+    free(rgns);
+
+    return status;
+}
+
+
+/**
+ * Recovers from the death of a writer in the middle of an index-modification
+ * (see `jn_begin()`) or while it held a pending reservation (see
+ * `jn_openReserve()`). The indexes are rebuilt without the affected
+ * data-product: a reservation or insertion is rolled back and a deletion is
+ * completed.
+ *
+ * @pre                    The control-header is write-locked and the indexes
+ *                         are in memory
+ * @param[in,out] pq       Product-queue
+ * @param[in,out] jnp      The journal or a pending reservation of the
+ *                         control-header. Cleared on success.
+ * @retval     0           Success
+ * @retval     ENOMEM      Out of memory. `log_error()` called.
+ * @retval     PQ_CORRUPT  The indexes can't be rebuilt. `log_error()` called.
+ */
+static int
+ctl_recover(pqueue *const pq, pqjournal *const jnp)
+{
+        static const char *const ops[] = {"", "reserving", "inserting",
+                "deleting"};
+        pqctl *const    ctlp = pq->ctlp;
+        const pqjournal jn = *jnp;
+        void           *ix;
+        size_t          mdo;
+        int             status = posix_memalign(&ix, pq->pagesz, pq->ixsz);
+
+        if(status)
+        {
+                log_errno(status, "Couldn't allocate %zu bytes for rebuilding "
+                        "the indexes", pq->ixsz);
+                return ENOMEM;
+        }
+        (void)memset(ix, 0, pq->ixsz);
+
+        status = ix_rebuild(pq, ix, pq->ixsz, pq->ixo, pq->nalloc,
+                fIsSet(pq->pflags, PQ_SXTABLE), jn.offset, &mdo);
+        if(status == ENOERR)
+        {
+                /* Same layout; consequently, the index pointers are unchanged */
+                (void)memcpy(pq->ixp, ix, pq->ixsz);
+                jnp->op = JN_NONE;
+                jnp->offset = OFF_NONE;
+                ctlp->nrecovered++;
+                log_warning("Recovered product-queue: process %ld died while "
+                        "%s a data-product (offset %ld)", (long)jn.pid,
+                        (jn.op > 0 && jn.op < 4) ? ops[jn.op] : "modifying",
+                        (long)jn.offset);
+        }
+        free(ix);
+
+        return status;
+}
+
+
+/**
+ * Rolls back the pending reservations of writers that died before their
+ * data-products were added to the time-queue (see `jn_openReserve()`).
+ *
+ * @pre                    The control-header is write-locked and the indexes
+ *                         are in memory
+ * @param[in,out] pq       Product-queue
+ * @retval     0           Success
+ * @return                 Error-code of `ctl_recover()`
+ */
+static int
+ctl_recoverPending(pqueue *const pq)
+{
+        pqctl *const ctlp = pq->ctlp;
+        const pid_t  self = getpid();
+        int          status = ENOERR;
+
+        for(int i = 0; status == ENOERR && ctlp->npending &&
+                        i < PQ_MAX_PENDING; i++)
+        {
+                pqjournal *const jn = ctlp->pending + i;
+
+                if(jn->op != JN_NONE && jn->pid != self &&
+                                kill(jn->pid, 0) == -1 && errno == ESRCH)
+                {
+                        status = ctl_recover(pq, jn);
+                        if(status == ENOERR)
+                                ctlp->npending--;
+                }
+        }
+
+        return status;
+}
+
+
+/**
+ * Get/lock the ctl for access by this process
+ *
+ * @param[in] rflags  Region flags: bitwise OR of
+ *                    - RGN_NOLOCK  Don't lock region; locking handled elsewhere
+ *                    - RGN_WRITE   Region will be modified
+ *                    - RGN_NOWAIT  Return immediately if can't lock, else wait
+ * @retval ENOERR     Success.
+ * @retval EACCESS or EAGAIN
+ *                    The region is already locked by another process.
+ * @retval EINVAL     The product-queue file doesn't support locking.
+ * @retval ENOLCK     The number of locked regions would exceed a system-imposed
+ *                    limit.
+ * @retval EDEADLK    A deadlock in region locking has been detected.
+ * @retval EBADF      The file descriptor of the product-queue is invalid.
+ * @retval EIO        An I/O error occurred while reading from the file system.
+ * @retval EOVERFLOW  The file size in bytes or the number of blocks allocated
+ *                    to the file or the file serial number cannot be
+ *                    represented correctly.
+ * @retval EINTR      A signal was caught during execution.
+ * @retval EFBIG or EINVAL
+ *                    The size of the product-queue is greater than the maximum
+ *                    file size.
+ * @retval EROFS      The named file resides on a read-only file system.
+ * @retval EAGAIN     The mapping could not be locked in memory, if required by
+ *                    mlockall(), due to a lack of resources.
+ * @retval EINVAL     The product-queue object wants to map the product-queue to
+ *                    a fixed memory location that is not a multiple of the page
+ *                    size as returned by sysconf(), or is considered invalid
+ *                    by the O/S.
+ * @retval EMFILE     The number of mapped regions would exceed an O/S-dependent
+ *                    limit (per process or per system).
+ * @retval ENODEV     The file descriptor of the product-queue object refers to
+ *                    a file whose type is not supported by mmap().
+ * @retval ENOMEM     The size of the product-queue exceeds that allowed for the
+ *                    address space of a process.
+ * @retval ENOMEM     The mapping could not be locked in memory, if required by
+ *                    mlockall(), because it would require more space than the
+ *                    system is able to supply.
+ * @retval ENOTSUP    The O/S does not support the combination of accesses
+ *                    requested.
+ * @retval ENXIO      The size of the product-queue is invalid for the object
+ *                    specified by its file descriptor.
+ * @retval EAGAIN     `RGN_NOLOCK` was specified and the product-queue was
+ *                    resized by another process. The control-header was
+ *                    released. Try again with a lock.
+ */
+static int
+ctl_get(pqueue *const pq, int const rflags)
+{
+        int status = ENOERR;
+
+#if _NOMAP || !defined(HAVE_MMAP)
+        log_assert(pq->mtof == f_mtof);
+        log_assert(pq->ctlp == NULL);
+        log_assert(pq->ixp == NULL);
+#endif
+
+        if(fIsSet(rflags, RGN_WRITE) && !fIsSet(pq->pflags, PQ_SIGSBLOCKED))
+        {
+                /* We are beginning a critical section */
+                sigset_t set;
+
+                (void) sigfillset(&set);
+                (void) sigdelset(&set, SIGABRT);
+                (void) sigdelset(&set, SIGFPE);
+                (void) sigdelset(&set, SIGILL);
+                (void) sigdelset(&set, SIGSEGV);
+                (void) sigdelset(&set, SIGBUS);
+                status = pthread_sigmask(SIG_BLOCK, &set, &pq->sav_set);
+                log_assert(0 == status);
+                fSet(pq->pflags, PQ_SIGSBLOCKED);
+        }
+        if(pq->ctlp == NULL)
+        {
+                /* bring in the pqctl */
+                struct timespec start;
+
+                if(fIsSet(rflags, RGN_WRITE))
+                        (void)clock_gettime(CLOCK_MONOTONIC, &start);
+                status = (pq->ftom)(pq,
+                                 0, (size_t)pq->datao, rflags,
+                                (void **)&pq->ctlp);
+                if(status != ENOERR)
+                        goto unwind_mask;
+                if(fIsSet(rflags, RGN_WRITE))
+                        tm_lockWait(pq->ctlp, &start);
+        }
+        log_assert(pq->ctlp->magic == PQ_MAGIC);
+        log_assert(PQ_VERSION == pq->ctlp->version ||
+                PQ_ZVERSION == pq->ctlp->version);
+        log_assert(pq->ctlp->datao == pq->datao);
+
+        if(pq->ixp == NULL && ctl_isResizing(pq->ctlp))
+        {
+                /* A resizing process died while copying the new indexes */
+                if(fIsSet(rflags, RGN_NOLOCK))
+                {
+                        log_assert(!fIsSet(rflags, RGN_WRITE));
+                        (void) (pq->mtof)(pq, 0, RGN_NOLOCK);
+                        pq->ctlp = NULL;
+                        return EAGAIN;
+                }
+                if(!fIsSet(rflags, RGN_WRITE))
+                {
+                        /* Finish the resize under a write-lock and retry */
+                        (void) (pq->mtof)(pq, 0, 0);
+                        pq->ctlp = NULL;
+                        if(fIsSet(pq->pflags, PQ_READONLY))
+                        {
+                                log_error("Product-queue %s must be opened "
+                                        "for writing to finish an interrupted "
+                                        "resize", pq->pathname);
+                                return PQ_CORRUPT;
+                        }
+                        status = ctl_get(pq, RGN_WRITE);
+                        if(status != ENOERR)
+                                return status;
+                        (void) ctl_rel(pq, RGN_MODIFIED);
+                        return ctl_get(pq, rflags);
+                }
+                status = ctl_finishResize(pq);
+                if(status != ENOERR)
+                        goto unwind_ctl;
+        }
+
+        if(pq->ixp == NULL && (pq->ctlp->ixo != pq->ixo ||
+                        pq->ctlp->ixsz != pq->ixsz ||
+                        pq->ctlp->nalloc != pq->nalloc))
+        {
+                /* The product-queue was resized (see `pq_resize()`) */
+                if(fIsSet(rflags, RGN_NOLOCK))
+                {
+                        /* The layout might be changing: lock and try again */
+                        log_assert(!fIsSet(rflags, RGN_WRITE));
+                        (void) (pq->mtof)(pq, 0, RGN_NOLOCK);
+                        pq->ctlp = NULL;
+                        return EAGAIN;
+                }
+                status = ctl_adoptLayout(pq);
+                if(status != ENOERR)
+                        goto unwind_ctl;
+        }
+        log_assert(pq->ctlp->ixo == pq->ixo);
+        log_assert(pq->ctlp->ixsz == pq->ixsz);
+
+        if(pq->ixp == NULL)
+        {
+                /* bring in the indexes */
+                status = (pq->ftom)(pq,
+                                 pq->ixo, pq->ctlp->ixsz, rflags|RGN_NOLOCK,
+                                &pq->ixp);
+                if(status != ENOERR)
+                        goto unwind_ctl;
+        }
+
+        if(fIsSet(pq->pflags, PQ_IXCHECK))
+        {
+                /* Deferred by `PQ_FASTOPEN` */
+                status = ctl_checkIndexes(pq);
+                if(status != ENOERR)
+                {
+                        (void) ctl_rel(pq, rflags & RGN_NOLOCK);
+                        return status;
+                }
+                fClr(pq->pflags, PQ_IXCHECK);
+        }
+        else
+        {
+                ix_ptrs(pq->ixp, pq->ixsz, pq->nalloc, pq->ctlp->align,
+                    fIsSet(pq->pflags, PQ_SXTABLE), &pq->rlp, &pq->tqp,
+                    &pq->fbp, &pq->sxp);
+                log_assert(pq->rlp->nalloc == pq->nalloc &&
+                        pq->tqp->nalloc == pq->nalloc &&
+                        pq->sxp->nalloc == pq->nalloc);
+                ctl_setTrp(pq);
+                ctl_setMdp(pq);
+        }
+
+        if(fIsSet(rflags, RGN_WRITE) && fIsSet(pq->pflags, PQ_SEQLOCK)
+                        && !fIsSet(pq->pflags, PQ_SEQWRITE))
+        {
+                /*
+                 * Begin write-side of sequence-lock. The value is made odd
+                 * even if a previous writer died while it was odd.
+                 */
+                pq->ctlp->seqlock = (pq->ctlp->seqlock + 1) | 1;
+                __sync_synchronize();
+                fSet(pq->pflags, PQ_SEQWRITE);
+        }
+
+        if(fIsSet(rflags, RGN_WRITE) && !fIsSet(pq->pflags, PQ_NOLOCK) &&
+                        JOURNAL_MAGIC == pq->ctlp->journal_magic &&
+                        pq->ctlp->journal.op != JN_NONE)
+        {
+                /* The previous writer died while modifying the indexes */
+                status = ctl_recover(pq, &pq->ctlp->journal);
+                if(status != ENOERR)
+                {
+                        log_error("Couldn't recover product-queue");
+                        (void) ctl_rel(pq, 0);
+                        return status;
+                }
+        }
+
+        if(fIsSet(rflags, RGN_WRITE) && !fIsSet(pq->pflags, PQ_NOLOCK) &&
+                        PENDING_MAGIC == pq->ctlp->pending_magic &&
+                        pq->ctlp->npending && pq->pendingCheck != time(NULL))
+        {
+                /*
+                 * A writer might have died before committing a reservation.
+                 * Checking costs a system-call per reservation; so, it's done
+                 * at most once a second.
+                 */
+                pq->pendingCheck = time(NULL);
+                status = ctl_recoverPending(pq);
+                if(status != ENOERR)
+                {
+                        log_error("Couldn't recover product-queue");
+                        (void) ctl_rel(pq, 0);
+                        return status;
+                }
+        }
+
+        return ENOERR;
+unwind_ctl:
+        (void) (pq->mtof)(pq, 0, 0);
+        pq->ctlp = NULL;
+unwind_mask:
+        {
+            sigset_t set = pq->sav_set;
+
+            (void) sigemptyset(&pq->sav_set);
+            fClr(pq->pflags, PQ_SIGSBLOCKED);
+            (void) pthread_sigmask(SIG_SETMASK, &set, NULL);
+        }
+        return status;
+}
+
+
+/**
+ * Gets the control-header for reading. If the product-queue is sequence-locked
+ * (see `PQ_SEQLOCK`) and entirely memory-mapped and no writer has it, then the
+ * control-header isn't locked and anything read via it must be validated by
+ * `ctl_readValid()` before it's used; otherwise, the control-header is
+ * read-locked. Release the control-header with `ctl_rel(pq, 0)`.
+ *
+ * @param[in,out] pq    Product-queue
+ * @param[in]     lock  Whether to read-lock the control-header regardless
+ * @param[out]    seq   Value of the sequence-lock for `ctl_readValid()`
+ * @return              Return-value of `ctl_get()`
+ */
+static int
+ctl_getRead(pqueue *const pq, const bool lock, uint32_t *const seq)
+{
+        *seq = 0;
+
+#ifdef HAVE_MMAP
+        if(!lock && fIsSet(pq->pflags, PQ_SEQLOCK) && pq->ftom == mm0_ftom)
+        {
+                log_assert(pq->ctlp == NULL);
+
+                int status = ctl_get(pq, RGN_NOLOCK);
+                if(status == EAGAIN)
+                        return ctl_get(pq, 0); /* product-queue was resized */
+                if(status != ENOERR)
+                        return status;
+                fSet(pq->pflags, PQ_SEQREAD);
+
+                *seq = *(volatile uint32_t *)&pq->ctlp->seqlock;
+                __sync_synchronize();
+                if((*seq & 1) == 0)
+                        return ENOERR;
+
+                /* a writer has the control-header: wait for it */
+                (void)ctl_rel(pq, 0);
+        }
+#endif
+
+        return ctl_get(pq, 0);
+}
+
+
+/**
+ * Indicates if what was read via a control-header obtained by `ctl_getRead()`
+ * is consistent, i.e., no writer has had the control-header since then.
+ *
+ * @param[in] pq   Product-queue
+ * @param[in] seq  Sequence-lock value returned by `ctl_getRead()`
+ * @retval true    Consistent
+ * @retval false   Inconsistent. Release the control-header and try again.
+ */
+static bool
+ctl_readValid(pqueue *const pq, const uint32_t seq)
+{
+        if(!fIsSet(pq->pflags, PQ_SEQREAD))
+                return true;    /* control-header is read-locked */
+
+        __sync_synchronize();
+        return *(volatile uint32_t *)&pq->ctlp->seqlock == seq;
+}
+
+/******************************************************************************
+ * Sharded Product-Queue Functions:
+ *
+ * A sharded product-queue consists of several ordinary product-queue files,
+ * each with its own control-header, indexes, and lock, so that writers of
+ * different data-products don't contend for the same lock. The first shard is
+ * the file whose pathname is given to pq_createSharded() and pq_open(); shard
+ * `i` is the file whose pathname is that of the first with ".<i>" appended.
+ * A data-product's shard is chosen by its signature. The instance of the first
+ * shard is the one returned to the caller: it dispatches insertions and
+ * lookups by signature to the other shards and merges their time-queues for
+ * pq_sequence() and pq_next().
+ ******************************************************************************/
+
+/*
+ * Bits of a data-product's offset that identify its shard in the offsets
+ * returned by pq_sequenceLock() and pq_next() (see pq_release())
+ */
+#define SH_SHIFT        48
+
+/*
+ * Initializes the shard-information of the control-header of an unsharded
+ * product-queue.
+ */
+static void
+sh_init(pqctl *const ctlp)
+{
+        ctlp->shard_magic = SHARD_MAGIC;
+        ctlp->nshards = 1;
+        ctlp->shard = 0;
+        ctlp->shardSeq = 0;
+}
+
+/*
+ * Returns the index of the shard of a data-product. Signature bytes that
+ * aren't used by the signature-index are hashed so that each shard's index
+ * remains evenly populated.
+ */
+static unsigned
+sh_index(const pqueue *const pq, const signaturet sig)
+{
+        const uint32_t hash = ((uint32_t)sig[12] << 24) |
+                ((uint32_t)sig[13] << 16) | ((uint32_t)sig[14] << 8) | sig[15];
+
+        return hash % pq->nshards;
+}
+
+/*
+ * Returns the shard of a data-product: the given instance if the product-queue
+ * isn't sharded or the product belongs to the first shard.
+ */
+static pqueue*
+sh_shard(pqueue *const pq, const signaturet sig)
+{
+        return pq->shards == NULL
+                ? pq
+                : pq->shards[sh_index(pq, sig)];
+}
+
+/*
+ * Returns the offset of a data-product in a shard as seen by the caller of the
+ * first shard.
+ */
+static off_t
+sh_encode(const pqueue *const pq, const off_t offset)
+{
+        return offset | ((off_t)pq->shIndex << SH_SHIFT);
+}
+
+/*
+ * Moves the cursor of the first shard to that of the shard that last found a
+ * data-product.
+ */
+static void
+sh_adopt(pqueue *const pq, const pqueue *const shard)
+{
+        pq_cset(pq, &shard->cursor);
+        pq->shCursor = shard->shIndex;
+        pq->shTie = true;
+}
+
+/**
+ * Notifies the readers of a sharded product-queue of an insertion into one of
+ * its shards (see pq_waitForNewer()).
+ *
+ * @param[in] pq        Shard into which a data-product was inserted
+ * @param[in] feedtype  Feedtype of the data-product or `ANY` if unknown
+ */
+static void
+sh_notify(pqueue *const pq, const feedtypet feedtype)
+{
+        const pqueue *const first = pq->shFirst;
+
+        if(first == NULL || first->shMap == NULL)
+                return;
+
+        volatile pqctl *const ctlp = first->shMap;
+
+        (void)__sync_add_and_fetch(&ctlp->shardSeq, 1);
+#if defined(__linux__) && defined(SYS_futex) && defined(FUTEX_WAKE_BITSET)
+        (void)syscall(SYS_futex, &ctlp->shardSeq, FUTEX_WAKE_BITSET, INT_MAX,
+                NULL, NULL, feedtype ? feedtype : FUTEX_BITSET_MATCH_ANY);
+#endif
+}
+
+/**
+ * Returns the shard-information of a product-queue.
+ *
+ * @param[in]  pq       Product-queue
+ * @param[out] nshards  Number of shards of the product-queue
+ * @param[out] shard    Index of the product-queue's shard
+ * @retval     0        Success. `*nshards` and `*shard` are set.
+ * @return              `<errno.h>` error-code of `ctl_get()`. `log_add()`
+ *                      called.
+ */
+static int
+sh_get(pqueue *const pq, unsigned *const nshards, unsigned *const shard)
+{
+        int status = ctl_get(pq, 0);
+
+        if(status)
+        {
+                log_add_errno(status, "Couldn't get control-header of "
+                        "product-queue %s", pq->pathname);
+                return status;
+        }
+
+        if(SHARD_MAGIC == pq->ctlp->shard_magic)
+        {
+                *nshards = pq->ctlp->nshards;
+                *shard = pq->ctlp->shard;
+        }
+        else
+        {
+                *nshards = 1;
+                *shard = 0;
+        }
+
+        return ctl_rel(pq, 0);
+}
+
+/**
+ * Sets the shard-information of a newly-created product-queue.
+ *
+ * @param[in,out] pq       Product-queue
+ * @param[in]     nshards  Number of shards
+ * @param[in]     shard    Index of the product-queue's shard
+ * @retval        0        Success
+ * @return                 `<errno.h>` error-code. `log_add()` called.
+ */
+static int
+sh_set(pqueue *const pq, const unsigned nshards, const unsigned shard)
+{
+        int status = ctl_get(pq, RGN_WRITE);
+
+        if(status)
+        {
+                log_add_errno(status, "Couldn't write-lock control-header of "
+                        "product-queue %s", pq->pathname);
+                return status;
+        }
+
+        pq->ctlp->nshards = nshards;
+        pq->ctlp->shard = shard;
+
+        return ctl_rel(pq, RGN_MODIFIED);
+}
+
+/*
+ * Sets the pathname of a shard of a product-queue.
+ */
+static void
+sh_path(const char *const path, const unsigned shard, char buf[PATH_MAX])
+{
+        (void)snprintf(buf, PATH_MAX, "%s.%u", path, shard);
+}
+
+/**
+ * Makes the instance of the first shard of a product-queue the one that
+ * represents all the shards. The other shards aren't opened.
+ *
+ * @param[in,out] pq       First shard of the product-queue
+ * @param[in]     nshards  Number of shards
+ * @retval        0        Success
+ * @return                 `<errno.h>` error-code. `log_add()` called.
+ */
+static int
+sh_attach(pqueue *const pq, const unsigned nshards)
+{
+        pq->shards = calloc(nshards, sizeof(pqueue*));
+        if(pq->shards == NULL)
+        {
+                log_add_syserr("Couldn't allocate %u shards", nshards);
+                return errno;
+        }
+        pq->shards[0] = pq;
+        pq->nshards = nshards;
+        pq->shFirst = pq;
+
+#ifdef HAVE_MMAP
+        if(!fIsSet(pq->pflags, PQ_READONLY))
+        {
+                void *const vp = mmap(NULL, pq->pagesz, PROT_READ|PROT_WRITE,
+                                MAP_SHARED, pq->fd, 0);
+
+                if(vp == MAP_FAILED)
+                {
+                        log_add_syserr("Couldn't map control-header of "
+                                "product-queue %s", pq->pathname);
+                        return errno;
+                }
+                pq->shMap = vp;
+        }
+#endif
+
+        return 0;
+}
+
+/*
+ * Closes the other shards of a product-queue, if any.
+ */
+static int
+sh_close(pqueue *const pq)
+{
+        int status = 0;
+
+        if(pq->shards == NULL)
+                return 0;
+
+        for(unsigned i = 1; i < pq->nshards; i++)
+        {
+                if(pq->shards[i] != NULL)
+                {
+                        const int stat = pq_close(pq->shards[i]);
+
+                        if(status == 0)
+                                status = stat;
+                }
+        }
+        free(pq->shards);
+        pq->shards = NULL;
+        pq->nshards = 0;
+#ifdef HAVE_MMAP
+        if(pq->shMap != NULL)
+        {
+                (void)munmap(pq->shMap, pq->pagesz);
+                pq->shMap = NULL;
+        }
+#endif
+
+        return status;
+}
+
+/**
+ * Opens the other shards of a product-queue if it's the first shard of a
+ * sharded product-queue.
+ *
+ * @param[in,out] pq      Product-queue
+ * @param[in]     path    Pathname of the product-queue
+ * @param[in]     pflags  Flags with which the product-queue was opened
+ * @retval        0       Success
+ * @retval        EINVAL  The product-queue isn't the first shard or a shard
+ *                        doesn't belong to it. `log_add()` called.
+ * @return                `<errno.h>` error-code. `log_add()` called.
+ */
+static int
+sh_open(pqueue *const pq, const char *const path, const int pflags)
+{
+        unsigned nshards, shard;
+
+        if(fIsSet(pflags, PQ_SHARD))
+                return 0;
+
+        int status = sh_get(pq, &nshards, &shard);
+
+        if(status || nshards <= 1)
+                return status;
+
+        if(shard != 0)
+        {
+                log_add("Product-queue %s is shard %u of %u: open the first "
+                        "shard instead", path, shard, nshards);
+                return EINVAL;
+        }
+
+        status = sh_attach(pq, nshards);
+
+        for(unsigned i = 1; status == 0 && i < nshards; i++)
+        {
+                char     shardPath[PATH_MAX];
+                unsigned n, index;
+
+                sh_path(path, i, shardPath);
+                status = pq_open(shardPath, pflags | PQ_SHARD,
+                                pq->shards + i);
+                if(status)
+                {
+                        log_add_errno(status, "Couldn't open shard %s",
+                                shardPath);
+                        break;
+                }
+                pq->shards[i]->shIndex = i;
+                pq->shards[i]->shFirst = pq;
+
+                status = sh_get(pq->shards[i], &n, &index);
+                if(status == 0 && (n != nshards || index != i))
+                {
+                        log_add("Product-queue %s is shard %u of %u rather "
+                                "than shard %u of %u", shardPath, index, n,
+                                i, nshards);
+                        status = EINVAL;
+                }
+        }
+
+        return status;
+}
+
+int
+pq_createSharded(
+        const char* const path,
+        const mode_t      mode,
+        const int         pflags,
+        const size_t      align,
+        const off_t       initialsz,
+        const size_t      nproducts,
+        const unsigned    nshards,
+        pqueue** const    pqp)
+{
+        if(nshards == 0 || nshards > PQ_MAX_SHARDS)
+        {
+                log_add("Invalid number of shards: %u", nshards);
+                return EINVAL;
+        }
+        if(nshards == 1)
+                return pq_create(path, mode, pflags, align, initialsz,
+                                nproducts, pqp);
+
+        const off_t  shardSize = initialsz / nshards;
+        const size_t shardSlots = (nproducts + nshards - 1) / nshards;
+        pqueue*      pq;
+        int          status = pq_create(path, mode, pflags, align, shardSize,
+                        shardSlots, &pq);
+
+        if(status)
+        {
+                log_add_errno(status, "Couldn't create first shard %s", path);
+                return status;
+        }
+
+        status = sh_set(pq, nshards, 0);
+        if(status == 0)
+                status = sh_attach(pq, nshards);
+
+        for(unsigned i = 1; status == 0 && i < nshards; i++)
+        {
+                char shardPath[PATH_MAX];
+
+                sh_path(path, i, shardPath);
+                status = pq_create(shardPath, mode, pflags, align, shardSize,
+                                shardSlots, pq->shards + i);
+                if(status)
+                {
+                        log_add_errno(status, "Couldn't create shard %s",
+                                shardPath);
+                        break;
+                }
+                pq->shards[i]->shIndex = i;
+                pq->shards[i]->shFirst = pq;
+                status = sh_set(pq->shards[i], nshards, i);
+        }
+
+        if(status)
+        {
+                /* Only the files that were created are removed */
+                unsigned ncreated = 1;
+
+                while(pq->shards && ncreated < nshards &&
+                                pq->shards[ncreated] != NULL)
+                        ncreated++;
+
+                (void)pq_close(pq);
+                (void)unlink(path);
+                for(unsigned i = 1; i < ncreated; i++)
+                {
+                        char shardPath[PATH_MAX];
+
+                        sh_path(path, i, shardPath);
+                        (void)unlink(shardPath);
+                }
+                return status;
+        }
+
+        *pqp = pq;
+
+        return 0;
+}
+
+unsigned
+pq_getShardCount(pqueue* const pq)
+{
+        return pq->shards ? pq->nshards : 1;
+}
+
+/******************************************************************************
+ * Product-Queue Functions:
+ ******************************************************************************/
+static void
+pq_lockIf(pqueue* const pq)
+{
+    if (fIsSet(pq->pflags, PQ_THREADSAFE)) {
+        (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &pq->cancelState);
+
+        int status = pthread_mutex_lock(&pq->mutex);
+
+        if (status) {
+            log_errno(status, "pthread_mutex_lock() failure");
+            abort();
+        }
+    }
+}
+
+static void
+pq_unlockIf(pqueue* const pq)
+{
+    if (fIsSet(pq->pflags, PQ_THREADSAFE)) {
+        int status = pthread_mutex_unlock(&pq->mutex);
+
+        if (status) {
+            log_errno(status, "pthread_mutex_unlock() failure");
+            abort();
+        }
+
+        int lockState;
+        (void)pthread_setcancelstate(pq->cancelState, &lockState);
+    }
+}
+
+/**
+ * Returns the XDR-encoded data-product of a compressed region for a reader.
+ * The data-product is inflated into a buffer that's freed when the region is
+ * released unless the product-queue was opened with PQ_NOINFLATE, in which
+ * case the region's contents are returned.
+ *
+ * @pre                   The region is locked
+ * @param[in,out] pq      Product-queue
+ * @param[in]     offset  Offset of the region
+ * @param[in]     info    Decoded product-information of the data-product
+ * @param[in]     xdrs    XDR stream of the region positioned after the
+ *                        product-information
+ * @param[in,out] xprod   On input, start of the region. On output, the
+ *                        XDR-encoded data-product.
+ * @param[out]    size    Size of `*xprod` in bytes
+ * @param[out]    data    Data of the data-product
+ * @retval        0           Success
+ * @retval        PQ_CORRUPT  The region is invalid. `log_add()` called.
+ * @retval        PQ_SYSTEM   System failure. `log_add()` called.
+ */
+static int
+zp_get(
+        pqueue* const restrict          pq,
+        const off_t                     offset,
+        const prod_info* const restrict info,
+        XDR* const restrict             xdrs,
+        void** const restrict           xprod,
+        size_t* const restrict          size,
+        void** const restrict           data)
+{
+        const size_t infoLen = (char*)xdrs->x_private - (char*)*xprod;
+
+        if(fIsSet(pq->pflags, PQ_NOINFLATE)) {
+                u_int len;
+
+                if(!xdr_u_int(xdrs, &len) || len > xdrs->x_handy) {
+                        log_add("Invalid length of compressed data");
+                        return PQ_CORRUPT;
+                }
+                *size = infoLen + 4 + _RNDUP(len, 4);
+                *data = xdrs->x_private;
+                return 0;
+        }
+
+        const size_t xlen = infoLen + _RNDUP(info->sz, 4);
+        char* const  buf = malloc(xlen);
+
+        if(buf == NULL) {
+                log_add_syserr("Couldn't allocate %zu-byte buffer", xlen);
+                return PQ_SYSTEM;
+        }
+
+        (void)memcpy(buf, *xprod, infoLen);
+        (void)memset(buf + xlen - 4, 0, 4);     /* XDR padding */
+
+        int status = zp_inflateInto(buf + infoLen, info->sz, xdrs);
+
+        if(status) {
+                free(buf);
+                return status;
+        }
+
+        /* The buffer is freed when the region is released */
+        riu* rp;
+
+        pq_lockIf(pq);
+                if(riul_r_find(pq->riulp, offset, &rp)) {
+                        free(rp->zbuf);
+                        rp->zbuf = buf;
+                }
+                else {
+                        log_add("Region with offset %ld is not in use",
+                                (long)offset);
+                        free(buf);
+                        status = PQ_SYSTEM;
+                }
+        pq_unlockIf(pq);
+
+        if(status == 0) {
+                *xprod = buf;
+                *size = xlen;
+                *data = buf + infoLen;
+        }
+
+        return status;
+}
+
+/*
+ * Sets the offset and size fields of a product-queue structure.
+ *
+ * Arguments:
+ *      pq              Pointer to the product-queue structure to have its
+ *                      "pagesz" (unless it's already set), "datao", "ixo",
+ *                      "ixsz", and "nalloc" fields set.
+ *      align           Alignment reguirement in bytes.
+ *      initsz          Initial size of the data segment in bytes.
+ *      nregions        The capacity of the product-queue in products.
+ */
+static void
+pq_setOffsetsAndSizes(
+    pqueue* const       pq,
+    const size_t        align,
+    const off_t         initsz,
+    const size_t        nregions)
+{
+    /* Size of an I/O page in bytes: */
+    if (pq->pagesz == 0)
+        pq->pagesz = (size_t)pagesize();
+    /* Offset to the data segment in bytes: */
+    pq->datao = lcm(pq->pagesz, align);
+    log_assert(pq->datao >= sizeof(pqctl));
+    /* Offset to the index segment in bytes: */
+    pq->ixo = pq->datao + _RNDUP(initsz, pq->pagesz);
+    /* The capacity of the product-queue in products: */
+    pq->nalloc = nregions;
+
+    /* Size of the index segement: */
+    if (nregions == 0) {
+        pq->ixsz = pq->pagesz;
+    }
+    else {
+        if (nregions <= SXT_NALLOC_MAX)
+            fSet(pq->pflags, PQ_SXTABLE); // Default for new product-queues
+        else
+            fClr(pq->pflags, PQ_SXTABLE);
+        pq->ixsz = ix_totalSz(nregions, align, fIsSet(pq->pflags, PQ_SXTABLE),
+                fIsSet(pq->pflags, PQ_TIMERING), pq->pagesz);
+    }
+}
+
+/**
+ * Adapts a product-queue structure to the file-system of its file. A file on a
+ * hugetlbfs(5) can only be memory-mapped in its entirety and in units of huge
+ * pages and can only be extended by `ftruncate()`; consequently, the offsets
+ * and sizes of the product-queue are recomputed using the huge-page size.
+ *
+ * @param[in,out] pq         Product-queue structure. `pq->fd` must be open.
+ * @param[in]     align      Alignment reguirement in bytes.
+ * @param[in]     initsz     Initial size of the data segment in bytes.
+ * @param[in]     nregions   The capacity of the product-queue in products.
+ * @retval        0          Success
+ * @retval        EINVAL     The file is on a hugetlbfs(5) and `PQ_NOMAP` was
+ *                           specified.
+ */
+static int
+pq_adaptToFileSystem(
+    pqueue* const       pq,
+    const size_t        align,
+    const off_t         initsz,
+    const size_t        nregions)
+{
+#ifdef __linux__
+    struct statfs       sfs;
+
+    if (fstatfs(pq->fd, &sfs) == 0 && sfs.f_type == HUGETLBFS_MAGIC) {
+        if (fIsSet(pq->pflags, PQ_NOMAP)) {
+            log_error("Product-queue on a hugetlbfs must be memory-mapped");
+            return EINVAL;
+        }
+        fClr(pq->pflags, PQ_MAPRGNS);
+        fSet(pq->pflags, PQ_SPARSE);
+        fSet(pq->mapMode, PQ_MAP_HUGETLBFS);
+        pq->pagesz = (size_t)sfs.f_bsize;
+        pq_setOffsetsAndSizes(pq, align, initsz, nregions);
+        ctl_setAccessFunctions(pq);
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * Allocates and initializes a product-queue structure.
+ *
+ * @param[in] pflags     Product-queue flags. Bitwise OR of
+ *                       - PQ_MAPRGNS    Map region by region, default is whole
+ *                                       file if possible; otherwise, by region
+ *                       - PQ_NOCLOBBER  Don't replace an existing product-queue
+ *                       - PQ_NOLOCK     Disable locking (DANGER!)
+ *                       - PQ_NOMAP      Use `malloc/read/write/free` instead of
+ *                                       `mmap()`
+ *                       - PQ_PRIVATE    `mmap()` the file `MAP_PRIVATE`.
+ *                                       Default is `MAP_SHARED`.
+ *                       - PQ_READONLY   Product-queue is read-only. Default is
+ *                                       read/write.
+ * @param[in] align      Alignment reguirement in bytes.
+ * @param[in] initialsz  Capacity of the product-queue in bytes.
+ * @param[in] maxProds   Capacity of the product-queue in number of products.
+ * @retval    NULL       Failure. "errno" set.
+ * @return               Pointer to the product-queue structure. The client
+ *                       should call "pq_delete(pq)" when the structure is no
+ *                       longer needed.
+ */
+static pqueue*
+pq_new(
+    const int           pflags,
+    const size_t        align,
+    const off_t         initialsz,
+    const size_t        maxProds)
+{
+    pqueue* const       pq = (pqueue*)malloc(sizeof(pqueue));
+
+    if (pq == NULL)
+        return NULL;
+
+    (void)memset(pq, 0, sizeof(pqueue));
+    (void)sigemptyset(&pq->sav_set);
+
+    /*
+     * This is a convenient place to overide things at compile time.
+     */
+
+    pq->pflags = pflags;
+    pq->wakeFeedtypes = ANY;
+
+    fSet(pq->pflags, PQ_NOGROW); /* always set for this version of pq! */
+    pq_setOffsetsAndSizes(pq, align, initialsz, maxProds);
+
+    if (pq->ixo < pq->datao) {
+        log_error("Queue-size not supported by environment: initialsz=%ld, "
+                "sizeof(off_t)=%lu, sizeof(size_t)=%lu", (long)initialsz,
+                (unsigned long)sizeof(off_t), (unsigned long)sizeof(size_t));
+        errno = EINVAL;
+        free(pq);
+        return NULL;
+    }
+
+    if (isProductMappingNecessary(pq)) {
+        /*
+         * The entire product-queue can't be memory-mapped in one mmap(2)
+         * call; consequently, each data-product will be individually
+         * memory-mapped.
+         */
+        fSet(pq->pflags, PQ_MAPRGNS);
+    }
+
+#if __hpux
+    if (fIsSet(pq->pflags, PQ_MAPRGNS)) {
+        /*
+         * HP-UX requires that memory-mapped segments be aligned on page
+         * boundaries.
+         */
+        if (align < pq->pagesz) {
+            /* LOG_NOTICE("forcing alignment %u", pq->pagesz); */
+            pq_setOffsetsAndSizes(pq, pq->pagesz, initialsz, maxProds);
+        }
+    }
+#endif
+
+    pq->riulp = (riul*)malloc(pq->pagesz);
+    if (pq->riulp == NULL) {
+        free(pq);
+        return NULL;
+    }
+    riul_init(pq->riulp, 0, pq->pagesz);
+
+    {
+        pthread_mutexattr_t attr;
+        int                 status = pthread_mutexattr_init(&attr);
+        if (status) {
+            log_errno(status, "Couldn't initialize mutex attributes");
+        }
+        else {
+            (void)pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+            (void)pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+            status = pthread_mutex_init(&pq->mutex, &attr);
+            if (status)
+                log_errno(status, "Couldn't initialize mutex");
+            (void)pthread_mutexattr_destroy(&attr);
+        }
+        if (status) {
+            free(pq->riulp);
+            free(pq);
+            return NULL;
+        }
+    }
+
+    /*
+     * Set the product-queue access-functions.
+     */
+    ctl_setAccessFunctions(pq);
+
+    pq->fd = -1;
+    pq->cursor = TS_NONE;
+    pq->cursor_offset = OFF_NONE;
+    pq->pqe_count = 0;
+    pq->locked_count = 0;
+	pq->smallest_extent_seen = UINT_MAX;
+
+    return pq;
+}
+
+/**
+ * Frees a product-queue.
+ *
+ * @param[in,out]  Product queue
+ */
+static void
+pq_free(pqueue *const pq)
+{
+        if(pq == NULL)
+                return;
+        (void)pthread_mutex_destroy(&pq->mutex);
+        if(pq->riulp != NULL)
+        {
+                for(size_t i = 0; i < pq->riulp->nelems; i++)
+                        free(pq->riulp->rp[i].zbuf);
+                free(pq->riulp);
+                pq->riulp = NULL;
+        }
+#ifdef HAVE_MMAP
+        if(pq->seqMap != NULL)
+        {
+                (void)munmap(pq->seqMap, pq->pagesz);
+                pq->seqMap = NULL;
+        }
+#endif
+        rd_release(pq);
+        free(pq);
+}
+
+int
+pq_create(const char *path, mode_t mode,
+        int pflags,
+        size_t align,
+        off_t initialsz, /* initial allocation available */
+        size_t nproducts, /* initial rl->nalloc, ... */
+        pqueue **pqp)
+{
+        int oflags = (O_RDWR|O_CREAT|O_TRUNC);
+        int fd;
+        pqueue *pq = NULL;
+        int status = ENOERR;
+
+        /* enforce minimum alignment */
+        align = (align == 0 ? M_RND_UNIT : _RNDUP(align, M_RND_UNIT));
+        /* TODO: check for absurd align values ? */
+
+        if(initialsz != 0)
+                initialsz = (off_t) _RNDUP(initialsz, align);
+        else
+                initialsz = (off_t) align;
+
+        /*
+         * Writing zeros would allocate small pages before the mapping is
+         * advised; instead, pages are allocated by faults on the mapping.
+         */
+        if(fIsSet(pflags, PQ_HUGEPAGES))
+                fSet(pflags, PQ_SPARSE);
+
+        pq = pq_new(pflags, align, initialsz, nproducts);
+        if(pq == NULL)
+                return errno;
+
+        if(fIsSet(pflags, PQ_NOCLOBBER))
+                fSet(oflags, O_EXCL);
+        fd = open(path, oflags, mode);
+        if(fd < 0)
+        {
+                status = errno;
+                goto unwind_new;
+        }
+        (void)ensure_close_on_exec(fd);
+
+        pq->fd = fd;
+
+        status = pq_adaptToFileSystem(pq, align, initialsz, nproducts);
+        if(status != ENOERR)
+                goto unwind_open;
+
+        status = ctl_init(pq, align);
+        if(status != ENOERR)
+                goto unwind_open;
+
+        (void)strncpy(pq->pathname, path, sizeof(pq->pathname));
+        pq->pathname[sizeof(pq->pathname)-1] = 0;
+
+        *pqp = pq;
+
+        status = ctl_rel(pq, RGN_MODIFIED);
+        if (status) {
+        	log_error("ctl_rel() failure");
+        	goto unwind_open;
+        }
+
+        return ENOERR;
+
+unwind_open:
+        (void)close(fd);
+        (void)unlink(path);
+        /*FALLTHROUGH*/
+unwind_new:
+        pq_free(pq);
+        return status;
+}
+
+
+int
+pq_open(
+    const char* const path,
+    int               pflags,
+    pqueue** const    pqp)
+{
+    int               status;
+    timestampt        start;
+    pqueue*           pq;
+
+    (void)set_timestamp(&start);
+    pq = pq_new(pflags, M_RND_UNIT, 0, 0);
+
+    if (NULL == pq) {
+        status = errno;
+    }
+    else {
+        pq->fd = open(path, fIsSet(pflags, PQ_READONLY) ? O_RDONLY : O_RDWR, 0);
+
+        if (0 > pq->fd) {
+            status = errno;
+        }
+        else {
+            (void)ensure_close_on_exec(pq->fd);
+            (void)strncpy(pq->pathname, path, sizeof(pq->pathname));
+            pq->pathname[sizeof(pq->pathname)-1] = 0;
+            status = pq_adaptToFileSystem(pq, M_RND_UNIT, 0, 0);
+            if (!status)
+                status = ctl_gopen(pq, path);
+
+            if (!status) {
+                status = ctl_rel(pq, 0);           /* release control-block */
+
+                if (status) {
+                	log_error("ctl_rel() failure");
+                }
+                else {
+					if (!fIsSet(pflags, PQ_READONLY)) {
+						status = ctl_get(pq, RGN_WRITE);
+
+						if (!status) {
+							int      rflags = 0;    // control-block unmodified
+							pqctl*   ctlp = pq->ctlp;
+
+							if (WRITE_COUNT_MAGIC != ctlp->write_count_magic) {
+								/*
+								 * This process is the first one of this version
+								 * of the LDM to open the product-queue for
+								 * writing. Initialize the "write count"
+								 * mechanism.
+								 */
+								ctlp->write_count_magic = WRITE_COUNT_MAGIC;
+								ctlp->write_count = 0;
+								rflags = RGN_MODIFIED;
+							}
+
+							if (MAX_WRITE_COUNT > ctlp->write_count) {
+								ctlp->write_count++;
+								rflags = RGN_MODIFIED;
+							}
+							else {
+								log_error("Too many writers (%u) to "
+										"product-queue (%s)", ctlp->write_count,
+										path);
+
+								status = EACCES;    /* too many writers */
+							}
+
+							if (!status) {
+								if (METRICS_MAGIC != ctlp->metrics_magic) {
+									/*
+									 * This process is the first one of this
+									 * version of the LDM to open the
+									 * product-queue for writing.  Initialize
+									 * the additional metrics.
+									 */
+									ctlp->metrics_magic = METRICS_MAGIC;
+									ctlp->mostRecent = TS_NONE;
+									ctlp->minVirtResTime = TS_NONE;
+									ctlp->isFull = 0;
+									rflags = RGN_MODIFIED;
+								}
+								if (METRICS_MAGIC_2 != ctlp->metrics_magic_2) {
+									/*
+									 * This process is the first one of this
+									 * version of the LDM to open the
+									 * product-queue for writing.  Initialize
+									 * the additional metrics.
+									 */
+									ctlp->metrics_magic_2 = METRICS_MAGIC_2;
+									ctlp->mvrtSize = -1;
+									ctlp->mvrtSlots = 0;
+									rflags = RGN_MODIFIED;
+								}
+								if (INSERT_SEQ_MAGIC !=
+										ctlp->insert_seq_magic) {
+									/*
+									 * Initialize the insertion-notification
+									 * mechanism (see pq_waitForNewer()).
+									 */
+									ctlp->insert_seq_magic = INSERT_SEQ_MAGIC;
+									ctlp->insertSeq = 0;
+									rflags = RGN_MODIFIED;
+								}
+								if (FEED_RING_MAGIC != ctlp->feed_ring_magic) {
+									ctlp->feed_ring_magic = FEED_RING_MAGIC;
+									(void)memset(ctlp->feedRing, 0,
+											sizeof(ctlp->feedRing));
+									rflags = RGN_MODIFIED;
+								}
+								if (EVICT_MAGIC != ctlp->evict_magic) {
+									ctlp->evict_magic = EVICT_MAGIC;
+									ctlp->nevicted = 0;
+									ctlp->nevictedForSlot = 0;
+									ctlp->evictedBytes = 0;
+									rflags = RGN_MODIFIED;
+								}
+								if (JOURNAL_MAGIC != ctlp->journal_magic) {
+									jn_init(ctlp);
+									rflags = RGN_MODIFIED;
+								}
+								if (PENDING_MAGIC != ctlp->pending_magic) {
+									jn_initPending(ctlp);
+									rflags = RGN_MODIFIED;
+								}
+								if (TELEMETRY_MAGIC !=
+										ctlp->telemetry_magic) {
+									tm_init(ctlp);
+									rflags = RGN_MODIFIED;
+								}
+								if (READER_MAGIC != ctlp->reader_magic) {
+									rd_init(ctlp);
+									rflags = RGN_MODIFIED;
+								}
+								if (SHARD_MAGIC != ctlp->shard_magic) {
+									sh_init(ctlp);
+									rflags = RGN_MODIFIED;
+								}
+							}
+
+							const int stat = ctl_rel(pq, rflags);
+							if (stat) {
+								log_error("ctl_rel() failure");
+								if (status == 0)
+									status = stat;
+							}
+						}                           /* ctl_get() success */
+					}                               /* open for writing */
+                } // `ctl_rel()` success
+            }                                   /* ctl_gopen() success */
+
+            if (status) {
+                (void)close(pq->fd);
+                pq->fd = -1;
+            }
+        }                                       /* pq->fd >= 0 */
+
+        if (status == 0) {
+            status = sh_open(pq, path, pflags);
+            if (status) {
+                (void)pq_close(pq); // Closes the shards that were opened
+                pq = NULL;
+            }
+        }
+
+        if (status) {
+            pq_free(pq);
+        }
+        else {
+            timestampt now;
+
+            (void)set_timestamp(&now);
+            pq->openLatency = d_diff_timestamp(&now, &start);
+            log_debug("Opened product-queue \"%s\" in %g s", path,
+                    pq->openLatency);
+            *pqp = pq;
+        }
+    }                                           /* pq != NULL */
+
+    return status;
+}
+
+int
+pq_getFlags(
+        pqueue* const pq)
+{
+    pq_lockIf(pq);
+        int pflags = pq->pflags;
+    pq_unlockIf(pq);
+
+    return pflags;
+}
+
+int
+pq_getMapMode(
+        pqueue* const pq)
+{
+    pq_lockIf(pq);
+        int mapMode = pq->mapMode;
+    pq_unlockIf(pq);
+
+    return mapMode;
+}
+
+double
+pq_getOpenLatency(
+        pqueue* const pq)
+{
+    pq_lockIf(pq);
+        double latency = pq->openLatency;
+    pq_unlockIf(pq);
+
+    return latency;
+}
+
+int
+pq_close(pqueue *pq)
+{
+    int status = ENOERR;                    /* success */
+    int fd = -1;
+
+    if (pq == NULL)
+            return 0;
+
+    const int shStatus = sh_close(pq);
+
+    pq_lockIf(pq);
+        fd = pq->fd;
+
+        if(pq->riulp != NULL)
+        {
+                while(pq->riulp->nelems > 2)
+                {
+                        off_t offset =
+                                pq->riulp->rp[pq->riulp->nelems -1].offset;
+                        if(offset == pq->ixo || offset == 0)
+                                continue;
+                        (void) (pq->mtof)(pq, offset, 0);
+                }
+        }
+
+        if(pq->rlp != NULL)
+        {
+                (void)(pq->mtof)(pq, pq->ixo, RGN_NOLOCK);
+                pq->rlp = NULL;
+        }
+
+        if (fIsSet(pq->pflags, PQ_READONLY)) {
+            if (NULL != pq->ctlp) {
+                status = ctl_rel(pq, 0);
+
+                if (status)
+                	log_error("ctl_rel() failure");
+            }
+        }
+        else {
+            status = ctl_get(pq, RGN_WRITE);
+
+            if (!status) {
+                int rflags;
+
+                if (0 < pq->ctlp->write_count) {
+                    pq->ctlp->write_count--;
+                    rflags = RGN_MODIFIED;
+                }
+                else {
+                    log_error("Write-count of product-queue prematurely 0");
+
+                    rflags = 0;                 /* unmodified */
+                    status = EOVERFLOW;
+                }
+
+                const int stat = ctl_rel(pq, rflags);
+
+                if (stat) {
+                	log_error("ctl_rel() failure");
+                	if (status == 0)
+                		status = stat;
+                }
+            }
+        }                                       /* was opened for writing */
+
+#ifdef HAVE_MMAP
+        if(pq->base != NULL && pq->ftom == mm0_ftom)
+        {
+                /* special case, time to unmap the whole thing */
+                int mflags = 0; /* TODO: translate rflags to mflags */
+                (void) unmapwrap(pq->base, 0, pq->mapsz, mflags);
+                pq->base = NULL;
+        }
+        while(pq->retired != NULL)
+        {
+                retiredMap *const map = pq->retired;
+
+                (void) unmapwrap(map->base, 0, map->size, 0);
+                pq->retired = map->next;
+                free(map);
+        }
+#endif
+
+    pq_unlockIf(pq);
+    pq_free(pq);
+
+    if(fd > -1 && close(fd) < 0 && !status)
+            status = errno;
+    if(status == 0)
+            status = shStatus;
+
+    return status;
+}
+
+const char* pq_getPathname(
+        pqueue* pq)
+{
+    pq_lockIf(pq);
+        const char* pathname = pq->pathname;
+    pq_unlockIf(pq);
+
+    return pathname;
+}
+
+int
+pq_pagesize(pqueue *pq)
+{
+    /*
+     * Allow the caller to figure out what the default would be prior to
+     * calling `pq_create()`.
+     */
+    if(pq == NULL)
+        return (int)pagesize();
+
+    // Else, tell the caller what it is
+    pq_lockIf(pq);
+        int pagesz = (int) pq->pagesz;
+    pq_unlockIf(pq);
+
+    return pagesz;
+}
+
+/*
+ * Returns the size of the data portion of a product-queue. For callers that
+ * already hold the instance-lock (see `pq_lockIf()`).
+ */
+static size_t
+pq_dataSize(
+    const pqueue* const pq)
+{
+    return pq->ixo - pq->datao;
+}
+
+size_t
+pq_getDataSize(
+    pqueue* const       pq)
+{
+    pq_lockIf(pq);
+        size_t size = pq_dataSize(pq);
+    pq_unlockIf(pq);
+
+    return size;
+}
+
+
+typedef struct {
+    time_t      start;
+    /*
+     * Hostnames are limited to 255 bytes.  See
+     * <http://www.opengroup.org/onlinepubs/007908799/xns/gethostname.html>.
+     */
+    char        hostname[256];
+} FutureEntry;
+
+
+static inline int
+compareFutureEntries(
+    const void* const   entry1,
+    const void* const   entry2)
+{
+    const char* name1 = ((FutureEntry*)entry1)->hostname;
+    const char* name2 = ((FutureEntry*)entry2)->hostname;
+
+    return strcmp(name1, name2);
+}
+
+
+static void
+vetCreationTime(
+    const prod_info* const      info)
+{
+    /*
+     * Vet the creation-time of a data-product.
+     */
+    timestampt  initialSearchTime = info->arrival;
+    timestampt  now;
+
+    /*
+     * Keep the following consonant with the temporal backoff in
+     * pq_setCursorFromSignature().
+     */
+    initialSearchTime.tv_sec -= SEARCH_BACKOFF;
+
+    (void)set_timestamp(&now);
+
+    if (tvCmp(initialSearchTime, now, >)) {
+        const char* const       origin = info->origin;
+        char*                   cp = strstr(origin, "_v_");
+        size_t                  len =
+            cp == NULL ?  strlen(origin) : (size_t)(cp - origin);
+
+        if (log_is_enabled_info) {
+            log_warning("Future product from \"%*s\". "
+                    "Fix local or ingest clock. %s",
+                    (int)len, origin, s_prod_info(NULL, 0, info, 0));
+        }
+        else {
+            FutureEntry         targetEntry;
+            FutureEntry* const* treeEntry;
+            static void*        root = NULL;
+#           define              FUTURE_INTERVAL (60*60) /* 1 h */
+
+            if (len > (sizeof(targetEntry.hostname)-1))
+                len = sizeof(targetEntry.hostname) - 1;
+            (void)memcpy(targetEntry.hostname, origin, len);
+            targetEntry.hostname[len] = 0;
+
+            treeEntry = tfind(&targetEntry, &root, compareFutureEntries);
+
+            if (treeEntry != NULL) {
+                FutureEntry*    entry = *treeEntry;
+                time_t          now = time(NULL);
+
+                if (entry->start <= now) {
+                    log_warning("Future product from \"%s\". "
+                            "Fix local or ingest clock. %s", entry->hostname,
+                            s_prod_info(NULL, 0, info, 0));
+
+                    entry->start = now + FUTURE_INTERVAL;
+                }
+            }
+            else {
+                FutureEntry*    newEntry = malloc(sizeof(FutureEntry));
+
+                log_warning("Future product from \"%s\". "
+                        "Fix local or ingest clock. %s", targetEntry.hostname,
+                    s_prod_info(NULL, 0, info, 0));
+
+                if (newEntry != NULL) {
+                    newEntry->start = time(NULL) + FUTURE_INTERVAL;
+                    (void)strcpy(newEntry->hostname, targetEntry.hostname);
+
+                    (void)tsearch(newEntry, &root, compareFutureEntries);
+                }                       /* "newEntry" allocated */
+            }                           /* host not in database */
+        }                               /* non-verbose logging */
+    }                                   /* product created in future */
+}
+
+/**
+ * Records the insertion of a data-product in the control-header of a
+ * product-queue: the insertion is added to the telemetry ring, the
+ * data-product's feedtype is added to the feedtype ring, and the insertion
+ * sequence-number is incremented.
+ *
+ * @pre                The control-header is write-locked.
+ * @param[in] ctlp     The control-header.
+ * @param[in] feedtype The feedtype of the inserted data-product or `ANY` if
+ *                     unknown.
+ * @param[in] extent   Extent of the data-product's region in bytes
+ */
+static inline void
+ctl_incrInsertSeq(
+        pqctl* const    ctlp,
+        const feedtypet feedtype,
+        const size_t    extent)
+{
+    tm_insert(ctlp, extent);
+    if (INSERT_SEQ_MAGIC == ctlp->insert_seq_magic) {
+        if (FEED_RING_MAGIC == ctlp->feed_ring_magic) {
+            ctlp->feedRing[ctlp->insertSeq % FEED_RING_SIZE] = feedtype;
+#ifdef __GNUC__
+            /* Lock-free readers must see the ring entry before the increment */
+            __sync_synchronize();
+#endif
         }
+        ctlp->insertSeq++;
+    }
+}
 
-        pq->datao = ctlp->datao;
-        pq->ixo = ctlp->ixo;
-        pq->ixsz = ctlp->ixsz;
-        pq->nalloc = ctlp->nalloc;
-        pq->ctlp = ctlp;
+/**
+ * Returns a pointer to a shared, read-only mapping of the control-header of a
+ * product-queue for insertion-notification. The mapping remains valid until
+ * the product-queue is closed.
+ *
+ * @param[in] pq    The product-queue.
+ * @retval    NULL  The product-queue doesn't support insertion-notification
+ *                  (e.g., it's accessed via read(2)/write(2) or no writer of
+ *                  this version has opened it).
+ * @return          Pointer to the control-header.
+ */
+static const volatile pqctl*
+pq_getNotifyCtl(pqueue* const pq)
+{
+#ifdef HAVE_MMAP
+    if (pq->seqMap == NULL) {
+        void* vp;
 
-        if (!(pq->datao > 0) ||
-            !(pq->datao % pq->pagesz == 0) ||
-            !(pq->ixo > pq->datao) ||
-            !(pq->ixo % pq->pagesz == 0) ||
-            !(pq->ixsz >= pq->pagesz) ||
-            !(pq->ixsz % pq->pagesz == 0)) {
+        if (fIsSet(pq->pflags, PQ_NOMAP))
+            return NULL;
 
-            log_error("pq->datao=%lu, pq->pagesz=%lu, pq->ixo=%lu, "
-                "pq->ixsz=%lu",
-                (unsigned long)pq->datao, (unsigned long)pq->pagesz, 
-                (unsigned long)pq->ixo, (unsigned long)pq->ixsz);
-            status = PQ_CORRUPT;
-            goto unwind_map;
+        vp = mmap(NULL, pq->pagesz, PROT_READ, MAP_SHARED, pq->fd, 0);
+        if (vp == MAP_FAILED) {
+            log_syserr("Couldn't map control-header of product-queue %s",
+                    pq->pathname);
+            return NULL;
         }
+        pq->seqMap = vp;
+    }
 
-        /*
-         * Reset the product-queue access-functions based on the product-queue's
-         * actual size.
-         */
-        ctl_setAccessFunctions(pq);
+    const volatile pqctl* const ctlp = pq->seqMap;
 
-        /* bring in the indexes */
-        status = (pq->ftom)(pq, pq->ixo, pq->ixsz, RGN_NOLOCK, &pq->ixp);
-        if(status != ENOERR)
-                goto unwind_map;
+    return INSERT_SEQ_MAGIC == ctlp->insert_seq_magic
+            ? ctlp
+            : NULL;
+#else
+    return NULL;
+#endif
+}
 
-        if (!ix_ptrs(pq->ixp, pq->ixsz, pq->nalloc, pq->ctlp->align,
-                &pq->rlp, &pq->tqp, &pq->fbp, &pq->sxp)) {
-            status = PQ_CORRUPT;
-            goto unwind_map;
-        }
+/**
+ * Indicates if any data-product inserted into a product-queue between two
+ * insertion sequence-numbers has a feedtype of interest. Doesn't lock.
+ *
+ * @param[in] ctlp       Shared control-header.
+ * @param[in] from       Insertion sequence-number before the insertions.
+ * @param[in] to         Insertion sequence-number after the insertions.
+ * @param[in] feedtypes  Feedtypes of interest.
+ * @retval    true       A data-product of interest might have been inserted.
+ * @retval    false      No data-product of interest was inserted.
+ */
+static bool
+ctl_isInsertOfInterest(
+        const volatile pqctl* const ctlp,
+        const uint32_t              from,
+        const uint32_t              to,
+        const feedtypet             feedtypes)
+{
+    if (feedtypes == ANY || FEED_RING_MAGIC != ctlp->feed_ring_magic ||
+            (uint32_t)(to - from) >= FEED_RING_SIZE)
+        return true;
+
+    for (uint32_t seq = from; seq != to; seq++) {
+        if (ctlp->feedRing[seq % FEED_RING_SIZE] & feedtypes)
+            return true;
+    }
 
-        if (!(pq->rlp->nalloc == pq->nalloc && pq->tqp->nalloc == pq->nalloc
-                        && pq->sxp->nalloc == pq->nalloc)) { 
-                log_error("pq->rlp->nalloc=%lu, pq->nalloc=%lu, "
-                    "pq->tqp->nalloc=%lu, pq->sxp->nalloc=%lu",
-                    (unsigned long)pq->rlp->nalloc,
-                    (unsigned long)pq->nalloc, 
-                    (unsigned long)pq->tqp->nalloc, 
-                    (unsigned long)pq->sxp->nalloc);
-                status = PQ_CORRUPT;
-                goto unwind_map;
-        }
+#ifdef __GNUC__
+    __sync_synchronize();
+#endif
+    /*
+     * If the ring wrapped while it was being read, then the entries can't be
+     * trusted.
+     */
+    return (uint32_t)(ctlp->insertSeq - from) >= FEED_RING_SIZE;
+}
 
-        return ENOERR;
+/**
+ * Wakes the processes waiting in `pq_waitForNewer()` on a product-queue that
+ * are interested in a given feedtype.
+ *
+ * @param[in] pq        The product-queue.
+ * @param[in] feedtype  The feedtype of the inserted data-product or `ANY` if
+ *                      unknown.
+ */
+static void
+pq_wakeWaiters(
+        pqueue* const   pq,
+        const feedtypet feedtype)
+{
+#if defined(__linux__) && defined(SYS_futex) && defined(FUTEX_WAKE_BITSET)
+    const volatile pqctl* const ctlp = pq_getNotifyCtl(pq);
 
-unwind_map:
-        (void)(pq->mtof)(pq, 0, 0);
-        return status;
+    if (ctlp != NULL)
+        (void)syscall(SYS_futex, &ctlp->insertSeq, FUTEX_WAKE_BITSET, INT_MAX,
+                NULL, NULL, feedtype ? feedtype : FUTEX_BITSET_MATCH_ANY);
+#endif
+    sh_notify(pq, feedtype);
 }
 
+/*
+ * Data-products at least this large are XDR-encoded into the product-queue
+ * after the control-header has been released (see pq_insertNoSig()) so that
+ * other processes aren't blocked by the copy. Smaller data-products are encoded
+ * while the control-header is locked because that's cheaper than locking it a
+ * second time.
+ */
+#define PQ_UNLOCKED_ENCODE_MIN  65536
 
 /**
- * Get/lock the ctl for access by this process
+ * Inserts a data-product into a product-queue or into one shard of a sharded
+ * product-queue. Readers aren't woken.
  *
- * @param[in] rflags  Region flags: bitwise OR of
- *                    - RGN_NOLOCK  Don't lock region; locking handled elsewhere
- *                    - RGN_WRITE   Region will be modified
- *                    - RGN_NOWAIT  Return immediately if can't lock, else wait
- * @retval ENOERR     Success.
- * @retval EACCESS or EAGAIN
- *                    The region is already locked by another process.
- * @retval EINVAL     The product-queue file doesn't support locking.
- * @retval ENOLCK     The number of locked regions would exceed a system-imposed
- *                    limit.
- * @retval EDEADLK    A deadlock in region locking has been detected.
- * @retval EBADF      The file descriptor of the product-queue is invalid.
- * @retval EIO        An I/O error occurred while reading from the file system.
- * @retval EOVERFLOW  The file size in bytes or the number of blocks allocated
- *                    to the file or the file serial number cannot be
- *                    represented correctly.
- * @retval EINTR      A signal was caught during execution.
- * @retval EFBIG or EINVAL
- *                    The size of the product-queue is greater than the maximum
- *                    file size.
- * @retval EROFS      The named file resides on a read-only file system.
- * @retval EAGAIN     The mapping could not be locked in memory, if required by
- *                    mlockall(), due to a lack of resources.
- * @retval EINVAL     The product-queue object wants to map the product-queue to
- *                    a fixed memory location that is not a multiple of the page
- *                    size as returned by sysconf(), or is considered invalid
- *                    by the O/S.
- * @retval EMFILE     The number of mapped regions would exceed an O/S-dependent
- *                    limit (per process or per system).
- * @retval ENODEV     The file descriptor of the product-queue object refers to
- *                    a file whose type is not supported by mmap().
- * @retval ENOMEM     The size of the product-queue exceeds that allowed for the
- *                    address space of a process.
- * @retval ENOMEM     The mapping could not be locked in memory, if required by
- *                    mlockall(), because it would require more space than the
- *                    system is able to supply.
- * @retval ENOTSUP    The O/S does not support the combination of accesses
- *                    requested.
- * @retval ENXIO      The size of the product-queue is invalid for the object
- *                    specified by its file descriptor.
+ * @pre                   The instance-lock of `pq` is held (see `pq_lockIf()`)
+ * @param[in,out] pq      Product queue or shard
+ * @param[in]     prod    The data-product
+ * @return                See `pq_insertNoSig()`
  */
 static int
-ctl_get(pqueue *const pq, int const rflags)
+pq_insertNoSigHelper(pqueue* const pq, const product* const prod)
 {
         int status = ENOERR;
+        size_t extent;
+        void *vp = NULL;
+        sxelem *sxep;
+        off_t offset;
+        bool ctlLocked;
+        int pending = -1;       /* slot of pending reservation */
+        zdata zd = {NULL};
+        
+        log_assert(pq != NULL);
+        log_assert(prod != NULL);
 
-#if _NOMAP || !defined(HAVE_MMAP)
-        log_assert(pq->mtof == f_mtof);
-        log_assert(pq->ctlp == NULL);
-        log_assert(pq->ixp == NULL);
-#endif
+        if(fIsSet(pq->pflags, PQ_READONLY)) {
+                log_debug("pq_insertNoSig(): queue is read-only");
+                status = EACCES;
+                goto unwind_lock;
+        }
 
-        if(fIsSet(rflags, RGN_WRITE) && !fIsSet(pq->pflags, PQ_SIGSBLOCKED))
-        {
-                /* We are beginning a critical section */
-                sigset_t set;
+        // log_debug_1("Getting product size");
+        extent = zp_deflate(pq, prod, &zd);
+        if (extent > pq_dataSize(pq)) {
+                log_debug("pq_insertNoSig(): product is too big");
+                status = PQ_BIG;
+                goto unwind_lock;
+        }
 
-                (void) sigfillset(&set);
-                (void) sigdelset(&set, SIGABRT);
-                (void) sigdelset(&set, SIGFPE);
-                (void) sigdelset(&set, SIGILL);
-                (void) sigdelset(&set, SIGSEGV);
-                (void) sigdelset(&set, SIGBUS);
-                status = pthread_sigmask(SIG_BLOCK, &set, &pq->sav_set);
-                log_assert(0 == status);
-                fSet(pq->pflags, PQ_SIGSBLOCKED);
+        /*
+         * Write lock pq->ctl.
+         */
+        // log_debug_1("Getting control header");
+        status = ctl_get(pq, RGN_WRITE);
+        if(status != ENOERR) {
+                log_debug("pq_insertNoSig(): ctl_get() failure");
+                goto unwind_lock;
         }
-        if(pq->ctlp == NULL)
-        {
-                /* bring in the pqctl */
-                status = (pq->ftom)(pq,
-                                 0, (size_t)pq->datao, rflags,
-                                (void **)&pq->ctlp);
+        ctlLocked = true;
+
+        // log_debug_1("Getting space for product");
+        status = rpqe_new(pq, extent, prod->info.signature, &vp, &sxep);
+        if(status != ENOERR) {
+                log_debug("pq_insertNoSig(): rpqe_new() failure");
+                goto unwind_ctl;
+        }
+        offset = sxep->offset;
+        /* Lets a later writer roll back the reservation if this process dies */
+        pending = jn_openReserve(pq, offset);
+
+        if(extent >= PQ_UNLOCKED_ENCODE_MIN && pending >= 0) {
+                /*
+                 * Release pq->ctl during the copy. The reserved region remains
+                 * write-locked and isn't in the time-queue, so no other
+                 * process can read or delete it; its signature-entry already
+                 * prevents a duplicate insertion.
+                 */
+                status = ctl_rel(pq, RGN_MODIFIED);
+                ctlLocked = false;
                 if(status != ENOERR)
-                        goto unwind_mask;
+                        log_debug("pq_insertNoSig(): ctl_rel() failure");
         }
-        log_assert(pq->ctlp->magic == PQ_MAGIC);
-        log_assert(PQ_VERSION == pq->ctlp->version || 7 == pq->ctlp->version);
-        log_assert(pq->ctlp->datao == pq->datao);
-        log_assert(pq->ctlp->ixo == pq->ixo);
-        log_assert(pq->ctlp->ixsz == pq->ixsz);
 
-        if(pq->ixp == NULL)
-        {
-                /* bring in the indexes */
-                status = (pq->ftom)(pq,
-                                 pq->ixo, pq->ctlp->ixsz, rflags|RGN_NOLOCK,
-                                &pq->ixp);
+        if(status == ENOERR) {
+                // log_debug_1("XDR-ing product");
+                status = zp_encode(vp, extent, prod, &zd);
                 if(status != ENOERR)
+                        log_debug("pq_insertNoSig(): zp_encode() failure");
+        }
+
+        if(!ctlLocked) {
+                /*
+                 * Briefly re-lock pq->ctl to commit (or free) the region.
+                 */
+                int stat = ctl_get(pq, RGN_WRITE);
+                if(stat != ENOERR) {
+                        log_debug("pq_insertNoSig(): ctl_get() failure");
+                        if(status == ENOERR)
+                                status = stat;
+                        /*
+                         * The region can't be committed. Release it and try
+                         * once more to obtain pq->ctl so that it can be freed.
+                         */
+                        (void)rgn_rel(pq, offset, 0);
+                        stat = ctl_get(pq, RGN_WRITE);
+                        if(stat != ENOERR) {
+                                log_error("Couldn't free region at offset %ld "
+                                        "of product-queue %s: it remains "
+                                        "reserved until process %ld "
+                                        "terminates", (long)offset,
+                                        pq->pathname, (long)getpid());
+                                goto unwind_lock;
+                        }
+                        ctlLocked = true;
+                        (void)rpqe_free(pq, offset, prod->info.signature);
+                        jn_closeReserve(pq, pending);
                         goto unwind_ctl;
+                }
+                ctlLocked = true;
         }
 
-        ix_ptrs(pq->ixp, pq->ixsz, pq->nalloc, pq->ctlp->align, &pq->rlp,
-            &pq->tqp, &pq->fbp, &pq->sxp);
-        log_assert(pq->rlp->nalloc == pq->nalloc && pq->tqp->nalloc == pq->nalloc
-                        && pq->sxp->nalloc == pq->nalloc);
+        if(status != ENOERR) {
+                (void)rgn_rel(pq, offset, 0);
+                (void)rpqe_free(pq, offset, prod->info.signature);
+                jn_closeReserve(pq, pending);
+                goto unwind_ctl;
+        }
+
+        zp_setZipped(pq, offset, &prod->info, &zd);
+        log_assert(pq->tqp != NULL && tq_HasSpace(pq->tqp));
+        status = pq_tqAdd(pq, offset, &prod->info);
+        if(status != ENOERR) {
+                log_debug("pq_insertNoSig(): tq_add() failure");
+                (void)rgn_rel(pq, offset, 0);
+                (void)rpqe_free(pq, offset, prod->info.signature);
+                jn_closeReserve(pq, pending);
+                goto unwind_ctl;
+        }
+        jn_closeReserve(pq, pending);
+
+        // log_debug_1("Setting timestamp");
+        (void)set_timestamp(&pq->ctlp->mostRecent);
+        ctl_incrInsertSeq(pq->ctlp, prod->info.feedtype, extent);
+        // log_debug_1("Vetting creation time");
+        vetCreationTime(&prod->info);
+        (void) rgn_rel(pq, offset, RGN_MODIFIED);
+        /*FALLTHROUGH*/
 
-        return ENOERR;
 unwind_ctl:
-        (void) (pq->mtof)(pq, 0, 0);
-        pq->ctlp = NULL;
-unwind_mask:
-        {
-            sigset_t set = pq->sav_set;
+        // log_debug_1("Releasing control header");
+        if(ctlLocked)
+                (void) ctl_rel(pq, RGN_MODIFIED);
+        /*FALLTHROUGH*/
 
-            (void) sigemptyset(&pq->sav_set);
-            fClr(pq->pflags, PQ_SIGSBLOCKED);
-            (void) pthread_sigmask(SIG_SETMASK, &set, NULL);
+unwind_lock:
+        // log_debug_1("Returning %d", status);
+        free(zd.buf);
+        return status;
+}
+
+int
+pq_insertNoSig(pqueue *pq, const product *prod)
+{
+    if (pq->shards)
+        pq = sh_shard(pq, prod->info.signature);
+
+    pq_lockIf(pq);
+        int status = pq_insertNoSigHelper(pq, prod);
+    pq_unlockIf(pq);
+
+    /*
+     * Wake readers waiting on the queue (see pq_waitForNewer()). Unlike
+     * SIGCONT, this doesn't disturb the process group.
+     */
+    if(status == ENOERR)
+        pq_wakeWaiters(pq, prod->info.feedtype);
+
+    return status;
+}
+
+int
+pq_insert(pqueue *pq, const product *prod)
+{
+        int status = pq_insertNoSig(pq, prod);
+        if(status == ENOERR)
+        {
+                /*
+                 * Inform others in our process group
+                 * that there is new data available.
+                 * (see pq_suspend() below.)
+                 *  SIGCONT is ignored by default...
+                 */
+                (void)kill(0, SIGCONT);
         }
         return status;
 }
 
-/******************************************************************************
- * Product-Queue Functions:
- ******************************************************************************/
-static void
-pq_lockIf(pqueue* const pq)
+/**
+ * Inserts a small data-product into a product-queue whose control-header is
+ * write-locked. The data-product is XDR-encoded while the control-header is
+ * locked.
+ *
+ * @pre                   The control-header is write-locked.
+ * @param[in,out] pq      The product-queue.
+ * @param[in]     prod    The data-product.
+ * @param[in]     zd      The deflated data of the data-product (see
+ *                        `zp_deflate()`).
+ * @retval        ENOERR  Success.
+ * @retval        PQ_DUP  Product already exists in the queue.
+ * @return                Other error-code of `rpqe_new()` or `tq_add()`.
+ */
+static int
+pq_insertLocked(
+        pqueue* const        pq,
+        const product* const prod,
+        const zdata* const   zd)
 {
-    if (fIsSet(pq->pflags, PQ_THREADSAFE)) {
-        (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &pq->cancelState);
-
-        int status = pthread_mutex_lock(&pq->mutex);
+        void *vp = NULL;
+        sxelem *sxep;
+        int status = rpqe_new(pq, zd->extent, prod->info.signature, &vp,
+                &sxep);
 
-        if (status) {
-            log_errno(status, "pthread_mutex_lock() failure");
-            abort();
+        if(status != ENOERR) {
+                log_debug("pq_insertLocked(): rpqe_new() failure");
+                return status;
         }
-    }
-}
 
-static void
-pq_unlockIf(pqueue* const pq)
-{
-    if (fIsSet(pq->pflags, PQ_THREADSAFE)) {
-        int status = pthread_mutex_unlock(&pq->mutex);
+        const off_t offset = sxep->offset;
+        /* Lets a later writer roll back the reservation if this process dies */
+        const int   pending = jn_openReserve(pq, offset);
 
-        if (status) {
-            log_errno(status, "pthread_mutex_unlock() failure");
-            abort();
+        if(zp_encode(vp, zd->extent, prod, zd) != 0) {
+                log_debug("pq_insertLocked(): zp_encode() failure");
+                (void)rgn_rel(pq, offset, 0);
+                (void)rpqe_free(pq, offset, prod->info.signature);
+                jn_closeReserve(pq, pending);
+                return EIO;
         }
 
-        int lockState;
-        (void)pthread_setcancelstate(pq->cancelState, &lockState);
-    }
-}
+        zp_setZipped(pq, offset, &prod->info, zd);
+        log_assert(pq->tqp != NULL && tq_HasSpace(pq->tqp));
+        status = pq_tqAdd(pq, offset, &prod->info);
+        if(status != ENOERR) {
+                log_debug("pq_insertLocked(): tq_add() failure");
+                (void)rgn_rel(pq, offset, 0);
+                (void)rpqe_free(pq, offset, prod->info.signature);
+                jn_closeReserve(pq, pending);
+                return status;
+        }
+        jn_closeReserve(pq, pending);
 
-/*
- * Sets the offset and size fields of a product-queue structure.
- *
- * Arguments:
- *      pq              Pointer to the product-queue structure to have its
- *                      "pagesz", "datao", "ixo", "ixsz", and "nalloc" fields
- *                      set.
- *      align           Alignment reguirement in bytes.
- *      initsz          Initial size of the data segment in bytes.
- *      nregions        The capacity of the product-queue in products.
- */
-static void
-pq_setOffsetsAndSizes(
-    pqueue* const       pq,
-    const size_t        align,
-    const off_t         initsz,
-    const size_t        nregions)
-{
-    /* Size of an I/O page in bytes: */
-    pq->pagesz = (size_t)pagesize();
-    /* Offset to the data segment in bytes: */
-    pq->datao = lcm(pq->pagesz, align);
-    log_assert(pq->datao >= sizeof(pqctl));
-    /* Offset to the index segment in bytes: */
-    pq->ixo = pq->datao + _RNDUP(initsz, pq->pagesz);
-    /* The capacity of the product-queue in products: */
-    pq->nalloc = nregions;
+        (void)set_timestamp(&pq->ctlp->mostRecent);
+        ctl_incrInsertSeq(pq->ctlp, prod->info.feedtype, zd->extent);
+        vetCreationTime(&prod->info);
+        (void)rgn_rel(pq, offset, RGN_MODIFIED);
 
-    /* Size of the index segement: */
-    if (nregions == 0) {
-        pq->ixsz = pq->pagesz;
-    }
-    else {
-        pq->ixsz = ix_sz(nregions, align);
-        pq->ixsz = _RNDUP(pq->ixsz, pq->pagesz);
-    }
+        return ENOERR;
 }
 
-
 /**
- * Allocates and initializes a product-queue structure.
+ * Inserts data-products into a product-queue or into one shard of a sharded
+ * product-queue.
  *
- * @param[in] pflags     Product-queue flags. Bitwise OR of
- *                       - PQ_MAPRGNS    Map region by region, default is whole
- *                                       file if possible; otherwise, by region
- *                       - PQ_NOCLOBBER  Don't replace an existing product-queue
- *                       - PQ_NOLOCK     Disable locking (DANGER!)
- *                       - PQ_NOMAP      Use `malloc/read/write/free` instead of
- *                                       `mmap()`
- *                       - PQ_PRIVATE    `mmap()` the file `MAP_PRIVATE`.
- *                                       Default is `MAP_SHARED`.
- *                       - PQ_READONLY   Product-queue is read-only. Default is
- *                                       read/write.
- * @param[in] align      Alignment reguirement in bytes.
- * @param[in] initialsz  Capacity of the product-queue in bytes.
- * @param[in] maxProds   Capacity of the product-queue in number of products.
- * @retval    NULL       Failure. "errno" set.
- * @return               Pointer to the product-queue structure. The client
- *                       should call "pq_delete(pq)" when the structure is no
- *                       longer needed.
+ * @param[in,out] pq        Product queue or shard
+ * @param[in]     prods     Data-products
+ * @param[in]     nprods    Number of data-products
+ * @param[out]    statuses  Insertion status of each data-product or NULL
+ * @return                  See `pq_insertBatch()`
  */
-static pqueue*
-pq_new(
-    const int           pflags,
-    const size_t        align,
-    const off_t         initialsz,
-    const size_t        maxProds)
+static int
+pq_insertBatchHelper(
+        pqueue* const        pq,
+        const product* const prods,
+        const size_t         nprods,
+        int* const           statuses)
 {
-    pqueue* const       pq = (pqueue*)malloc(sizeof(pqueue));
+    int       status = ENOERR;
+    bool      ctlLocked = false;
+    size_t    ninserted = 0;
+    feedtypet inserted = NONE; // Feedtypes of readers yet to be woken
 
-    if (pq == NULL)
-        return NULL;
+    pq_lockIf(pq);
 
-    (void)memset(pq, 0, sizeof(pqueue));
-    (void)sigemptyset(&pq->sav_set);
+    if (fIsSet(pq->pflags, PQ_READONLY)) {
+        log_debug("pq_insertBatch(): queue is read-only");
+        status = EACCES;
+    }
 
     /*
-     * This is a convenient place to overide things at compile time.
+     * Data-products that will be encoded while the control-header is held are
+     * deflated beforehand. They're stored as is if that's not possible.
      */
-
-    pq->pflags = pflags;
-
-    fSet(pq->pflags, PQ_NOGROW); /* always set for this version of pq! */
-    pq_setOffsetsAndSizes(pq, align, initialsz, maxProds);
-
-    if (pq->ixo < pq->datao) {
-        log_error("Queue-size not supported by environment: initialsz=%ld, "
-                "sizeof(off_t)=%lu, sizeof(size_t)=%lu", (long)initialsz,
-                (unsigned long)sizeof(off_t), (unsigned long)sizeof(size_t));
-        errno = EINVAL;
-        free(pq);
-        return NULL;
-    }
-
-    if (isProductMappingNecessary(pq)) {
-        /*
-         * The entire product-queue can't be memory-mapped in one mmap(2)
-         * call; consequently, each data-product will be individually
-         * memory-mapped.
-         */
-        fSet(pq->pflags, PQ_MAPRGNS);
-    }
-
-#if __hpux
-    if (fIsSet(pq->pflags, PQ_MAPRGNS)) {
-        /*
-         * HP-UX requires that memory-mapped segments be aligned on page
-         * boundaries.
-         */
-        if (align < pq->pagesz) {
-            /* LOG_NOTICE("forcing alignment %u", pq->pagesz); */
-            pq_setOffsetsAndSizes(pq, pq->pagesz, initialsz, maxProds);
+    zdata* zds = NULL;
+    if (status == ENOERR && fIsSet(pq->pflags, PQ_COMPRESS) && nprods) {
+        zds = calloc(nprods, sizeof(zdata));
+        for (size_t i = 0; zds && i < nprods; i++) {
+            if (xlen_product(prods + i) < PQ_UNLOCKED_ENCODE_MIN)
+                (void)zp_deflate(pq, prods + i, zds + i);
         }
     }
-#endif
 
-    pq->riulp = (riul*)malloc(pq->pagesz);
-    if (pq->riulp == NULL) {
-        free(pq);
-        return NULL;
-    }
-    riul_init(pq->riulp, 0, pq->pagesz);
+    for (size_t i = 0; status == ENOERR && i < nprods; i++) {
+        const product* const prod = prods + i;
+        zdata                zd = {NULL, 0, xlen_product(prod)};
+        const size_t         extent = zd.extent;
+        int                  stat;
 
-    {
-        pthread_mutexattr_t attr;
-        int                 status = pthread_mutexattr_init(&attr);
-        if (status) {
-            log_errno(status, "Couldn't initialize mutex attributes");
+        if (zds && extent < PQ_UNLOCKED_ENCODE_MIN)
+            zd = zds[i];
+
+        if (extent > pq_dataSize(pq)) {
+            stat = PQ_BIG;
+        }
+        else if (extent >= PQ_UNLOCKED_ENCODE_MIN) {
+            /*
+             * Let pq_insertNoSigHelper() encode a large data-product without
+             * holding the control-header. Insertion order is preserved.
+             */
+            if (ctlLocked) {
+                (void)ctl_rel(pq, RGN_MODIFIED);
+                ctlLocked = false;
+            }
+            stat = pq_insertNoSigHelper(pq, prod);
         }
         else {
-            (void)pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-            (void)pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
-            status = pthread_mutex_init(&pq->mutex, &attr);
-            if (status)
-                log_errno(status, "Couldn't initialize mutex");
-            (void)pthread_mutexattr_destroy(&attr);
+            if (!ctlLocked) {
+                status = ctl_get(pq, RGN_WRITE);
+                if (status) {
+                    log_add_errno(status, "Couldn't write-lock control-header "
+                            "of product-queue %s", pq->pathname);
+                    for (size_t j = i; statuses && j < nprods; j++)
+                        statuses[j] = status;
+                    break;
+                }
+                ctlLocked = true;
+            }
+            stat = pq_insertLocked(pq, prod, &zd);
         }
-        if (status) {
-            free(pq->riulp);
-            free(pq);
-            return NULL;
+
+        if (stat == ENOERR) {
+            ninserted++;
+            inserted |= prod->info.feedtype;
         }
+        if (statuses)
+            statuses[i] = stat;
     }
 
-    /*
-     * Set the product-queue access-functions.
-     */
-    ctl_setAccessFunctions(pq);
+    if (ctlLocked)
+        (void)ctl_rel(pq, RGN_MODIFIED);
 
-    pq->fd = -1;
-    pq->cursor = TS_NONE;
-    pq->cursor_offset = OFF_NONE;
-    pq->pqe_count = 0;
-    pq->locked_count = 0;
-	pq->smallest_extent_seen = UINT_MAX;
+    pq_unlockIf(pq);
 
-    return pq;
+    for (size_t i = 0; zds && i < nprods; i++)
+        free(zds[i].buf);
+    free(zds);
+
+    // One notification for the whole batch (see pq_insert())
+    if (inserted != NONE)
+        pq_wakeWaiters(pq, inserted);
+    if (ninserted)
+        (void)kill(0, SIGCONT);
+
+    return status;
 }
 
 /**
- * Frees a product-queue.
+ * Inserts data-products into a sharded product-queue. The data-products of
+ * each shard are inserted as one batch in their given order.
  *
- * @param[in,out]  Product queue
+ * @param[in,out] pq        First shard of the product-queue
+ * @param[in]     prods     Data-products
+ * @param[in]     nprods    Number of data-products
+ * @param[out]    statuses  Insertion status of each data-product or NULL
+ * @return                  See `pq_insertBatch()`
  */
-static void
-pq_free(pqueue *const pq)
+static int
+sh_insertBatch(
+        pqueue* const        pq,
+        const product* const prods,
+        const size_t         nprods,
+        int* const           statuses)
 {
-        if(pq == NULL)
-                return;
-        (void)pthread_mutex_destroy(&pq->mutex);
-        if(pq->riulp != NULL)
-        {
-                free(pq->riulp);
-                pq->riulp = NULL;
+    if (nprods == 0)
+        return ENOERR;
+
+    product* const batch = malloc(nprods * sizeof(product));
+    size_t* const  indexes = malloc(nprods * sizeof(size_t));
+    int* const     stats = malloc(nprods * sizeof(int));
+    int            status = ENOERR;
+    unsigned       shard;
+
+    if (batch == NULL || indexes == NULL || stats == NULL) {
+        log_add_syserr("Couldn't allocate batch of %zu data-products", nprods);
+        status = ENOMEM;
+    }
+
+    for (shard = 0; status == ENOERR && shard < pq->nshards; shard++) {
+        size_t n = 0;
+
+        for (size_t i = 0; i < nprods; i++) {
+            if (sh_index(pq, prods[i].info.signature) == shard) {
+                indexes[n] = i;
+                batch[n++] = prods[i];
+            }
         }
-        free(pq);
+
+        if (n) {
+            status = pq_insertBatchHelper(pq->shards[shard], batch, n, stats);
+            for (size_t i = 0; statuses && i < n; i++)
+                statuses[indexes[i]] = stats[i];
+        }
+    }
+
+    if (status && statuses) {
+        // Data-products of the remaining shards weren't processed
+        for (size_t i = 0; i < nprods; i++) {
+            if (sh_index(pq, prods[i].info.signature) >= shard)
+                statuses[i] = status;
+        }
+    }
+
+    free(stats);
+    free(indexes);
+    free(batch);
+
+    return status;
 }
 
 int
-pq_create(const char *path, mode_t mode,
-        int pflags,
-        size_t align,
-        off_t initialsz, /* initial allocation available */
-        size_t nproducts, /* initial rl->nalloc, ... */
-        pqueue **pqp)
+pq_insertBatch(
+        pqueue* const        pq,
+        const product* const prods,
+        const size_t         nprods,
+        int* const           statuses)
+{
+    if (pq == NULL || (prods == NULL && nprods)) {
+        log_add("Invalid argument: pq=%p, prods=%p", pq, prods);
+        return EINVAL;
+    }
+
+    return pq->shards
+            ? sh_insertBatch(pq, prods, nprods, statuses)
+            : pq_insertBatchHelper(pq, prods, nprods, statuses);
+}
+
+unsigned
+pq_getInsertSeq(pqueue* const pq)
 {
-        int oflags = (O_RDWR|O_CREAT|O_TRUNC);
-        int fd;
-        pqueue *pq = NULL;
-        int status = ENOERR;
+    pq_lockIf(pq);
+        const volatile pqctl* const ctlp = pq_getNotifyCtl(pq);
+        const unsigned              seq = ctlp == NULL
+                ? 0
+                : pq->shards
+                    ? ctlp->shardSeq
+                    : ctlp->insertSeq;
+    pq_unlockIf(pq);
+
+    return seq;
+}
+
+int
+pq_waitForNewer(
+        pqueue* const  pq,
+        const unsigned lastSeq,
+        const unsigned timeout)
+{
+    pq_lockIf(pq);
+        const volatile pqctl* const ctlp = pq_getNotifyCtl(pq);
+        const feedtypet             feedtypes = pq->wakeFeedtypes;
+    /*
+     * The instance is unlocked before waiting so that other threads may
+     * access the product-queue. `ctlp` remains valid until pq_close().
+     */
+    pq_unlockIf(pq);
+
+#if defined(__linux__) && defined(SYS_futex) && defined(FUTEX_WAIT_BITSET)
+    if (ctlp != NULL) {
+        uint32_t        seen = lastSeq;
+        struct timespec deadline; // FUTEX_WAIT_BITSET uses an absolute time
+
+        if (timeout) {
+            (void)clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += timeout;
+        }
+
+        /*
+         * Readers of a sharded product-queue wait on the insertions into all
+         * shards. Their feedtypes aren't recorded.
+         */
+        const bool                     sharded = pq->shards != NULL;
+        const volatile uint32_t* const word = sharded
+                ? &ctlp->shardSeq
+                : &ctlp->insertSeq;
+
+        for (;;) {
+            const uint32_t seq = *word;
+
+            if (seq != seen) {
+                if (sharded ||
+                        ctl_isInsertOfInterest(ctlp, seen, seq, feedtypes))
+                    return 0;
+                seen = seq; // Only uninteresting insertions occurred
+            }
 
-        /* enforce minimum alignment */
-        align = (align == 0 ? M_RND_UNIT : _RNDUP(align, M_RND_UNIT));
-        /* TODO: check for absurd align values ? */
+            if (syscall(SYS_futex, word, FUTEX_WAIT_BITSET, seen,
+                    timeout ? &deadline : NULL, NULL,
+                    feedtypes ? feedtypes : FUTEX_BITSET_MATCH_ANY) == 0)
+                return 0; // Awakened by insertion of interest
 
-        if(initialsz != 0)
-                initialsz = (off_t) _RNDUP(initialsz, align);
-        else
-                initialsz = (off_t) align;
+            const int status = errno;
 
-        pq = pq_new(pflags, align, initialsz, nproducts);
-        if(pq == NULL)
-                return errno;
+            if (status == EAGAIN)
+                continue; // Sequence-number changed before sleeping
+            if (status == ETIMEDOUT || status == EINTR)
+                return status;
 
-        if(fIsSet(pflags, PQ_NOCLOBBER))
-                fSet(oflags, O_EXCL);
-        fd = open(path, oflags, mode);
-        if(fd < 0)
-        {
-                status = errno;
-                goto unwind_new;
+            log_add_syserr("futex(2) failure on product-queue %s",
+                    pq->pathname);
+            return status;
         }
-        (void)ensure_close_on_exec(fd);
+    }
+#endif
 
-        pq->fd = fd;
+    /*
+     * Insertion-notification isn't supported for this product-queue. Fall
+     * back to waiting for SIGCONT from an inserting process.
+     */
+    (void)pq_suspend(timeout);
 
-        status = ctl_init(pq, align);
-        if(status != ENOERR)
-                goto unwind_open;
+    return 0;
+}
 
-        (void)strncpy(pq->pathname, path, sizeof(pq->pathname));
-        pq->pathname[sizeof(pq->pathname)-1] = 0;
+void
+pq_setWakeClass(
+        pqueue* const             pq,
+        const prod_class_t* const clssp)
+{
+    feedtypet feedtypes = 0;
 
-        *pqp = pq;
+    if (clssp == NULL || clssp == PQ_CLASS_ALL) {
+        feedtypes = ANY;
+    }
+    else {
+        for (unsigned i = 0; i < clssp->psa.psa_len; i++)
+            feedtypes |= clssp->psa.psa_val[i].feedtype;
+        if (feedtypes == 0)
+            feedtypes = ANY;
+    }
 
-        status = ctl_rel(pq, RGN_MODIFIED);
-        if (status) {
-        	log_error("ctl_rel() failure");
-        	goto unwind_open;
+    pq_lockIf(pq);
+        pq->wakeFeedtypes = feedtypes;
+    pq_unlockIf(pq);
+}
+
+int
+pq_highwater(pqueue *pq, off_t *highwaterp, size_t *maxproductsp)
+{
+    pq_lockIf(pq);
+        /* Read lock pq->xctl. */
+        int status = ctl_get(pq, 0);
+
+        if(status == ENOERR) {
+            if(highwaterp)
+                    *highwaterp = pq->ctlp->highwater;
+            if(maxproductsp)
+                    *maxproductsp = pq->ctlp->maxproducts;
+            (void) ctl_rel(pq, 0);
         }
+    pq_unlockIf(pq);
 
-        return ENOERR;
+    return status;
+}
 
-unwind_open:
-        (void)close(fd);
-        (void)unlink(path);
-        /*FALLTHROUGH*/
-unwind_new:
-        pq_free(pq);
-        return status;
+int pq_isFull(
+    pqueue* const       pq,
+    int* const          isFull)
+{
+    pq_lockIf(pq);
+    int status = ctl_get(pq, 0);
+    if (status == ENOERR) {
+        *isFull = pq->ctlp->isFull;
+        (void)ctl_rel(pq, 0);
+    }                                   /* "pq->ctlp" allocated */
+
+    pq_unlockIf(pq);
+    return status;
 }
 
+int pq_getMostRecent(
+    pqueue* const       pq,
+    timestampt* const   mostRecent)
+{
+    pq_lockIf(pq);
+    int status = ctl_get(pq, 0);
+    if (status == ENOERR) {
+        *mostRecent = pq->ctlp->mostRecent;
+        (void)ctl_rel(pq, 0);
+    }                                   /* "pq->ctlp" allocated */
+
+    pq_unlockIf(pq);
+    return status;
+}
 
-int
-pq_open(
-    const char* const path,
-    int               pflags,
-    pqueue** const    pqp)
+int pq_getMinVirtResTimeMetrics(
+    pqueue* const       pq,
+    timestampt* const   minVirtResTime,
+    off_t* const        size,
+    size_t* const       slots)
 {
-    int               status;
-    pqueue*           pq = pq_new(pflags, M_RND_UNIT, 0, 0);
+    pq_lockIf(pq);
 
-    if (NULL == pq) {
-        status = errno;
-    }
-    else {
-        pq->fd = open(path, fIsSet(pflags, PQ_READONLY) ? O_RDONLY : O_RDWR, 0);
+    int status = ctl_get(pq, 0);
+    if (status == ENOERR) {
+        pqctl*   ctlp = pq->ctlp;
 
-        if (0 > pq->fd) {
-            status = errno;
+        if (METRICS_MAGIC == ctlp->metrics_magic) {
+            *minVirtResTime = ctlp->minVirtResTime;
         }
         else {
-            (void)ensure_close_on_exec(pq->fd);
-            status = ctl_gopen(pq, path);
+            *minVirtResTime = TS_NONE;
+        }
 
-            if (!status) {
-                status = ctl_rel(pq, 0);           /* release control-block */
+        if (METRICS_MAGIC_2 == ctlp->metrics_magic_2) {
+            *size = ctlp->mvrtSize;
+            *slots = ctlp->mvrtSlots;
+        }
+        else {
+            *size = -1;
+            *slots = 0;
+        }
 
-                if (status) {
-                	log_error("ctl_rel() failure");
-                }
-                else {
-					if (!fIsSet(pflags, PQ_READONLY)) {
-						status = ctl_get(pq, RGN_WRITE);
+        (void)ctl_rel(pq, 0);
+    }                                   /* "pq->ctlp" allocated */
 
-						if (!status) {
-							int      rflags = 0;    // control-block unmodified
-							pqctl*   ctlp = pq->ctlp;
+    pq_unlockIf(pq);
+    return status;
+}
 
-							if (WRITE_COUNT_MAGIC != ctlp->write_count_magic) {
-								/*
-								 * This process is the first one of this version
-								 * of the LDM to open the product-queue for
-								 * writing. Initialize the "write count"
-								 * mechanism.
-								 */
-								ctlp->write_count_magic = WRITE_COUNT_MAGIC;
-								ctlp->write_count = 0;
-								rflags = RGN_MODIFIED;
-							}
+int pq_clearMinVirtResTimeMetrics(
+    pqueue* const       pq)
+{
+    pq_lockIf(pq);
 
-							if (MAX_WRITE_COUNT > ctlp->write_count) {
-								ctlp->write_count++;
-								rflags = RGN_MODIFIED;
-							}
-							else {
-								log_error("Too many writers (%u) to "
-										"product-queue (%s)", ctlp->write_count,
-										path);
+    int status = ctl_get(pq, RGN_WRITE);
+    if (status == ENOERR) {
+        pq->ctlp->minVirtResTime = TS_NONE;
+        pq->ctlp->mvrtSize = -1;
+        pq->ctlp->mvrtSlots = 0;
 
-								status = EACCES;    /* too many writers */
-							}
+        (void)ctl_rel(pq, RGN_MODIFIED);
+    }                                   /* "pq->ctlp" allocated */
 
-							if (!status) {
-								if (METRICS_MAGIC != ctlp->metrics_magic) {
-									/*
-									 * This process is the first one of this
-									 * version of the LDM to open the
-									 * product-queue for writing.  Initialize
-									 * the additional metrics.
-									 */
-									ctlp->metrics_magic = METRICS_MAGIC;
-									ctlp->mostRecent = TS_NONE;
-									ctlp->minVirtResTime = TS_NONE;
-									ctlp->isFull = 0;
-									rflags = RGN_MODIFIED;
-								}
-								if (METRICS_MAGIC_2 != ctlp->metrics_magic_2) {
-									/*
-									 * This process is the first one of this
-									 * version of the LDM to open the
-									 * product-queue for writing.  Initialize
-									 * the additional metrics.
-									 */
-									ctlp->metrics_magic_2 = METRICS_MAGIC_2;
-									ctlp->mvrtSize = -1;
-									ctlp->mvrtSlots = 0;
-									rflags = RGN_MODIFIED;
-								}
+    pq_unlockIf(pq);
+    return status;
+}
 
-								(void)strncpy(pq->pathname, path,
-										sizeof(pq->pathname));
-								pq->pathname[sizeof(pq->pathname)-1] = 0;
-							}
+int
+pq_stats(
+		pqueue* const pq,
+        size_t* const nprodsp,
+        size_t* const nfreep,
+        size_t* const nemptyp,
+        size_t* const nbytesp,
+        size_t* const maxprodsp,
+        size_t* const maxfreep,
+        size_t* const minemptyp,
+        size_t* const maxbytesp,
+        double* const age_oldestp,
+        size_t* const maxextentp)
+{
+    pq_lockIf(pq);
+        /* Read lock pq->ctl. */
+        int status = ctl_get(pq, 0);
 
-							const int stat = ctl_rel(pq, rflags);
-							if (stat) {
-								log_error("ctl_rel() failure");
-								if (status == 0)
-									status = stat;
-							}
-						}                           /* ctl_get() success */
-					}                               /* open for writing */
-                } // `ctl_rel()` success
-            }                                   /* ctl_gopen() success */
+        if(status == ENOERR) {
+            if(nprodsp)
+                *nprodsp = pq->rlp->nelems;
+            if(nfreep)
+                *nfreep = pq->rlp->nfree;
+            if(maxextentp)
+                *maxextentp = pq->rlp->maxfextent;
+            if(nemptyp)
+                *nemptyp = pq->rlp->nempty;
+            if(nbytesp)
+                *nbytesp = pq->rlp->nbytes;
+            if(maxprodsp)
+                *maxprodsp = pq->rlp->maxelems;
+            if(maxfreep)
+                *maxfreep = pq->rlp->maxfree;
+            if(minemptyp)
+                *minemptyp = pq->rlp->minempty;
+            if(maxbytesp)
+                *maxbytesp = pq->rlp->maxbytes;
+            if(age_oldestp) {
+                timestampt ts0;
+                tqelem *tqep;
 
-            if (status) {
-                (void)close(pq->fd);
-                pq->fd = -1;
+                tqep = tqe_first(pq->tqp); /* get oldest */
+                if(tqep != NULL) {
+                  (void)set_timestamp(&ts0);
+                  *age_oldestp = d_diff_timestamp(&ts0, &tqep->tv);
+                } else {
+                  *age_oldestp = 0;
+                }
             }
-        }                                       /* pq->fd >= 0 */
 
-        if (status) {
-            pq_free(pq);
-        }
-        else {
-            *pqp = pq;
+            (void) ctl_rel(pq, 0);
         }
-    }                                           /* pq != NULL */
-
-    return status;
-}
-
-int
-pq_getFlags(
-        pqueue* const pq)
-{
-    pq_lockIf(pq);
-        int pflags = pq->pflags;
     pq_unlockIf(pq);
 
-    return pflags;
+    return status;
 }
 
 int
-pq_close(pqueue *pq)
+pq_allocStats(
+        pqueue* const restrict         pq,
+        pq_alloc_stats* const restrict stats)
 {
-    int status = ENOERR;                    /* success */
-    int fd = -1;
-
-    if (pq == NULL)
-            return 0;
-
     pq_lockIf(pq);
-        fd = pq->fd;
+    int status = ctl_get(pq, 0);
 
-        if(pq->riulp != NULL)
-        {
-                while(pq->riulp->nelems > 2)
-                {
-                        off_t offset =
-                                pq->riulp->rp[pq->riulp->nelems -1].offset;
-                        if(offset == pq->ixo || offset == 0)
-                                continue;
-                        (void) (pq->mtof)(pq, offset, 0);
-                }
+    if (status == ENOERR) {
+        const regionl* const rl = pq->rlp;
+        const size_t         dataSize = (size_t)(pq->ixo - pq->datao);
+
+        stats->nfree = rl->nfree;
+        stats->freeBytes = dataSize - rl->nbytes;
+        stats->maxFreeExtent = rl->maxfextent;
+        stats->fragmentation = stats->freeBytes == 0
+                ? 0
+                : 1 - (double)stats->maxFreeExtent / stats->freeBytes;
+        if (EVICT_MAGIC == pq->ctlp->evict_magic) {
+            stats->nevicted = pq->ctlp->nevicted;
+            stats->nevictedForSlot = pq->ctlp->nevictedForSlot;
+            stats->evictedBytes = pq->ctlp->evictedBytes;
         }
-
-        if(pq->rlp != NULL)
-        {
-                (void)(pq->mtof)(pq, pq->ixo, RGN_NOLOCK);
-                pq->rlp = NULL;
+        else {
+            stats->nevicted = stats->nevictedForSlot = stats->evictedBytes = 0;
         }
-
-        if (fIsSet(pq->pflags, PQ_READONLY)) {
-            if (NULL != pq->ctlp) {
-                status = ctl_rel(pq, 0);
-
-                if (status)
-                	log_error("ctl_rel() failure");
-            }
+        stats->binned = rl_bins(pq->rlp) != NULL;
+        stats->nrecovered = JOURNAL_MAGIC == pq->ctlp->journal_magic
+                ? pq->ctlp->nrecovered
+                : 0;
+        if (COMPRESS_MAGIC == pq->ctlp->compress_magic) {
+            stats->ncompressed = pq->ctlp->nzipped;
+            stats->compressedRawBytes = pq->ctlp->zipRawBytes;
+            stats->compressedBytes = pq->ctlp->zipBytes;
         }
         else {
-            status = ctl_get(pq, RGN_WRITE);
-
-            if (!status) {
-                int rflags;
-
-                if (0 < pq->ctlp->write_count) {
-                    pq->ctlp->write_count--;
-                    rflags = RGN_MODIFIED;
-                }
-                else {
-                    log_error("Write-count of product-queue prematurely 0");
-
-                    rflags = 0;                 /* unmodified */
-                    status = EOVERFLOW;
-                }
-
-                const int stat = ctl_rel(pq, rflags);
-
-                if (stat) {
-                	log_error("ctl_rel() failure");
-                	if (status == 0)
-                		status = stat;
-                }
-            }
-        }                                       /* was opened for writing */
-
-#ifdef HAVE_MMAP
-        if(pq->base != NULL && pq->ftom == mm0_ftom)
-        {
-                /* special case, time to unmap the whole thing */
-                int mflags = 0; /* TODO: translate rflags to mflags */
-                (void) unmapwrap(pq->base, 0, TOTAL_SIZE(pq), mflags);
-                pq->base = NULL;
+            stats->ncompressed = stats->compressedRawBytes =
+                    stats->compressedBytes = 0;
         }
-#endif
 
+        (void)ctl_rel(pq, 0);
+    }
     pq_unlockIf(pq);
-    pq_free(pq);
-
-    if(fd > -1 && close(fd) < 0 && !status)
-            status = errno;
 
     return status;
 }
 
-const char* pq_getPathname(
-        pqueue* pq)
+int
+pq_getTelemetry(
+        pqueue* const restrict   pq,
+        pq_telemetry             slots[PQ_TELEMETRY_SIZE],
+        unsigned* const restrict nslots)
 {
     pq_lockIf(pq);
-        const char* pathname = pq->pathname;
-    pq_unlockIf(pq);
+        const volatile pqctl* const ctlp = pq_getNotifyCtl(pq);
+    pq_unlockIf(pq); // `ctlp` remains valid until pq_close()
+
+    if (ctlp == NULL || TELEMETRY_MAGIC != ctlp->telemetry_magic)
+        return ENOSYS;
+
+    const int64_t now = time(NULL);
+    unsigned      n = 0;
+
+    // A slot that's reset or reused while it's copied is skipped
+    for (int64_t second = now - PQ_TELEMETRY_SIZE + 1; second <= now;
+            second++) {
+        const volatile pq_telemetry* const slot =
+                ctlp->telemetry + second % PQ_TELEMETRY_SIZE;
+
+        if (slot->second != second)
+            continue;
+        __sync_synchronize();
+        slots[n].insertedBytes = slot->insertedBytes;
+        slots[n].evictedBytes = slot->evictedBytes;
+        slots[n].lockWaitUs = slot->lockWaitUs;
+        slots[n].ninserted = slot->ninserted;
+        slots[n].nevicted = slot->nevicted;
+        slots[n].minResidenceMs = slot->minResidenceMs;
+        slots[n].nlocks = slot->nlocks;
+        slots[n].maxLockWaitUs = slot->maxLockWaitUs;
+        slots[n].nmissed = slot->nmissed;
+        __sync_synchronize();
+        if (slot->second == second) {
+            slots[n].second = second;
+            n++;
+        }
+    }
+    *nslots = n;
 
-    return pathname;
+    return 0;
 }
 
 int
-pq_pagesize(pqueue *pq)
+pq_registerReader(pqueue* const pq)
 {
-    /*
-     * Allow the caller to figure out what the default would be prior to
-     * calling `pq_create()`.
-     */
-    if(pq == NULL)
-        return (int)pagesize();
+    int status = 0;
 
-    // Else, tell the caller what it is
     pq_lockIf(pq);
-        int pagesz = (int) pq->pagesz;
-    pq_unlockIf(pq);
-
-    return pagesz;
-}
+        if (pq->rdSlot == NULL) {
+            const volatile pqctl* const ctlp = pq_getNotifyCtl(pq);
 
-size_t
-pq_getDataSize(
-    pqueue* const       pq)
-{
-    pq_lockIf(pq);
-        size_t size = pq->ixo - pq->datao;
+            if (ctlp == NULL || READER_MAGIC != ctlp->reader_magic) {
+                log_add("Product-queue %s doesn't have a reader-registry",
+                        pq->pathname);
+                status = ENOSYS;
+            }
+            else {
+                status = rd_register(pq);
+            }
+        }
     pq_unlockIf(pq);
 
-    return size;
+    return status;
 }
 
-
-typedef struct {
-    time_t      start;
-    /*
-     * Hostnames are limited to 255 bytes.  See
-     * <http://www.opengroup.org/onlinepubs/007908799/xns/gethostname.html>.
-     */
-    char        hostname[256];
-} FutureEntry;
-
-
-static inline int
-compareFutureEntries(
-    const void* const   entry1,
-    const void* const   entry2)
+/*
+ * Compares registered readers by cursor, slowest first.
+ */
+static int
+rd_compare(const void* const left, const void* const right)
 {
-    const char* name1 = ((FutureEntry*)entry1)->hostname;
-    const char* name2 = ((FutureEntry*)entry2)->hostname;
+    const pq_reader* const l = left;
+    const pq_reader* const r = right;
 
-    return strcmp(name1, name2);
-}
+    if (tvIsNone(l->cursor))
+        return tvIsNone(r->cursor) ? 0 : 1;
+    if (tvIsNone(r->cursor))
+        return -1;
 
+    return tvCmp(l->cursor, r->cursor, <)
+            ? -1
+            : tvCmp(l->cursor, r->cursor, >) ? 1 : 0;
+}
 
-static void
-vetCreationTime(
-    const prod_info* const      info)
+int
+pq_getReaders(
+        pqueue* const restrict   pq,
+        pq_reader                readers[PQ_MAX_READERS],
+        unsigned* const restrict nreaders)
 {
-    /*
-     * Vet the creation-time of a data-product.
-     */
-    timestampt  initialSearchTime = info->arrival;
-    timestampt  now;
-
-    /*
-     * Keep the following consonant with the temporal backoff in
-     * pq_setCursorFromSignature().
-     */
-    initialSearchTime.tv_sec -= SEARCH_BACKOFF;
-
-    (void)set_timestamp(&now);
-
-    if (tvCmp(initialSearchTime, now, >)) {
-        const char* const       origin = info->origin;
-        char*                   cp = strstr(origin, "_v_");
-        size_t                  len =
-            cp == NULL ?  strlen(origin) : (size_t)(cp - origin);
-
-        if (log_is_enabled_info) {
-            log_warning("Future product from \"%*s\". "
-                    "Fix local or ingest clock. %s",
-                    (int)len, origin, s_prod_info(NULL, 0, info, 0));
-        }
-        else {
-            FutureEntry         targetEntry;
-            FutureEntry* const* treeEntry;
-            static void*        root = NULL;
-#           define              FUTURE_INTERVAL (60*60) /* 1 h */
-
-            if (len > (sizeof(targetEntry.hostname)-1))
-                len = sizeof(targetEntry.hostname) - 1;
-            (void)memcpy(targetEntry.hostname, origin, len);
-            targetEntry.hostname[len] = 0;
+    pq_lockIf(pq);
+        const volatile pqctl* const ctlp = pq_getNotifyCtl(pq);
+    pq_unlockIf(pq); // `ctlp` remains valid until pq_close()
 
-            treeEntry = tfind(&targetEntry, &root, compareFutureEntries);
+    if (ctlp == NULL || READER_MAGIC != ctlp->reader_magic)
+        return ENOSYS;
 
-            if (treeEntry != NULL) {
-                FutureEntry*    entry = *treeEntry;
-                time_t          now = time(NULL);
+    const timestampt newest = ctlp->mostRecent;
+    unsigned         n = 0;
 
-                if (entry->start <= now) {
-                    log_warning("Future product from \"%s\". "
-                            "Fix local or ingest clock. %s", entry->hostname,
-                            s_prod_info(NULL, 0, info, 0));
+    for (int i = 0; i < PQ_MAX_READERS; i++) {
+        const volatile rdslot* const slot = ctlp->readers + i;
+        const pid_t                  pid = slot->pid;
 
-                    entry->start = now + FUTURE_INTERVAL;
-                }
-            }
-            else {
-                FutureEntry*    newEntry = malloc(sizeof(FutureEntry));
+        // A process that no longer exists didn't release its slot
+        if (pid == 0 || (kill(pid, 0) == -1 && errno == ESRCH))
+            continue;
 
-                log_warning("Future product from \"%s\". "
-                        "Fix local or ingest clock. %s", targetEntry.hostname,
-                    s_prod_info(NULL, 0, info, 0));
+        pq_reader* const reader = readers + n++;
 
-                if (newEntry != NULL) {
-                    newEntry->start = time(NULL) + FUTURE_INTERVAL;
-                    (void)strcpy(newEntry->hostname, targetEntry.hostname);
+        reader->pid = pid;
+        reader->cursor = rd_timestamp(slot->cursor);
+        reader->nmissed = slot->nmissed;
+        reader->lag = (tvIsNone(reader->cursor) || tvIsNone(newest) ||
+                        tvCmp(newest, reader->cursor, <))
+                ? -1
+                : d_diff_timestamp(&newest, &reader->cursor);
+    }
+    qsort(readers, n, sizeof(*readers), rd_compare);
+    *nreaders = n;
 
-                    (void)tsearch(newEntry, &root, compareFutureEntries);
-                }                       /* "newEntry" allocated */
-            }                           /* host not in database */
-        }                               /* non-verbose logging */
-    }                                   /* product created in future */
+    return 0;
 }
 
-int
-pq_insertNoSig(pqueue *pq, const product *prod)
+/*
+ * A part of a scan of a snapshot of the indexes of a product-queue (see
+ * `pq_scan()`). Each part scans a contiguous range of the time-queue elements
+ * and of the region slots into its own statistics.
+ */
+typedef struct {
+    regionl*      rl;
+    tqueue*       tq;
+    sx*           sxp;
+    const md*     mdp;                  /* metadata sidecar or NULL */
+    off_t         datao;
+    off_t         ixo;
+    size_t        align;
+    timestampt    now;
+    size_t        tqBegin;              /* time-queue elements */
+    size_t        tqEnd;
+    size_t        rlBegin;              /* region slots */
+    size_t        rlEnd;
+    timestampt    oldest;
+    timestampt    youngest;
+    pq_scan_stats stats;
+    pthread_t     thread;
+    bool          threaded;
+} scan_part;
+
+/*
+ * Returns the age-histogram bin of an age in seconds (see `pq_feed_stats`).
+ */
+static unsigned
+scan_ageBin(const double age)
 {
-    int status = ENOERR;
+    unsigned bin = 0;
 
-    pq_lockIf(pq);
-        size_t extent;
-        void *vp = NULL;
-        sxelem *sxep;
-        
-        log_assert(pq != NULL);
-        log_assert(prod != NULL);
+    for (double limit = 1; age >= limit && bin < PQ_SCAN_NAGES - 1;
+            limit *= 2)
+        bin++;
 
-        if(fIsSet(pq->pflags, PQ_READONLY)) {
-                log_debug("pq_insertNoSig(): queue is read-only");
-                status = EACCES;
-                goto unwind_lock;
-        }
+    return bin;
+}
 
-        // log_debug_1("Getting product size");
-        extent = xlen_product(prod);
-        if (extent > pq_getDataSize(pq)) {
-                log_debug("pq_insertNoSig(): product is too big");
-                status = PQ_BIG;
-                goto unwind_lock;
-        }
+static void*
+scan_run(void* const arg)
+{
+    scan_part* const     part = arg;
+    pq_scan_stats* const stats = &part->stats;
 
-        /*
-         * Write lock pq->ctl.
-         */
-        // log_debug_1("Getting control header");
-        status = ctl_get(pq, RGN_WRITE);
-        if(status != ENOERR) {
-                log_debug("pq_insertNoSig(): ctl_get() failure");
-                goto unwind_lock;
-        }
+    for (size_t rlix = part->rlBegin; rlix < part->rlEnd; rlix++) {
+        const region* const rp = part->rl->rp + rlix;
 
-        // log_debug_1("Getting space for product");
-        status = rpqe_new(pq, extent, prod->info.signature, &vp, &sxep);
-        if(status != ENOERR) {
-                log_debug("pq_insertNoSig(): rpqe_new() failure");
-                goto unwind_ctl;
+        if (rp->offset == OFF_NONE) {
+            stats->nempty++;
+            continue;
         }
 
-        // log_debug_1("XDR-ing product");
-                                                /* cast away const'ness */
-        if(xproduct(vp, extent, XDR_ENCODE, (product *)prod) == 0)
-        {
-                log_debug("pq_insertNoSig(): xproduct() failure");
-                status = EIO;
-                goto unwind_rgn;
+        const size_t extent = Extent(rp);
+
+        if (rp->offset < part->datao || rp->offset + (off_t)extent > part->ixo
+                || rp->offset % part->align != 0)
+            stats->badRegions++;
+        if (IsAlloc(rp)) {
+            stats->nregions++;
+            stats->usedBytes += extent;
         }
+        else {
+            stats->nfree++;
+            stats->freeBytes += extent;
+        }
+    }
 
-        log_assert(pq->tqp != NULL && tq_HasSpace(pq->tqp));
-        status = tq_add(pq->tqp, sxep->offset);
-        if(status != ENOERR) {
-                log_debug("pq_insertNoSig(): tq_add() failure");
-                goto unwind_rgn;
+    for (size_t i = part->tqBegin; i < part->tqEnd; i++) {
+        const tqelem* const tqep = part->tq->tqep + i;
+        region*             rp;
+
+        if (tqep->fblk == (fblk_t)OFF_NONE)
+            continue;                   /* on the free list */
+
+        stats->nprods++;
+        if (!rl_r_findUnlocked(part->rl, tqep->offset, &rp)) {
+            stats->badTimes++;
+            continue;
         }
 
-        // log_debug_1("Setting timestamp");
-        (void)set_timestamp(&pq->ctlp->mostRecent);
-        // log_debug_1("Vetting creation time");
-        vetCreationTime(&prod->info);
-        /*FALLTHROUGH*/
+        if (TV_CMP_LT(tqep->tv, part->oldest))
+            part->oldest = tqep->tv;
+        if (TV_CMP_LT(part->youngest, tqep->tv))
+            part->youngest = tqep->tv;
 
-unwind_rgn:
-        // log_debug_1("Releasing region");
-        (void) rgn_rel(pq, sxep->offset, status == ENOERR ? RGN_MODIFIED : 0);
-        /*FALLTHROUGH*/
+        const size_t        rlix = (size_t)(rp - part->rl->rp);
+        const mdrec* const  rec = part->mdp && rlix < part->mdp->nalloc
+                ? part->mdp->recs + rlix
+                : NULL;
+        pq_feed_stats*      feed = &stats->unknown;
 
-unwind_ctl:
-        // log_debug_1("Releasing control header");
-        (void) ctl_rel(pq, RGN_MODIFIED);
-        /*FALLTHROUGH*/
+        if (rec != NULL && rec->identOff != 0) {
+            sxelem* sxep;
 
-unwind_lock:
-        // log_debug_1("Unlocking");
-        // log_debug_1("Returning %d", status);
-    pq_unlockIf(pq);
+            if (rec->feedtype)
+                feed = stats->feeds + __builtin_ctz(rec->feedtype);
+            if (!sx_find(part->sxp, rec->signature, &sxep)
+                    || sxep->offset != tqep->offset)
+                stats->badSigs++;
+        }
 
-    return status;
+        feed->nprods++;
+        feed->nbytes += Extent(rp);
+        feed->ages[scan_ageBin(d_diff_timestamp(&part->now, &tqep->tv))]++;
+    }
+
+    return NULL;
 }
 
-int
-pq_insert(pqueue *pq, const product *prod)
+/*
+ * Adds the statistics of one product-queue feedtype to those of another.
+ */
+static void
+scan_addFeed(
+        pq_feed_stats* const restrict       sum,
+        const pq_feed_stats* const restrict feed)
 {
-        int status = pq_insertNoSig(pq, prod);
-        if(status == ENOERR)
-        {
-                /*
-                 * Inform others in our process group
-                 * that there is new data available.
-                 * (see pq_suspend() below.)
-                 *  SIGCONT is ignored by default...
-                 */
-                (void)kill(0, SIGCONT);
-        }
-        return status;
+    sum->nprods += feed->nprods;
+    sum->nbytes += feed->nbytes;
+    for (int i = 0; i < PQ_SCAN_NAGES; i++)
+        sum->ages[i] += feed->ages[i];
 }
 
 int
-pq_highwater(pqueue *pq, off_t *highwaterp, size_t *maxproductsp)
+pq_scan(
+        pqueue* const restrict        pq,
+        unsigned                      nthreads,
+        pq_scan_stats* const restrict stats)
 {
     pq_lockIf(pq);
-        /* Read lock pq->xctl. */
-        int status = ctl_get(pq, 0);
 
-        if(status == ENOERR) {
-            if(highwaterp)
-                    *highwaterp = pq->ctlp->highwater;
-            if(maxproductsp)
-                    *maxproductsp = pq->ctlp->maxproducts;
-            (void) ctl_rel(pq, 0);
-        }
-    pq_unlockIf(pq);
+    int status = ctl_get(pq, 0);
 
-    return status;
-}
+    if (status) {
+        log_errno(status, "Couldn't get control-header");
+        pq_unlockIf(pq);
+        return status;
+    }
 
-int pq_isFull(
-    pqueue* const       pq,
-    int* const          isFull)
-{
-    pq_lockIf(pq);
-    int status = ctl_get(pq, 0);
-    if (status == ENOERR) {
-        *isFull = pq->ctlp->isFull;
-        (void)ctl_rel(pq, 0);
-    }                                   /* "pq->ctlp" allocated */
+    /*
+     * Copy the indexes so that the control-header is held only briefly. The
+     * copy is page-aligned like the original because the indexes are aligned
+     * relative to memory.
+     */
+    const size_t ixsz = pq->ixsz;
+    void*        ixp;
 
-    pq_unlockIf(pq);
-    return status;
-}
+    if (posix_memalign(&ixp, pq->pagesz, ixsz))
+        ixp = NULL;
+    const size_t mdo = pq->mdp ? pq->ctlp->mdo : 0;
+    const bool   sxTable = fIsSet(pq->pflags, PQ_SXTABLE);
+    const size_t align = pq->ctlp->align;
 
-int pq_getMostRecent(
-    pqueue* const       pq,
-    timestampt* const   mostRecent)
-{
-    pq_lockIf(pq);
-    int status = ctl_get(pq, 0);
-    if (status == ENOERR) {
-        *mostRecent = pq->ctlp->mostRecent;
-        (void)ctl_rel(pq, 0);
-    }                                   /* "pq->ctlp" allocated */
+    if (ixp != NULL)
+        (void)memcpy(ixp, pq->ixp, ixsz);
+    (void)ctl_rel(pq, 0);
+
+    const off_t  datao = pq->datao;
+    const off_t  ixo = pq->ixo;
+    const size_t nalloc = pq->nalloc;
 
     pq_unlockIf(pq);
-    return status;
+
+    if (ixp == NULL) {
+        log_syserr("Couldn't allocate %zu bytes for a copy of the indexes",
+                ixsz);
+        return ENOMEM;
+    }
+
+    regionl* rl;
+    tqueue*  tq;
+    fb*      fbp;
+    sx*      sxp;
+
+    (void)ix_ptrs(ixp, ixsz, nalloc, align, sxTable, &rl, &tq, &fbp, &sxp);
+
+    if (nthreads == 0) {
+        const long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = nprocs > 0 ? (unsigned)nprocs : 1;
+    }
+    // Parts smaller than this aren't worth a thread
+    const size_t minPart = 256;
+    if (nthreads > nalloc / minPart)
+        nthreads = nalloc / minPart ? (unsigned)(nalloc / minPart) : 1;
+
+    scan_part* const parts = calloc(nthreads, sizeof(scan_part));
+
+    if (parts == NULL) {
+        log_syserr("Couldn't allocate %u scan parts", nthreads);
+        free(ixp);
+        return ENOMEM;
+    }
+
+    const size_t tqBegin = TQ_HEAD + 1;
+    const size_t tqEnd = nalloc + TQ_OVERHEAD_ELEMS;
+    const size_t rlBegin = RL_EMPTY_HD;
+    const size_t rlEnd = nalloc + RL_FREE_OVERHEAD;
+    timestampt   now;
+
+    (void)set_timestamp(&now);
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        scan_part* const part = parts + i;
+
+        part->rl = rl;
+        part->tq = tq;
+        part->sxp = sxp;
+        part->mdp = mdo ? (const md*)((char*)ixp + mdo) : NULL;
+        part->datao = datao;
+        part->ixo = ixo;
+        part->align = align;
+        part->now = now;
+        part->tqBegin = tqBegin + (tqEnd - tqBegin) * i / nthreads;
+        part->tqEnd = tqBegin + (tqEnd - tqBegin) * (i + 1) / nthreads;
+        part->rlBegin = rlBegin + (rlEnd - rlBegin) * i / nthreads;
+        part->rlEnd = rlBegin + (rlEnd - rlBegin) * (i + 1) / nthreads;
+        part->oldest = TS_ENDT;
+        part->youngest = TS_ZERO;
+
+        // The first part is scanned by this thread
+        part->threaded = i > 0 &&
+                pthread_create(&part->thread, NULL, scan_run, part) == 0;
+    }
+    for (unsigned i = 0; i < nthreads; i++) {
+        if (!parts[i].threaded)
+            (void)scan_run(parts + i);
+    }
+
+    timestampt oldest = TS_ENDT;
+    timestampt youngest = TS_ZERO;
+
+    (void)memset(stats, 0, sizeof(*stats));
+    for (unsigned i = 0; i < nthreads; i++) {
+        const scan_part* const     part = parts + i;
+        const pq_scan_stats* const ps = &part->stats;
+
+        if (part->threaded)
+            (void)pthread_join(part->thread, NULL);
+
+        stats->nprods += ps->nprods;
+        stats->nregions += ps->nregions;
+        stats->nfree += ps->nfree;
+        stats->nempty += ps->nempty;
+        stats->usedBytes += ps->usedBytes;
+        stats->freeBytes += ps->freeBytes;
+        stats->badTimes += ps->badTimes;
+        stats->badRegions += ps->badRegions;
+        stats->badSigs += ps->badSigs;
+        for (int j = 0; j < PQ_SCAN_NFEEDS; j++)
+            scan_addFeed(stats->feeds + j, ps->feeds + j);
+        scan_addFeed(&stats->unknown, &ps->unknown);
+        if (TV_CMP_LT(part->oldest, oldest))
+            oldest = part->oldest;
+        if (TV_CMP_LT(youngest, part->youngest))
+            youngest = part->youngest;
+    }
+
+    if (stats->nprods) {
+        stats->ageOldest = d_diff_timestamp(&now, &oldest);
+        stats->ageYoungest = d_diff_timestamp(&now, &youngest);
+    }
+    stats->countsAgree = stats->nprods == tq->nelems - TQ_OVERHEAD_ELEMS
+            && stats->nprods <= stats->nregions
+            && stats->nregions == rl->nelems
+            && stats->nfree == rl->nfree
+            && stats->nempty == rl->nempty
+            && stats->usedBytes == (uint64_t)rl->nbytes
+            && stats->usedBytes + stats->freeBytes == (uint64_t)(ixo - datao);
+    stats->nthreads = nthreads;
+
+    free(parts);
+    free(ixp);
+
+    return 0;
 }
 
-int pq_getMinVirtResTimeMetrics(
-    pqueue* const       pq,
-    timestampt* const   minVirtResTime,
-    off_t* const        size,
-    size_t* const       slots)
+/**
+ * Deletes the data-products that prevent a product-queue from being resized:
+ * those that extend beyond the new end of the data segment and then the oldest
+ * ones until the remaining ones and the free regions between them will fit in
+ * the new number of slots.
+ *
+ * @pre                   The control-header is write-locked.
+ * @param[in,out] pq      Product-queue
+ * @param[in]     ixo     New offset to the indexes, i.e., the end of the data
+ *                        segment
+ * @param[in]     nalloc  New number of slots
+ * @retval        0       Success
+ * @retval        EBUSY   A data-product or reserved region that must be
+ *                        deleted is in use. `log_error()` called.
+ * @retval     PQ_CORRUPT The product-queue is corrupt. `log_error()` called.
+ * @retval     PQ_SYSTEM  System error. `log_error()` called.
+ */
+static int
+resize_evict(
+        pqueue* const pq,
+        const off_t   ixo,
+        const size_t  nalloc)
 {
-    pq_lockIf(pq);
+    regionl* const      rl = pq->rlp;
+    const tqelem* const nil = pq->tqp->tqep + TQ_NIL;
+    int                 status = 0;
 
-    int status = ctl_get(pq, 0);
-    if (status == ENOERR) {
-        pqctl*   ctlp = pq->ctlp;
+    for (tqelem* tqep = tqe_first(pq->tqp); status == 0 && tqep != NULL &&
+            tqep != nil; ) {
+        tqelem* const next = tq_next(pq->tqp, tqep);
+        const size_t  rlix = rl_find(rl, tqep->offset);
 
-        if (METRICS_MAGIC == ctlp->metrics_magic) {
-            *minVirtResTime = ctlp->minVirtResTime;
+        if (rlix == RL_NONE) {
+            log_error("No region for time-entry: offset=%ld",
+                    (long)tqep->offset);
+            status = PQ_CORRUPT;
         }
         else {
-            *minVirtResTime = TS_NONE;
-        }
+            const size_t extent = Extent(rl->rp + rlix);
 
-        if (METRICS_MAGIC_2 == ctlp->metrics_magic_2) {
-            *size = ctlp->mvrtSize;
-            *slots = ctlp->mvrtSlots;
+            if (tqep->offset + (off_t)extent > ixo) {
+                prod_info        info;
+                const timestampt inserted = tqep->tv;
+
+                status = pq2_try_del_prod(pq, tqep, rlix, &info);
+                if (status == EACCES) {
+                    log_error("Data-product at offset %ld is in use",
+                            (long)tqep->offset);
+                    status = EBUSY;
+                }
+                else if (status == 0) {
+                    if (EVICT_MAGIC == pq->ctlp->evict_magic) {
+                        pq->ctlp->nevicted++;
+                        pq->ctlp->evictedBytes += extent;
+                    }
+                    tm_evict(pq->ctlp, extent, &inserted,
+                            rd_evict(pq->ctlp, &inserted));
+                    xdr_free(xdr_prod_info, (char*)&info);
+                }
+            }
         }
-        else {
-            *size = -1;
-            *slots = 0;
+        tqep = next;
+    }
+
+    // What's left beyond the end is reserved by `pqe_new()`
+    for (size_t rlix = RL_EMPTY_HD;
+            status == 0 && rlix < rl->nalloc + RL_FREE_OVERHEAD; rlix++) {
+        const region* const rep = rl->rp + rlix;
+
+        if (rep->offset != OFF_NONE && IsAlloc(rep) &&
+                rep->offset + (off_t)Extent(rep) > ixo) {
+            log_error("Region at offset %ld is reserved", (long)rep->offset);
+            status = EBUSY;
         }
+    }
 
-        (void)ctl_rel(pq, 0);
-    }                                   /* "pq->ctlp" allocated */
+    // One more slot for a free region at the end
+    while (status == 0 && rl->nelems && rl->nelems + rl->nfree + 1 > nalloc) {
+        status = pq2_del_oldest(pq);
+        if (status == EACCES)
+            status = EBUSY;
+    }
 
-    pq_unlockIf(pq);
     return status;
 }
 
-int pq_clearMinVirtResTimeMetrics(
-    pqueue* const       pq)
-{
-    pq_lockIf(pq);
+/**
+ * Makes a resized product-queue use its new indexes. The new index region is
+ * written to the file before the control-header refers to it. If the new
+ * region overlaps the old one (e.g., if only the number of slots changes),
+ * then it's first staged past the end of the file and the copy is journaled
+ * so that `ctl_get()` can finish it if this process dies in the middle (see
+ * `ctl_finishResize()`).
+ *
+ * @pre                 The control-header is write-locked.
+ * @param[in,out] pq    Product-queue
+ * @param[in]     ix    New index region
+ * @param[in]     ixsz  Extent of the new index region in bytes
+ * @param[in]     ixo   New offset to the indexes
+ * @param[in]  nalloc   New number of slots
+ * @param[in]  sxTable  Whether the new signature index is an open-addressing
+ *                      table
+ * @param[in]  mdo      Offset to the new metadata sidecar from `ix` or 0
+ * @retval     0        Success
+ * @return              `<errno.h>` error-code. `log_error()` called.
+ */
+static int
+resize_commit(
+        pqueue* const restrict    pq,
+        const void* const restrict ix,
+        const size_t              ixsz,
+        const off_t               ixo,
+        const size_t              nalloc,
+        const bool                sxTable,
+        const size_t              mdo)
+{
+    pqctl* const   ctlp = pq->ctlp;
+    const pqresize rs = {0, ixo, ixsz, nalloc, mdo, sxTable};
+    const bool     overlaps = ixo < TOTAL_SIZE(pq) &&
+            pq->ixo < ixo + (off_t)ixsz;
+    off_t          stage = 0;
+    int            status;
+
+    if (!overlaps) {
+        // The old layout remains valid until the control-header changes
+        status = ctl_writeIndexes(pq, ix, ixsz, ixo);
+        if (status)
+            return status;
+    }
+    else {
+        struct stat sb;
 
-    int status = ctl_get(pq, RGN_WRITE);
-    if (status == ENOERR) {
-        pq->ctlp->minVirtResTime = TS_NONE;
-        pq->ctlp->mvrtSize = -1;
-        pq->ctlp->mvrtSlots = 0;
+        if (fstat(pq->fd, &sb)) {
+            log_syserr("Couldn't get size of product-queue");
+            return errno;
+        }
+        // Past anything that a process without a lock might be looking at
+        stage = _RNDUP(sb.st_size > ixo + (off_t)ixsz
+                ? sb.st_size : ixo + (off_t)ixsz, pq->pagesz);
+        status = fgrow(pq->fd, stage + (off_t)ixsz,
+                fIsSet(pq->pflags, PQ_SPARSE));
+        if (status) {
+            log_errno(status, "Couldn't grow product-queue for staged "
+                    "indexes");
+        }
+        else {
+            status = ctl_writeIndexes(pq, ix, ixsz, stage);
+        }
+        if (status) {
+            (void)ftruncate(pq->fd, sb.st_size);
+            return status;
+        }
+    }
 
-        (void)ctl_rel(pq, RGN_MODIFIED);
-    }                                   /* "pq->ctlp" allocated */
+    // Release the current indexes unmodified: they're superseded
+    (void)(pq->mtof)(pq, pq->ixo, RGN_NOLOCK);
+    pq->ixp = NULL;
+    pq->rlp = NULL;
+    pq->tqp = NULL;
+    pq->sxp = NULL;
+    pq->fbp = NULL;
+    pq->trp = NULL;
+    pq->mdp = NULL;
+
+    if (stage) {
+        // From here on, the old indexes are being overwritten
+        ctlp->resize = rs;
+        ctlp->resize_magic = RESIZE_MAGIC;
+        __sync_synchronize();
+        ctlp->resize.stage = stage;
+
+        status = ctl_writeIndexes(pq, ix, ixsz, ixo);
+        if (status) {
+            // The next writer will finish the copy
+            log_error("Couldn't copy new indexes of product-queue %s",
+                    pq->pathname);
+            return status;
+        }
+    }
+
+    ctl_setLayout(pq, &rs);
+    if (stage) {
+        ctlp->resize.stage = 0;
+        if (ftruncate(pq->fd, stage))
+            log_warning("Couldn't remove staged indexes: %s",
+                    strerror(errno));
+    }
+
+    status = ctl_adoptLayout(pq);
+
+    if (status == 0) {
+        status = (pq->ftom)(pq, pq->ixo, pq->ixsz, RGN_WRITE|RGN_NOLOCK,
+                &pq->ixp);
+        if (status) {
+            log_errno(status, "Couldn't get resized indexes");
+        }
+        else {
+            (void)ix_ptrs(pq->ixp, pq->ixsz, pq->nalloc, ctlp->align,
+                    sxTable, &pq->rlp, &pq->tqp, &pq->fbp, &pq->sxp);
+            ctl_setTrp(pq);
+            ctl_setMdp(pq);
+        }
+    }
 
-    pq_unlockIf(pq);
     return status;
 }
 
 int
-pq_stats(
-		pqueue* const pq,
-        size_t* const nprodsp,
-        size_t* const nfreep,
-        size_t* const nemptyp,
-        size_t* const nbytesp,
-        size_t* const maxprodsp,
-        size_t* const maxfreep,
-        size_t* const minemptyp,
-        size_t* const maxbytesp,
-        double* const age_oldestp,
-        size_t* const maxextentp)
+pq_resize(
+        pqueue* const pq,
+        const off_t   datasz,
+        const size_t  nalloc)
 {
+    if (datasz <= 0 || nalloc == 0) {
+        log_error("Invalid size: datasz=%ld, nalloc=%zu", (long)datasz,
+                nalloc);
+        return EINVAL;
+    }
+    if (fIsSet(pq->pflags, PQ_READONLY)) {
+        log_error("Product-queue is open read-only");
+        return EACCES;
+    }
+    if (fIsSet(pq->pflags, PQ_PRIVATE)) {
+        log_error("Product-queue is memory-mapped privately");
+        return EINVAL;
+    }
+    if (fIsSet(pq->mapMode, PQ_MAP_HUGETLBFS)) {
+        log_error("Product-queue on a hugetlbfs can't be resized");
+        return ENOTSUP;
+    }
+
     pq_lockIf(pq);
-        /* Read lock pq->ctl. */
-        int status = ctl_get(pq, 0);
 
-        if(status == ENOERR) {
-            if(nprodsp)
-                *nprodsp = pq->rlp->nelems;
-            if(nfreep)
-                *nfreep = pq->rlp->nfree;
-            if(maxextentp)
-                *maxextentp = pq->rlp->maxfextent;
-            if(nemptyp)
-                *nemptyp = pq->rlp->nempty;
-            if(nbytesp)
-                *nbytesp = pq->rlp->nbytes;
-            if(maxprodsp)
-                *maxprodsp = pq->rlp->maxelems;
-            if(maxfreep)
-                *maxfreep = pq->rlp->maxfree;
-            if(minemptyp)
-                *minemptyp = pq->rlp->minempty;
-            if(maxbytesp)
-                *maxbytesp = pq->rlp->maxbytes;
-            if(age_oldestp) {
-                timestampt ts0;
-                tqelem *tqep;
+    /*
+     * The file is grown before the control-header is write-locked because
+     * that can take a while.
+     */
+    int     status = ctl_get(pq, 0);
+    size_t  ixsz = 0;
+    off_t   ixo = 0;
+    bool    sxTable = nalloc <= SXT_NALLOC_MAX;
+
+    if (status) {
+        log_error("Couldn't get control-header");
+    }
+    else {
+        const size_t align = pq->ctlp->align;
+
+        ixo = pq->datao + _RNDUP(_RNDUP(datasz, align), pq->pagesz);
+        ixsz = ix_totalSz(nalloc, align, sxTable, pq->trp != NULL,
+                pq->pagesz);
+        (void)ctl_rel(pq, 0);
+
+        bool tooBig = ixo <= pq->datao || ixo + (off_t)ixsz < ixo;
+#ifdef HAVE_MMAP
+        // The whole file must remain mappable in one piece
+        if (pq->ftom == mm0_ftom && MAX_SIZE_T < ixo + (off_t)ixsz)
+            tooBig = true;
+#endif
+
+        if (tooBig) {
+            log_error("Product-queue would be too big: datasz=%ld, "
+                    "nalloc=%zu", (long)datasz, nalloc);
+            status = EFBIG;
+        }
+        else {
+            status = fgrow(pq->fd, ixo + (off_t)ixsz,
+                    fIsSet(pq->pflags, PQ_SPARSE));
+            if (status)
+                log_errno(status, "Couldn't grow product-queue");
+        }
+    }
+
+    if (status == 0) {
+        status = ctl_get(pq, RGN_WRITE);
 
-                tqep = tqe_first(pq->tqp); /* get oldest */
-                if(tqep != NULL) {
-                  (void)set_timestamp(&ts0);
-                  *age_oldestp = d_diff_timestamp(&ts0, &tqep->tv);
-                } else {
-                  *age_oldestp = 0;
+        if (status) {
+            log_error("Couldn't lock control-header");
+        }
+        else if (ixo == pq->ixo && nalloc == pq->nalloc) {
+            (void)ctl_rel(pq, 0);       // Nothing to do
+        }
+        else {
+            const off_t  oldIxo = pq->ixo;
+            const off_t  oldEnd = TOTAL_SIZE(pq);
+            const size_t oldNalloc = pq->nalloc;
+            void*        ix = NULL;
+            size_t       mdo = 0;
+
+            status = resize_evict(pq, ixo, nalloc);
+
+            // Another process might have shrunk the file in the meantime
+            if (status == 0) {
+                status = fgrow(pq->fd, ixo + (off_t)ixsz,
+                        fIsSet(pq->pflags, PQ_SPARSE));
+                if (status)
+                    log_errno(status, "Couldn't grow product-queue");
+            }
+            if (status == 0) {
+                status = posix_memalign(&ix, pq->pagesz, ixsz);
+                if (status) {
+                    log_errno(status, "Couldn't allocate %zu bytes for the "
+                            "new indexes", ixsz);
+                    ix = NULL;
                 }
             }
+            if (status == 0) {
+                (void)memset(ix, 0, ixsz);
+                status = ix_rebuild(pq, ix, ixsz, ixo, nalloc, sxTable,
+                        OFF_NONE, &mdo);
+            }
+            if (status == 0)
+                status = resize_commit(pq, ix, ixsz, ixo, nalloc, sxTable,
+                        mdo);
+            free(ix);
 
-            (void) ctl_rel(pq, 0);
+            /*
+             * A sequence-locked product-queue isn't truncated because
+             * processes without a lock might still be looking at the old
+             * indexes.
+             */
+            if (status == 0 && !fIsSet(pq->pflags, PQ_SEQLOCK) &&
+                    TOTAL_SIZE(pq) < oldEnd &&
+                    ftruncate(pq->fd, TOTAL_SIZE(pq)))
+                log_warning("Couldn't truncate product-queue: %s",
+                        strerror(errno));
+
+            (void)ctl_rel(pq, RGN_MODIFIED);
+
+            if (status == 0)
+                log_notice("Resized product-queue: data-size %ld -> %ld bytes, "
+                        "slots %zu -> %zu", (long)(oldIxo - pq->datao),
+                        (long)(ixo - pq->datao), oldNalloc, nalloc);
         }
+    }
+
     pq_unlockIf(pq);
 
     return status;
@@ -6659,23 +12172,38 @@ pq_fext_dump(pqueue *const pq)
             rlrp = rl->rp;
             fbp = pq->fbp;
 
-            /* p = l->header; */
-            spix = rl->fext;    /* head of skip list by extent */
-            spp = rlrp + spix;
-            /* q = p->forward[0]; */
-            sqix = fbp->fblks[spp->prev];
-            log_debug("** Free list extents:\t");                  /* debugging */
-            while(sqix != RL_FEXT_TL) {
-                /* p = q */
-                spix = sqix;
+            const rb* const rbp = rl_bins(rl);
+            if (rbp) {
+                log_debug("** Free list extents by bin:\t");
+                for (unsigned bin = rb_nextBin(rbp, 0); bin < RB_NBINS;
+                        bin = rb_nextBin(rbp, bin + 1)) {
+                    for (spix = rbp->heads[bin]; spix != RL_NONE;
+                            spix = rbp->links[spix].next) {
+                        spp = rlrp + spix;
+                        log_debug("%u ", spp->extent);
+                        log_assert(rb_bin(spp->extent) == bin);
+                    }
+                }
+            }
+            else {
+                /* p = l->header; */
+                spix = rl->fext;    /* head of skip list by extent */
                 spp = rlrp + spix;
-                log_debug("%u ", spp->extent);             /* debugging */
-#if !defined(NDEBUG)
-                log_assert(spp->extent >= prev_extent);
-                prev_extent = spp->extent;
-#endif
                 /* q = p->forward[0]; */
                 sqix = fbp->fblks[spp->prev];
+                log_debug("** Free list extents:\t");                  /* debugging */
+                while(sqix != RL_FEXT_TL) {
+                    /* p = q */
+                    spix = sqix;
+                    spp = rlrp + spix;
+                    log_debug("%u ", spp->extent);             /* debugging */
+#if !defined(NDEBUG)
+                    log_assert(spp->extent >= prev_extent);
+                    prev_extent = spp->extent;
+#endif
+                    /* q = p->forward[0]; */
+                    sqix = fbp->fblks[spp->prev];
+                }
             }
             (void) ctl_rel(pq, 0);
         }
@@ -6698,6 +12226,9 @@ pq_cset(pqueue *pq, const timestampt *tvp)
         } else if (tvEqual(*tvp, TS_ZERO)) {
             pq->cursor_offset = 0;
         }
+        pq->shTie = false;
+        if (pq->rdSlot)
+            rd_setCursor(pq);
     pq_unlockIf(pq);
 }
 
@@ -6730,8 +12261,31 @@ pq_cClassSet(pqueue *pq,  pq_match *mtp, const prod_class_t *clssp)
                 return EINVAL;
         }
 
+        pq_setWakeClass(pq, clssp);
         pq_cset(pq, &clssp->from);
 
+        if(pq->shards != NULL && !tvEqual(clssp->from, TS_ZERO) &&
+                        !tvEqual(clssp->from, TS_ENDT))
+        {
+                /*
+                 * The time-queues of the shards are only merged by
+                 * pq_sequence() and pq_next(); so, the cursor is moved just
+                 * outside the time-range instead of onto a data-product.
+                 */
+                timestampt cursor = clssp->from;
+                const bool reverse = tvCmp(clssp->from, clssp->to, >);
+
+                if(reverse)
+                        timestamp_incr(&cursor);
+                else
+                        timestamp_decr(&cursor);
+                pq_cset(pq, &cursor);
+                if(mtp != NULL)
+                        *mtp = reverse ? TV_LT : TV_GT;
+                pq_unlockIf(pq);
+                return ENOERR;
+        }
+
         if(tvCmp(clssp->from, clssp->to, >))
         {
                 /* reversed scan */
@@ -7057,6 +12611,18 @@ pq_setCursorFromSignature(
 {
     int status;
 
+    if (pq->shards && sh_shard(pq, signature) != pq) {
+        pqueue* const shard = sh_shard(pq, signature);
+
+        status = pq_setCursorFromSignature(shard, signature);
+        if (status == 0) {
+            pq_lockIf(pq);
+                sh_adopt(pq, shard);
+            pq_unlockIf(pq);
+        }
+        return status;
+    }
+
     pq_lockIf(pq);
         /*
          * Read-lock the control-region of the product-queue.
@@ -7074,6 +12640,8 @@ pq_setCursorFromSignature(
             if (status == 0) {
                 pq_cset(pq, &timeEntry->tv);
                 pq_coffset(pq, timeEntry->offset);
+                if (pq->shards)
+                    sh_adopt(pq, pq);
             }
 
             /*
@@ -7093,6 +12661,9 @@ pq_processProduct(
         pq_seqfunc* const func,
         void* const       optArg)
 {
+    if (pq->shards && sh_shard(pq, sig) != pq)
+        return pq_processProduct(sh_shard(pq, sig), sig, func, optArg);
+
     pq_lockIf(pq);
     bool instanceLocked = true;
 
@@ -7136,6 +12707,7 @@ pq_processProduct(
                 void*               vp;
                 const region* const rp = rlp->rp + rlix;
                 const size_t        extent = Extent(rp);
+                const bool          zipped = IsZip(rp);
 
                 if (rgn_get(pq, offset, extent, 0, &vp)) {
                     log_error("Couldn't lock data-product's data-region");
@@ -7178,12 +12750,25 @@ pq_processProduct(
                             status = PQ_SYSTEM;
                         }
                         else {
-                            /*
-                             * Process the data-product while its data-region
-                             * is locked.
-                             */
-                            status = func(&info, xdrs.x_private, vp, extent,
-                                    optArg);
+                            void*  datap = xdrs.x_private;
+                            void*  xprod = vp;
+                            size_t size = extent;
+
+                            status = zipped
+                                    ? zp_get(pq, offset, &info, &xdrs, &xprod,
+                                            &size, &datap)
+                                    : 0;
+                            if (status) {
+                                log_flush_error();
+                            }
+                            else {
+                                /*
+                                 * Process the data-product while its
+                                 * data-region is locked.
+                                 */
+                                status = func(&info, datap, xprod, size,
+                                        optArg);
+                            }
                             xdr_free(xdr_prod_info, (char*)&info);
                         }
 
@@ -7210,6 +12795,194 @@ pq_processProduct(
 }
 
 
+/*
+ * Maximum number of times that a lookup in a sequence-locked product-queue is
+ * tried without a lock before the control-header is read-locked instead.
+ */
+#define PQ_SEQLOCK_TRIES 8
+
+/*
+ * Snapshot of a time-queue element and of the data-region of its product.
+ * Values are used rather than pointers into the index because, without a
+ * read-lock, the index can change as soon as the lookup has been validated.
+ */
+typedef struct {
+    timestampt tv;      ///< Insertion-time of product
+    timestampt oldest;  ///< Insertion-time of oldest product
+    off_t      offset;  ///< Offset to data-region
+    size_t     extent;  ///< Extent of data-region in bytes
+    bool       zipped;  ///< Is the product's data compressed?
+    void*      vp;      ///< Reserved data-region or NULL
+    int        isFull;  ///< Is the product-queue full?
+    bool       skipped; ///< Was the product ruled out by its metadata?
+} tqsnap;
+
+/**
+ * Finds the time-queue element adjacent to the cursor.
+ *
+ * @pre                   The control-header is held (see `ctl_getRead()`)
+ * @param[in]     pq      Product-queue
+ * @param[in]     mt      Direction from cursor
+ * @param[out]    snap    Snapshot of the element. Only `snap->tv`,
+ *                        `snap->offset`, and `snap->oldest` are set.
+ * @retval        true    Success
+ * @retval        false   No such element
+ */
+static bool
+ctl_findTime(
+        const pqueue* const restrict pq,
+        const pq_match               mt,
+        tqsnap* const restrict       snap)
+{
+    if (pq->trp != NULL) {
+        // Binary search of the time-ring
+        const trelem* const trep = tr_find(pq->trp, &pq->cursor, mt);
+        const trelem* const first = tr_first(pq->trp);
+
+        if (trep == NULL)
+            return false;
+        snap->tv = trep->tv;
+        snap->offset = trep->offset;
+        snap->oldest = first ? first->tv : trep->tv;
+    }
+    else {
+        const tqelem* const tqep = tqe_find(pq->tqp, &pq->cursor, mt);
+        const tqelem* const first = tqe_first(pq->tqp);
+
+        if (tqep == NULL)
+            return false;
+        snap->tv = tqep->tv;
+        snap->offset = tqep->offset;
+        snap->oldest = first ? first->tv : tqep->tv;
+    }
+
+    return true;
+}
+
+/**
+ * Gets the control-header for reading and finds the time-queue element
+ * adjacent to the cursor and, optionally, reserves the data-region of its
+ * product. Lookups in a sequence-locked product-queue (see `PQ_SEQLOCK`) are
+ * done without a file-lock and are repeated until they're consistent. If the
+ * product-queue has a metadata sidecar and the product's record rules out the
+ * class of interest, then the data-region isn't touched. The cursor isn't
+ * modified.
+ *
+ * @param[in,out] pq          Product-queue
+ * @param[in]     mt          Direction from cursor
+ * @param[in]     getRgn      Whether to read-lock the data-region of the
+ *                            product
+ * @param[in]     clss        Class of products of interest or NULL to get
+ *                            the data-region regardless
+ * @param[out]    snap        Snapshot of the element
+ * @retval        0           Success. `snap` is set. If `getRgn` and not
+ *                            `snap->skipped`, then `snap->vp` is set and the
+ *                            caller should call `rgn_rel(pq, snap->offset, 0)`
+ *                            when done with it. Release the control-header
+ *                            with `ctl_rel(pq, 0)`.
+ * @retval        PQ_END      No such element. Release the control-header with
+ *                            `ctl_rel(pq, 0)`.
+ * @retval        PQ_CORRUPT  Element doesn't refer to a valid data-region.
+ *                            `snap->tv` and `snap->offset` are set. Release
+ *                            the control-header with `ctl_rel(pq, 0)`.
+ *                            `log_add()` called.
+ * @retval        PQ_SYSTEM   System error. Control-header isn't held.
+ *                            `log_add()` called.
+ */
+static int
+ctl_findElem(
+        pqueue* const restrict pq,
+        const pq_match         mt,
+        const bool             getRgn,
+        const prod_class_t*    clss,
+        tqsnap* const restrict snap)
+{
+    int status;
+
+    for (int ntries = 1; ; ntries++) {
+        uint32_t seq;
+
+        status = ctl_getRead(pq, ntries > PQ_SEQLOCK_TRIES, &seq);
+        if (status) {
+            log_add_errno(status, "Couldn't get control-header");
+            return PQ_SYSTEM;
+        }
+
+        const char* problem = NULL;
+
+        if (!ctl_findTime(pq, mt, snap)) {
+            status = PQ_END;
+        }
+        else {
+            snap->extent = 0;
+            snap->zipped = false;
+            snap->vp = NULL;
+            snap->isFull = pq->ctlp->isFull;
+            snap->skipped = false;
+
+            if (getRgn) {
+                region* rp;
+                int     found = fIsSet(pq->pflags, PQ_SEQREAD)
+                        ? rl_r_findUnlocked(pq->rlp, snap->offset, &rp)
+                        : rl_r_find(pq->rlp, snap->offset, &rp);
+
+                if (found == 0 || rp->offset != snap->offset
+                        || Extent(rp) > pq_dataSize(pq)) {
+                    problem = found ? "invalid region" : "no data";
+                    status = PQ_CORRUPT;
+                }
+                else {
+                    snap->extent = Extent(rp);
+                    snap->zipped = IsZip(rp);
+
+                    if (pq->mdp != NULL && clss != NULL) {
+                        const size_t rlix = (size_t)(rp - pq->rlp->rp);
+
+                        snap->skipped = rlix < pq->mdp->nalloc &&
+                                !md_mightMatch(pq->mdp->recs + rlix, clss);
+                    }
+                }
+            }
+        }
+
+        if (!ctl_readValid(pq, seq)) {
+            (void)ctl_rel(pq, 0);
+            continue;
+        }
+
+        if (status == PQ_CORRUPT) {
+            char ts[20];
+
+            (void)sprint_timestampt(ts, sizeof(ts), &snap->tv);
+            log_add("Queue corrupt: tq: %s %s at %ld", ts, problem,
+                    (long)snap->offset);
+        }
+        else if (status == 0 && getRgn && !snap->skipped) {
+            status = rgn_get(pq, snap->offset, snap->extent, 0, &snap->vp);
+
+            if (status) {
+                log_add_errno(status, "Couldn't get product region");
+                (void)ctl_rel(pq, 0);
+                status = PQ_SYSTEM;
+            }
+            else if (!ctl_readValid(pq, seq)) {
+                // Region might have been deleted before it was locked
+                (void)rgn_rel(pq, snap->offset, 0);
+                (void)ctl_rel(pq, 0);
+                continue;
+            }
+            else {
+                log_assert(snap->vp != NULL);
+            }
+        }
+
+        break;
+    }
+
+    return status;
+}
+
+
 /**
  * Step thru the time sorted inventory according to 'mt',
  * and the current cursor value.
@@ -7286,212 +13059,398 @@ pq_sequenceHelper(
                 }
             }
 
-            // Read lock the control-header
-            status = ctl_get(pq, 0);
+            /*
+             * Spec'ing clss NULL or ifMatch NULL _just_ sequences
+             * the cursor. This feature used by the 'pqexpire' program.
+             */
+            const bool getRgn = clss != NULL && ifMatch != NULL;
+            tqsnap     snap;
 
-            if (status) {
-                log_add("ctl_get() failure");
-                status = PQ_SYSTEM;
+            // Read the control-header and find the specified queue element
+            status = ctl_findElem(pq, mt, getRgn, clss, &snap);
+
+            if (status == PQ_SYSTEM) {
+                log_add("ctl_findElem() failure");
             }
             else {
                 bool ctlLocked = true;
 
-                // Find the specified queue element
-                tqelem* tqep = tqe_find(pq->tqp, &pq->cursor, mt);
-
-                if (tqep == NULL) {
-                    status = PQ_END;
+                if (status == PQ_END) {
+                    // No such element
                 }
                 else {
                     // Update cursor
-                    pq_cset(pq, &tqep->tv);
-                    pq_coffset(pq, tqep->offset);
+                    pq_cset(pq, &snap.tv);
+                    pq_coffset(pq, snap.offset);
 
-                    /*
-                     * Spec'ing clss NULL or ifMatch NULL _just_ sequences
-                     * the cursor. This feature used by the 'pqexpire' program.
-                     */
-                    if (clss == NULL || ifMatch == NULL) {
+                    if (!getRgn) {
                         log_debug("NOOP");
                     }
+                    else if (status == PQ_CORRUPT) {
+                        /*
+                         * We can't fix it (tq_delete(pq->tqp, tqep)) here
+                         * since we don't have write permission
+                         */
+                    }
+                    else if (snap.skipped) {
+                        // Product ruled out by its metadata: didn't match
+                    }
                     else {
-                        // Get the actual data region
-                        region* rp;
+                        // The data-region is read-locked
+                        void* vp = snap.vp;
+
+                        pq->locked_count++;
+                        log_debug("locked_count: %ld", pq->locked_count);
+
+                        size_t extent = snap.extent;
+                        off_t  offset = snap.offset;
+                        // Did product match `clss`?
+                        bool   matched = false;
+
+                        /*
+                         * Delay to process product, useful to see if
+                         * it's falling behind
+                         */
+                        if (log_is_enabled_debug) {
+                            timestampt now;
+
+                            if (gettimeofday(&now, 0) == 0) {
+                                double delay = d_diff_timestamp(&now,
+                                        &snap.tv);
+                                log_debug("Delay: %.4f sec", delay);
+                            }
+                        }
+
+                        /*
+                         * We've got the data, so we can let go of the
+                         * control-header
+                         */
+                        status = ctl_rel(pq, 0);
+                        log_assert(status == 0);
+                        ctlLocked = false;
+
+                        /*
+                         * No race conditions from here on. Also,
+                         * calling a foreign function with an acquired
+                         * lock might result in deadlock.
+                         */
+                        pq_unlockIf(pq);
+                        threadLocked = false;
+
+                        /* All this to avoid malloc in the xdr calls */
+                        struct infobuf {
+                            prod_info b_i;
+                            char      b_origin[HOSTNAMESIZE + 1];
+                            char      b_ident[KEYSIZE + 1];
+                        }          buf;
+                        (void)memset(&buf, 0, sizeof(buf));
+                        prod_info* info ;
+                        info = &buf.b_i;
+                        info->origin = &buf.b_origin[0];
+                        info->ident = &buf.b_ident[0];
+
+                        // Decode the product's information
+                        XDR xdrs;
+                        xdrmem_create(&xdrs, vp, (u_int)extent,
+                                XDR_DECODE) ;
+
+                        if (!xdr_prod_info(&xdrs, info)) {
+                            log_add("xdr_prod_info() failure") ;
+                            status = PQ_SYSTEM;
+                        }
+                        else {
+                            log_assert(snap.zipped ||
+                                    info->sz <= xdrs.x_handy);
+
+                            /*
+                             * Rather than copy the data, just use the
+                             * existing buffer
+                             */
+                            void* datap = xdrs.x_private;
+                            void* xprod = vp;
+
+#if PQ_SEQ_TRACE
+                            log_debug("%s %u",
+                                    s_prod_info(NULL, 0, info, 1),
+                                    xdrs.x_handy) ;
+#endif
+
+                            /*
+                             * Log time-interval from product-creation
+                             * to queue-insertion.
+                             */
+                            if (log_is_enabled_debug) {
+                                double latency = d_diff_timestamp(
+                                        &snap.tv, &info->arrival);
+                                log_debug("time(insert)-time(create): "
+                                        "%.4f s", latency);
+                            }
+
+                            // Do the work.
+                            if (clss == PQ_CLASS_ALL ||
+                                    prodInClass(clss, info)) {
+                                matched = true;
+
+                                if (snap.zipped) {
+                                    status = zp_get(pq, offset, info, &xdrs,
+                                            &xprod, &extent, &datap);
+                                }
+                                else {
+                                    // Change extent into xlen_product
+                                    const size_t xsz =
+                                            _RNDUP(info->sz, 4);
+                                    if (xdrs.x_handy > xsz)
+                                        extent -= (xdrs.x_handy - xsz);
+                                }
+
+                                if (off) {
+                                	// In case `otherargs == off`
+											*off = sh_encode(pq, offset);
+                                }
+
+                                if (status) {
+                                    // Product can't be inflated
+                                }
+                                else if ((status = ifMatch(info, datap, xprod,
+                                        extent, otherargs))) {
+                                	// Problem with `ifMatch()`
+                                    /*
+                                     * Back up, presumes clock tick >
+                                     * usec (not always true)
+                                     */
+                                    if (mt == TV_GT) {
+                                        timestamp_decr(&pq->cursor);
+                                        pq_coffset(pq, OFF_NONE);
+                                    }
+                                    else if (mt == TV_LT) {
+                                        pq_coffset(pq, offset + 1);
+                                    }
+                                } // Problem with `ifMatch()`
+                            } // Product matches
+                        } // Product information decoded
+
+                        xdr_destroy(&xdrs);
+
+                        // Release the data segment if appropriate
+                        if (off == NULL || status || !matched) {
+                            (void)rgn_rel(pq, offset, 0);
+									pq->locked_count--;
+								}
+                    } // `clss != NULL && ifMatch != NULL`
+                } // Time-queue element found
+
+                if (ctlLocked)
+                    (void)ctl_rel(pq, 0);
+            } // Control-header was obtained
+
+            if (threadLocked)
+                pq_unlockIf(pq);
+        } // `pq_lockIf() was called
+    } // `pq != NULL`
+
+    return status;
+}
+
+/**
+ * Finds the shard of a sharded product-queue that contains the next
+ * data-product in a given direction. The time-queues of the shards
+ * are merged in order of insertion-time and then shard.
+ *
+ * Each shard stamps the insertion-times of its own data-products; so, the
+ * shards are examined as of a single moment: either all their control-headers
+ * are read-locked (in shard order) or, if they're sequence-locked, no shard
+ * was modified while they were examined. Otherwise, a data-product inserted
+ * into a shard after that shard was examined could have an earlier
+ * insertion-time than the chosen one and would be skipped.
+ *
+ * @param[in,out] pq         First shard of the product-queue
+ * @param[in]     mt         Direction from the cursor
+ * @param[out]    shard      Shard that contains the next data-product
+ * @param[out]    start      Cursor from which `pq_sequenceHelper(*shard, mt,
+ *                           ...)` finds the next data-product
+ * @retval        0          Success. `*shard` and `*start` are set.
+ * @retval        PQ_END     No such data-product
+ * @retval        PQ_SYSTEM  System error. `log_add()` called.
+ */
+static int
+sh_seek(
+        pqueue* const restrict     pq,
+        const pq_match             mt,
+        pqueue** const restrict    shard,
+        timestampt* const restrict start)
+{
+    pq_lockIf(pq);
+
+    if (tvIsNone(pq->cursor))
+        pq->cursor = mt == TV_LT ? TS_ENDT : TS_ZERO;
+
+    const timestampt cursor = pq->cursor;
+    timestampt       bestStart = cursor;
+    unsigned         bestIndex = 0;
+    int              status;
+
+    for (int ntries = 1; ; ntries++) {
+        uint32_t   seqs[pq->nshards];
+        unsigned   nheld;
+        timestampt best = TS_NONE;
+
+        status = PQ_END;
+
+        // The first shard is `pq`, whose thread-lock is already held
+        for (nheld = 0; nheld < pq->nshards; nheld++) {
+            pqueue* const sh = pq->shards[nheld];
+
+            if (sh != pq)
+                pq_lockIf(sh);
+            int stat = ctl_getRead(sh, ntries > PQ_SEQLOCK_TRIES,
+                    seqs + nheld);
+            if (stat) {
+                log_add_errno(stat, "Couldn't get control-header of shard "
+                        "%u", nheld);
+                if (sh != pq)
+                    pq_unlockIf(sh);
+                status = PQ_SYSTEM;
+                break;
+            }
+        }
 
-                        status = rl_r_find(pq->rlp, tqep->offset, &rp);
+        for (unsigned i = 0; status != PQ_SYSTEM && i < pq->nshards; i++) {
+            pqueue* const sh = pq->shards[i];
+            timestampt    start = cursor;
+
+            /*
+             * A data-product of a later shard with the same insertion-time as
+             * the one at the cursor comes after it; one of an earlier shard,
+             * before.
+             */
+            if (pq->shTie && mt == TV_GT && i > pq->shCursor) {
+                timestamp_decr(&start);
+            }
+            else if (pq->shTie && mt == TV_LT && i < pq->shCursor) {
+                timestamp_incr(&start);
+            }
 
-                        if (status == 0
-                                 || rp->offset != tqep->offset
-                                 || Extent(rp) > pq_getDataSize(pq)) {
-                            char ts[20];
+            tqsnap snap;
 
-                            (void)sprint_timestampt(ts, sizeof(ts), &tqep->tv);
-                            log_add("Queue corrupt: tq: %s %s at %ld",
-                                    ts,
-                                    status ? "invalid region" : "no data",
-                                    tqep->offset);
-                            /*
-                             * We can't fix it (tq_delete(pq->tqp, tqep)) here
-                             * since we don't have write permission
-                             */
-                            status = PQ_CORRUPT;
-                        }
-                        else {
-                            void* vp = NULL;
+            sh->cursor = start;
+            if (!ctl_findTime(sh, mt, &snap))
+                continue;
 
-                            status = rgn_get(pq, rp->offset, Extent(rp), 0, &vp);
+            if (status == PQ_END ||
+                    (mt == TV_GT && tvCmp(snap.tv, best, <)) ||
+                    (mt == TV_LT && !tvCmp(snap.tv, best, <))) {
+                best = snap.tv;
+                bestStart = start;
+                bestIndex = i;
+                status = 0;
+            }
+        }
 
-                            if (status) {
-                                log_add("rgn_get() failure");
-                                status = PQ_SYSTEM;
-                            }
-                            else {
-								pq->locked_count++;
-								log_debug("locked_count: %ld",
-										pq->locked_count);
+        // All shards must be validated before any is released
+        bool valid = true;
+        for (unsigned i = 0; i < nheld; i++)
+            valid = ctl_readValid(pq->shards[i], seqs[i]) && valid;
 
-								log_assert(vp != NULL);
+        while (nheld-- > 0) {
+            pqueue* const sh = pq->shards[nheld];
 
-                                size_t extent = Extent(rp);
-                                off_t  offset = rp->offset;
-                                // Did product match `clss`?
-                                bool   matched = false;
+            (void)ctl_rel(sh, 0);
+            if (sh != pq)
+                pq_unlockIf(sh);
+        }
 
-                                /*
-                                 * Delay to process product, useful to see if
-                                 * it's falling behind
-                                 */
-                                if (log_is_enabled_debug) {
-                                    timestampt now;
+        if (status == PQ_SYSTEM || valid)
+            break;
+    }
 
-                                    if (gettimeofday(&now, 0) == 0) {
-                                        double delay = d_diff_timestamp(&now,
-                                                &tqep->tv);
-                                        log_debug("Delay: %.4f sec", delay);
-                                    }
-                                }
+    // The first shard's cursor is also the product-queue's
+    pq->cursor = cursor;
+    if (status == 0) {
+        *shard = pq->shards[bestIndex];
+        *start = bestStart;
+    }
 
-                                /*
-                                 * We've got the data, so we can let go of the
-                                 * control-header
-                                 */
-                                status = ctl_rel(pq, 0);
-                                log_assert(status == 0);
-                                ctlLocked = false;
+    pq_unlockIf(pq);
 
-                                /*
-                                 * No race conditions from here on. Also,
-                                 * calling a foreign function with an acquired
-                                 * lock might result in deadlock.
-                                 */
-                                pq_unlockIf(pq);
-                                threadLocked = false;
-
-                                /* All this to avoid malloc in the xdr calls */
-                                struct infobuf {
-                                    prod_info b_i;
-                                    char      b_origin[HOSTNAMESIZE + 1];
-                                    char      b_ident[KEYSIZE + 1];
-                                }          buf;
-                                (void)memset(&buf, 0, sizeof(buf));
-                                prod_info* info ;
-                                info = &buf.b_i;
-                                info->origin = &buf.b_origin[0];
-                                info->ident = &buf.b_ident[0];
-
-                                // Decode the product's information
-                                XDR xdrs;
-                                xdrmem_create(&xdrs, vp, (u_int)extent,
-                                        XDR_DECODE) ;
-
-                                if (!xdr_prod_info(&xdrs, info)) {
-                                    log_add("xdr_prod_info() failure") ;
-                                    status = PQ_SYSTEM;
-                                }
-                                else {
-                                    log_assert(info->sz <= xdrs.x_handy);
+    return status;
+}
 
-                                    /*
-                                     * Rather than copy the data, just use the
-                                     * existing buffer
-                                     */
-                                    void* datap = xdrs.x_private;
+/*
+ * Sets the cursor of a shard of a sharded product-queue before the shard is
+ * sequenced.
+ */
+static void
+sh_position(pqueue* const restrict shard, const timestampt* const restrict start)
+{
+    pq_lockIf(shard);
+        shard->cursor = *start;
+    pq_unlockIf(shard);
+}
 
-#if PQ_SEQ_TRACE
-                                    log_debug("%s %u",
-                                            s_prod_info(NULL, 0, info, 1),
-                                            xdrs.x_handy) ;
-#endif
+/**
+ * Sets the cursor of a sharded product-queue after one of its shards was
+ * sequenced. Whether the shard moved to a data-product is decided by its
+ * cursor rather than by the status of the sequencing because a callback may
+ * return `PQ_END` (e.g., that of `pq_last()`).
+ *
+ * @param[in,out] pq      First shard of the product-queue
+ * @param[in]     shard   Shard that was sequenced
+ * @param[in]     start   Cursor of the shard before sequencing (see
+ *                        `sh_position()`)
+ * @param[in]     cursor  Cursor of the product-queue before sequencing
+ */
+static void
+sh_settle(
+        pqueue* const restrict           pq,
+        pqueue* const restrict           shard,
+        const timestampt* const restrict start,
+        const timestampt* const restrict cursor)
+{
+    pq_lockIf(shard);
+        const bool moved = !tvEqual(shard->cursor, *start);
+    pq_unlockIf(shard);
 
-                                    /*
-                                     * Log time-interval from product-creation
-                                     * to queue-insertion.
-                                     */
-                                    if (log_is_enabled_debug) {
-                                        double latency = d_diff_timestamp(
-                                                &tqep->tv, &info->arrival);
-                                        log_debug("time(insert)-time(create): "
-                                                "%.4f s", latency);
-                                    }
+    pq_lockIf(pq);
+        if (moved) {
+            sh_adopt(pq, shard);
+        }
+        else {
+            // The first shard's cursor was repositioned by `sh_position()`
+            pq->cursor = *cursor;
+        }
+    pq_unlockIf(pq);
+}
 
-                                    // Do the work.
-                                    if (clss == PQ_CLASS_ALL ||
-                                            prodInClass(clss, info)) {
-                                        matched = true;
-
-                                        {
-                                            // Change extent into xlen_product
-                                            const size_t xsz =
-                                                    _RNDUP(info->sz, 4);
-                                            if (xdrs.x_handy > xsz)
-                                                extent -= (xdrs.x_handy - xsz);
-                                        }
-
-                                        if (off) {
-                                        	// In case `otherargs == off`
-											*off = offset;
-                                        }
-
-                                        status = ifMatch(info, datap, vp,
-                                                extent, otherargs);
-
-                                        if (status) {
-                                        	// Problem with `ifMatch()`
-                                            /*
-                                             * Back up, presumes clock tick >
-                                             * usec (not always true)
-                                             */
-                                            if (mt == TV_GT) {
-                                                timestamp_decr(&pq->cursor);
-                                                pq_coffset(pq, OFF_NONE);
-                                            }
-                                            else if (mt == TV_LT) {
-                                                pq_coffset(pq, offset + 1);
-                                            }
-                                        } // Problem with `ifMatch()`
-                                    } // Product matches
-                                } // Product information decoded
-
-                                xdr_destroy(&xdrs);
-
-                                // Release the data segment if appropriate
-                                if (off == NULL || status || !matched) {
-                                    (void)rgn_rel(pq, offset, 0);
-									pq->locked_count--;
-								}
-                            } // Region locked
-                        } // Region found
-                    } // `clss != NULL && ifMatch != NULL`
-                } // Time-queue element found
+/**
+ * Steps through the merged time-queues of a sharded product-queue. The cursor
+ * of the product-queue is that of the shard that last found a data-product.
+ *
+ * @param[in,out] pq  First shard of the product-queue
+ * @return            See `pq_sequenceHelper()`
+ */
+static int
+sh_sequence(
+        pqueue* const restrict             pq,
+        const pq_match                     mt,
+        const prod_class_t* const restrict clss,
+        pq_seqfunc* const                  ifMatch,
+        void* const                        otherargs,
+        off_t* const                       off)
+{
+    pqueue*    shard;
+    timestampt start;
+    int        status = sh_seek(pq, mt, &shard, &start);
 
-                if (ctlLocked)
-                    (void)ctl_rel(pq, 0);
-            } // Control-header was locked
+    if (status == PQ_SYSTEM) {
+        log_add("sh_seek() failure");
+    }
+    else if (status == 0) {
+        const timestampt cursor = pq->cursor;
 
-            if (threadLocked)
-                pq_unlockIf(pq);
-        } // `pq_lockIf() was called
-    } // `pq != NULL`
+        sh_position(shard, &start);
+        status = pq_sequenceHelper(shard, mt, clss, ifMatch, otherargs, off);
+        sh_settle(pq, shard, &start, &cursor);
+    }
 
     return status;
 }
@@ -7504,7 +13463,9 @@ pq_sequence(
         pq_seqfunc* const         ifMatch,
         void* const               otherargs)
 {
-    return pq_sequenceHelper(pq, mt, clss, ifMatch, otherargs, NULL);
+    return pq && pq->shards
+            ? sh_sequence(pq, mt, clss, ifMatch, otherargs, NULL)
+            : pq_sequenceHelper(pq, mt, clss, ifMatch, otherargs, NULL);
 }
 
 int
@@ -7516,11 +13477,20 @@ pq_sequenceLock(
         void* const                        otherargs,
         off_t* const                       offset)
 {
-    return pq_sequenceHelper(pq, mt, clss, ifMatch, otherargs, offset);
+    return pq && pq->shards
+            ? sh_sequence(pq, mt, clss, ifMatch, otherargs, offset)
+            : pq_sequenceHelper(pq, mt, clss, ifMatch, otherargs, offset);
 }
 
-int
-pq_next(
+/**
+ * Processes the next data-product of a product-queue or of one shard of a
+ * sharded product-queue.
+ *
+ * @param[in,out] pq  Product-queue or shard
+ * @return            See `pq_next()`
+ */
+static int
+pq_nextHelper(
         pqueue* const restrict             pq,
         const bool                         reverse,
         const prod_class_t* const restrict clss,
@@ -7541,51 +13511,45 @@ pq_next(
         if (tvIsNone(pq->cursor))
             pq->cursor = reverse ? TS_ENDT : TS_ZERO;
 
-        // Read-lock control-header
-        status = ctl_get(pq, 0);
-        if (status) {
-            log_errno(status, "Couldn't get control-header");
-            status = PQ_SYSTEM;
+        /*
+         * Read control-header, find next element in time-queue, and lock
+         * region in product-queue that contains product
+         */
+        tqsnap snap;
+        status = ctl_findElem(pq, reverse ? TV_LT : TV_GT, true, clss,
+                &snap);
+        if (status == PQ_SYSTEM) {
+            log_flush_error();
         }
         else {
             bool ctl_locked = true;
 
             queue_par_t queue_par;
-            queue_par.is_full = pq->ctlp->isFull;
 
-            // Find next element in time-queue
-            tqelem* tqep = tqe_find(pq->tqp, &pq->cursor,
-                    reverse ? TV_LT : TV_GT);
-            if (tqep == NULL) {
+            if (status == PQ_END) {
                 status = PQUEUE_END;
             }
             else {
-                timestampt oldest = tqe_first(pq->tqp)->tv;
-                queue_par.early_cursor = tvCmp(pq->cursor, oldest, <=);
+                queue_par.is_full = snap.isFull;
+                queue_par.early_cursor = tvCmp(pq->cursor, snap.oldest, <=);
 
                 // Update product-queue time-cursor
-                pq_cset(pq, &tqep->tv);
-                pq_coffset(pq, tqep->offset);
+                pq_cset(pq, &snap.tv);
+                pq_coffset(pq, snap.offset);
 
-                queue_par.inserted = tqep->tv;
+                queue_par.inserted = snap.tv;
 
-                // Find region in product-queue that contains product
-                region* rp;
-                status = rl_r_find(pq->rlp, tqep->offset, &rp);
-                if (status == 0 || rp->offset != tqep->offset
-                        || Extent(rp) > pq_getDataSize(pq)) {
-                    char ts[20];
-                    (void)sprint_timestampt(ts, sizeof(ts), &tqep->tv);
-                    log_error("Queue corrupt: tq: %s %s at %ld",
-                            ts,
-                            status ? "invalid region" : "no data",
-                            tqep->offset);
+                if (status == PQ_CORRUPT) {
+                    log_flush_error();
                     /*
                      * Can't be fixed (tq_delete(pq->tqp, tqep)) here because no
                      * write permission
                      */
                     status = 0;
                 }
+                else if (snap.skipped) {
+                    // Product ruled out by its metadata: didn't match
+                }
                 else {
                     // Following avoids calls to malloc() in XDR module
                     char ident[KEYSIZE + 1];
@@ -7593,72 +13557,79 @@ pq_next(
                     prod_par_t prod_par = {
                             .info.ident = ident,
                             .info.origin = origin,
-                            .size = Extent(rp)
+                            .size = snap.extent,
+                            .encoded = snap.vp
                     };
-                    // Lock region in product-queue that contains product
-                    status = rgn_get(pq, rp->offset, prod_par.size, 0,
-                            &prod_par.encoded);
-                    if (status) {
-                        log_errno(status, "Couldn't get product region");
+                    log_assert(prod_par.encoded != NULL);
+
+                    /*
+                     * Because data-product is locked, control-header can
+                     * be released so that another process can access
+                     * product-queue.
+                     */
+                    status = ctl_rel(pq, 0);
+                    log_assert(status == 0);
+                    ctl_locked = false;
+
+                    /*
+                     * If appropriate, log delay since product insertion to
+                     * indicate if processing is falling behind.
+                     */
+                    if (log_is_enabled_debug) {
+                        timestampt now;
+                        if (gettimeofday(&now, 0) == 0) {
+                            double delay = d_diff_timestamp(&now,
+                                    &queue_par.inserted);
+                            log_debug("Delay: %.4f sec", delay);
+                        }
+                    }
+
+                    // Decode data-product metadata
+                    bool matched = false;
+                    XDR  xdrs;
+                    xdrmem_create(&xdrs, prod_par.encoded,
+                            (u_int)prod_par.size, XDR_DECODE) ;
+                    if (!xdr_prod_info(&xdrs, &prod_par.info)) {
+                        log_error("xdr_prod_info() failed") ;
                         status = PQ_SYSTEM;
                     }
                     else {
-                        log_assert(prod_par.encoded != NULL);
+                        log_assert(snap.zipped ||
+                                prod_par.info.sz <= xdrs.x_handy);
 
-                        /*
-                         * Because data-product is locked, control-header can
-                         * be released so that another process can access
-                         * product-queue. NB: This makes `tqep` invalid.
-                         */
-                        status = ctl_rel(pq, 0);
-                        log_assert(status == 0);
-                        ctl_locked = false;
+                        #if PQ_SEQ_TRACE
+                            log_debug("%s %u",
+                                    s_prod_info(NULL, 0, &prod_par.info, 1),
+                                    xdrs.x_handy) ;
+                        #endif
 
                         /*
-                         * If appropriate, log delay since product insertion to
-                         * indicate if processing is falling behind.
+                         * If appropriate, log time-interval from
+                         * product-creation to queue-insertion.
                          */
                         if (log_is_enabled_debug) {
-                            timestampt now;
-                            if (gettimeofday(&now, 0) == 0) {
-                                double delay = d_diff_timestamp(&now,
-                                        &queue_par.inserted);
-                                log_debug("Delay: %.4f sec", delay);
-                            }
-                        }
-
-                        // Decode data-product metadata
-                        XDR xdrs;
-                        xdrmem_create(&xdrs, prod_par.encoded,
-                                (u_int)prod_par.size, XDR_DECODE) ;
-                        if (!xdr_prod_info(&xdrs, &prod_par.info)) {
-                            log_error("xdr_prod_info() failed") ;
-                            status = PQ_SYSTEM;
+                            double latency =
+                                    d_diff_timestamp(&queue_par.inserted,
+                                            &prod_par.info.arrival);
+                            log_debug("time(insert)-time(create): %.4f s",
+                                    latency);
                         }
-                        else {
-                            log_assert(prod_par.info.sz <= xdrs.x_handy);
 
-                            #if PQ_SEQ_TRACE
-                                log_debug("%s %u",
-                                        s_prod_info(NULL, 0, &prod_par.info, 1),
-                                        xdrs.x_handy) ;
-                            #endif
-
-                            /*
-                             * If appropriate, log time-interval from
-                             * product-creation to queue-insertion.
-                             */
-                            if (log_is_enabled_debug) {
-                                double latency =
-                                        d_diff_timestamp(&queue_par.inserted,
-                                                &prod_par.info.arrival);
-                                log_debug("time(insert)-time(create): %.4f s",
-                                        latency);
+                        // If appropriate, apply caller-supplied function.
+                        if (clss == PQ_CLASS_ALL || prodInClass(clss, &prod_par.info)) {
+                            matched = true;
+                            log_assert(func != NULL);
+                            if (snap.zipped) {
+                                void* xprod = snap.vp;
+
+                                status = zp_get(pq, snap.offset,
+                                        &prod_par.info, &xdrs, &xprod,
+                                        &prod_par.size, &prod_par.data);
+                                prod_par.encoded = xprod;
+                                if (status)
+                                    log_flush_error();
                             }
-
-                            // If appropriate, apply caller-supplied function.
-                            if (clss == PQ_CLASS_ALL || prodInClass(clss, &prod_par.info)) {
-                                log_assert(func != NULL);
+                            else {
                                 {
                                     // Change extent into xlen_product */
                                     const size_t xsz =
@@ -7671,24 +13642,30 @@ pq_next(
                                  * buffer.
                                  */
                                 prod_par.data = xdrs.x_private;
-                                queue_par.offset = rp->offset;
-                                /*
-                                 * Product-queue is unlocked because calling a
-                                 * foreign function with an acquired lock can
-                                 * result in deadlock:
-                                 */
+                            }
+                            queue_par.offset = sh_encode(pq, snap.offset);
+                            /*
+                             * Product-queue is unlocked because calling a
+                             * foreign function with an acquired lock can
+                             * result in deadlock:
+                             */
+                            if (status == 0)
                                 func(&prod_par, &queue_par, app_par);
-                            } // Product matches
-                        } // xdr_prod_info() succeeded
-                        xdr_destroy(&xdrs);
-                        if (!keep_locked)
-                            (void)rgn_rel(pq, rp->offset, 0);
-                    } // rgn_get() succeeded
-                } // rl_r_find() succeeded
-            } // tqe_find() succeeded
+                        } // Product matches
+                    } // xdr_prod_info() succeeded
+                    xdr_destroy(&xdrs);
+                    // An unmatched product can't be released by the caller
+                    if (keep_locked && matched && status == 0) {
+                        pq->locked_count++;
+                    }
+                    else {
+                        (void)rgn_rel(pq, snap.offset, 0);
+                    }
+                } // Region found
+            } // Time-queue element found
             if (ctl_locked)
                 (void)ctl_rel(pq, 0);
-        } // ctl_get() succeeded
+        } // Control-header obtained
 
         pq_unlockIf(pq);
     } // Valid arguments
@@ -7696,11 +13673,58 @@ pq_next(
     return status;
 }
 
+int
+pq_next(
+        pqueue* const restrict             pq,
+        const bool                         reverse,
+        const prod_class_t* const restrict clss,
+        pq_next_func* const                func,
+        const bool                         keep_locked,
+        void* const restrict               app_par)
+{
+    if (pq == NULL || pq->shards == NULL || clss == NULL || func == NULL)
+        return pq_nextHelper(pq, reverse, clss, func, keep_locked, app_par);
+
+    const pq_match mt = reverse ? TV_LT : TV_GT;
+    pqueue*        shard;
+    timestampt     start;
+    int            status = sh_seek(pq, mt, &shard, &start);
+
+    if (status == PQ_SYSTEM) {
+        log_flush_error();
+    }
+    else if (status == PQ_END) {
+        status = PQUEUE_END;
+    }
+    else {
+        const timestampt cursor = pq->cursor;
+
+        sh_position(shard, &start);
+        status = pq_nextHelper(shard, reverse, clss, func, keep_locked,
+                app_par);
+        sh_settle(pq, shard, &start, &cursor);
+    }
+
+    return status;
+}
+
 int
 pq_release(
         pqueue* const pq,
         const off_t   offset)
 {
+    if (pq->shards) {
+        const off_t index = offset >> SH_SHIFT;
+
+        if (index < 0 || index >= pq->nshards) {
+            log_error("Invalid offset %ld", (long)offset);
+            return PQ_INVAL;
+        }
+        if (index)
+            return pq_release(pq->shards[index],
+                    offset & (((off_t)1 << SH_SHIFT) - 1));
+    }
+
     pq_lockIf(pq);
         int status = rgn_rel(pq, offset, 0);
 
@@ -7720,6 +13744,138 @@ pq_release(
                 : 0;
 }
 
+/*
+ * A pinned data-product. The product-information strings are copied; the data
+ * isn't.
+ */
+struct pq_ref {
+        pqueue*     pq;
+        prod_par_t  prod;
+        queue_par_t queue;
+        unsigned    refCount;
+        char        ident[KEYSIZE + 1];
+        char        origin[HOSTNAMESIZE + 1];
+};
+
+/*
+ * Result of pinning a data-product.
+ */
+typedef struct {
+        pq_ref* ref;            /* Pinned data-product or NULL */
+        off_t   offset;         /* Offset of matching data-product */
+        bool    matched;        /* Did the data-product match? */
+} pin_par;
+
+/*
+ * Pins a matching data-product. Called by `pq_next()` on behalf of
+ * `pq_acquire()`.
+ */
+static void
+pq_pin(
+        const prod_par_t* restrict  prod_par,
+        const queue_par_t* restrict queue_par,
+        void* restrict              app_par)
+{
+        pin_par* const pin = (pin_par*)app_par;
+        pq_ref* const  ref = malloc(sizeof(pq_ref));
+
+        if (ref != NULL) {
+                ref->prod = *prod_par;
+                (void)strncpy(ref->ident, prod_par->info.ident,
+                        sizeof(ref->ident));
+                ref->ident[sizeof(ref->ident)-1] = 0;
+                (void)strncpy(ref->origin, prod_par->info.origin,
+                        sizeof(ref->origin));
+                ref->origin[sizeof(ref->origin)-1] = 0;
+                ref->prod.info.ident = ref->ident;
+                ref->prod.info.origin = ref->origin;
+                ref->queue = *queue_par;
+                ref->refCount = 1;
+        }
+        pin->ref = ref;
+        pin->offset = queue_par->offset;
+        pin->matched = true;
+}
+
+int
+pq_acquire(
+        pqueue* const restrict             pq,
+        const bool                         reverse,
+        const prod_class_t* const restrict clss,
+        pq_ref** const restrict            ref)
+{
+        if (ref == NULL) {
+                log_error("NULL reference argument");
+                return PQ_INVAL;
+        }
+
+        pin_par pin = {.ref = NULL, .matched = false};
+        int     status = pq_next(pq, reverse, clss, pq_pin, true, &pin);
+
+        if (status == 0 && pin.matched) {
+                if (pin.ref == NULL) {
+                        log_syserr("Couldn't allocate pinned data-product");
+                        (void)pq_release(pq, pin.offset);
+                        status = PQ_SYSTEM;
+                }
+                else {
+                        pin.ref->pq = pq;
+                }
+        }
+        *ref = pin.ref;
+
+        return status;
+}
+
+const prod_par_t*
+pq_refProd(
+        const pq_ref* const ref)
+{
+        return &ref->prod;
+}
+
+const queue_par_t*
+pq_refQueue(
+        const pq_ref* const ref)
+{
+        return &ref->queue;
+}
+
+pq_ref*
+pq_retainRef(
+        pq_ref* const ref)
+{
+        pq_lockIf(ref->pq);
+            log_assert(ref->refCount > 0);
+            ref->refCount++;
+        pq_unlockIf(ref->pq);
+
+        return ref;
+}
+
+int
+pq_releaseRef(
+        pq_ref* const ref)
+{
+        if (ref == NULL)
+                return 0;
+
+        pqueue* const pq = ref->pq;
+
+        pq_lockIf(pq);
+            log_assert(ref->refCount > 0);
+            const bool last = --ref->refCount == 0;
+        pq_unlockIf(pq);
+
+        if (!last)
+                return 0;
+
+        const int status = pq_release(pq, ref->queue.offset);
+        free(ref);
+
+        return status;
+}
+
 int
 pq_ctimeck(pqueue *pq, pq_match mt, const prod_class_t *clssp,
         const timestampt *maxlatencyp)
@@ -7759,9 +13915,16 @@ pq_ctimeck(pqueue *pq, pq_match mt, const prod_class_t *clssp,
 }
 
 
+/**
+ * Deletes the next data-product of a product-queue or of one shard of a sharded
+ * product-queue.
+ *
+ * @param[in,out] pq  Product-queue or shard
+ * @return            See `pq_seqdel()`
+ */
 /*ARGSUSED*/
-int
-pq_seqdel(
+static int
+pq_seqdelHelper(
         pqueue* const       pq,
         pq_match            mt,
         const prod_class_t* clss,
@@ -7769,9 +13932,6 @@ pq_seqdel(
         size_t* const       extentp,
         timestampt* const   timestampp)
 {
-    if(pq == NULL)
-        return EINVAL;
-
     pq_lockIf(pq);
         int        status = ENOERR;
         tqelem*    tqep;
@@ -7830,7 +13990,7 @@ pq_seqdel(
 
         rp = pq->rlp->rp + rlix;
         log_assert(rp->offset == tqep->offset);
-        log_assert(Extent(rp) <= pq_getDataSize(pq));
+        log_assert(Extent(rp) <= pq_dataSize(pq));
 
         status = rgn_get(pq, rp->offset, Extent(rp), rflags, &vp);
 
@@ -7857,7 +14017,7 @@ pq_seqdel(
             status = EIO;
             goto unwind_rgn;
         }
-        log_assert(info->sz <= xdrs.x_handy);
+        log_assert(IsZip(rp) || info->sz <= xdrs.x_handy);
 
         /* return timestamp value even if we don't delete it */
         if(timestampp)
@@ -7882,16 +14042,23 @@ pq_seqdel(
         if(extentp)
             *extentp = extent;
 
-        tq_delete(pq->tqp, tqep); {
-            const int found = sx_find_delete(pq->sxp, info->signature);
-            if(found == 0) {
-                char ts[20];
-                (void) sprint_timestampt(ts, sizeof(ts), &tqep->tv);
-                log_error("Queue corrupt: pq_seqdel: %s no signature at %ld",
-                        ts, tqep->offset);
+        {
+            pqjournal outer;
+            jn_begin(pq, JN_DELETE, offset, &outer);
+
+            pq_tqDelete(pq, tqep); {
+                const int found = sx_find_delete(pq->sxp, info->signature);
+                if(found == 0) {
+                    char ts[20];
+                    (void) sprint_timestampt(ts, sizeof(ts), &tqep->tv);
+                    log_error("Queue corrupt: pq_seqdel: %s no signature at %ld",
+                            ts, tqep->offset);
+                }
             }
+            rl_free(pq->rlp, rlix);
+
+            jn_end(pq, &outer);
         }
-        rl_free(pq->rlp, rlix);
 
         /*FALLTHROUGH*/
     unwind_rgn:
@@ -7910,11 +14077,51 @@ unwind_lock:
     return status;
 }
 
+int
+pq_seqdel(
+        pqueue* const       pq,
+        pq_match            mt,
+        const prod_class_t* clss,
+        const int           wait,
+        size_t* const       extentp,
+        timestampt* const   timestampp)
+{
+    if(pq == NULL)
+        return EINVAL;
+    if(pq->shards == NULL)
+        return pq_seqdelHelper(pq, mt, clss, wait, extentp, timestampp);
+
+    // The shards' time-queues are merged as in `sh_sequence()`
+    pqueue*    shard;
+    timestampt start;
+    int        status = sh_seek(pq, mt, &shard, &start);
+
+    if (status == PQ_SYSTEM) {
+        log_flush_error();
+        status = EIO;
+    }
+    else if (status == PQ_END) {
+        status = PQUEUE_END;
+    }
+    else {
+        const timestampt cursor = pq->cursor;
+
+        sh_position(shard, &start);
+        status = pq_seqdelHelper(shard, mt, clss, wait, extentp, timestampp);
+        sh_settle(pq, shard, &start, &cursor);
+    }
+
+    return status;
+}
+
 int
 pq_deleteBySignature(
         pqueue* const restrict pq,
         const signaturet       sig)
 {
+    if (pq->shards && sh_shard(pq, sig) != pq)
+        return pq_deleteBySignature(sh_shard(pq, sig), sig);
+
     pq_lockIf(pq);
     int status = ctl_get(pq, RGN_WRITE);
     if (status) {
@@ -8202,6 +14409,9 @@ pqe_new(pqueue *pq,
     log_assert(ptrp != NULL);
     log_assert(indexp != NULL);
 
+    if (pq->shards && sh_shard(pq, infop->signature) != pq)
+        return pqe_new(sh_shard(pq, infop->signature), infop, ptrp, indexp);
+
     pq_lockIf(pq);
         size_t extent;
         void *vp = NULL;
@@ -8213,9 +14423,9 @@ pqe_new(pqueue *pq,
                 goto unwind_lock;
         }
 
-        if (infop->sz > pq_getDataSize(pq)) {
+        if (infop->sz > pq_dataSize(pq)) {
                 log_error("Product too big: product=%u bytes; queue=%lu bytes",
-                    infop->sz, (unsigned long)pq_getDataSize(pq));
+                    infop->sz, (unsigned long)pq_dataSize(pq));
                 status = PQ_BIG;
                 goto unwind_lock;
         }
@@ -8256,6 +14466,8 @@ pqe_new(pqueue *pq,
         memcpy(indexp->signature, sxep->sxi, sizeof(signaturet));
         indexp->sig_is_set = true;
         pq->pqe_count++;
+        /* The data might be received over a network: survive this process */
+        (void)jn_openReserve(pq, sxep->offset);
         /*FALLTHROUGH*/
 
 unwind_ctl:
@@ -8286,12 +14498,16 @@ pqe_newDirect(
                 signature);
         status = EINVAL;
     }
+    else if (pq->shards && sh_shard(pq, signature) != pq) {
+        status = pqe_newDirect(sh_shard(pq, signature), size, signature, ptrp,
+                indexp);
+    }
     else {
         pq_lockIf(pq);
 
-        if (size > pq_getDataSize(pq)) {
+        if (size > pq_dataSize(pq)) {
             log_error("Product too big: product=%lu bytes; queue=%lu bytes",
-                    (unsigned long)size, (unsigned long)pq_getDataSize(pq));
+                    (unsigned long)size, (unsigned long)pq_dataSize(pq));
             status = PQ_BIG;
         }
         else {
@@ -8327,6 +14543,11 @@ pqe_newDirect(
                                 sizeof(signaturet));
                         indexp->sig_is_set = true;
                         pq->pqe_count++;
+                        /*
+                         * The data might be received over a network: survive
+                         * the death of this process.
+                         */
+                        (void)jn_openReserve(pq, sxep->offset);
                     }
 
                     (void)ctl_rel(pq, RGN_MODIFIED);
@@ -8345,6 +14566,9 @@ pqe_discard(
         pqueue* const restrict          pq,
         const pqe_index* const restrict index)
 {
+    if (pq->shards && sh_shard(pq, index->signature) != pq)
+        return pqe_discard(sh_shard(pq, index->signature), index);
+
     pq_lockIf(pq);
         int   status;
         off_t offset = pqeOffset(*index);
@@ -8371,6 +14595,7 @@ pqe_discard(
                 }
                 else {
 					pq->pqe_count--;
+                    jn_closeReserve(pq, jn_findReserve(pq, offset));
                 }
 
 				(void)ctl_rel(pq, RGN_MODIFIED);
@@ -8384,9 +14609,17 @@ pqe_discard(
 int
 pqe_xinsert(pqueue *pq, pqe_index index, const signaturet realsignature)
 {
+        /*
+         * The region was reserved in the shard of the provisional signature;
+         * so, duplicates are only detected in that shard.
+         */
+        if(pq->shards)
+                pq = sh_shard(pq, index.signature);
+
         pq_lockIf(pq);
         int status = ENOERR;
         off_t offset = pqeOffset(index);
+        size_t extent;
 
         /* correct the signature in the product */
         {
@@ -8399,6 +14632,7 @@ pqe_xinsert(pqueue *pq, pqe_index index, const signaturet realsignature)
                         goto unwind_lock;
                 }
                 xp = rp->vp;
+                extent = rp->extent;
                 log_assert(xp != NULL);
                 xp += 8; /* xlen_timestampt */
                 memcpy(xp, realsignature, sizeof(signaturet));
@@ -8425,10 +14659,13 @@ pqe_xinsert(pqueue *pq, pqe_index index, const signaturet realsignature)
               log_debug("PQ_DUP");
               status = PQ_DUP;
               (void) rpqe_free(pq, offset, index.signature);
+              jn_closeReserve(pq, jn_findReserve(pq, offset));
               goto unwind_ctl;
             }
           /* else */
           /* correct the signature in the index */
+          pqjournal outer;
+          jn_begin(pq, JN_INSERT, offset, &outer);
 
           if(sx_find_delete(pq->sxp, index.signature) == 0)
             {
@@ -8436,14 +14673,18 @@ pqe_xinsert(pqueue *pq, pqe_index index, const signaturet realsignature)
                      s_signaturet(NULL, 0, index.signature));
             }
           sxep = sx_add(pq->sxp, realsignature, offset);
+          jn_end(pq, &outer);
         }
 
         log_assert(pq->tqp != NULL && tq_HasSpace(pq->tqp));
 
-        status = tq_add(pq->tqp, offset);
+        status = pq_tqAdd(pq, offset, NULL); // Product isn't decoded
         if(status != ENOERR)
                 goto unwind_ctl;
 
+        jn_closeReserve(pq, jn_findReserve(pq, offset));
+        ctl_incrInsertSeq(pq->ctlp, ANY, extent); // Feedtype isn't decoded
+
         /*
          * Inform others in our process group
          * that there is new data available.
@@ -8455,6 +14696,8 @@ pqe_xinsert(pqueue *pq, pqe_index index, const signaturet realsignature)
         /*FALLTHROUGH*/
 unwind_ctl:
         (void) ctl_rel(pq, RGN_MODIFIED);
+        if(status == ENOERR)
+                pq_wakeWaiters(pq, ANY);
 unwind_lock:
         pq_unlockIf(pq);
         return status;
@@ -8467,6 +14710,9 @@ pqe_insert(
 {
     int  status;
 
+    if (pq->shards && sh_shard(pq, index->signature) != pq)
+        return pqe_insert(sh_shard(pq, index->signature), index);
+
 #if 1
     pq_lockIf(pq);
         riu* rp;
@@ -8479,6 +14725,8 @@ pqe_insert(
             InfoBuf    infoBuf;
             prod_info* info = ib_init(&infoBuf);
             XDR        xdrs;
+            zdata      zd = {NULL, 0, 0};
+            size_t     extent = rp->extent;
             xdrmem_create(&xdrs, rp->vp, rp->extent, XDR_DECODE);
             if (!xdr_prod_info(&xdrs, info)) {
                 log_error("xdr_prod_info() failed; "
@@ -8492,6 +14740,9 @@ pqe_insert(
                         (unsigned long)info->sz, (unsigned long)rp->extent);
                 status = PQ_BIG;
             }
+            else if (zp_deflateRegion(pq, info, &xdrs, rp->vp, &zd)) {
+                status = PQ_SYSTEM;
+            }
             else if (pq->mtof(pq, index->offset, RGN_MODIFIED)) {
                 log_error("pq->mtof() failed");
                 status = PQ_SYSTEM;
@@ -8501,13 +14752,22 @@ pqe_insert(
                 status = PQ_SYSTEM;
             }
             else {
+                if (zd.buf != NULL) {
+                    pqjournal outer;
+                    jn_begin(pq, JN_INSERT, index->offset, &outer);
+                    extent = rpqe_shrink(pq, index->offset, zd.extent);
+                    zp_setZipped(pq, index->offset, info, &zd);
+                    jn_end(pq, &outer);
+                }
                 log_assert(pq->tqp != NULL && tq_HasSpace(pq->tqp));
-                if (tq_add(pq->tqp, index->offset)) {
+                if (pq_tqAdd(pq, index->offset, info)) {
                     log_error("tq_add() failed");
                     status = PQ_SYSTEM;
                 }
                 else {
+                    jn_closeReserve(pq, jn_findReserve(pq, index->offset));
                     (void)set_timestamp(&pq->ctlp->mostRecent);
+                    ctl_incrInsertSeq(pq->ctlp, info->feedtype, extent);
                     pq->pqe_count--;
                     /*
                      * Inform our process group that there is new data available
@@ -8517,8 +14777,11 @@ pqe_insert(
                     status = 0;
                 } // entry made in time-queue
                 (void)ctl_rel(pq, RGN_MODIFIED);
+                if (status == 0)
+                    pq_wakeWaiters(pq, info->feedtype); // See pq_waitForNewer()
             } // `ctl_get()` succeeded
             xdr_destroy(&xdrs);
+            free(zd.buf);
 
             if (status)
                 (void)pqe_discard(pq, index);
@@ -8544,7 +14807,7 @@ pqe_insert(
 
         log_assert(pq->tqp != NULL && tq_HasSpace(pq->tqp));
 
-        status = tq_add(pq->tqp, offset);
+        status = pq_tqAdd(pq, offset, NULL);
         if(status != ENOERR)
                 goto unwind_ctl;
 
@@ -11,6 +11,7 @@
 #include <sys/types.h>	/* off_t, mode_t */
 #include <stdbool.h>
 #include <stddef.h>	/* size_t */
+#include <stdint.h>
 
 
 /**
@@ -90,7 +91,27 @@ typedef void pq_next_func(
 #define PQ_MAPRGNS	0x40	/* Map region by region, default whole file */
 #define PQ_SPARSE       0x80    /* Created as sparse file, zero blocks unallocated */
 #define PQ_THREADSAFE   0x100   /* Make the queue access functions thread-safe */
-/* N.B.: bits 0x1000 (and above) in use internally */
+#define PQ_SEQLOCK      0x200   /* If pq_create(), readers validate a sequence-lock
+                                   instead of read-locking the control-header */
+#define PQ_TIMERING     0x400   /* If pq_create(), add a sorted time-ring index for
+                                   faster reader lookups */
+#define PQ_HUGEPAGES    0x800   /* Back the mapping with huge pages if possible */
+/* N.B.: bits 0x1000 through 0x8000 in use internally */
+#define PQ_INTERLEAVE   0x10000 /* Interleave the mapping across NUMA nodes */
+#define PQ_FASTOPEN     0x20000 /* If pq_open(), prefetch the indexes and defer
+                                   their validation until first used */
+/* N.B.: bit 0x40000 in use internally */
+#define PQ_COMPRESS     0x80000 /* If pq_create(), store data-products
+                                   compressed when that saves space */
+#define PQ_NOINFLATE    0x100000 /* If pq_open(), pass compressed data-products
+                                   to readers as stored (see pq_inflate()) */
+
+/**
+ * Mapping modes returned by pq_getMapMode()
+ */
+#define PQ_MAP_HUGETLBFS  0x1   /* Product-queue file is on a hugetlbfs(5) */
+#define PQ_MAP_THP        0x2   /* Transparent huge pages were advised */
+#define PQ_MAP_INTERLEAVE 0x4   /* Pages are interleaved across NUMA nodes */
 
 #define pqeOffset(pqe) ((pqe).offset)
 #define pqeEqual(left, rght) (pqeOffset(left) == pqeOffset(rght))
@@ -137,6 +158,33 @@ extern const pqe_index _pqenone;
  *                          PQ_PRIVATE    `mmap()` the file `MAP_PRIVATE`.
  *                                        Default is `MAP_SHARED`.
  *                          PQ_THREADSAFE Ensure thread-safe access
+ *                          PQ_SEQLOCK    Readers of the product-queue won't
+ *                                        read-lock its control-header but
+ *                                        will, instead, validate a
+ *                                        sequence-lock that's incremented by
+ *                                        writers. Persistent. Writers must
+ *                                        memory-map the product-queue shared.
+ *                          PQ_TIMERING   Add a time-index that's a sorted,
+ *                                        circular array, in addition to the
+ *                                        skip-list, so that readers find the
+ *                                        next data-product by binary search.
+ *                                        Persistent. Enlarges the index
+ *                                        segment by about 27 bytes per slot.
+ *                          PQ_HUGEPAGES  Back the memory-mapping with huge
+ *                                        pages: the file is laid out in
+ *                                        huge pages if it's on a hugetlbfs;
+ *                                        otherwise, transparent huge pages
+ *                                        are advised. Persistent.
+ *                          PQ_INTERLEAVE Interleave the pages of the memory-
+ *                                        mapping across the online NUMA
+ *                                        nodes. Persistent.
+ *                          PQ_COMPRESS   Deflate the data of inserted
+ *                                        data-products with zlib(3) when
+ *                                        that makes them smaller. Readers
+ *                                        are passed the inflated
+ *                                        data-products. Persistent. The
+ *                                        product-queue can't be opened by
+ *                                        older versions of the LDM.
  * @param[in]  align      Alignment parameter for file components or 0.
  * @param[in]  initialsz  Size, in bytes, of the data portion of the product-
  *                        queue.
@@ -153,7 +201,65 @@ pq_create(const char *path, mode_t mode,
         pqueue **pqp);
 
 /**
- * Opens an existing product-queue.
+ * Maximum number of shards of a product-queue.
+ */
+#define PQ_MAX_SHARDS 64
+
+/**
+ * Creates a sharded product-queue: `nshards` product-queues, each with its own
+ * control-header, indexes, and lock, so that concurrent writers of different
+ * data-products don't contend for one lock. The first shard is the file
+ * `path`; shard `i` is the file `path.i`. The shard of a data-product is chosen
+ * by its signature. `pq_open()` of `path` opens all the shards and returns a
+ * product-queue whose insertions and lookups by signature are dispatched to
+ * the appropriate shard and whose `pq_sequence()`, `pq_sequenceLock()`, and
+ * `pq_next()` merge the shards in order of insertion-time.
+ *
+ * `pq_last()` and `pq_seqdel()` also merge the shards. Functions that report
+ * on or modify the product-queue as a whole (e.g., `pq_stats()`,
+ * `pq_highwater()`, `pq_getTelemetry()`, and `pq_registerReader()`) only apply
+ * to the first shard. Readers of a sharded product-queue aren't notified of
+ * insertions by feedtype.
+ *
+ * @param[in]  path       Pathname of the first shard
+ * @param[in]  mode       File-mode of the shards
+ * @param[in]  pflags     Flags of the shards (see `pq_create()`)
+ * @param[in]  align      Alignment parameter for file components or 0
+ * @param[in]  initialsz  Size, in bytes, of the data portions of all the shards
+ *                        together
+ * @param[in]  nproducts  Number of product slots of all the shards together
+ * @param[in]  nshards    Number of shards. 1 is the same as `pq_create()`.
+ * @param[out] pqp        Product-queue
+ * @retval     0          Success. `*pqp` is set.
+ * @retval     EINVAL     `nshards` is 0 or greater than `PQ_MAX_SHARDS`.
+ *                        `log_add()` called.
+ * @return                Other `<errno.h>` error-code. `log_add()` called.
+ *                        Shards that were created are removed.
+ */
+int
+pq_createSharded(
+        const char* const path,
+        const mode_t      mode,
+        const int         pflags,
+        const size_t      align,
+        const off_t       initialsz,
+        const size_t      nproducts,
+        const unsigned    nshards,
+        pqueue** const    pqp);
+
+/**
+ * Returns the number of shards of a product-queue.
+ *
+ * @param[in] pq  Product-queue
+ * @return        Number of shards. 1 if the product-queue isn't sharded.
+ * @see `pq_createSharded()`
+ */
+unsigned
+pq_getShardCount(pqueue* const pq);
+
+/**
+ * Opens an existing product-queue. If it's the first shard of a sharded
+ * product-queue, then all its shards are opened (see `pq_createSharded()`).
  *
  * @param[in] path         Pathname of product-queue.
  * @param[in] pflags       File-open flags. Bitwise OR of
@@ -165,6 +271,26 @@ pq_create(const char *path, mode_t mode,
  *                           PQ_PRIVATE    `mmap()` the file `MAP_PRIVATE`.
  *                                         Default is `MAP_SHARED`
  *                           PQ_READONLY   Default is read-write.
+ *                           PQ_HUGEPAGES  Advise huge pages for the mapping
+ *                                         even if the product-queue wasn't
+ *                                         created with this flag.
+ *                           PQ_INTERLEAVE Interleave the mapping across NUMA
+ *                                         nodes even if the product-queue
+ *                                         wasn't created with this flag.
+ *                           PQ_FASTOPEN   Start reading the indexes into the
+ *                                         page-cache in the background and
+ *                                         don't validate them until they're
+ *                                         first used. An inconsistent
+ *                                         product-queue is then reported by
+ *                                         the first function that accesses it.
+ *                                         For processes that open a
+ *                                         product-queue that's already known
+ *                                         to be good (e.g., children of
+ *                                         ldmd(1)).
+ *                           PQ_NOINFLATE  Pass compressed data-products (see
+ *                                         PQ_COMPRESS) to readers as they're
+ *                                         stored rather than inflated. See
+ *                                         pq_inflate().
  * @param[out] pqp         Memory location to receive pointer to product-queue
  *                         structure.
  * @retval     0           Success. *pqp set.
@@ -172,7 +298,11 @@ pq_create(const char *path, mode_t mode,
  *                         and the product-queue is already open by the maximum
  *                         number of writers.
  * @retval     PQ_CORRUPT  The  product-queue is internally inconsistent.
+ * @retval     EINVAL      The product-queue is a shard other than the first of
+ *                         a sharded product-queue or one of its shards doesn't
+ *                         belong to it. `log_add()` called.
  * @return                 Other <errno.h> error-code.
+ * @see pq_getOpenLatency()
  */
 int
 pq_open(
@@ -194,11 +324,50 @@ pq_open(
  *                                   `MAP_SHARED`
  *                    PQ_READONLY    Default is read/write.
  *                    PQ_THREADSAFE  Product-queue access is thread-safe
+ *                    PQ_SEQLOCK     Product-queue is sequence-locked
+ *                    PQ_TIMERING    Product-queue has a time-ring index
+ *                    PQ_HUGEPAGES   Huge pages are requested for the mapping
+ *                    PQ_INTERLEAVE  NUMA interleaving is requested for the
+ *                                   mapping
  */
 int
 pq_getFlags(
         pqueue* const pq);
 
+/**
+ * Returns how the product-queue is actually memory-mapped. Requesting huge
+ * pages or NUMA interleaving (see `PQ_HUGEPAGES` and `PQ_INTERLEAVE`) is only
+ * advice: it's ignored if the product-queue isn't memory-mapped in its
+ * entirety or if the operating-system doesn't support it.
+ *
+ * @param[in] pq  The product-queue.
+ * @return        The mapping mode: 0 if the product-queue isn't memory-mapped
+ *                in its entirety or no advice was taken; otherwise, a bitwise
+ *                OR of
+ *                    PQ_MAP_HUGETLBFS   Product-queue file is on a hugetlbfs
+ *                                       and is mapped by huge pages
+ *                    PQ_MAP_THP         Transparent huge pages were advised.
+ *                                       The kernel honors this only for
+ *                                       shared-memory files (e.g., on a
+ *                                       tmpfs(5) mounted with "huge=advise").
+ *                    PQ_MAP_INTERLEAVE  Pages are interleaved across the
+ *                                       online NUMA nodes
+ */
+int
+pq_getMapMode(
+        pqueue* const pq);
+
+/**
+ * Returns how long it took to open a product-queue.
+ *
+ * @param[in] pq  The product-queue.
+ * @return        Duration of `pq_open()` in seconds or 0 if the product-queue
+ *                was created by `pq_create()`.
+ */
+double
+pq_getOpenLatency(
+        pqueue* const pq);
+
 /*
  * On success, if the product-queue was open for writing, then its
  * writer-counter will be decremented.
@@ -240,7 +409,7 @@ pq_getDataSize(
 
 /**
  * Inserts a data-product at the tail-end of the product-queue without signaling
- * the process group.
+ * the process group. Readers waiting in `pq_waitForNewer()` are still woken.
  *
  * @param[in] pq           The product-queue.
  * @param[in] prod         The data-product.
@@ -269,6 +438,37 @@ pq_insertNoSig(pqueue *pq, const product *prod);
 int
 pq_insert(pqueue *pq, const product *prod);
 
+/**
+ * Inserts data-products at the rear of a product-queue. Small data-products
+ * are inserted under one acquisition of the control-header's write-lock and
+ * the process group is signaled, and waiting readers awakened, only once for
+ * the whole batch. Data-products are inserted in the given order.
+ *
+ * @param[in,out] pq        Product queue
+ * @param[in]     prods     Data-products
+ * @param[in]     nprods    Number of data-products
+ * @param[out]    statuses  Insertion status of each data-product or NULL:
+ *                            - 0         Inserted
+ *                            - PQ_DUP    Product already exists in the queue
+ *                            - PQ_BIG    Product is too large for the queue
+ *                            - EACCES    Couldn't make room: no unlocked
+ *                                        products left to delete
+ *                            - else      <errno.h> error-code
+ * @retval 0                Success. Every data-product was processed and
+ *                          `statuses`, if non-NULL, is set.
+ * @retval EACCES           Queue is read-only. No data-product was processed.
+ * @retval EINVAL           Invalid argument. `log_add()` called.
+ * @return                  Other <errno.h> error-code of locking the
+ *                          control-header. Remaining elements of `statuses`
+ *                          are set to it. `log_add()` called.
+ */
+int
+pq_insertBatch(
+        pqueue* const        pq,
+        const product* const prods,
+        const size_t         nprods,
+        int* const           statuses);
+
 /**
  * Returns some useful, "highwater" statistics of a product-queue.  The
  * statistics are since the queue was created.
@@ -461,6 +661,265 @@ pq_stats(
         double* const age_oldestp,
         size_t* const maxextentp);
 
+/**
+ * Data-region allocation statistics of a product-queue.
+ */
+typedef struct {
+    size_t   nfree;           ///< Number of free regions
+    size_t   freeBytes;       ///< Total bytes in free regions
+    size_t   maxFreeExtent;   ///< Size of the largest free region in bytes
+    /**
+     * Fragmentation of the free space: 0 if it's one region; approaching 1 as
+     * it's split into many small ones. `1 - maxFreeExtent/freeBytes`.
+     */
+    double   fragmentation;
+    uint64_t nevicted;        ///< Products deleted to make room
+    uint64_t nevictedForSlot; ///< Of which were deleted for a product-slot
+    uint64_t evictedBytes;    ///< Bytes of the deleted products
+    bool     binned;          ///< Free regions are in size-class bins
+    /**
+     * Number of times the indexes were rebuilt because a writer died while
+     * modifying them
+     */
+    uint64_t nrecovered;
+    /// Data-products stored compressed (see `PQ_COMPRESS`)
+    uint64_t ncompressed;
+    /// Bytes of data of those data-products before compression
+    uint64_t compressedRawBytes;
+    /// Bytes of data of those data-products after compression
+    uint64_t compressedBytes;
+} pq_alloc_stats;
+
+/**
+ * Returns data-region allocation statistics of a product-queue. The eviction
+ * and recovery counts are since the product-queue was created or first opened
+ * for writing by this version of the LDM; the compression counts are since it
+ * was created.
+ *
+ * @param[in]  pq     Product-queue.
+ * @param[out] stats  Statistics.
+ * @retval     0      Success. `*stats` is set.
+ * @return            `<errno.h>` error-code. Error-message logged.
+ */
+int
+pq_allocStats(
+        pqueue* const restrict         pq,
+        pq_alloc_stats* const restrict stats);
+
+/// Number of seconds in the telemetry ring of a product-queue
+#define PQ_TELEMETRY_SIZE 32
+
+/**
+ * Activity of the writers of a product-queue during one second.
+ */
+typedef struct {
+    int64_t  second;          ///< `time(2)` at the start of the second
+    uint64_t insertedBytes;   ///< Bytes of inserted products
+    uint64_t evictedBytes;    ///< Bytes of evicted products
+    uint64_t lockWaitUs;      ///< Total wait for the control-header in µs
+    uint32_t ninserted;       ///< Number of products inserted
+    uint32_t nevicted;        ///< Number of products deleted to make room
+    /**
+     * Minimum residence-time, in ms, of the evicted products. A reader whose
+     * lag approaches this value is about to be overrun. 0 if `nevicted == 0`.
+     */
+    uint32_t minResidenceMs;
+    uint32_t nlocks;          ///< Number of write-locks of the control-header
+    uint32_t maxLockWaitUs;   ///< Maximum wait for the control-header in µs
+    /**
+     * Number of times an evicted product hadn't been reached by a registered
+     * reader (see `pq_registerReader()`)
+     */
+    uint32_t nmissed;
+} pq_telemetry;
+
+/**
+ * Returns the recent activity of the writers of a product-queue, one entry per
+ * second for up to the last `PQ_TELEMETRY_SIZE` seconds. Seconds without
+ * activity are omitted. Doesn't lock the product-queue, so it may be called
+ * as often as desired without delaying the writers.
+ *
+ * @param[in]  pq       Product-queue
+ * @param[out] slots    Activity in order of increasing time. The last entry
+ *                      might be for the current, incomplete, second.
+ * @param[out] nslots   Number of entries in `slots`
+ * @retval     0        Success. `*nslots` and `slots` are set.
+ * @retval     ENOSYS   The product-queue can't be read without locking (e.g.,
+ *                      it's accessed via read(2)/write(2)) or no writer of
+ *                      this version of the LDM has opened it.
+ */
+int
+pq_getTelemetry(
+        pqueue* const restrict       pq,
+        pq_telemetry                 slots[PQ_TELEMETRY_SIZE],
+        unsigned* const restrict     nslots);
+
+/// Maximum number of registered readers of a product-queue
+#define PQ_MAX_READERS 32
+
+/**
+ * Registers the cursor of a reader of a product-queue so that writers count the
+ * data-products that they delete to make room before the reader reaches them
+ * and so that the reader is listed by `pq_getReaders()`. The cursor is then
+ * published whenever it's set (see `pq_cset()`), which `pq_sequence()` and
+ * `pq_next()` do for every data-product; the reader logs a warning when it
+ * next does so after such deletions. The registration is released by
+ * `pq_close()`. A product-queue opened `PQ_READONLY` may be registered, but
+ * the process must have write permission for the product-queue file.
+ *
+ * @param[in] pq      Product-queue
+ * @retval    0       Success or already registered
+ * @retval    ENOSPC  All `PQ_MAX_READERS` slots are claimed by existing
+ *                    processes. `log_add()` called.
+ * @retval    ENOSYS  The product-queue isn't memory-mapped or no writer of
+ *                    this version of the LDM has opened it. `log_add()` called.
+ * @return            `<errno.h>` error-code. `log_add()` called.
+ */
+int
+pq_registerReader(pqueue* const pq);
+
+/**
+ * A registered reader of a product-queue.
+ */
+typedef struct {
+    pid_t      pid;      ///< Process identifier of the reader
+    /// Insertion-time of the last data-product reached or `TS_NONE`
+    timestampt cursor;
+    /**
+     * Seconds from `cursor` to the insertion of the newest data-product or -1
+     * if either is unknown
+     */
+    double     lag;
+    /**
+     * Number of data-products deleted to make room before the reader reached
+     * them
+     */
+    uint32_t   nmissed;
+} pq_reader;
+
+/**
+ * Returns the registered readers of a product-queue, slowest first. Doesn't
+ * lock the product-queue. Readers whose process no longer exists are omitted.
+ *
+ * @param[in]  pq        Product-queue
+ * @param[out] readers   Registered readers
+ * @param[out] nreaders  Number of entries in `readers`
+ * @retval     0         Success. `*nreaders` and `readers` are set.
+ * @retval     ENOSYS    The product-queue can't be read without locking
+ *                       (e.g., it's accessed via read(2)/write(2)) or no
+ *                       writer of this version of the LDM has opened it.
+ */
+int
+pq_getReaders(
+        pqueue* const restrict   pq,
+        pq_reader                readers[PQ_MAX_READERS],
+        unsigned* const restrict nreaders);
+
+/// Number of bins in the age-histograms of `pq_scan_stats`
+#define PQ_SCAN_NAGES   24
+/// Number of feedtype bits in `pq_scan_stats`
+#define PQ_SCAN_NFEEDS  32
+
+/**
+ * Products of one feedtype in a product-queue.
+ */
+typedef struct {
+    uint64_t nprods;                ///< Number of products
+    uint64_t nbytes;                ///< Bytes of their data-regions
+    /**
+     * Age-histogram by time since insertion. Bin 0 counts products less than
+     * one second old; bin `i > 0` counts products at least `2^(i-1)` but less
+     * than `2^i` seconds old; the last bin also counts older products.
+     */
+    uint64_t ages[PQ_SCAN_NAGES];
+} pq_feed_stats;
+
+/**
+ * Statistics and consistency of a snapshot of a product-queue's indexes.
+ */
+typedef struct {
+    size_t        nprods;           ///< Products in the time-queue
+    size_t        nregions;         ///< In-use regions, incl. reserved ones
+    size_t        nfree;            ///< Free regions
+    size_t        nempty;           ///< Empty region-slots
+    uint64_t      usedBytes;        ///< Bytes of in-use regions
+    uint64_t      freeBytes;        ///< Bytes of free regions
+    double        ageOldest;        ///< Age of oldest product in seconds
+    double        ageYoungest;      ///< Age of youngest product in seconds
+    /**
+     * Products by the lowest bit of their feedtype. Only available if the
+     * product-queue has a metadata sidecar (i.e., was created by this version
+     * of the LDM); otherwise, every product is counted by `unknown`.
+     */
+    pq_feed_stats feeds[PQ_SCAN_NFEEDS];
+    pq_feed_stats unknown;          ///< Products whose feedtype isn't known
+    size_t        badTimes;         ///< Time-entries without an in-use region
+    size_t        badRegions;       ///< Regions outside the data segment
+    size_t        badSigs;          ///< Products not in the signature-index
+    bool          countsAgree;      ///< Index counts agree with the scan
+    unsigned      nthreads;         ///< Number of threads used
+} pq_scan_stats;
+
+/**
+ * Scans a product-queue for statistics and consistency. The indexes of the
+ * product-queue are copied while the control-header is read-locked and are
+ * then scanned, in parallel and without a lock, so that insertions into the
+ * product-queue are blocked only for the duration of the copy. The data-regions
+ * aren't accessed.
+ *
+ * @param[in]  pq        Product-queue.
+ * @param[in]  nthreads  Number of threads to use or 0 to use one per online
+ *                       processor.
+ * @param[out] stats     Statistics.
+ * @retval     0         Success. `*stats` is set. The product-queue is
+ *                       consistent if `stats->countsAgree` and
+ *                       `stats->badTimes`, `stats->badRegions`, and
+ *                       `stats->badSigs` are all zero.
+ * @retval     ENOMEM    Out of memory. Error-message logged.
+ * @return               Other `<errno.h>` error-code. Error-message logged.
+ */
+int
+pq_scan(
+        pqueue* const restrict        pq,
+        unsigned                      nthreads,
+        pq_scan_stats* const restrict stats);
+
+/**
+ * Resizes a product-queue in place while other processes continue to use it.
+ * The data segment and the number of slots can both be increased or decreased.
+ * Data-products don't move: only the indexes are rebuilt -- while the
+ * control-header is write-locked -- and other processes adopt the new layout
+ * the next time they access the product-queue. Data-products that extend
+ * beyond a smaller data segment are deleted, as are the oldest ones if the
+ * remaining ones won't fit in fewer slots. The file of a product-queue that
+ * isn't sequence-locked (see `PQ_SEQLOCK`) is truncated if it's smaller.
+ *
+ * @param[in] pq          Product-queue. Must be open for writing.
+ * @param[in] datasz      New size of the data segment in bytes. Rounded up to
+ *                        the page size.
+ * @param[in] nalloc      New capacity of the product-queue in data-products
+ * @retval    0           Success
+ * @retval    EINVAL      `datasz` or `nalloc` is zero or the product-queue is
+ *                        memory-mapped privately (see `PQ_PRIVATE`). Error
+ *                        message logged.
+ * @retval    EACCES      The product-queue is open read-only. Error message
+ *                        logged.
+ * @retval    ENOTSUP     The product-queue is on a hugetlbfs(5). Error message
+ *                        logged.
+ * @retval    EFBIG       The product-queue would be too big. Error message
+ *                        logged.
+ * @retval    EBUSY       A data-product that must be deleted is in use. Some
+ *                        data-products might have been deleted. Error message
+ *                        logged.
+ * @retval    PQ_CORRUPT  The product-queue is corrupt. Error message logged.
+ * @return                Other `<errno.h>` error-code. Error message logged.
+ */
+int
+pq_resize(
+        pqueue* const pq,
+        const off_t   datasz,
+        const size_t  nalloc);
+
 /*
  * Returns the number of slots in a product-queue.
  *
@@ -559,6 +1018,8 @@ pq_ctimestamp(pqueue *pq, timestampt *tvp);
  * Set the cursor to include all of clssp time range in the queue.
  * (N.B.: For "reverse" scans, this range may not include all
  * the arrival times.)
+ * Also registers the feedtypes of clssp for pq_waitForNewer() (see
+ * pq_setWakeClass()).
  */
 int
 pq_cClassSet(pqueue *pq,  pq_match *mtp, const prod_class_t *clssp);
@@ -764,9 +1225,10 @@ pq_sequenceLock(
  * @param[in]     clss         Product matching criteria
  * @param[in]     func         Function to call for matching products. NB: The function *will only be
  *                             called* for products that match `clss`.
- * @param[in]     keep_locked  Whether or not product should be locked (i.e.,
- *                             kept unavailable for deletion) upon return. If
- *                             `true`, then caller must call
+ * @param[in]     keep_locked  Whether or not a matching product should be
+ *                             locked (i.e., kept unavailable for deletion)
+ *                             upon return. If `true` and `func` was called,
+ *                             then caller must call
  *                             `pq_release(queue_par->offset)`, where
  *                             `queue_par` is the queue-parameters argument to
  *                             `func`.
@@ -801,6 +1263,113 @@ pq_release(
         pqueue* const pq,
         const off_t   offset);
 
+/**
+ * Inflates a data-product that was passed to a reader of a product-queue that
+ * was opened with `PQ_NOINFLATE`. Such a data-product is compressed if, and
+ * only if, its XDR-encoded size is less than `xlen_prod_i(info)`, in which
+ * case it's the XDR-encoded product-information followed by the deflated data
+ * as XDR variable-length opaque data.
+ *
+ * @param[in]  info      Product-information passed to the reader
+ * @param[in]  xprod     XDR-encoded data-product passed to the reader
+ * @param[in]  size      Size of `xprod` in bytes
+ * @param[out] buf       Buffer for the XDR-encoded, inflated data-product.
+ *                       Must be at least `xlen_prod_i(info)` bytes.
+ * @retval     0         Success. `buf` is set.
+ * @retval     PQ_INVAL  `xprod` isn't a valid data-product. `log_add()`
+ *                       called.
+ */
+int
+pq_inflate(
+        const prod_info* const restrict info,
+        const void* const restrict      xprod,
+        const size_t                    size,
+        void* const restrict            buf);
+
+/**
+ * A pinned data-product: a reference-counted handle to a data-product whose
+ * region in the product-queue is locked against deletion -- even by
+ * `pq_insert()` making room -- while the control-header isn't held. The data
+ * isn't copied: it's accessed where it resides in the product-queue, so a
+ * consumer can queue it for asynchronous sending or writing.
+ */
+typedef struct pq_ref pq_ref;
+
+/**
+ * Steps thru the time-sorted inventory from the current time-cursor like
+ * `pq_next()` but, instead of calling a function, pins the next data-product
+ * if it matches.
+ *
+ * @param[in,out] pq         Product-queue. Must stay open until all
+ *                           references have been released.
+ * @param[in]     reverse    Whether to match in reverse direction (i.e.,
+ *                           towards earlier times).
+ * @param[in]     clss       Product matching criteria
+ * @param[out]    ref        Pinned data-product, with one reference, or NULL
+ *                           if the next data-product doesn't match `clss`.
+ *                           The caller should call `pq_releaseRef(*ref)` when
+ *                           it's no longer needed.
+ * @retval        0          Success. `*ref` is set.
+ * @retval        PQ_END     End of time-queue hit
+ * @retval        PQ_INVAL   Invalid argument. log_error() called.
+ * @retval        PQ_SYSTEM  System failure. log_error() called.
+ */
+int
+pq_acquire(
+        pqueue* const restrict             pq,
+        const bool                         reverse,
+        const prod_class_t* const restrict clss,
+        pq_ref** const restrict            ref);
+
+/**
+ * Returns the data-product of a pinned data-product. Its data is in the
+ * product-queue.
+ *
+ * @param[in] ref  Pinned data-product
+ * @return         Data-product. Valid until the last reference is released.
+ */
+const prod_par_t*
+pq_refProd(
+        const pq_ref* const ref);
+
+/**
+ * Returns the queue-parameters of a pinned data-product.
+ *
+ * @param[in] ref  Pinned data-product
+ * @return         Queue-parameters. Valid until the last reference is
+ *                 released.
+ */
+const queue_par_t*
+pq_refQueue(
+        const pq_ref* const ref);
+
+/**
+ * Adds a reference to a pinned data-product. Thread-safe if the product-queue
+ * is (see `PQ_THREADSAFE`).
+ *
+ * @param[in,out] ref  Pinned data-product
+ * @return             `ref`
+ */
+pq_ref*
+pq_retainRef(
+        pq_ref* const ref);
+
+/**
+ * Removes a reference to a pinned data-product. The last one unlocks the
+ * data-product so that it can be deleted and frees the handle. Thread-safe if
+ * the product-queue is (see `PQ_THREADSAFE`).
+ *
+ * @param[in,out] ref           Pinned data-product or NULL
+ * @retval        0             Success
+ * @retval        PQ_CORRUPT    Product-queue is corrupt. `log_error()` called.
+ * @retval        PQ_INVAL      Product-queue is closed. `log_error()` called.
+ * @retval        PQ_NOTFOUND   The data-product isn't locked. `log_error()`
+ *                              called.
+ */
+int
+pq_releaseRef(
+        pq_ref* const ref);
+
 /**
  * Boolean function to check that the cursor time is in the time range specified
  * by clssp. Returns non-zero if this is the case, zero if not.
@@ -921,6 +1490,63 @@ pq_suspendAndUnblock(
 unsigned
 pq_suspend(unsigned int maxsleep);
 
+/**
+ * Returns the insertion sequence-number of a product-queue. The number is
+ * incremented every time a data-product is inserted into the product-queue.
+ * This function doesn't lock the product-queue and is intended to be called
+ * before scanning the product-queue so that the return value can be passed to
+ * `pq_waitForNewer()` if the end of the product-queue is reached.
+ *
+ * @param[in] pq  The product-queue.
+ * @return        The insertion sequence-number of the product-queue. Always
+ *                0 if the product-queue doesn't support insertion
+ *                notification.
+ */
+unsigned
+pq_getInsertSeq(
+        pqueue* const pq);
+
+/**
+ * Waits until the insertion sequence-number of a product-queue differs from a
+ * given value (i.e., until another data-product has been inserted), a
+ * signal is caught, or a timeout occurs. Unlike `pq_suspend()`, only
+ * processes waiting on the product-queue are awakened by an insertion and no
+ * signal-handlers are modified. Insertions of data-products whose feedtype
+ * isn't in the class registered by `pq_setWakeClass()` or `pq_cClassSet()`
+ * are ignored. If the product-queue doesn't support insertion notification,
+ * then this function calls `pq_suspend(timeout)`.
+ *
+ * @param[in] pq          The product-queue.
+ * @param[in] lastSeq     The insertion sequence-number from a previous call to
+ *                        `pq_getInsertSeq()`.
+ * @param[in] timeout     Maximum number of seconds to wait or 0 for an
+ *                        indefinite wait.
+ * @retval    0           The insertion sequence-number differs from `lastSeq`
+ *                        or might (e.g., spurious wakeup).
+ * @retval    ETIMEDOUT   The timeout occurred.
+ * @retval    EINTR       A signal was caught.
+ * @return                Other `errno` value. `log_add()` called.
+ */
+int
+pq_waitForNewer(
+        pqueue* const  pq,
+        const unsigned lastSeq,
+        const unsigned timeout);
+
+/**
+ * Registers the class of data-products whose insertion will awaken
+ * `pq_waitForNewer()`. Only the feedtypes of the class are used. The default
+ * is all data-products.
+ *
+ * @param[in] pq     The product-queue.
+ * @param[in] clssp  The class of data-products of interest. If `NULL` or
+ *                   `PQ_CLASS_ALL`, then all data-products are of interest.
+ */
+void
+pq_setWakeClass(
+        pqueue* const             pq,
+        const prod_class_t* const clssp);
+
 /*
  * Returns an appropriate error-message given a product-queue and error-code.
  *
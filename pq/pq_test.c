@@ -21,7 +21,12 @@
 #include "xdr.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -357,6 +362,1621 @@ static void test_pq_sequence(void)
     unlink_pq();
 }
 
+static void insert_one(
+        pqueue* const   pq,
+        const feedtypet feedtype,
+        const int       seqno)
+{
+    product    prod;
+    prod_info* info = &prod.info;
+    char       data[100] = {0};
+    info->feedtype = feedtype;
+    info->ident = "insert_one";
+    info->origin = "localhost";
+    info->seqno = seqno;
+    info->sz = sizeof(data);
+    (void)memset(info->signature, seqno + 1, sizeof(info->signature));
+    int status = set_timestamp(&info->arrival);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    prod.data = data;
+    status = pq_insert(pq, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+}
+
+static void wait_for_child(
+        const int pid)
+{
+    int child_status;
+    int status = wait(&child_status);
+    CU_ASSERT_EQUAL(status, pid);
+    CU_ASSERT_TRUE(WIFEXITED(child_status));
+    CU_ASSERT_EQUAL(WEXITSTATUS(child_status), 0);
+}
+
+static int verify_prod(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    const product* const expect = arg;
+    CU_ASSERT_EQUAL(info->sz, expect->info.sz);
+    CU_ASSERT_STRING_EQUAL(info->ident, expect->info.ident);
+    CU_ASSERT_EQUAL(memcmp(data, expect->data, info->sz), 0);
+    return 0;
+}
+
+static int read_prod_consistent(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    // The identifier of an inserted product is its sequence-number
+    CU_ASSERT_EQUAL(atoi(info->ident), info->seqno);
+    CU_ASSERT_TRUE(info->sz <= size);
+    return read_prod(info, data, xprod, size, arg);
+}
+
+static void test_pq_sequence_seqlock(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq;
+    int     status = pq_create(PQ_PATHNAME, 0600, PQ_SEQLOCK, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(pq_getFlags(pq) & PQ_SEQLOCK);
+    close_pq(pq);
+
+    int pid = fork();
+    CU_ASSERT_NOT_EQUAL(pid, -1);
+    if (pid == 0) {
+        pq = open_pq(true);
+        status = insert_products(pq, insert_prod);
+        CU_ASSERT_EQUAL(status, 0);
+        close_pq(pq);
+        exit(0);
+    }
+
+    pq = open_pq(false);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+    CU_ASSERT_TRUE(pq_getFlags(pq) & PQ_SEQLOCK);
+    for (bool done = false; !done;) {
+        status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, read_prod_consistent,
+                &done);
+        if (status == PQUEUE_END) {
+            (void)pq_suspend(0); // Indefinite wait. Unblocks SIGCONT
+        }
+        else {
+            CU_ASSERT_EQUAL_FATAL(status, 0);
+        }
+    }
+    close_pq(pq);
+
+    wait_for_child(pid);
+
+    // A sequence-locked product-queue can't be written via read()/write()
+    status = pq_open(PQ_PATHNAME, PQ_NOMAP, &pq);
+    CU_ASSERT_EQUAL(status, EINVAL);
+
+    unlink_pq();
+}
+
+static int check_order(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    int* const prev = arg; // Previous sequence-number or -1
+    if (*prev >= 0) {
+        // Forward or reverse, depending on the sign of the first step
+        CU_ASSERT_NOT_EQUAL(info->seqno, *prev);
+    }
+    *prev = info->seqno;
+    return 0;
+}
+
+static void test_pq_timering(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq;
+    int     status = pq_create(PQ_PATHNAME, 0600, PQ_TIMERING, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(pq_getFlags(pq) & PQ_TIMERING);
+    // Products will be deleted to make room
+    status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    close_pq(pq);
+
+    pq = open_pq(false);
+    CU_ASSERT_TRUE(pq_getFlags(pq) & PQ_TIMERING);
+
+    // Forward: sequence-numbers increase to the last one inserted
+    int prev = -1;
+    int first = -1;
+    int count = 0;
+    pq_cset(pq, &TS_ZERO);
+    while (pq_sequence(pq, TV_GT, PQ_CLASS_ALL, check_order, &prev) == 0) {
+        if (count++ == 0)
+            first = prev;
+        else
+            CU_ASSERT_TRUE(prev > first);
+    }
+    CU_ASSERT_TRUE(count > 0);
+    CU_ASSERT_EQUAL(prev, NUM_PRODS - 1);
+
+    // Reverse: sequence-numbers decrease to the oldest one
+    int last = -1;
+    int rcount = 0;
+    pq_cset(pq, &TS_ENDT);
+    while (pq_sequence(pq, TV_LT, PQ_CLASS_ALL, check_order, &last) == 0)
+        rcount++;
+    CU_ASSERT_EQUAL(rcount, count);
+    CU_ASSERT_EQUAL(last, first);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static void test_pq_signatures(void)
+{
+    pqueue*    pq = create_pq();
+    char       data[8] = {0};
+    char       ident[32];
+    product    prod;
+    prod_info* info = &prod.info;
+    unsigned   i;
+    int        status;
+
+    info->feedtype = EXP;
+    info->ident = ident;
+    info->origin = "localhost";
+    info->sz = sizeof(data);
+    prod.data = data;
+
+    // Fill the slots several times over so that signatures are deleted
+    for (i = 0; i < 4*PQ_SLOT_COUNT; i++) {
+        (void)snprintf(ident, sizeof(ident), "%u", i);
+        (void)memset(info->signature, 0, sizeof(info->signature));
+        (void)memcpy(info->signature, &i, sizeof(i));
+        info->seqno = i;
+        (void)set_timestamp(&info->arrival);
+        status = pq_insert(pq, &prod);
+        CU_ASSERT_EQUAL_FATAL(status, 0);
+    }
+
+    // The most recent product is still there
+    i--;
+    status = pq_insert(pq, &prod);
+    CU_ASSERT_EQUAL(status, PQ_DUP);
+    status = pq_deleteBySignature(pq, info->signature);
+    CU_ASSERT_EQUAL(status, 0);
+    status = pq_deleteBySignature(pq, info->signature);
+    CU_ASSERT_EQUAL(status, PQ_NOTFOUND);
+    status = pq_insert(pq, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+
+    // The first product was deleted to make room
+    i = 0;
+    (void)memset(info->signature, 0, sizeof(info->signature));
+    (void)memcpy(info->signature, &i, sizeof(i));
+    status = pq_deleteBySignature(pq, info->signature);
+    CU_ASSERT_EQUAL(status, PQ_NOTFOUND);
+    status = pq_insert(pq, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static void test_pq_allocStats(void)
+{
+    pqueue*        pq = create_pq();
+    pq_alloc_stats stats;
+    int            status = pq_allocStats(pq, &stats);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(stats.binned);
+    CU_ASSERT_EQUAL(stats.nfree, 1);
+    CU_ASSERT_EQUAL(stats.freeBytes, pq_getDataSize(pq));
+    CU_ASSERT_EQUAL(stats.maxFreeExtent, stats.freeBytes);
+    CU_ASSERT_EQUAL(stats.nevicted, 0);
+
+    // Random sizes; products will be deleted to make room
+    status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+
+    size_t nprods, nbytes;
+    status = pq_stats(pq, &nprods, NULL, NULL, &nbytes, NULL, NULL, NULL, NULL,
+            NULL, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    status = pq_allocStats(pq, &stats);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(stats.nevicted > 0);
+    CU_ASSERT_EQUAL(stats.nevicted + nprods, NUM_PRODS);
+    CU_ASSERT_TRUE(stats.evictedBytes > 0);
+    CU_ASSERT_EQUAL(stats.freeBytes + nbytes, pq_getDataSize(pq));
+    CU_ASSERT_TRUE(stats.maxFreeExtent <= stats.freeBytes);
+    CU_ASSERT_TRUE(stats.fragmentation >= 0 && stats.fragmentation < 1);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static void test_pq_telemetry(void)
+{
+    pqueue*        pq = create_pq();
+    int            status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    pq_alloc_stats stats;
+    status = pq_allocStats(pq, &stats);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(stats.nevicted > 0);
+    close_pq(pq);
+
+    // Readers see the writers' activity without locking
+    pq = open_pq(true);
+    pq_telemetry slots[PQ_TELEMETRY_SIZE];
+    unsigned     nslots;
+    status = pq_getTelemetry(pq, slots, &nslots);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE_FATAL(nslots > 0 && nslots <= PQ_TELEMETRY_SIZE);
+
+    uint64_t ninserted = 0, nevicted = 0, evictedBytes = 0, nlocks = 0;
+    for (unsigned i = 0; i < nslots; i++) {
+        if (i)
+            CU_ASSERT_TRUE(slots[i].second > slots[i-1].second);
+        CU_ASSERT_TRUE(slots[i].maxLockWaitUs <= slots[i].lockWaitUs);
+        if (slots[i].nevicted)
+            CU_ASSERT_TRUE(slots[i].evictedBytes > 0);
+        ninserted += slots[i].ninserted;
+        nevicted += slots[i].nevicted;
+        evictedBytes += slots[i].evictedBytes;
+        nlocks += slots[i].nlocks;
+    }
+    CU_ASSERT_EQUAL(ninserted, NUM_PRODS);
+    CU_ASSERT_EQUAL(nevicted, stats.nevicted);
+    CU_ASSERT_EQUAL(evictedBytes, stats.evictedBytes);
+    CU_ASSERT_TRUE(nlocks >= NUM_PRODS);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static void test_pq_readers(void)
+{
+    pqueue* pq = create_pq();
+    pqueue* reader;
+    int     status = pq_open(PQ_PATHNAME, PQ_READONLY, &reader);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    status = pq_registerReader(reader);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    pq_cset(reader, &TS_ZERO);
+
+    pq_reader readers[PQ_MAX_READERS];
+    unsigned  nreaders;
+    status = pq_getReaders(pq, readers, &nreaders);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_EQUAL_FATAL(nreaders, 1);
+    CU_ASSERT_EQUAL(readers[0].pid, getpid());
+    CU_ASSERT_TRUE(tvEqual(readers[0].cursor, TS_ZERO));
+    CU_ASSERT_EQUAL(readers[0].nmissed, 0);
+
+    // The reader hasn't reached any product that's deleted to make room
+    status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    pq_alloc_stats stats;
+    status = pq_allocStats(pq, &stats);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE_FATAL(stats.nevicted > 0);
+    status = pq_getReaders(pq, readers, &nreaders);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_EQUAL_FATAL(nreaders, 1);
+    CU_ASSERT_EQUAL(readers[0].nmissed, stats.nevicted);
+    CU_ASSERT_TRUE(readers[0].lag > 0);
+
+    pq_telemetry slots[PQ_TELEMETRY_SIZE];
+    unsigned     nslots;
+    uint64_t     nmissed = 0;
+    status = pq_getTelemetry(pq, slots, &nslots);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    for (unsigned i = 0; i < nslots; i++)
+        nmissed += slots[i].nmissed;
+    CU_ASSERT_EQUAL(nmissed, stats.nevicted);
+
+    // Reading a product publishes the cursor
+    status = pq_sequence(reader, TV_GT, PQ_CLASS_ALL, NULL, NULL);
+    CU_ASSERT_EQUAL(status, 0);
+    timestampt cursor;
+    pq_ctimestamp(reader, &cursor);
+    status = pq_getReaders(pq, readers, &nreaders);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_EQUAL_FATAL(nreaders, 1);
+    CU_ASSERT_TRUE(tvEqual(readers[0].cursor, cursor));
+
+    // Closing releases the registration
+    close_pq(reader);
+    status = pq_getReaders(pq, readers, &nreaders);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_EQUAL(nreaders, 0);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+#define NUM_SHARDS        4
+#define NUM_SHARDED_PRODS 500
+
+static void unlink_sharded(void)
+{
+    char path[PATH_MAX];
+    for (int i = 1; i < NUM_SHARDS; i++) {
+        (void)snprintf(path, sizeof(path), "%s.%d", PQ_PATHNAME, i);
+        (void)unlink(path);
+    }
+    (void)unlink(PQ_PATHNAME);
+}
+
+static void init_sharded_prod(
+        product* const prod,
+        char           ident[16],
+        const int      seqno)
+{
+    static char data[100];
+    prod_info*  info = &prod->info;
+    info->feedtype = EXP;
+    (void)snprintf(ident, 16, "%d", seqno);
+    info->ident = ident;
+    info->origin = "localhost";
+    info->seqno = seqno;
+    info->sz = sizeof(data);
+    (void)memset(info->signature, 0, sizeof(info->signature));
+    uint32_t signet = htonl(seqno); // Selects the shard
+    (void)memcpy(info->signature+sizeof(signaturet)-sizeof(signet), &signet,
+            sizeof(signet));
+    int status = set_timestamp(&info->arrival);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    prod->data = data;
+}
+
+static int check_merged(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    unsigned char* const seen = arg;
+    CU_ASSERT_EQUAL(atoi(info->ident), info->seqno);
+    CU_ASSERT_FATAL(info->seqno < NUM_CHILDREN*NUM_SHARDED_PRODS + 1);
+    CU_ASSERT_EQUAL(seen[info->seqno], 0);
+    seen[info->seqno]++;
+    return 0;
+}
+
+static int count_merged(
+        pqueue* const  pq,
+        const pq_match mt)
+{
+    static unsigned char seen[NUM_CHILDREN*NUM_SHARDED_PRODS + 1];
+    int                  count = 0;
+    timestampt           prev = mt == TV_GT ? TS_ZERO : TS_ENDT;
+    int                  status;
+
+    (void)memset(seen, 0, sizeof(seen));
+    pq_cset(pq, &prev);
+    while ((status = pq_sequence(pq, mt, PQ_CLASS_ALL, check_merged, seen))
+            == 0) {
+        // Insertion-times are merged across the shards
+        timestampt cursor;
+        pq_ctimestamp(pq, &cursor);
+        CU_ASSERT_FALSE(mt == TV_GT
+                ? tvCmp(cursor, prev, <)
+                : tvCmp(cursor, prev, >));
+        prev = cursor;
+        count++;
+    }
+    CU_ASSERT_EQUAL(status, PQ_END);
+
+    return count;
+}
+
+static int find_seqno(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    CU_ASSERT_EQUAL(info->seqno, *(int*)arg);
+    return 0;
+}
+
+static void count_next(
+        const prod_par_t* const  prod_par,
+        const queue_par_t* const queue_par,
+        void* const              arg)
+{
+    ++*(int*)arg;
+}
+
+/*
+ * Verifies that a reader of the merged shards doesn't miss data-products that
+ * are inserted while it reads.
+ */
+static void test_pq_shardedLive(void)
+{
+    unlink_sharded();
+    pqueue* pq;
+    int     status = pq_createSharded(PQ_PATHNAME, 0600, 0, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT*NUM_SHARDS, NUM_SHARDS, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    close_pq(pq);
+
+    pqueue* reader = open_pq(false);
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        int pid = fork();
+        CU_ASSERT_NOT_EQUAL(pid, -1);
+        if (pid == 0) {
+            pq = open_pq(true);
+            for (int j = 1; j <= NUM_SHARDED_PRODS; j++) {
+                product prod;
+                char    ident[16];
+                init_sharded_prod(&prod, ident, i*NUM_SHARDED_PRODS + j);
+                status = pq_insert(pq, &prod);
+                CU_ASSERT_EQUAL(status, 0);
+                (void)usleep(1000); // Lets the reader catch up
+            }
+            close_pq(pq);
+            exit(0);
+        }
+    }
+
+    static unsigned char seen[NUM_CHILDREN*NUM_SHARDED_PRODS + 1];
+    int                  count = 0;
+    int                  nrunning = NUM_CHILDREN;
+    (void)memset(seen, 0, sizeof(seen));
+    pq_cset(reader, &TS_ZERO);
+    for (;;) {
+        status = pq_sequence(reader, TV_GT, PQ_CLASS_ALL, check_merged, seen);
+        if (status == 0) {
+            count++;
+            continue;
+        }
+        CU_ASSERT_EQUAL_FATAL(status, PQ_END);
+        if (nrunning == 0)
+            break; // The last pass started after the writers had exited
+
+        int child_status;
+        while (nrunning && waitpid(-1, &child_status, WNOHANG) > 0) {
+            CU_ASSERT_TRUE(WIFEXITED(child_status));
+            CU_ASSERT_EQUAL(WEXITSTATUS(child_status), 0);
+            nrunning--;
+        }
+    }
+    CU_ASSERT_EQUAL(count, NUM_CHILDREN*NUM_SHARDED_PRODS);
+
+    close_pq(reader);
+    unlink_sharded();
+}
+
+static void test_pq_sharded(void)
+{
+    unlink_sharded();
+    pqueue* pq;
+    int     status = pq_createSharded(PQ_PATHNAME, 0600, 0, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT*NUM_SHARDS, NUM_SHARDS, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_EQUAL(pq_getShardCount(pq), NUM_SHARDS);
+    close_pq(pq);
+
+    pqueue* reader = open_pq(false);
+    CU_ASSERT_EQUAL(pq_getShardCount(reader), NUM_SHARDS);
+    const unsigned seq = pq_getInsertSeq(reader);
+
+    // Concurrent writers of different data-products
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        int pid = fork();
+        CU_ASSERT_NOT_EQUAL(pid, -1);
+        if (pid == 0) {
+            pq = open_pq(true);
+            for (int j = 0; j < NUM_SHARDED_PRODS; j++) {
+                product prod;
+                char    ident[16];
+                init_sharded_prod(&prod, ident, i*NUM_SHARDED_PRODS + j);
+                status = pq_insert(pq, &prod);
+                CU_ASSERT_EQUAL(status, 0);
+            }
+            close_pq(pq);
+            exit(0);
+        }
+    }
+    for (int i = 0; i < NUM_CHILDREN; i++) {
+        int child_status;
+        status = wait(&child_status);
+        CU_ASSERT_NOT_EQUAL_FATAL(status, -1);
+        CU_ASSERT_TRUE(WIFEXITED(child_status));
+        CU_ASSERT_EQUAL(WEXITSTATUS(child_status), 0);
+    }
+
+    // Every insertion into every shard notifies the readers
+    CU_ASSERT_EQUAL(pq_getInsertSeq(reader) - seq,
+            NUM_CHILDREN*NUM_SHARDED_PRODS);
+    CU_ASSERT_EQUAL(count_merged(reader, TV_GT),
+            NUM_CHILDREN*NUM_SHARDED_PRODS);
+    CU_ASSERT_EQUAL(count_merged(reader, TV_LT),
+            NUM_CHILDREN*NUM_SHARDED_PRODS);
+
+    // An offset from pq_sequenceLock() identifies the shard
+    off_t offset;
+    int   nlocked = 0;
+    pq_cset(reader, &TS_ZERO);
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        bool done;
+        status = pq_sequenceLock(reader, TV_GT, PQ_CLASS_ALL, read_prod, &done,
+                &offset);
+        if (status == 0) {
+            status = pq_release(reader, offset);
+            CU_ASSERT_EQUAL(status, 0);
+            nlocked++;
+        }
+    }
+    CU_ASSERT_TRUE(nlocked > 0);
+    close_pq(reader);
+
+    // Lookups and insertions by signature go to the data-product's shard
+    pq = open_pq(true);
+    for (int seqno = 1; seqno <= NUM_SHARDS; seqno++) {
+        product prod;
+        char    ident[16];
+        init_sharded_prod(&prod, ident, seqno);
+        status = pq_processProduct(pq, prod.info.signature, find_seqno,
+                &seqno);
+        CU_ASSERT_EQUAL(status, 0);
+        status = pq_insert(pq, &prod);
+        CU_ASSERT_EQUAL(status, PQ_DUP);
+    }
+    product prods[NUM_SHARDS];
+    char    idents[NUM_SHARDS][16];
+    int     statuses[NUM_SHARDS];
+    for (int i = 0; i < NUM_SHARDS; i++)
+        init_sharded_prod(prods + i, idents[i],
+                i ? i : NUM_CHILDREN*NUM_SHARDED_PRODS);
+    status = pq_insertBatch(pq, prods, NUM_SHARDS, statuses);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_EQUAL(statuses[0], 0);
+    for (int i = 1; i < NUM_SHARDS; i++)
+        CU_ASSERT_EQUAL(statuses[i], PQ_DUP);
+    CU_ASSERT_EQUAL(count_merged(pq, TV_GT),
+            NUM_CHILDREN*NUM_SHARDED_PRODS + 1);
+
+    // pq_last() positions the cursor at the tail of the merged shards
+    timestampt last = TS_ZERO;
+    status = pq_last(pq, PQ_CLASS_ALL, &last);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_FALSE(tvEqual(last, TS_ZERO));
+    int nnext = 0;
+    while (pq_next(pq, false, PQ_CLASS_ALL, count_next, false, &nnext) == 0)
+        ;
+    CU_ASSERT_EQUAL(nnext, 0);
+    for (int i = 1; i <= NUM_SHARDS; i++) {
+        product prod;
+        char    ident[16];
+        init_sharded_prod(&prod, ident, NUM_CHILDREN*NUM_SHARDED_PRODS + i);
+        status = pq_insert(pq, &prod);
+        CU_ASSERT_EQUAL(status, 0);
+    }
+    while (pq_next(pq, false, PQ_CLASS_ALL, count_next, false, &nnext) == 0)
+        ;
+    CU_ASSERT_EQUAL(nnext, NUM_SHARDS);
+
+    // pq_seqdel() deletes from every shard in order of insertion-time
+    int        ndel = 0;
+    timestampt prev = TS_ZERO;
+    pq_cset(pq, &TS_ZERO);
+    while ((status = pq_seqdel(pq, TV_GT, PQ_CLASS_ALL, 0, NULL, NULL)) == 0) {
+        timestampt cursor;
+        pq_ctimestamp(pq, &cursor);
+        CU_ASSERT_FALSE(tvCmp(cursor, prev, <));
+        prev = cursor;
+        ndel++;
+    }
+    CU_ASSERT_EQUAL(status, PQUEUE_END);
+    CU_ASSERT_EQUAL(ndel, NUM_CHILDREN*NUM_SHARDED_PRODS + 1 + NUM_SHARDS);
+    CU_ASSERT_EQUAL(count_merged(pq, TV_GT), 0);
+    close_pq(pq);
+
+    // Only the first shard can be opened
+    char path[PATH_MAX];
+    (void)snprintf(path, sizeof(path), "%s.1", PQ_PATHNAME);
+    status = pq_open(path, PQ_READONLY, &pq);
+    CU_ASSERT_EQUAL(status, EINVAL);
+    log_clear();
+
+    unlink_sharded();
+}
+
+static void test_pq_insert_large(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+
+    // Large enough to be encoded after the control-header is released
+    static char data[1000000];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i % 251);
+    product prod;
+    prod.info.feedtype = EXP;
+    prod.info.ident = "test_pq_insert_large";
+    prod.info.origin = "localhost";
+    prod.info.seqno = 0;
+    prod.info.sz = sizeof(data);
+    (void)memset(prod.info.signature, 2, sizeof(prod.info.signature));
+    int status = set_timestamp(&prod.info.arrival);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    prod.data = data;
+
+    status = pq_insert(pq, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+    status = pq_insert(pq, &prod);
+    CU_ASSERT_EQUAL(status, PQ_DUP);
+
+    pq_cset(pq, &TS_ZERO);
+    status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, verify_prod, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+    status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, verify_prod, &prod);
+    CU_ASSERT_EQUAL(status, PQ_END);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static int count_prod(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    // The identifier of an inserted product is its sequence-number
+    CU_ASSERT_EQUAL(atoi(info->ident), info->seqno);
+    CU_ASSERT_EQUAL(info->seqno, *(int*)arg);
+    ++*(int*)arg;
+    return 0;
+}
+
+static void test_pq_insertBatch(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+
+    #define BATCH_SIZE 100
+    static char    data[100000]; // One product is large
+    static char    idents[BATCH_SIZE][16];
+    static product prods[BATCH_SIZE];
+    int            statuses[BATCH_SIZE];
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        prod_info* info = &prods[i].info;
+        info->feedtype = EXP;
+        (void)snprintf(idents[i], sizeof(idents[i]), "%d", i);
+        info->ident = idents[i];
+        info->origin = "localhost";
+        info->seqno = i;
+        info->sz = i == BATCH_SIZE/2 ? sizeof(data) : 100;
+        (void)memset(info->signature, 0, sizeof(info->signature));
+        (void)memcpy(info->signature, &i, sizeof(i));
+        int status = set_timestamp(&info->arrival);
+        CU_ASSERT_EQUAL_FATAL(status, 0);
+        prods[i].data = data;
+    }
+    // Last product duplicates the first
+    (void)memset(prods[BATCH_SIZE-1].info.signature, 0, sizeof(signaturet));
+
+    const unsigned seq = pq_getInsertSeq(pq);
+    int            status = pq_insertBatch(pq, prods, BATCH_SIZE, statuses);
+    CU_ASSERT_EQUAL(status, 0);
+    for (int i = 0; i < BATCH_SIZE - 1; i++)
+        CU_ASSERT_EQUAL(statuses[i], 0);
+    CU_ASSERT_EQUAL(statuses[BATCH_SIZE-1], PQ_DUP);
+    CU_ASSERT_EQUAL(pq_getInsertSeq(pq), seq + BATCH_SIZE - 1);
+
+    // Products are in insertion order
+    int count = 0;
+    pq_cset(pq, &TS_ZERO);
+    while ((status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, count_prod, &count))
+            == 0)
+        ;
+    CU_ASSERT_EQUAL(status, PQ_END);
+    CU_ASSERT_EQUAL(count, BATCH_SIZE - 1);
+
+    close_pq(pq);
+
+    pq = open_pq(false);
+    status = pq_insertBatch(pq, prods, BATCH_SIZE, NULL);
+    CU_ASSERT_EQUAL(status, EACCES);
+    close_pq(pq);
+
+    // A thread-safe insertion leaves the calling thread cancellable
+    status = pq_open(PQ_PATHNAME, PQ_THREADSAFE, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    for (int i = 0; i < BATCH_SIZE; i++)
+        prods[i].info.signature[sizeof(signaturet)-1] = 1;
+    status = pq_insertBatch(pq, prods, BATCH_SIZE, NULL);
+    CU_ASSERT_EQUAL(status, 0);
+    int cancelState;
+    (void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &cancelState);
+    CU_ASSERT_EQUAL(cancelState, PTHREAD_CANCEL_ENABLE);
+    close_pq(pq);
+
+    unlink_pq();
+}
+
+static void test_pq_hugePages(void)
+{
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+    CU_ASSERT_FALSE(pq_getFlags(pq) & (PQ_HUGEPAGES | PQ_INTERLEAVE));
+    CU_ASSERT_EQUAL(pq_getMapMode(pq), 0);
+    close_pq(pq);
+
+    int status = pq_create(PQ_PATHNAME, 0600, PQ_HUGEPAGES | PQ_INTERLEAVE, 0,
+            PQ_DATA_SIZE, PQ_SLOT_COUNT, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    for (int i = 0; i < 3; i++)
+        insert_one(pq, EXP, i);
+    close_pq(pq);
+
+    // The advice is persistent
+    pq = open_pq(false);
+    CU_ASSERT_EQUAL(pq_getFlags(pq) & (PQ_HUGEPAGES | PQ_INTERLEAVE),
+            PQ_HUGEPAGES | PQ_INTERLEAVE);
+    // The O/S may decline; a hugetlbfs file needs no transparent huge pages
+    const int mapMode = pq_getMapMode(pq);
+    CU_ASSERT_NOT_EQUAL(mapMode & (PQ_MAP_HUGETLBFS | PQ_MAP_THP),
+            PQ_MAP_HUGETLBFS | PQ_MAP_THP);
+    size_t nprods;
+    status = pq_stats(pq, &nprods, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+            NULL, NULL);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_EQUAL(nprods, 3);
+    close_pq(pq);
+
+    unlink_pq();
+}
+
+static void test_pq_acquire(void)
+{
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+    insert_one(pq, EXP, 0);
+
+    pq_ref* ref;
+    pq_cset(pq, &TS_ZERO);
+    int status = pq_acquire(pq, false, PQ_CLASS_ALL, &ref);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ref);
+
+    const prod_par_t* prod = pq_refProd(ref);
+    CU_ASSERT_STRING_EQUAL(prod->info.ident, "insert_one");
+    CU_ASSERT_EQUAL(prod->info.sz, 100);
+    // The data wasn't copied
+    CU_ASSERT_TRUE((char*)prod->data > (char*)prod->encoded &&
+            (char*)prod->data < (char*)prod->encoded + prod->size);
+    char encoded[200];
+    CU_ASSERT_FATAL(prod->size <= sizeof(encoded));
+    (void)memcpy(encoded, prod->encoded, prod->size);
+    const timestampt inserted = pq_refQueue(ref)->inserted;
+    CU_ASSERT_PTR_EQUAL(pq_retainRef(ref), ref);
+
+    // Products are deleted to make room but not the pinned one
+    status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    pq_alloc_stats stats;
+    status = pq_allocStats(pq, &stats);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_TRUE(stats.nevicted > 0);
+    timestampt oldest;
+    status = pq_getOldestCursor(pq, &oldest);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_TRUE(oldest.tv_sec == inserted.tv_sec &&
+            oldest.tv_usec == inserted.tv_usec);
+    CU_ASSERT_EQUAL(memcmp(prod->encoded, encoded, prod->size), 0);
+
+    // Only the last reference unpins it
+    CU_ASSERT_EQUAL(pq_releaseRef(ref), 0);
+    status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    status = pq_getOldestCursor(pq, &oldest);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_TRUE(oldest.tv_sec == inserted.tv_sec &&
+            oldest.tv_usec == inserted.tv_usec);
+    CU_ASSERT_EQUAL(pq_releaseRef(ref), 0);
+    status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    status = pq_getOldestCursor(pq, &oldest);
+    CU_ASSERT_EQUAL(status, 0);
+    CU_ASSERT_FALSE(oldest.tv_sec == inserted.tv_sec &&
+            oldest.tv_usec == inserted.tv_usec);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static int count_feedtype(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    CU_ASSERT_EQUAL(info->feedtype, NEXRAD2);
+    CU_ASSERT_EQUAL(info->seqno % 2, 1);
+    ++*(int*)arg;
+    return 0;
+}
+
+static void next_feedtype(
+        const prod_par_t* const  prod_par,
+        const queue_par_t* const queue_par,
+        void* const              arg)
+{
+    CU_ASSERT_EQUAL(prod_par->info.feedtype, NEXRAD2);
+    ++*(int*)arg;
+}
+
+static void test_pq_metadata(void)
+{
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+    for (int i = 0; i < 10; i++)
+        insert_one(pq, i % 2 ? NEXRAD2 : EXP, i);
+    close_pq(pq);
+
+    pq = open_pq(false);
+    prod_spec    spec = {.feedtype = NEXRAD2, .pattern = ".*"};
+    prod_class_t clss = {.from = TS_ZERO, .to = TS_ENDT,
+            .psa = {.psa_len = 1, .psa_val = &spec}};
+    // Products of other feedtypes are passed over
+    int count = 0;
+    int nseq = 0;
+    pq_cset(pq, &TS_ZERO);
+    while (pq_sequence(pq, TV_GT, &clss, count_feedtype, &count) == 0)
+        nseq++;
+    CU_ASSERT_EQUAL(nseq, 10);
+    CU_ASSERT_EQUAL(count, 5);
+
+    count = 0;
+    pq_cset(pq, &TS_ENDT);
+    while (pq_next(pq, true, &clss, next_feedtype, false, &count) == 0)
+        ;
+    CU_ASSERT_EQUAL(count, 5);
+
+    // So are products created outside the class's time-interval
+    (void)set_timestamp(&clss.from);
+    clss.from.tv_sec += 3600;
+    count = 0;
+    pq_cset(pq, &TS_ZERO);
+    while (pq_sequence(pq, TV_GT, &clss, count_feedtype, &count) == 0)
+        ;
+    CU_ASSERT_EQUAL(count, 0);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static void test_pq_scan(void)
+{
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+    // Products will be deleted to make room
+    int status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    insert_one(pq, NEXRAD2, 0);
+
+    size_t nprods;
+    size_t nbytes;
+    status = pq_stats(pq, &nprods, NULL, NULL, &nbytes, NULL, NULL, NULL, NULL,
+            NULL, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+
+    for (unsigned nthreads = 0; nthreads <= 3; nthreads += 3) {
+        pq_scan_stats stats;
+        status = pq_scan(pq, nthreads, &stats);
+        CU_ASSERT_EQUAL_FATAL(status, 0);
+        CU_ASSERT_TRUE(stats.nthreads >= 1);
+        if (nthreads)
+            CU_ASSERT_EQUAL(stats.nthreads, nthreads);
+        CU_ASSERT_TRUE(stats.countsAgree);
+        CU_ASSERT_EQUAL(stats.badTimes, 0);
+        CU_ASSERT_EQUAL(stats.badRegions, 0);
+        CU_ASSERT_EQUAL(stats.badSigs, 0);
+        CU_ASSERT_EQUAL(stats.nprods, nprods);
+        CU_ASSERT_EQUAL(stats.usedBytes, nbytes);
+        CU_ASSERT_TRUE(stats.ageOldest >= stats.ageYoungest);
+
+        const pq_feed_stats* const exp = stats.feeds + ffs(EXP) - 1;
+        const pq_feed_stats* const nexrad2 = stats.feeds + ffs(NEXRAD2) - 1;
+        CU_ASSERT_EQUAL(nexrad2->nprods, 1);
+        CU_ASSERT_EQUAL(exp->nprods + 1, nprods);
+        CU_ASSERT_EQUAL(stats.unknown.nprods, 0);
+        uint64_t nages = 0;
+        for (int i = 0; i < PQ_SCAN_NAGES; i++)
+            nages += exp->ages[i];
+        CU_ASSERT_EQUAL(nages, exp->nprods);
+        CU_ASSERT_TRUE(exp->nbytes + nexrad2->nbytes == nbytes);
+    }
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static int check_increasing(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    int* const prev = arg; // Previous sequence-number or -1
+    CU_ASSERT_TRUE((int)info->seqno > *prev);
+    *prev = info->seqno;
+    return 0;
+}
+
+/**
+ * Verifies a resized product-queue.
+ *
+ * @param[in] pq      Product-queue
+ * @param[in] nalloc  Expected number of slots
+ * @param[in] nprods  Expected number of products or 0 if they might have been
+ *                    deleted
+ */
+static void verify_resized(
+        pqueue* const pq,
+        const size_t  nalloc,
+        const size_t  nprods)
+{
+    pq_scan_stats stats;
+    int           status = pq_scan(pq, 1, &stats);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(stats.countsAgree);
+    CU_ASSERT_EQUAL(stats.badTimes, 0);
+    CU_ASSERT_EQUAL(stats.badRegions, 0);
+    CU_ASSERT_EQUAL(stats.badSigs, 0);
+    CU_ASSERT_EQUAL(pq_getSlotCount(pq), nalloc);
+    CU_ASSERT_TRUE(stats.nprods > 0 && stats.nprods <= nalloc);
+    if (nprods)
+        CU_ASSERT_EQUAL(stats.nprods, nprods);
+
+    // Insertion-order is preserved
+    int    prev = -1;
+    size_t count = 0;
+    pq_cset(pq, &TS_ZERO);
+    while (pq_sequence(pq, TV_GT, PQ_CLASS_ALL, check_increasing, &prev) == 0)
+        count++;
+    CU_ASSERT_EQUAL(count, stats.nprods);
+    if (nprods)
+        CU_ASSERT_EQUAL(prev, NUM_PRODS - 1);
+}
+
+static void test_pq_resize(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq;
+    int     status = pq_create(PQ_PATHNAME, 0600, PQ_TIMERING, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    // Products will be deleted to make room
+    status = insert_products(pq, insert_prod);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+
+    pqueue* reader = open_pq(false);
+    size_t  nprods;
+    status = pq_stats(reader, &nprods, NULL, NULL, NULL, NULL, NULL, NULL,
+            NULL, NULL, NULL);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+
+    // Grow while the reader has the product-queue open
+    status = pq_resize(pq, 2*PQ_DATA_SIZE, 2*PQ_SLOT_COUNT);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    verify_resized(reader, 2*PQ_SLOT_COUNT, nprods);
+    CU_ASSERT_TRUE(pq_getDataSize(reader) >= 2*PQ_DATA_SIZE);
+    verify_resized(pq, 2*PQ_SLOT_COUNT, nprods);
+
+    // Shrink: products are deleted
+    status = pq_resize(pq, PQ_DATA_SIZE/2, PQ_SLOT_COUNT/2);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    verify_resized(reader, PQ_SLOT_COUNT/2, 0);
+    CU_ASSERT_TRUE(pq_getDataSize(reader) < PQ_DATA_SIZE);
+    insert_one(pq, NEXRAD2, 0);
+    close_pq(reader);
+    close_pq(pq);
+
+    reader = open_pq(false);
+    CU_ASSERT_EQUAL(pq_getSlotCount(reader), PQ_SLOT_COUNT/2);
+    pq_scan_stats stats;
+    status = pq_scan(reader, 1, &stats);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(stats.countsAgree);
+    CU_ASSERT_EQUAL(stats.feeds[ffs(NEXRAD2) - 1].nprods, 1);
+    close_pq(reader);
+    unlink_pq();
+}
+
+/*
+ * Verifies that a resize is finished if its process dies while the new
+ * indexes are being written over the old ones.
+ */
+static void test_pq_resize_killed(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+    for (int i = 0; i < 100; i++)
+        insert_one(pq, EXP, i);
+    close_pq(pq);
+
+    for (int i = 0; i < 20; i++) {
+        const pid_t pid = fork();
+        CU_ASSERT_NOT_EQUAL_FATAL(pid, -1);
+        if (pid == 0) {
+            // Only the number of slots changes: the index regions coincide
+            pq = open_pq(true);
+            for (size_t nalloc = 2*PQ_SLOT_COUNT; ;
+                    nalloc = 3*PQ_SLOT_COUNT - nalloc)
+                if (pq_resize(pq, PQ_DATA_SIZE, nalloc))
+                    exit(1);
+        }
+        (void)usleep(1000 + 500*i);
+        CU_ASSERT_EQUAL(kill(pid, SIGKILL), 0);
+        int child_status;
+        CU_ASSERT_EQUAL(waitpid(pid, &child_status, 0), pid);
+        CU_ASSERT_TRUE(WIFSIGNALED(child_status));
+
+        pq = open_pq(true);
+        pq_scan_stats stats;
+        int           status = pq_scan(pq, 1, &stats);
+        CU_ASSERT_EQUAL_FATAL(status, 0);
+        CU_ASSERT_TRUE(stats.countsAgree);
+        CU_ASSERT_EQUAL(stats.badTimes, 0);
+        CU_ASSERT_EQUAL(stats.badRegions, 0);
+        CU_ASSERT_EQUAL(stats.badSigs, 0);
+        CU_ASSERT_EQUAL(stats.nprods, 100);
+        close_pq(pq);
+    }
+
+    unlink_pq();
+}
+
+static void test_pq_fastOpen(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq;
+    int     status = pq_create(PQ_PATHNAME, 0600, PQ_TIMERING, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_EQUAL(pq_getOpenLatency(pq), 0);
+    for (int i = 0; i < 3; i++)
+        insert_one(pq, EXP, i);
+    close_pq(pq);
+
+    // Readers validate the indexes when they're first used
+    status = pq_open(PQ_PATHNAME, PQ_READONLY | PQ_FASTOPEN, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    CU_ASSERT_TRUE(pq_getOpenLatency(pq) >= 0);
+    CU_ASSERT_TRUE(pq_getFlags(pq) & PQ_TIMERING);
+    int prev = -1;
+    int count = 0;
+    pq_cset(pq, &TS_ZERO);
+    while (pq_sequence(pq, TV_GT, PQ_CLASS_ALL, check_order, &prev) == 0)
+        count++;
+    CU_ASSERT_EQUAL(count, 3);
+    CU_ASSERT_EQUAL(prev, 2);
+    close_pq(pq);
+
+    // Writers validate them when the writer-count is incremented
+    status = pq_open(PQ_PATHNAME, PQ_FASTOPEN, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    insert_one(pq, EXP, 3);
+    CU_ASSERT_EQUAL(pq_getSlotCount(pq), PQ_SLOT_COUNT);
+    close_pq(pq);
+
+    unlink_pq();
+}
+
+static void insert_forever(
+        void)
+{
+    pqueue* pq = open_pq(true);
+    char    data[1000] = {0};
+    product prod;
+    prod.info.feedtype = EXP;
+    prod.info.ident = "insert_forever";
+    prod.info.origin = "localhost";
+    prod.info.sz = sizeof(data);
+    prod.data = data;
+
+    for (uint32_t i = 0; ; i++) {
+        (void)memset(prod.info.signature, 0, sizeof(prod.info.signature));
+        (void)memcpy(prod.info.signature, &i, sizeof(i));
+        prod.info.seqno = i;
+        (void)set_timestamp(&prod.info.arrival);
+        if (pq_insert(pq, &prod))
+            _exit(1);
+    }
+}
+
+static int tally_prod(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    ++*(int*)arg;
+    return 0;
+}
+
+static void test_pq_journal(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq;
+    int     status = pq_create(PQ_PATHNAME, 0600, PQ_DEFAULT, 0, 1000000, 100,
+            &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    close_pq(pq);
+
+    // Writers killed at arbitrary points mustn't leave the queue unusable
+    for (int i = 0; i < 5; i++) {
+        const pid_t pid = fork();
+        CU_ASSERT_NOT_EQUAL_FATAL(pid, -1);
+        if (pid == 0)
+            insert_forever();
+
+        struct timespec duration = {0, 10000000 + 3000000*i};
+        (void)nanosleep(&duration, NULL);
+        CU_ASSERT_EQUAL(kill(pid, SIGKILL), 0);
+        int childStatus;
+        CU_ASSERT_EQUAL(waitpid(pid, &childStatus, 0), pid);
+
+        pq = open_pq(true);
+        int count = 0;
+        pq_cset(pq, &TS_ZERO);
+        while ((status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, tally_prod,
+                &count)) == 0)
+            ;
+        CU_ASSERT_EQUAL(status, PQUEUE_END);
+        CU_ASSERT_TRUE(count > 0);
+        insert_one(pq, EXP, i);
+
+        pq_alloc_stats stats;
+        CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+        CU_ASSERT_TRUE(stats.nrecovered <= i + 1);
+        close_pq(pq);
+    }
+
+    unlink_pq();
+}
+
+static int stuckFd; // Written when the writer below is stuck
+
+static void stuck_writer(
+        const int sig)
+{
+    (void)write(stuckFd, "", 1);
+    for (;;)
+        (void)pause();
+}
+
+/*
+ * Forks a process that gets stuck while inserting a data-product and waits
+ * there to be killed.
+ *
+ * @param[in] prod     Data-product
+ * @param[in] reserve  Whether the process gets stuck after `pqe_new()` rather
+ *                     than while copying the data-product
+ * @return             Process identifier
+ */
+static pid_t start_stuck_writer(
+        const product* const prod,
+        const bool           reserve)
+{
+    int fds[2];
+    CU_ASSERT_EQUAL_FATAL(pipe(fds), 0);
+    const pid_t pid = fork();
+    CU_ASSERT_NOT_EQUAL_FATAL(pid, -1);
+    if (pid == 0) {
+        stuckFd = fds[1];
+        pqueue* const pq = open_pq(true);
+        if (reserve) {
+            void*     ptr;
+            pqe_index index;
+            if (pqe_new(pq, &prod->info, &ptr, &index))
+                exit(1);
+            stuck_writer(0);
+        }
+        // The writer faults in the middle of copying the data-product
+        const long pagesz = sysconf(_SC_PAGESIZE);
+        void*      buf;
+        if (posix_memalign(&buf, pagesz, prod->info.sz + pagesz))
+            exit(1);
+        (void)memcpy(buf, prod->data, prod->info.sz);
+        if (mprotect((char*)buf + pagesz*(prod->info.sz/pagesz/2), pagesz,
+                PROT_NONE))
+            exit(1);
+        (void)signal(SIGSEGV, stuck_writer);
+        product copy = *prod;
+        copy.data = buf;
+        (void)pq_insert(pq, &copy);
+        exit(1);
+    }
+    char c;
+    CU_ASSERT_EQUAL(read(fds[0], &c, 1), 1);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+    return pid;
+}
+
+static void kill_stuck_writer(
+        const pid_t pid)
+{
+    CU_ASSERT_EQUAL(kill(pid, SIGKILL), 0);
+    int childStatus;
+    CU_ASSERT_EQUAL(waitpid(pid, &childStatus, 0), pid);
+    sleep(1); // Dead writers are looked for at most once a second
+}
+
+static void test_pq_insert_killed(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+    close_pq(pq);
+
+    // Large enough to be encoded after the control-header is released
+    static char data[1000000];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i % 251);
+    product prod;
+    prod.info.feedtype = EXP;
+    prod.info.ident = "test_pq_insert_killed";
+    prod.info.origin = "localhost";
+    prod.info.seqno = 0;
+    prod.info.sz = sizeof(data);
+    (void)memset(prod.info.signature, 3, sizeof(prod.info.signature));
+    int status = set_timestamp(&prod.info.arrival);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    prod.data = data;
+
+    pid_t pid = start_stuck_writer(&prod, false);
+
+    pq = open_pq(true);
+    pq_alloc_stats stats;
+    CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+    uint64_t nrecovered = stats.nrecovered;
+
+    // The stuck writer doesn't hold the control-header but has the signature
+    insert_one(pq, EXP, 0);
+    CU_ASSERT_EQUAL(pq_insert(pq, &prod), PQ_DUP);
+
+    // Its reservation is rolled back once it's dead
+    kill_stuck_writer(pid);
+    CU_ASSERT_EQUAL(pq_insert(pq, &prod), 0);
+    CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+    CU_ASSERT_EQUAL(stats.nrecovered, nrecovered + 1);
+    nrecovered = stats.nrecovered;
+
+    // A small data-product is copied while the control-header is held
+    prod.info.sz = 16384;
+    (void)memset(prod.info.signature, 4, sizeof(prod.info.signature));
+    pid = start_stuck_writer(&prod, false);
+    kill_stuck_writer(pid);
+    CU_ASSERT_EQUAL(pq_insert(pq, &prod), 0);
+    CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+    CU_ASSERT_EQUAL(stats.nrecovered, nrecovered + 1);
+    nrecovered = stats.nrecovered;
+
+    // A region reserved by `pqe_new()` is held while the data is received
+    (void)memset(prod.info.signature, 5, sizeof(prod.info.signature));
+    pid = start_stuck_writer(&prod, true);
+    void*     ptr;
+    pqe_index index;
+    CU_ASSERT_EQUAL(pqe_new(pq, &prod.info, &ptr, &index), PQ_DUP);
+    kill_stuck_writer(pid);
+    CU_ASSERT_EQUAL(pq_insert(pq, &prod), 0);
+    CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+    CU_ASSERT_EQUAL(stats.nrecovered, nrecovered + 1);
+
+    int count = 0;
+    pq_cset(pq, &TS_ZERO);
+    while ((status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, tally_prod,
+            &count)) == 0)
+        ;
+    CU_ASSERT_EQUAL(status, PQ_END);
+    CU_ASSERT_EQUAL(count, 4);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+/*
+ * Verifies a data-product passed by `pq_sequence()` against the one that was
+ * inserted.
+ */
+static int check_compressed(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    const product* const prod = arg;
+
+    CU_ASSERT_EQUAL(info->sz, prod->info.sz);
+    CU_ASSERT_EQUAL(size, xlen_prod_i(info));
+    CU_ASSERT_EQUAL(memcmp(data, prod->data, prod->info.sz), 0);
+
+    product decoded;
+    decoded.info.origin = NULL;
+    decoded.info.ident = NULL;
+    decoded.data = NULL;
+    XDR xdrs;
+    xdrmem_create(&xdrs, xprod, size, XDR_DECODE);
+    CU_ASSERT_TRUE(xdr_product(&xdrs, &decoded));
+    CU_ASSERT_EQUAL(memcmp(decoded.data, prod->data, prod->info.sz), 0);
+    xdr_destroy(&xdrs);
+
+    return 0;
+}
+
+/*
+ * Inflates a data-product passed as stored by `pq_sequence()`.
+ */
+static int inflate_stored(
+        const prod_info* const restrict info,
+        const void* const restrict      data,
+        void* const restrict            xprod,
+        const size_t                    size,
+        void* const restrict            arg)
+{
+    const product* const prod = arg;
+    const size_t         xlen = xlen_prod_i(info);
+
+    CU_ASSERT_TRUE(size < xlen);
+
+    char* const buf = malloc(xlen);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+    CU_ASSERT_EQUAL(pq_inflate(info, xprod, size, buf), 0);
+    CU_ASSERT_EQUAL(memcmp(buf + xlen - (info->sz + 3) / 4 * 4, prod->data,
+            prod->info.sz), 0);
+    free(buf);
+
+    return 0;
+}
+
+static void test_pq_compress(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq;
+    int     status = pq_create(PQ_PATHNAME, 0600, PQ_COMPRESS, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+
+    static char text[10001];
+    for (int i = 0; i < sizeof(text); i++)
+        text[i] = "TTAA00 KWBC 181200\n"[i % 19];
+    product prods[2];
+    char    random[sizeof(text)];
+    unsigned short xsubi[3] = {1, 2, 3};
+    for (int i = 0; i < sizeof(random); i++)
+        random[i] = (char)nrand48(xsubi);
+    for (int i = 0; i < 2; i++) {
+        prod_info* info = &prods[i].info;
+        info->feedtype = EXP;
+        info->ident = i ? "random" : "text";
+        info->origin = "localhost";
+        info->seqno = i;
+        info->sz = sizeof(text);
+        (void)memset(info->signature, i + 1, sizeof(info->signature));
+        CU_ASSERT_EQUAL(set_timestamp(&info->arrival), 0);
+        prods[i].data = i ? random : text;
+    }
+    CU_ASSERT_EQUAL(pq_insertBatch(pq, prods, 2, NULL), 0);
+    close_pq(pq);
+
+    pq = open_pq(true);
+    CU_ASSERT_TRUE(pq_getFlags(pq) & PQ_COMPRESS);
+    pq_alloc_stats stats;
+    CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+    CU_ASSERT_EQUAL(stats.ncompressed, 1);
+    CU_ASSERT_EQUAL(stats.compressedRawBytes, sizeof(text));
+    CU_ASSERT_TRUE(stats.compressedBytes < sizeof(text)/10);
+
+    // Readers are passed the inflated data-products
+    pq_cset(pq, &TS_ZERO);
+    for (int i = 0; i < 2; i++) {
+        status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, check_compressed,
+                prods + i);
+        CU_ASSERT_EQUAL(status, 0);
+    }
+    status = pq_processProduct(pq, prods[0].info.signature, check_compressed,
+            prods);
+    CU_ASSERT_EQUAL(status, 0);
+    close_pq(pq);
+
+    // Unless they want them as stored
+    status = pq_open(PQ_PATHNAME, PQ_READONLY | PQ_NOINFLATE, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    pq_cset(pq, &TS_ZERO);
+    status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, inflate_stored, prods);
+    CU_ASSERT_EQUAL(status, 0);
+    close_pq(pq);
+
+    unlink_pq();
+}
+
+static void test_pq_compressReserved(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq;
+    int     status = pq_create(PQ_PATHNAME, 0600, PQ_COMPRESS, 0, PQ_DATA_SIZE,
+            PQ_SLOT_COUNT, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+
+    pq_alloc_stats stats;
+    CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+    const size_t freeBytes = stats.freeBytes;
+
+    static char text[10001];
+    for (int i = 0; i < sizeof(text); i++)
+        text[i] = "TTAA00 KWBC 181200\n"[i % 19];
+    product prod;
+    prod.info.feedtype = EXP;
+    prod.info.ident = "reserved";
+    prod.info.origin = "localhost";
+    prod.info.seqno = 0;
+    prod.info.sz = sizeof(text);
+    (void)memset(prod.info.signature, 1, sizeof(prod.info.signature));
+    CU_ASSERT_EQUAL(set_timestamp(&prod.info.arrival), 0);
+    prod.data = text;
+
+    // The data is written after the region is reserved
+    void*     ptr;
+    pqe_index index;
+    status = pqe_new(pq, &prod.info, &ptr, &index);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    (void)memcpy(ptr, text, sizeof(text));
+    status = pqe_insert(pq, &index);
+    CU_ASSERT_EQUAL(status, 0);
+
+    // The data-product is compressed and the rest of its region freed
+    CU_ASSERT_EQUAL(pq_allocStats(pq, &stats), 0);
+    CU_ASSERT_EQUAL(stats.ncompressed, 1);
+    CU_ASSERT_EQUAL(stats.compressedRawBytes, sizeof(text));
+    CU_ASSERT_TRUE(freeBytes - stats.freeBytes < sizeof(text)/2);
+    close_pq(pq);
+
+    pq = open_pq(true);
+    pq_cset(pq, &TS_ZERO);
+    status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, check_compressed, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+    close_pq(pq);
+
+    status = pq_open(PQ_PATHNAME, PQ_READONLY | PQ_NOINFLATE, &pq);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    pq_cset(pq, &TS_ZERO);
+    status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, inflate_stored, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+    close_pq(pq);
+
+    unlink_pq();
+}
+
+static void test_pq_waitForNewer(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+
+    unsigned seq = pq_getInsertSeq(pq);
+    int      status = pq_waitForNewer(pq, seq, 1);
+    CU_ASSERT_EQUAL(status, ETIMEDOUT);
+
+    int pid = fork();
+    CU_ASSERT_NOT_EQUAL_FATAL(pid, -1);
+    if (pid == 0) {
+        pqueue* reader = open_pq(false);
+        status = pq_waitForNewer(reader, seq, 10);
+        const bool advanced = pq_getInsertSeq(reader) != seq;
+        close_pq(reader);
+        exit(status == 0 && advanced ? 0 : 1);
+    }
+
+    (void)sleep(1);
+    insert_one(pq, EXP, 0);
+    CU_ASSERT_EQUAL(pq_getInsertSeq(pq), seq + 1);
+    wait_for_child(pid);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static void test_pq_waitForNewer_noSig(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+
+    const unsigned seq = pq_getInsertSeq(pq);
+    int            pid = fork();
+    CU_ASSERT_NOT_EQUAL_FATAL(pid, -1);
+    if (pid == 0) {
+        pqueue*   reader = open_pq(false);
+        // Must be woken by the insertion rather than time-out
+        const int status = pq_waitForNewer(reader, seq, 10);
+        const bool advanced = pq_getInsertSeq(reader) != seq;
+        close_pq(reader);
+        exit(status == 0 && advanced ? 0 : 1);
+    }
+
+    (void)sleep(1);
+    product    prod;
+    prod_info* info = &prod.info;
+    char       data[100] = {0};
+    info->feedtype = EXP;
+    info->ident = "noSig";
+    info->origin = "localhost";
+    info->seqno = 0;
+    info->sz = sizeof(data);
+    (void)memset(info->signature, 1, sizeof(info->signature));
+    int status = set_timestamp(&info->arrival);
+    CU_ASSERT_EQUAL_FATAL(status, 0);
+    prod.data = data;
+    status = pq_insertNoSig(pq, &prod);
+    CU_ASSERT_EQUAL(status, 0);
+    wait_for_child(pid);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
+static void test_pq_waitForNewer_class(void)
+{
+    unlink(PQ_PATHNAME);
+    pqueue* pq = create_pq();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pq);
+
+    const unsigned seq = pq_getInsertSeq(pq);
+    int            pid = fork();
+    CU_ASSERT_NOT_EQUAL_FATAL(pid, -1);
+    if (pid == 0) {
+        prod_spec    spec = {.feedtype = NEXRAD2, .pattern = ".*"};
+        prod_class_t clss = {.psa = {.psa_len = 1, .psa_val = &spec}};
+        pqueue*      reader = open_pq(false);
+        pq_setWakeClass(reader, &clss);
+        const int status = pq_waitForNewer(reader, seq, 10);
+        // The EXP product must not have ended the wait
+        const bool both = pq_getInsertSeq(reader) == seq + 2;
+        close_pq(reader);
+        exit(status == 0 && both ? 0 : 1);
+    }
+
+    (void)sleep(1);
+    insert_one(pq, EXP, 0);
+    (void)sleep(1);
+    insert_one(pq, NEXRAD2, 1);
+    wait_for_child(pid);
+
+    close_pq(pq);
+    unlink_pq();
+}
+
 int main(
         const int          argc,
         const char* const* argv)
@@ -378,6 +1998,30 @@ int main(
                         CU_ADD_TEST(testSuite, test_pq_insert)
                         && CU_ADD_TEST(testSuite, test_pq_sequence)
                         && CU_ADD_TEST(testSuite, test_pq_insert_children)
+                        && CU_ADD_TEST(testSuite, test_pq_insert_large)
+                        && CU_ADD_TEST(testSuite, test_pq_insertBatch)
+                        && CU_ADD_TEST(testSuite, test_pq_waitForNewer)
+                        && CU_ADD_TEST(testSuite, test_pq_waitForNewer_noSig)
+                        && CU_ADD_TEST(testSuite, test_pq_waitForNewer_class)
+                        && CU_ADD_TEST(testSuite, test_pq_sequence_seqlock)
+                        && CU_ADD_TEST(testSuite, test_pq_timering)
+                        && CU_ADD_TEST(testSuite, test_pq_signatures)
+                        && CU_ADD_TEST(testSuite, test_pq_allocStats)
+                        && CU_ADD_TEST(testSuite, test_pq_hugePages)
+                        && CU_ADD_TEST(testSuite, test_pq_acquire)
+                        && CU_ADD_TEST(testSuite, test_pq_metadata)
+                        && CU_ADD_TEST(testSuite, test_pq_scan)
+                        && CU_ADD_TEST(testSuite, test_pq_resize)
+                        && CU_ADD_TEST(testSuite, test_pq_resize_killed)
+                        && CU_ADD_TEST(testSuite, test_pq_fastOpen)
+                        && CU_ADD_TEST(testSuite, test_pq_journal)
+                        && CU_ADD_TEST(testSuite, test_pq_insert_killed)
+                        && CU_ADD_TEST(testSuite, test_pq_compress)
+                        && CU_ADD_TEST(testSuite, test_pq_compressReserved)
+                        && CU_ADD_TEST(testSuite, test_pq_telemetry)
+                        && CU_ADD_TEST(testSuite, test_pq_readers)
+                        && CU_ADD_TEST(testSuite, test_pq_sharded)
+                        && CU_ADD_TEST(testSuite, test_pq_shardedLive)
                         ) {
                     CU_basic_set_mode(CU_BRM_VERBOSE);
                     (void) CU_basic_run_tests();
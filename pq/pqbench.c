@@ -0,0 +1,714 @@
+/**
+ * Copyright 2016 University Corporation for Atmospheric Research. All rights
+ * reserved. See the file COPYRIGHT in the top-level source-directory for
+ * licensing conditions.
+ *
+ * Micro-benchmarks the product-queue: the throughput and latency percentiles
+ * of `pq_insert()` while concurrent readers call `pq_next()`, and then of
+ * `pq_next()`, `pq_sequence()`, `pq_processProduct()`, and
+ * `pq_deleteBySignature()` on the full product-queue. Product sizes are drawn
+ * from a distribution that resembles a real feed or from sizes captured from
+ * one.
+ *
+ * Usage: pqbench [-d dist] [-n nprods] [-r nreaders] [-s qsize] [-S nslots]
+ *                [-k nshards] [-t] [-z] [pathname]
+ */
+#include "config.h"
+
+#include "ldm.h"
+#include "log.h"
+#include "pq.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * A distribution of product sizes given by the sizes at fixed cumulative
+ * probabilities (see `quantileProbs`). Sizes between them are interpolated.
+ */
+typedef struct {
+    const char* name;
+    const char* description;
+    double      sizes[8];
+} sizeDist;
+
+static const double   quantileProbs[8] =
+    {0, 0.10, 0.25, 0.50, 0.75, 0.90, 0.99, 1};
+
+/*
+ * Approximate product-size quantiles of typical IDD feeds. Use "@file" for
+ * sizes captured from a particular feed.
+ */
+static const sizeDist builtinDists[] = {
+    {"text",   "IDS|DDPLUS bulletins",
+        {200, 400, 700, 1200, 2500, 5000, 20000, 100000}},
+    {"nexrad", "NEXRAD3 products",
+        {1000, 3000, 6000, 12000, 25000, 45000, 120000, 400000}},
+    {"grid",   "HDS|NGRID|CONDUIT GRIB messages",
+        {2000, 10000, 30000, 80000, 200000, 500000, 2000000, 8000000}},
+    {"image",  "NIMAGE satellite images",
+        {50000, 200000, 500000, 1000000, 2500000, 5000000, 15000000,
+            40000000}},
+};
+
+static unsigned       nprods = 100000;  /* number of products to insert */
+static unsigned       nreaders = 4;     /* number of concurrent readers */
+static off_t          queueSize = 500000000; /* bytes of data */
+static size_t         nslots;           /* product-slots; 0 => nprods */
+static unsigned       nshards = 1;      /* shards of the product-queue */
+static int            pflags = PQ_DEFAULT;
+static const sizeDist* dist = builtinDists;
+static unsigned*      captured;         /* captured sizes or NULL */
+static size_t         ncaptured;        /* number of captured sizes */
+static unsigned short xsubi[3] = {1234, 5678, 9012};
+
+/*
+ * Summary of the latencies of one operation.
+ */
+typedef struct {
+    unsigned long count;        /* number of calls */
+    double        elapsed;      /* duration of all calls in seconds */
+    double        p50, p99, p999, max; /* latencies in microseconds */
+} opStats;
+
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int
+cmpLatency(
+    const void* const   a,
+    const void* const   b)
+{
+    const uint64_t      x = *(const uint64_t*)a;
+    const uint64_t      y = *(const uint64_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Summarizes latencies in nanoseconds. Sorts them.
+ */
+static opStats
+summarize(
+    uint64_t* const     latencies,
+    const unsigned long count,
+    const uint64_t      elapsed)
+{
+    opStats             stats = {count, 1e-9*elapsed, 0, 0, 0, 0};
+
+    if (count) {
+        qsort(latencies, count, sizeof(*latencies), cmpLatency);
+        stats.p50 = 1e-3*latencies[(count - 1)*50/100];
+        stats.p99 = 1e-3*latencies[(count - 1)*99/100];
+        stats.p999 = 1e-3*latencies[(count - 1)*999/1000];
+        stats.max = 1e-3*latencies[count - 1];
+    }
+
+    return stats;
+}
+
+static void
+report(
+    const char* const   name,
+    const opStats*      stats)
+{
+    (void)printf("%-22s %8lu calls %10.0f/s  p50 %8.2f  p99 %8.2f  "
+        "p999 %9.2f  max %9.2f us\n", name, stats->count,
+        stats->elapsed > 0 ? stats->count/stats->elapsed : 0, stats->p50,
+        stats->p99, stats->p999, stats->max);
+    (void)fflush(stdout);
+}
+
+/*
+ * Returns the size of the next product.
+ */
+static unsigned
+nextSize(void)
+{
+    const double        u = erand48(xsubi);
+
+    if (captured)
+        return captured[(size_t)(u*ncaptured) % ncaptured];
+
+    int                 i = 1;
+    while (i < 7 && u > quantileProbs[i])
+        i++;
+
+    const double        lo = dist->sizes[i-1];
+    const double        frac = (u - quantileProbs[i-1]) /
+        (quantileProbs[i] - quantileProbs[i-1]);
+
+    return (unsigned)(lo + frac*(dist->sizes[i] - lo) + 0.5);
+}
+
+/*
+ * Sets the signature of the i-th product. Signatures are spread like those of
+ * MD5 checksums.
+ */
+static void
+setSignature(
+    signaturet          sig,
+    const unsigned      i)
+{
+    uint64_t            x = i + UINT64_C(0x9E3779B97F4A7C15);
+
+    for (int j = 0; j < 2; j++) {
+        x = (x ^ (x >> 30))*UINT64_C(0xBF58476D1CE4E5B9);
+        x = (x ^ (x >> 27))*UINT64_C(0x94D049BB133111EB);
+        x ^= x >> 31;
+        (void)memcpy(sig + 8*j, &x, 8);
+    }
+}
+
+/*
+ * Reads the captured sizes of a feed: one size in bytes per line.
+ */
+static int
+readCaptured(
+    const char* const   pathname)
+{
+    FILE* const         file = fopen(pathname, "r");
+    size_t              max = 0;
+    unsigned long       size;
+
+    if (file == NULL) {
+        (void)fprintf(stderr, "Couldn't open \"%s\": %s\n", pathname,
+            strerror(errno));
+        return 1;
+    }
+
+    while (fscanf(file, "%lu", &size) == 1) {
+        if (size == 0)
+            continue;
+        if (ncaptured == max) {
+            max = max ? 2*max : 1024;
+            unsigned* const sizes = realloc(captured, max*sizeof(*captured));
+            if (sizes == NULL) {
+                (void)fprintf(stderr, "Couldn't allocate sizes\n");
+                (void)fclose(file);
+                return 1;
+            }
+            captured = sizes;
+        }
+        captured[ncaptured++] = (unsigned)size;
+    }
+    (void)fclose(file);
+
+    if (ncaptured == 0) {
+        (void)fprintf(stderr, "No sizes in \"%s\"\n", pathname);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+setDist(
+    const char* const   arg)
+{
+    if (arg[0] == '@')
+        return readCaptured(arg + 1);
+
+    if (strncmp(arg, "fixed:", 6) == 0) {
+        captured = malloc(sizeof(*captured));
+        if (captured == NULL)
+            return 1;
+        captured[0] = (unsigned)atoi(arg + 6);
+        ncaptured = 1;
+        return captured[0] == 0;
+    }
+
+    for (size_t i = 0; i < sizeof(builtinDists)/sizeof(*builtinDists); i++) {
+        if (strcmp(arg, builtinDists[i].name) == 0) {
+            dist = builtinDists + i;
+            return 0;
+        }
+    }
+
+    (void)fprintf(stderr, "Unknown size-distribution \"%s\"\n", arg);
+    return 1;
+}
+
+/*
+ * Blocks until the "go" pipe is closed by the parent process so that all
+ * children start together.
+ */
+static void
+waitForGo(
+    const int   fd)
+{
+    char        c;
+
+    while (read(fd, &c, 1) == -1 && errno == EINTR)
+        ;
+    (void)close(fd);
+}
+
+/*
+ * Notes the sequence-number of a product read by `pq_next()`.
+ */
+static void
+noteNext(
+    const prod_par_t* restrict  prod_par,
+    const queue_par_t* restrict queue_par,
+    void* restrict              app_par)
+{
+    *(bool*)app_par = prod_par->info.seqno == nprods - 1;
+}
+
+/*
+ * Reads the product-queue with `pq_next()` until the last product has been
+ * seen and writes the latency summary to a pipe.
+ */
+static int
+reader(
+    const char* const   pathname,
+    const int           goFd,
+    const int           resultFd)
+{
+    pqueue*             pq;
+    int                 status = pq_open(pathname, PQ_READONLY, &pq);
+
+    if (status) {
+        log_flush_error();
+        return 1;
+    }
+
+    uint64_t* const     latencies = malloc(sizeof(uint64_t)*nprods);
+    unsigned long       count = 0;
+    unsigned            nidle = 0;      /* seconds without a new product */
+
+    waitForGo(goFd);
+
+    const uint64_t      start = now();
+
+    pq_cset(pq, &TS_ZERO);
+    for (bool done = false; !done; ) {
+        const unsigned  seq = pq_getInsertSeq(pq);
+        const uint64_t  before = now();
+
+        status = pq_next(pq, false, PQ_CLASS_ALL, noteNext, false, &done);
+        if (status == PQUEUE_END) {
+            if (pq_waitForNewer(pq, seq, 1) == ETIMEDOUT && ++nidle >= 10) {
+                (void)fprintf(stderr, "%ld: Last product wasn't seen\n",
+                    (long)getpid());
+                status = 0;
+                break;
+            }
+        }
+        else if (status) {
+            log_flush_error();
+            break;
+        }
+        else if (count < nprods) {
+            latencies[count++] = now() - before;
+            nidle = 0;
+        }
+    }
+
+    const opStats       stats = summarize(latencies, count, now() - start);
+
+    if (write(resultFd, &stats, sizeof(stats)) != sizeof(stats))
+        status = errno;
+    free(latencies);
+    (void)pq_close(pq);
+
+    return status ? 1 : 0;
+}
+
+/*
+ * Inserts the products while the readers read them.
+ */
+static int
+insertAll(
+    pqueue* const       pq,
+    const int           goFds[2],
+    uint64_t* const     latencies)
+{
+    unsigned* const     sizes = malloc(sizeof(unsigned)*nprods);
+    size_t              maxSize = 0;
+
+    /* Sizes are drawn beforehand so that drawing them isn't timed */
+    for (unsigned i = 0; sizes && i < nprods; i++) {
+        sizes[i] = nextSize();
+        if (sizes[i] > maxSize)
+            maxSize = sizes[i];
+    }
+
+    char* const         data = malloc(maxSize);
+    char                ident[32];
+    product             prod;
+    unsigned long       nbytes = 0;
+    int                 status = 0;
+
+    if (sizes == NULL || data == NULL) {
+        (void)fprintf(stderr, "Couldn't allocate %zu-byte product\n", maxSize);
+        free(sizes);
+        return 1;
+    }
+    for (size_t i = 0; i < maxSize; i++)
+        data[i] = "abcdefghijklmnopqrstuvwxyz0123456789 \n"[(i*7 + i/13) % 38];
+
+    prod.info.feedtype = EXP;
+    prod.info.ident = ident;
+    prod.info.origin = "localhost";
+    prod.data = data;
+
+    (void)close(goFds[1]);              /* go */
+    (void)close(goFds[0]);
+
+    const uint64_t      start = now();
+
+    for (unsigned i = 0; i < nprods; i++) {
+        (void)snprintf(ident, sizeof(ident), "pqbench %u", i);
+        setSignature(prod.info.signature, i);
+        prod.info.seqno = i;
+        prod.info.sz = sizes[i];
+        (void)set_timestamp(&prod.info.arrival);
+
+        const uint64_t  before = now();
+        status = pq_insert(pq, &prod);
+        latencies[i] = now() - before;
+
+        if (status) {
+            (void)fprintf(stderr, "pq_insert() failure: %d\n", status);
+            log_flush_error();
+            break;
+        }
+        nbytes += prod.info.sz;
+    }
+
+    const opStats       stats = summarize(latencies, status ? 0 : nprods,
+        now() - start);
+
+    report("pq_insert()", &stats);
+    (void)printf("%-22s %.1f MB/s, mean product %.0f bytes\n", "",
+        stats.elapsed > 0 ? 1e-6*nbytes/stats.elapsed : 0,
+        (double)nbytes/nprods);
+    free(data);
+    free(sizes);
+
+    return status ? 1 : 0;
+}
+
+static int
+seqNoop(
+    const prod_info* const restrict info,
+    const void* const restrict      data,
+    void* const restrict            xprod,
+    const size_t                    size,
+    void* const restrict            arg)
+{
+    return 0;
+}
+
+static void
+nextNoop(
+    const prod_par_t* restrict  prod_par,
+    const queue_par_t* restrict queue_par,
+    void* restrict              app_par)
+{
+}
+
+/*
+ * Times `pq_next()` or `pq_sequence()` through the whole product-queue.
+ */
+static void
+scanAll(
+    pqueue* const       pq,
+    const bool          useNext,
+    uint64_t* const     latencies)
+{
+    unsigned long       count = 0;
+    const uint64_t      start = now();
+
+    pq_cset(pq, &TS_ZERO);
+    for (;;) {
+        const uint64_t  before = now();
+        const int       status = useNext
+            ? pq_next(pq, false, PQ_CLASS_ALL, nextNoop, false, NULL)
+            : pq_sequence(pq, TV_GT, PQ_CLASS_ALL, seqNoop, NULL);
+
+        if (status)
+            break;
+        if (count < nprods)
+            latencies[count++] = now() - before;
+    }
+
+    const opStats       stats = summarize(latencies, count, now() - start);
+
+    report(useNext ? "pq_next()" : "pq_sequence()", &stats);
+}
+
+/*
+ * Times `pq_processProduct()` or `pq_deleteBySignature()` of every product in
+ * random order. Products that were deleted to make room aren't counted.
+ */
+static void
+bySignature(
+    pqueue* const       pq,
+    const bool          delete,
+    uint64_t* const     latencies)
+{
+    unsigned* const     order = malloc(sizeof(unsigned)*nprods);
+    unsigned long       count = 0;
+    signaturet          sig;
+
+    for (unsigned i = 0; i < nprods; i++)
+        order[i] = i;
+    for (unsigned i = nprods - 1; i > 0; i--) {
+        const unsigned  j = (unsigned)(erand48(xsubi)*(i + 1)) % (i + 1);
+        const unsigned  tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    const uint64_t      start = now();
+
+    for (unsigned i = 0; i < nprods; i++) {
+        setSignature(sig, order[i]);
+
+        const uint64_t  before = now();
+        const int       status = delete
+            ? pq_deleteBySignature(pq, sig)
+            : pq_processProduct(pq, sig, seqNoop, NULL);
+        const uint64_t  latency = now() - before;
+
+        if (status == 0)
+            latencies[count++] = latency;
+        else if (status != PQ_NOTFOUND)
+            log_flush_error();
+    }
+
+    const opStats       stats = summarize(latencies, count, now() - start);
+
+    report(delete ? "pq_deleteBySignature()" : "pq_processProduct()",
+        &stats);
+    free(order);
+}
+
+static int
+run(
+    const char* const   pathname)
+{
+    pqueue*             pq;
+    int                 goFds[2], resultFds[2];
+    int                 nfailed = 0;
+    int                 status = pq_createSharded(pathname, 0600, pflags, 0,
+        queueSize, nslots ? nslots : nprods, nshards, &pq);
+
+    if (status) {
+        (void)fprintf(stderr, "Couldn't create \"%s\": %s\n", pathname,
+            strerror(status));
+        log_flush_error();
+        return 1;
+    }
+    (void)pq_close(pq);
+
+    if (captured)
+        (void)printf("%u products of %zu captured size(s), ", nprods,
+            ncaptured);
+    else
+        (void)printf("%u products like %s, ", nprods, dist->description);
+    (void)printf("%u reader(s), %ld-byte queue, %u shard(s)\n", nreaders,
+        (long)queueSize, nshards);
+    (void)fflush(stdout);
+
+    if (pipe(goFds) || pipe(resultFds)) {
+        (void)fprintf(stderr, "pipe() failure: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for (unsigned i = 0; i < nreaders; i++) {
+        const pid_t     pid = fork();
+
+        if (pid == -1) {
+            (void)fprintf(stderr, "fork() failure: %s\n", strerror(errno));
+            nfailed++;
+            break;
+        }
+        if (pid == 0) {
+            (void)close(goFds[1]);
+            (void)close(resultFds[0]);
+            _exit(reader(pathname, goFds[0], resultFds[1]));
+        }
+    }
+    (void)close(resultFds[1]);
+
+    uint64_t* const     latencies = malloc(sizeof(uint64_t)*nprods);
+
+    status = pq_open(pathname, 0, &pq);
+    if (status || latencies == NULL) {
+        log_flush_error();
+        (void)close(goFds[1]);
+        (void)close(goFds[0]);
+        nfailed++;
+    }
+    else {
+        (void)sleep(1);                 /* let the readers open the queue */
+        nfailed += insertAll(pq, goFds, latencies);
+    }
+
+    /* Readers: the slowest percentiles over all of them */
+    opStats             worst = {0};
+    unsigned            nreports = 0;
+
+    for (opStats stats; read(resultFds[0], &stats, sizeof(stats)) ==
+            sizeof(stats); nreports++) {
+        worst.count += stats.count;
+        if (stats.elapsed > worst.elapsed)
+            worst.elapsed = stats.elapsed;
+        if (stats.p50 > worst.p50)
+            worst.p50 = stats.p50;
+        if (stats.p99 > worst.p99)
+            worst.p99 = stats.p99;
+        if (stats.p999 > worst.p999)
+            worst.p999 = stats.p999;
+        if (stats.max > worst.max)
+            worst.max = stats.max;
+    }
+    (void)close(resultFds[0]);
+    for (int childStatus; wait(&childStatus) != -1; ) {
+        if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus))
+            nfailed++;
+    }
+    if (nreports)
+        report("pq_next() (readers)", &worst);
+
+    if (status == 0 && latencies) {
+        scanAll(pq, true, latencies);
+        scanAll(pq, false, latencies);
+        bySignature(pq, false, latencies);
+        bySignature(pq, true, latencies);
+        (void)pq_close(pq);
+    }
+
+    free(latencies);
+    (void)unlink(pathname);
+    for (unsigned i = 1; i < nshards; i++) {
+        char    shardPath[PATH_MAX];
+
+        (void)snprintf(shardPath, sizeof(shardPath), "%s.%u", pathname, i);
+        (void)unlink(shardPath);
+    }
+
+    if (nfailed)
+        (void)printf("%d failure(s)\n", nfailed);
+
+    return nfailed ? 1 : 0;
+}
+
+static off_t
+parseSize(
+    const char* const   arg)
+{
+    char*               end;
+    double              size = strtod(arg, &end);
+
+    switch (*end) {
+    case 'g': case 'G': size *= 1000; /*FALLTHROUGH*/
+    case 'm': case 'M': size *= 1000; /*FALLTHROUGH*/
+    case 'k': case 'K': size *= 1000; end++; break;
+    }
+
+    return *end ? 0 : (off_t)size;
+}
+
+static void
+usage(
+    const char* const   progname)
+{
+    (void)fprintf(stderr,
+"Usage: %s [-d dist] [-n nprods] [-r nreaders] [-s qsize] [-S nslots]\n"
+"           [-k nshards] [-t] [-z] [pathname]\n"
+"Options:\n"
+"    -d dist      Product sizes. One of \"fixed:<size>\", \"@<file>\" (sizes\n"
+"                 captured from a feed, one per line), or\n", progname);
+    for (size_t i = 0; i < sizeof(builtinDists)/sizeof(*builtinDists); i++)
+        (void)fprintf(stderr, "                   %-8s %s%s\n",
+            builtinDists[i].name, builtinDists[i].description,
+            i ? "" : " (default)");
+    (void)fprintf(stderr,
+"    -n nprods    Number of products to insert. Default is %u.\n"
+"    -r nreaders  Number of concurrent readers. Default is %u.\n"
+"    -s qsize     Data-size of the queue in bytes with optional k|m|g.\n"
+"                 Default is %ld.\n"
+"    -S nslots    Number of product-slots. Default is nprods.\n"
+"    -k nshards   Number of shards. Default is 1.\n"
+"    -t           Add a time-ring index\n"
+"    -z           Store products compressed\n"
+"    pathname     Pathname of the queue. Default is \"pqbench.pq\".\n",
+        nprods, nreaders, (long)queueSize);
+}
+
+int
+main(
+    int         argc,
+    char*       argv[])
+{
+    const char* pathname = "pqbench.pq";
+    int         ch;
+
+    (void)log_init(argv[0]);
+
+    while ((ch = getopt(argc, argv, "d:k:n:r:S:s:tz")) != -1) {
+        switch (ch) {
+        case 'd':
+            if (setDist(optarg))
+                return 1;
+            break;
+        case 'k':
+            nshards = (unsigned)atoi(optarg);
+            break;
+        case 'n':
+            nprods = (unsigned)atoi(optarg);
+            break;
+        case 'r':
+            nreaders = (unsigned)atoi(optarg);
+            break;
+        case 'S':
+            nslots = (size_t)atol(optarg);
+            break;
+        case 's':
+            queueSize = parseSize(optarg);
+            break;
+        case 't':
+            pflags |= PQ_TIMERING;
+            break;
+        case 'z':
+            pflags |= PQ_COMPRESS;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        pathname = argv[optind];
+    if (nprods == 0 || queueSize <= 0 || nshards == 0) {
+        (void)fprintf(stderr, "Invalid number of products, queue size, or "
+            "number of shards\n");
+        return 1;
+    }
+
+    /* Readers wait via futex or SIGCONT; the latter mustn't kill them */
+    (void)signal(SIGCONT, SIG_IGN);
+
+    return run(pathname);
+}
@@ -0,0 +1,267 @@
+/**
+ * Copyright 2016 University Corporation for Atmospheric Research. All rights
+ * reserved. See the file COPYRIGHT in the top-level source-directory for
+ * licensing conditions.
+ *
+ * Benchmarks reading a product-queue by many processes while it's being
+ * written, first with the control-header read-locked by readers (the default)
+ * and then with a sequence-locked product-queue (`PQ_SEQLOCK`).
+ *
+ * Usage: seqlockBench [-r nreaders] [-n nprods] [-s size] [pathname]
+ */
+#include "config.h"
+
+#include "ldm.h"
+#include "log.h"
+#include "pq.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static unsigned  nreaders = 200;        /* number of reading processes */
+static unsigned  nprods = 2000;         /* number of products to insert */
+static unsigned  prodSize = 1000;       /* size of data-products in bytes */
+
+static double
+elapsed(
+    const struct timeval* const later,
+    const struct timeval* const earlier)
+{
+    return (later->tv_sec - earlier->tv_sec) +
+        1e-6*(later->tv_usec - earlier->tv_usec);
+}
+
+/*
+ * Blocks until the "go" pipe is closed by the parent process so that all
+ * children start together.
+ */
+static void
+waitForGo(
+    const int   fd)
+{
+    char        c;
+
+    while (read(fd, &c, 1) == -1 && errno == EINTR)
+        ;
+    (void)close(fd);
+}
+
+static int
+noteProd(
+    const prod_info* const restrict info,
+    const void* const restrict      data,
+    void* const restrict            xprod,
+    const size_t                    size,
+    void* const restrict            arg)
+{
+    *(bool*)arg = info->seqno == nprods - 1;
+    return 0;
+}
+
+/*
+ * Reads the product-queue until the last product has been seen.
+ */
+static int
+reader(
+    const char* const   pathname,
+    const int           goFd)
+{
+    pqueue*             pq;
+    unsigned long       ncalls = 0;
+    int                 status = pq_open(pathname, PQ_READONLY, &pq);
+
+    if (status) {
+        (void)fprintf(stderr, "%ld: Couldn't open \"%s\": %s\n",
+            (long)getpid(), pathname, strerror(status));
+        return 1;
+    }
+
+    waitForGo(goFd);
+
+    for (bool done = false; !done; ncalls++) {
+        const unsigned  seq = pq_getInsertSeq(pq);
+
+        status = pq_sequence(pq, TV_GT, PQ_CLASS_ALL, noteProd, &done);
+        if (status == PQUEUE_END) {
+            (void)pq_waitForNewer(pq, seq, 1);
+        }
+        else if (status) {
+            (void)fprintf(stderr, "%ld: pq_sequence() failure: %d\n",
+                (long)getpid(), status);
+            break;
+        }
+    }
+
+    (void)pq_close(pq);
+
+    return status ? 1 : 0;
+}
+
+/*
+ * Inserts the products and prints the insertion rate.
+ */
+static int
+writer(
+    const char* const   pathname,
+    const int           goFd)
+{
+    pqueue*             pq;
+    int                 status = pq_open(pathname, 0, &pq);
+
+    if (status) {
+        (void)fprintf(stderr, "%ld: Couldn't open \"%s\": %s\n",
+            (long)getpid(), pathname, strerror(status));
+        return 1;
+    }
+
+    char*               data = calloc(1, prodSize);
+    char                ident[32];
+    product             prod;
+    struct timeval      start, stop;
+
+    prod.info.feedtype = EXP;
+    prod.info.ident = ident;
+    prod.info.origin = "localhost";
+    prod.info.sz = prodSize;
+    prod.data = data;
+
+    waitForGo(goFd);
+    (void)gettimeofday(&start, NULL);
+
+    for (unsigned i = 0; status == 0 && i < nprods; i++) {
+        (void)snprintf(ident, sizeof(ident), "%u", i);
+        (void)memset(prod.info.signature, 0, sizeof(signaturet));
+        (void)memcpy(prod.info.signature, &i, sizeof(i));
+        prod.info.seqno = i;
+        (void)set_timestamp(&prod.info.arrival);
+
+        status = pq_insert(pq, &prod);
+        if (status)
+            (void)fprintf(stderr, "%ld: pq_insert() failure: %d\n",
+                (long)getpid(), status);
+    }
+
+    (void)gettimeofday(&stop, NULL);
+    (void)printf("    writer: %.0f insertions/s\n",
+        nprods/elapsed(&stop, &start));
+    (void)fflush(stdout);
+    free(data);
+    (void)pq_close(pq);
+
+    return status ? 1 : 0;
+}
+
+static int
+runMode(
+    const char* const   pathname,
+    const int           pflags,
+    const char* const   name)
+{
+    pqueue*             pq;
+    int                 goFds[2];
+    int                 nfailed = 0;
+    struct timeval      start, stop;
+    int                 status = pq_create(pathname, 0600, pflags, 0,
+        (off_t)(nprods + 1)*(prodSize + 1024)*2, nprods*2, &pq);
+
+    if (status) {
+        (void)fprintf(stderr, "Couldn't create \"%s\": %s\n", pathname,
+            strerror(status));
+        return 1;
+    }
+    (void)pq_close(pq);
+
+    if (pipe(goFds)) {
+        (void)fprintf(stderr, "pipe() failure: %s\n", strerror(errno));
+        return 1;
+    }
+
+    (void)printf("%s: %u readers, %u products of %u bytes\n", name,
+        nreaders, nprods, prodSize);
+    (void)fflush(stdout);
+
+    for (unsigned i = 0; i <= nreaders; i++) {
+        const pid_t     pid = fork();
+
+        if (pid == -1) {
+            (void)fprintf(stderr, "fork() failure: %s\n", strerror(errno));
+            nfailed++;
+            break;
+        }
+        if (pid == 0) {
+            (void)close(goFds[1]);
+            _exit(i == 0 ? writer(pathname, goFds[0])
+                    : reader(pathname, goFds[0]));
+        }
+    }
+
+    (void)sleep(1);                     /* let the children open the queue */
+    (void)gettimeofday(&start, NULL);
+    (void)close(goFds[1]);              /* go */
+    (void)close(goFds[0]);
+
+    for (int childStatus; wait(&childStatus) != -1; ) {
+        if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus))
+            nfailed++;
+    }
+    (void)gettimeofday(&stop, NULL);
+
+    (void)printf("    all readers done: %.3f s%s\n", elapsed(&stop, &start),
+        nfailed ? " (failures)" : "");
+    (void)unlink(pathname);
+
+    return nfailed ? 1 : 0;
+}
+
+int
+main(
+    int         argc,
+    char*       argv[])
+{
+    const char* pathname = "seqlockBench.pq";
+    int         ch;
+
+    (void)log_init(argv[0]);
+
+    while ((ch = getopt(argc, argv, "n:r:s:")) != -1) {
+        switch (ch) {
+        case 'n':
+            nprods = (unsigned)atoi(optarg);
+            break;
+        case 'r':
+            nreaders = (unsigned)atoi(optarg);
+            break;
+        case 's':
+            prodSize = (unsigned)atoi(optarg);
+            break;
+        default:
+            (void)fprintf(stderr,
+                "Usage: %s [-r nreaders] [-n nprods] [-s size] [pathname]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        pathname = argv[optind];
+    if (nprods == 0 || prodSize == 0) {
+        (void)fprintf(stderr, "Invalid number or size of products\n");
+        return 1;
+    }
+
+    /* Readers wait via futex or SIGCONT; the latter mustn't kill them */
+    (void)signal(SIGCONT, SIG_IGN);
+
+    int status = runMode(pathname, PQ_DEFAULT, "fcntl(2) read-locks");
+    if (status == 0)
+        status = runMode(pathname, PQ_SEQLOCK, "sequence-lock");
+
+    return status;
+}
@@ -0,0 +1,182 @@
+/**
+ * Copyright 2016 University Corporation for Atmospheric Research. All rights
+ * reserved. See the file COPYRIGHT in the top-level source-directory for
+ * licensing conditions.
+ *
+ * Benchmarks the time-index of a product-queue: the latency of advancing the
+ * cursor through every product and of finding the product nearest a random
+ * time, first with the skip-list alone (the default) and then with the
+ * time-ring (`PQ_TIMERING`).
+ *
+ * Usage: timeIndexBench [-S nslots] [-s size] [-f nfinds] [pathname]
+ */
+#include "config.h"
+
+#include "ldm.h"
+#include "log.h"
+#include "pq.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static unsigned  nslots = 5000000;      /* number of product-slots */
+static unsigned  prodSize = 16;         /* size of data-products in bytes */
+static unsigned  nfinds = 100000;       /* number of random finds */
+
+static double
+elapsed(
+    const struct timeval* const later,
+    const struct timeval* const earlier)
+{
+    return (later->tv_sec - earlier->tv_sec) +
+        1e-6*(later->tv_usec - earlier->tv_usec);
+}
+
+/*
+ * Fills the product-queue so that every slot is used.
+ */
+static int
+fill(
+    pqueue* const       pq)
+{
+    char*               data = calloc(1, prodSize);
+    char                ident[32];
+    product             prod;
+    int                 status = 0;
+
+    prod.info.feedtype = EXP;
+    prod.info.ident = ident;
+    prod.info.origin = "localhost";
+    prod.info.sz = prodSize;
+    prod.data = data;
+
+    for (unsigned i = 0; status == 0 && i < nslots; i++) {
+        (void)snprintf(ident, sizeof(ident), "%u", i);
+        (void)memset(prod.info.signature, 0, sizeof(signaturet));
+        (void)memcpy(prod.info.signature, &i, sizeof(i));
+        prod.info.seqno = i;
+        (void)set_timestamp(&prod.info.arrival);
+
+        status = pq_insert(pq, &prod);
+        if (status)
+            (void)fprintf(stderr, "pq_insert() failure: %d\n", status);
+    }
+
+    free(data);
+
+    return status;
+}
+
+static int
+runMode(
+    const char* const   pathname,
+    const int           pflags,
+    const char* const   name)
+{
+    pqueue*             pq;
+    struct timeval      start, stop;
+    int                 status = pq_create(pathname, 0600, pflags, 0,
+        (off_t)nslots*(prodSize + 128), nslots, &pq);
+
+    if (status) {
+        (void)fprintf(stderr, "Couldn't create \"%s\": %s\n", pathname,
+            strerror(status));
+        return 1;
+    }
+
+    (void)printf("%s: %u slots, %u-byte products\n", name, nslots, prodSize);
+    (void)fflush(stdout);
+
+    status = fill(pq);
+    if (status == 0) {
+        timestampt      oldest, newest;
+        unsigned long   nadvances = 0;
+
+        /* Advance the cursor through every product */
+        pq_cset(pq, &TS_ZERO);
+        (void)gettimeofday(&start, NULL);
+        while ((status = pq_sequence(pq, TV_GT, NULL, NULL, NULL)) == 0)
+            nadvances++;
+        (void)gettimeofday(&stop, NULL);
+        (void)printf("    advance: %lu products, %.3f us/product\n",
+            nadvances, 1e6*elapsed(&stop, &start)/nadvances);
+
+        pq_ctimestamp(pq, &newest);
+        pq_cset(pq, &TS_ZERO);
+        (void)pq_sequence(pq, TV_GT, NULL, NULL, NULL);
+        pq_ctimestamp(pq, &oldest);
+
+        /* Find the product nearest random times */
+        const double    span = d_diff_timestamp(&newest, &oldest);
+        srand(1);
+        (void)gettimeofday(&start, NULL);
+        for (unsigned i = 0; i < nfinds; i++) {
+            timestampt  ts = oldest;
+            double      offset = span * rand() / RAND_MAX;
+            ts.tv_sec += (time_t)offset;
+            ts.tv_usec += (long)(1e6*(offset - (time_t)offset));
+            if (ts.tv_usec >= 1000000) {
+                ts.tv_sec++;
+                ts.tv_usec -= 1000000;
+            }
+            pq_cset(pq, &ts);
+            (void)pq_sequence(pq, TV_GT, NULL, NULL, NULL);
+        }
+        (void)gettimeofday(&stop, NULL);
+        (void)printf("    find: %u random times, %.3f us/find\n", nfinds,
+            1e6*elapsed(&stop, &start)/nfinds);
+        status = 0;
+    }
+
+    (void)pq_close(pq);
+    (void)unlink(pathname);
+
+    return status ? 1 : 0;
+}
+
+int
+main(
+    int         argc,
+    char*       argv[])
+{
+    const char* pathname = "timeIndexBench.pq";
+    int         ch;
+
+    (void)log_init(argv[0]);
+
+    while ((ch = getopt(argc, argv, "f:S:s:")) != -1) {
+        switch (ch) {
+        case 'f':
+            nfinds = (unsigned)atoi(optarg);
+            break;
+        case 'S':
+            nslots = (unsigned)atoi(optarg);
+            break;
+        case 's':
+            prodSize = (unsigned)atoi(optarg);
+            break;
+        default:
+            (void)fprintf(stderr,
+                "Usage: %s [-S nslots] [-s size] [-f nfinds] [pathname]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        pathname = argv[optind];
+    if (nslots == 0 || prodSize == 0) {
+        (void)fprintf(stderr, "Invalid number of slots or size of products\n");
+        return 1;
+    }
+
+    int status = runMode(pathname, PQ_DEFAULT, "skip-list");
+    if (status == 0)
+        status = runMode(pathname, PQ_TIMERING, "time-ring");
+
+    return status;
+}
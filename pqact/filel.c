@@ -155,6 +155,8 @@ typedef union f_handle f_handle;
 struct fl_entry {
     struct fl_entry* next;
     struct fl_entry* prev;
+    struct fl_entry* hashNext;          // Next entry in hash-bucket
+    unsigned         hash;              // Hash of type and command
     struct fl_ops*   ops;
     f_handle         handle;
     unsigned long    private;           // pid, hstat*, R/W flg
@@ -207,13 +209,16 @@ struct fl_ops {
 };
 
 /**
- * The one global list of entries.
+ * The one global list of entries. The list is in least-recently-used order;
+ * the hash-table indexes the same entries by type and command.
  */
 static struct fl {
     int size;
     fl_entry *head;
     fl_entry *tail;
-} thefl[] = {{ 0, NULL, NULL }};
+    fl_entry **buckets;
+    unsigned nbuckets;                  // Zero or a power of two
+} thefl[] = {{ 0, NULL, NULL, NULL, 0 }};
 
 /// Maximum amount of time for an unused entry, in seconds
 static const unsigned long maxTime = 6 * 3600;
@@ -243,6 +248,11 @@ static fl_entry* entry_new(
         ft_t         type,
         int          argc,
         char** const argv);
+static int argcat(
+        char *buf,
+        int len,
+        int argc,
+        char **argv);
 
 static inline void
 entry_setFlag(
@@ -370,6 +380,115 @@ dump_fl(void)
 }
 #endif
 
+/**
+ * Returns the hash of a type of entry and command arguments. Only the part of
+ * the command that the type's `cmp()` function compares is used.
+ *
+ * @param[in] type  Type of entry.
+ * @param[in] argc  Number of command arguments.
+ * @param[in] argv  Command arguments.
+ * @return          Hash of the type and command.
+ */
+static unsigned
+fl_hash(
+        const ft_t   type,
+        const int    argc,
+        char** const argv)
+{
+    char                 buf[PATH_MAX];
+    const unsigned char* key;
+    unsigned             hash = 2166136261u; // FNV-1a
+
+    log_assert(argc > 0);
+
+    switch (type) {
+    case PIPE:
+        (void)argcat(buf, sizeof(buf) - 1, argc, argv);
+        key = (const unsigned char*)buf;
+        break;
+#if !defined(NO_DB) && defined(USE_GDBM)
+    case FT_DB:
+        key = (const unsigned char*)argv[0];
+        break;
+#endif
+    default:
+        key = (const unsigned char*)argv[argc - 1];
+    }
+
+    hash = (hash ^ type) * 16777619u;
+    while (*key)
+        hash = (hash ^ *key++) * 16777619u;
+
+    return hash;
+}
+
+/**
+ * Adds an entry to the hash-table, growing the table if necessary.
+ *
+ * @param[in] entry  The entry to be added. `entry->hash` must be set.
+ * @retval    0      Success.
+ * @retval    -1     Out of memory. log_add() called.
+ */
+static int
+fl_hashAdd(
+        fl_entry* const entry)
+{
+    if (thefl->size >= thefl->nbuckets) {
+        const unsigned nbuckets = thefl->nbuckets ? 2*thefl->nbuckets : 64;
+        fl_entry**     buckets = calloc(nbuckets, sizeof(fl_entry*));
+
+        if (buckets == NULL) {
+            if (thefl->nbuckets == 0) {
+                log_add_syserr("Couldn't allocate %u hash-buckets", nbuckets);
+                return -1;
+            }
+            // Keep using the smaller table
+        }
+        else {
+            for (unsigned i = 0; i < thefl->nbuckets; i++) {
+                fl_entry* next;
+
+                for (fl_entry* e = thefl->buckets[i]; e != NULL; e = next) {
+                    fl_entry** const head =
+                            buckets + (e->hash & (nbuckets - 1));
+
+                    next = e->hashNext;
+                    e->hashNext = *head;
+                    *head = e;
+                }
+            }
+            free(thefl->buckets);
+            thefl->buckets = buckets;
+            thefl->nbuckets = nbuckets;
+        }
+    }
+
+    fl_entry** const head = thefl->buckets +
+            (entry->hash & (thefl->nbuckets - 1));
+    entry->hashNext = *head;
+    *head = entry;
+
+    return 0;
+}
+
+/**
+ * Removes an entry from the hash-table.
+ *
+ * @param[in] entry  The entry to be removed.
+ * @pre              {The entry is in the hash-table.}
+ */
+static void
+fl_hashRemove(
+        fl_entry* const entry)
+{
+    fl_entry** ep = thefl->buckets + (entry->hash & (thefl->nbuckets - 1));
+
+    while (*ep != entry)
+        ep = &(*ep)->hashNext;
+    *ep = entry->hashNext;
+    entry->hashNext = NULL;
+}
+
 /**
  * Finds the entry in the list corresponding to a given type of entry and
  * command arguments.
@@ -377,20 +496,26 @@ dump_fl(void)
  * @param[in] type  Type of entry.
  * @param[in] argc  Number of command arguments.
  * @param[in] argv  Command arguments.
+ * @param[in] hash  `fl_hash(type, argc, argv)`.
  * @retval    NULL  No such entry.
  * @return          Corresponding entry.
  */
 static fl_entry*
 fl_find(
-        const ft_t   type,
-        const int    argc,
-        char** const argv)
+        const ft_t     type,
+        const int      argc,
+        char** const   argv,
+        const unsigned hash)
 {
     fl_entry *entry = NULL;
 
-    for (entry = thefl->head; entry != NULL ; entry = entry->next) {
-        if (entry->type == type && entry->ops->cmp(entry, argc, argv) == 0)
-            break;
+    if (thefl->nbuckets) {
+        for (entry = thefl->buckets[hash & (thefl->nbuckets - 1)];
+                entry != NULL; entry = entry->hashNext) {
+            if (entry->hash == hash && entry->type == type &&
+                    entry->ops->cmp(entry, argc, argv) == 0)
+                break;
+        }
     }
 
     return entry;
@@ -420,6 +545,7 @@ fl_removeAndFree(
         log_log(logLevel, fmt, dr->adjective,
                 TYPE_NAME[entry->type], entry->path, entry->private);
 
+        fl_hashRemove(entry);
         fl_remove(entry);
         entry_free(entry);
     }
@@ -506,7 +632,8 @@ fl_getEntry(
         char** const restrict argv,
         bool* const restrict  isNew)
 {
-    fl_entry* entry = fl_find(type, argc, argv);
+    const unsigned hash = fl_hash(type, argc, argv);
+    fl_entry*      entry = fl_find(type, argc, argv, hash);
 
     if (NULL != entry) {
         fl_makeHead(entry);
@@ -524,12 +651,19 @@ fl_getEntry(
 
         entry = entry_new(type, argc, argv);
         if (NULL != entry) {
-            fl_addToHead(entry);
-            #ifdef FL_DEBUG
-                dump_fl();
-            #endif
-            if (isNew)
-                *isNew = true;
+            entry->hash = hash;
+            if (fl_hashAdd(entry)) {
+                entry_free(entry);
+                entry = NULL;
+            }
+            else {
+                fl_addToHead(entry);
+                #ifdef FL_DEBUG
+                    dump_fl();
+                #endif
+                if (isNew)
+                    *isNew = true;
+            }
         }
     }
 
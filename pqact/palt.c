@@ -30,6 +30,7 @@
 #include "RegularExpressions.h"
 #include "log.h"
 #include "timestamp.h"
+#include "worker.h"
 #include <stdio.h>
 
 #ifndef TEST_DATE_SUB
@@ -46,6 +47,31 @@ timestampt palt_last_insertion = {-1, -1}; // TS_NONE
 
 #define PATSZ (MAXPATTERN+1)
 
+/*
+ * The arguments of an action get compiled into one of these, if possible, so
+ * that the substitutions for a data-product are done in a single pass.
+ */
+typedef enum {
+        TOP_TEXT,               /* literal text */
+        TOP_TIME,               /* strftime(3) format of the arrival time */
+        TOP_GROUP,              /* substring matched by a subexpression */
+        TOP_DATE,               /* date indicator, "(DD:select)" */
+        TOP_SEQ                 /* sequence indicator, "(seq)" */
+} topcode;
+
+typedef struct {
+        topcode code;
+        int     group;          /* subexpression or -1 */
+        int     dom;            /* day-of-month of TOP_DATE if group < 0 */
+        char    *str;           /* text, strftime(3) format, or date select */
+        size_t  len;            /* length of "str" */
+} tmplop;
+
+typedef struct {
+        int     nops;
+        tmplop  *ops;
+} tmpl;
+
 struct palt {    /* "Pattern Action Line" */
         struct palt *next;
         struct palt *prev;
@@ -55,14 +81,28 @@ struct palt {    /* "Pattern Action Line" */
         regmatch_t *pmatchp;
         actiont action;         /* action proc to execute */
         char *private;                  /* storage for args */
+        int anchor;             /* prefilter anchor index or -1 if none */
+        tmpl *tmpl;             /* compiled "private" or NULL */
 };
 typedef struct palt palt;
 
 
+static void
+free_tmpl(tmpl *tp)
+{
+        if(tp == NULL) return;
+        for(int i = 0; i < tp->nops; i++)
+                free(tp->ops[i].str);
+        free(tp->ops);
+        free(tp);
+}
+
+
 static void
 free_palt(palt *pal)
 {
         if(pal == NULL) return;
+        free_tmpl(pal->tmpl);
         if(pal->pmatchp != NULL)
         {
                 regfree(&pal->prog);
@@ -82,6 +122,7 @@ new_palt(void)
         if(pal == NULL)
                 return NULL;
         (void) memset((char *)pal, 0, sizeof(palt));
+        pal->anchor = -1;
         return pal;
 }
 
@@ -93,12 +134,141 @@ new_palt(void)
 static palt *paList = 0; /* the only one */
 
 
+/* Begin feedtype index */
+/*
+ * For every feedtype bit, the entries of the pattern / action table whose
+ * feedtype contains that bit, in configuration order. A product with a single
+ * feedtype bit only visits the entries of that bit's bucket.
+ */
+
+#define NFEEDBITS ((int)(sizeof(feedtypet) * CHAR_BIT))
+
+typedef struct {
+        palt    **entries;
+        int     count;
+        int     max;
+} pabucket;
+
+typedef struct {
+        pabucket buckets[NFEEDBITS];
+} paindex;
+
+/*
+ * The index of the current pattern / action table
+ */
+static paindex *paIndex = NULL;
+
+
+static void
+free_paindex(paindex *idx)
+{
+        if(idx == NULL) return;
+        for(int bit = 0; bit < NFEEDBITS; bit++)
+                free(idx->buckets[bit].entries);
+        free(idx);
+}
+
+
+static paindex *
+new_paindex(void)
+{
+        paindex *idx = Alloc(1, paindex);
+        if(idx == NULL)
+        {
+                log_add_syserr("Couldn't allocate feedtype index");
+                return NULL;
+        }
+        (void) memset((char *)idx, 0, sizeof(paindex));
+        return idx;
+}
+
+
+/*
+ * Appends an entry to the buckets of its feedtype bits. Returns 0 on success
+ * or -1 on memory failure.
+ */
+static int
+pi_add(paindex *idx, palt *pal)
+{
+        for(int bit = 0; bit < NFEEDBITS; bit++)
+        {
+                pabucket *bucket = idx->buckets + bit;
+
+                if(!(pal->feedtype & (1u << bit)))
+                        continue;
+                if(bucket->count == bucket->max)
+                {
+                        int     max = bucket->max ? 2*bucket->max : 16;
+                        palt    **entries = realloc(bucket->entries,
+                                        max * sizeof(palt *));
+                        if(entries == NULL)
+                        {
+                                log_add_syserr("Couldn't allocate %d index "
+                                        "entries", max);
+                                return -1;
+                        }
+                        bucket->entries = entries;
+                        bucket->max = max;
+                }
+                bucket->entries[bucket->count++] = pal;
+        }
+        return 0;
+}
+
+
+/*
+ * Removes an entry from the buckets of its feedtype bits.
+ */
+static void
+pi_remove(paindex *idx, const palt *pal)
+{
+        for(int bit = 0; bit < NFEEDBITS; bit++)
+        {
+                pabucket *bucket = idx->buckets + bit;
+
+                for(int i = 0; i < bucket->count; i++)
+                {
+                        if(bucket->entries[i] == pal)
+                        {
+                                (void) memmove(bucket->entries + i,
+                                        bucket->entries + i + 1,
+                                        (bucket->count - i - 1)
+                                            * sizeof(palt *));
+                                bucket->count--;
+                                break;
+                        }
+                }
+        }
+}
+
+
+/*
+ * Returns the bucket for products of a given feedtype or NULL if the
+ * feedtype doesn't have exactly one bit set.
+ */
+static const pabucket *
+pi_bucket(const paindex *idx, feedtypet feedtype)
+{
+        int bit;
+
+        if(idx == NULL || feedtype == 0 || (feedtype & (feedtype - 1)))
+                return NULL;
+        for(bit = 0; !(feedtype & (1u << bit)); bit++)
+                ;
+        return idx->buckets + bit;
+}
+
+/* End feedtype index */
+
+
 /*
  * remove an entry from the linked list and Free it
  */
 static void
 remove_palt(palt *pal)
 {
+        if(paIndex != NULL)
+                pi_remove(paIndex, pal);
         if(pal->prev != NULL)
                 pal->prev->next = pal->next;
         if(pal->next != NULL)
@@ -114,6 +284,743 @@ remove_palt(palt *pal)
 }
 
 
+/* Begin literal-anchor prefilter */
+/*
+ * Most pattern/action entries can only match an ident that contains some
+ * literal substring of their regular expression (e.g., "KOUN" in
+ * "^SDUS5. KOUN"). The longest such "anchor" of every entry is put into a
+ * single Aho-Corasick automaton so that one pass over the ident determines
+ * which anchors are present; regexec() is then only called for entries whose
+ * anchor was seen or that have no anchor. The order of the entries and the
+ * semantics of "_ELSE_" are unaffected.
+ */
+
+typedef struct {
+        int             child;  /* index of first child node or -1 */
+        int             sibling;/* index of next sibling node or -1 */
+        int             fail;   /* index of longest proper-suffix node */
+        int             dict;   /* nearest suffix node with an anchor or -1 */
+        int             out;    /* index of anchor ending here or -1 */
+        unsigned char   byte;   /* transition byte into this node */
+} pfnode;
+
+typedef struct {
+        pfnode*         nodes;  /* node 0 is the root */
+        int             nnodes;
+        int             maxnodes;
+        int             nanchors;
+        unsigned*       seen;   /* `gen` if anchor seen by last scan */
+        unsigned        gen;    /* generation of last scan */
+} prefilter;
+
+/*
+ * The prefilter of the current pattern / action table
+ */
+static prefilter *paFilter = NULL;
+
+
+/*
+ * Returns a pointer to the character just after the bracket expression that
+ * starts at "cp" or NULL if the expression isn't terminated.
+ */
+static const char*
+pf_skipBracket(const char* cp)
+{
+        cp++;
+        if(*cp == '^')
+                cp++;
+        if(*cp == ']')
+                cp++;
+        while(*cp != 0 && *cp != ']')
+        {
+                if(*cp == '[' && (cp[1] == ':' || cp[1] == '.'
+                                || cp[1] == '='))
+                {
+                        const char delim = cp[1];
+                        for(cp += 2; *cp != 0 && !(*cp == delim
+                                        && cp[1] == ']'); cp++)
+                                ;
+                        if(*cp == 0)
+                                return NULL;
+                        cp += 2;
+                }
+                else
+                {
+                        cp++;
+                }
+        }
+        return *cp == ']' ? cp + 1 : NULL;
+}
+
+
+/*
+ * Returns a pointer to the character just after the parenthesized group that
+ * starts at "cp" or NULL if the group isn't terminated.
+ */
+static const char*
+pf_skipGroup(const char* cp)
+{
+        int depth = 0;
+
+        while(*cp != 0)
+        {
+                switch(*cp)
+                {
+                case '\\':
+                        if(cp[1] == 0)
+                                return NULL;
+                        cp += 2;
+                        continue;
+                case '[':
+                        if((cp = pf_skipBracket(cp)) == NULL)
+                                return NULL;
+                        continue;
+                case '(':
+                        depth++;
+                        break;
+                case ')':
+                        if(--depth == 0)
+                                return cp + 1;
+                        break;
+                }
+                cp++;
+        }
+        return NULL;
+}
+
+
+/*
+ * Returns a pointer to the character just after the interval expression that
+ * starts at "cp" or NULL if the expression isn't terminated.
+ */
+static const char*
+pf_skipInterval(const char* cp)
+{
+        const char* end = strchr(cp, '}');
+        return end == NULL ? NULL : end + 1;
+}
+
+
+/*
+ * Determines the longest literal string that every ident matched by an
+ * extended regular expression must contain. The analysis is conservative:
+ * groups, bracket expressions, and optional atoms end a literal run and a
+ * top-level alternation means there is no anchor.
+ *
+ * Arguments:
+ *      re      The extended regular expression.
+ *      anchor  The buffer for the anchor. Must be at least PATSZ bytes.
+ * Returns:
+ *      The length of the anchor in bytes. 0 means the expression has none.
+ */
+static size_t
+pf_anchor(const char* re, char* anchor)
+{
+        char            run[PATSZ];
+        size_t          runLen = 0;
+        size_t          bestLen = 0;
+        const char*     cp = re;
+
+        if(strlen(re) >= sizeof(run))
+                return 0;
+
+        while(*cp != 0)
+        {
+                int     c;              /* literal byte of atom or -1 */
+                bool    optional = false;
+                bool    repeated = false;
+
+                switch(*cp)
+                {
+                case '|':
+                case ')':
+                        return 0;
+                case '\\':
+                        if(cp[1] == 0)
+                                return 0;
+                        /* "\1", "\w", "\<", etc. aren't literals */
+                        c = (isalnum((unsigned char)cp[1]) || cp[1] == '<'
+                                || cp[1] == '>' || cp[1] == '`'
+                                || cp[1] == '\'')
+                            ? -1
+                            : (unsigned char)cp[1];
+                        cp += 2;
+                        break;
+                case '[':
+                        cp = pf_skipBracket(cp);
+                        c = -1;
+                        break;
+                case '(':
+                        cp = pf_skipGroup(cp);
+                        c = -1;
+                        break;
+                case '{':
+                        cp = pf_skipInterval(cp);
+                        c = -1;
+                        break;
+                case '.':
+                case '^':
+                case '$':
+                case '*':
+                case '+':
+                case '?':
+                        cp++;
+                        c = -1;
+                        break;
+                default:
+                        c = (unsigned char)*cp++;
+                        break;
+                }
+                if(cp == NULL)
+                        return 0;
+
+                if(*cp == '*' || *cp == '?')
+                {
+                        optional = true;
+                        cp++;
+                }
+                else if(*cp == '+')
+                {
+                        repeated = true;
+                        cp++;
+                }
+                else if(*cp == '{')
+                {
+                        optional = true;        /* conservatively */
+                        if((cp = pf_skipInterval(cp)) == NULL)
+                                return 0;
+                }
+
+                if(c >= 0 && !optional)
+                        run[runLen++] = (char)c;
+                if(c < 0 || optional || repeated)
+                {
+                        if(runLen > bestLen)
+                        {
+                                (void) memcpy(anchor, run, runLen);
+                                bestLen = runLen;
+                        }
+                        runLen = 0;
+                }
+        }
+        if(runLen > bestLen)
+        {
+                (void) memcpy(anchor, run, runLen);
+                bestLen = runLen;
+        }
+        anchor[bestLen] = 0;
+
+        return bestLen;
+}
+
+
+static void
+free_prefilter(prefilter *pf)
+{
+        if(pf == NULL) return;
+        free(pf->nodes);
+        free(pf->seen);
+        free(pf);
+}
+
+
+/*
+ * Appends a node to a prefilter. Returns the index of the node or -1 on
+ * memory failure.
+ */
+static int
+pf_newNode(prefilter *pf, unsigned char byte)
+{
+        pfnode *node;
+
+        if(pf->nnodes == pf->maxnodes)
+        {
+                int     max = pf->maxnodes ? 2*pf->maxnodes : 256;
+                pfnode  *nodes = realloc(pf->nodes, max * sizeof(pfnode));
+                if(nodes == NULL)
+                {
+                        log_add_syserr("Couldn't allocate %d prefilter nodes",
+                                max);
+                        return -1;
+                }
+                pf->nodes = nodes;
+                pf->maxnodes = max;
+        }
+        node = pf->nodes + pf->nnodes;
+        node->child = node->sibling = node->dict = node->out = -1;
+        node->fail = 0;
+        node->byte = byte;
+
+        return pf->nnodes++;
+}
+
+
+static prefilter *
+new_prefilter(void)
+{
+        prefilter *pf = Alloc(1, prefilter);
+        if(pf == NULL)
+        {
+                log_add_syserr("Couldn't allocate prefilter");
+                return NULL;
+        }
+        (void) memset((char *)pf, 0, sizeof(prefilter));
+        if(pf_newNode(pf, 0) < 0)
+        {
+                free_prefilter(pf);
+                return NULL;
+        }
+        return pf;
+}
+
+
+/*
+ * Returns the index of the child of node "n" reached by "byte" or -1.
+ */
+static int
+pf_child(const prefilter *pf, int n, unsigned char byte)
+{
+        for(n = pf->nodes[n].child; n >= 0; n = pf->nodes[n].sibling)
+                if(pf->nodes[n].byte == byte)
+                        break;
+        return n;
+}
+
+
+/*
+ * Adds an anchor to a prefilter that hasn't been built. Identical anchors
+ * share an index. Returns the index of the anchor or -1 on memory failure.
+ */
+static int
+pf_add(prefilter *pf, const char *anchor)
+{
+        int n = 0;
+
+        for(const unsigned char *cp = (const unsigned char *)anchor; *cp;
+                        cp++)
+        {
+                int child = pf_child(pf, n, *cp);
+                if(child < 0)
+                {
+                        if((child = pf_newNode(pf, *cp)) < 0)
+                                return -1;
+                        pf->nodes[child].sibling = pf->nodes[n].child;
+                        pf->nodes[n].child = child;
+                }
+                n = child;
+        }
+        if(pf->nodes[n].out < 0)
+                pf->nodes[n].out = pf->nanchors++;
+
+        return pf->nodes[n].out;
+}
+
+
+/*
+ * Computes the failure links of a prefilter after all anchors have been
+ * added. Returns 0 on success or -1 on memory failure.
+ */
+static int
+pf_build(prefilter *pf)
+{
+        int     *queue = malloc(pf->nnodes * sizeof(int));
+        int     head = 0;
+        int     tail = 0;
+
+        pf->seen = calloc(pf->nanchors ? pf->nanchors : 1, sizeof(unsigned));
+        if(queue == NULL || pf->seen == NULL)
+        {
+                log_add_syserr("Couldn't allocate prefilter tables");
+                free(queue);
+                return -1;
+        }
+
+        for(int n = pf->nodes[0].child; n >= 0; n = pf->nodes[n].sibling)
+                queue[tail++] = n;      /* fail links are the root */
+
+        while(head < tail)
+        {
+                int parent = queue[head++];
+
+                for(int n = pf->nodes[parent].child; n >= 0;
+                                n = pf->nodes[n].sibling)
+                {
+                        unsigned char   byte = pf->nodes[n].byte;
+                        int             f = pf->nodes[parent].fail;
+                        int             next;
+
+                        while((next = pf_child(pf, f, byte)) < 0 && f != 0)
+                                f = pf->nodes[f].fail;
+                        pf->nodes[n].fail = next < 0 ? 0 : next;
+
+                        f = pf->nodes[n].fail;
+                        pf->nodes[n].dict = pf->nodes[f].out >= 0
+                                ? f
+                                : pf->nodes[f].dict;
+                        queue[tail++] = n;
+                }
+        }
+        free(queue);
+
+        return 0;
+}
+
+
+/*
+ * Marks the anchors of a built prefilter that occur in a string.
+ */
+static void
+pf_scan(prefilter *pf, const char *str)
+{
+        int n = 0;
+
+        if(++pf->gen == 0)
+        {
+                (void) memset(pf->seen, 0, pf->nanchors * sizeof(unsigned));
+                pf->gen = 1;
+        }
+
+        for(const unsigned char *cp = (const unsigned char *)str; *cp; cp++)
+        {
+                int next;
+
+                while((next = pf_child(pf, n, *cp)) < 0 && n != 0)
+                        n = pf->nodes[n].fail;
+                n = next < 0 ? 0 : next;
+
+                for(int m = pf->nodes[n].out >= 0 ? n : pf->nodes[n].dict;
+                                m >= 0; m = pf->nodes[m].dict)
+                        pf->seen[pf->nodes[m].out] = pf->gen;
+        }
+}
+
+
+/*
+ * Indicates whether or not an entry might match the string of the last
+ * pf_scan().
+ */
+static bool
+pf_mightMatch(const prefilter *pf, const palt *pal)
+{
+        return pal->anchor < 0 || pf->seen[pal->anchor] == pf->gen;
+}
+
+/* End literal-anchor prefilter */
+
+
+/* Begin compiled substitution templates */
+/*
+ * The "private" arguments of an entry are normally expanded for every matching
+ * data-product by four passes, each over the output of the previous one:
+ * regsub(), gm_strftime(), date_sub(), and seq_sub(). When possible, they're
+ * instead compiled by readPatFile() into a sequence of literal text and
+ * substitution operations that tmpl_expand() evaluates in one pass.
+ * Arguments whose meaning could depend on text that's only known at run-time
+ * (e.g., a subexpression inside a date indicator other than its day-of-month)
+ * aren't compiled and the passes are used instead. The "tmpl_expand" check
+ * program compares the two.
+ */
+
+/*
+ * Items of decoded arguments: a literal character or a subexpression.
+ */
+#define TMPL_GROUP(n)   (-1 - (n))
+#define TMPL_IS_GROUP(item)     ((item) < 0)
+#define TMPL_GROUP_NO(item)     (-1 - (item))
+
+/**
+ * Decodes the subexpression references of arguments exactly as regsub() does.
+ *
+ * @param[in]  src    The arguments.
+ * @param[in]  nsub   Number of subexpressions of the regular expression.
+ *                    References to higher subexpressions are dropped.
+ * @param[out] items  The items. Must have room for `strlen(src)` elements.
+ * @retval     -1     `src` has an invalid parenthetical backreference.
+ * @return            Number of items.
+ */
+static int
+tmpl_items(const char *src, const size_t nsub, int *items)
+{
+        int     nitems = 0;
+        char    c;
+
+        while ((c = *src++) != '\0') {
+                int     no;
+
+                if (c == '&') {
+                        no = 0;
+                }
+                else if (c == '\\' && '0' <= *src && *src <= '9') {
+                        no = *src++ - '0';
+                }
+                else if (c == '\\' && '(' == *src &&
+                        '0' <= src[1] && src[1] <= '9') {
+                        int     i;
+                        int     nbytes;
+
+                        if (sscanf(src+1, "%d%n)", &i, &nbytes) != 1 ||
+                                i < 0 || src[1+nbytes] != ')')
+                            return -1;
+                        no = i;
+                        src += 1 + nbytes + 1;
+                }
+                else {
+                        no = -1;
+                }
+
+                if (no < 0) {   /* Ordinary character. */
+                        if (c == '\\' && (*src == '\\' || *src == '&'))
+                                c = *src++;
+                        items[nitems++] = (unsigned char)c;
+                }
+                else if (no <= nsub) {
+                        items[nitems++] = TMPL_GROUP(no);
+                }
+        }
+
+        return nitems;
+}
+
+
+/**
+ * Appends an operation to a template.
+ *
+ * @param[in,out] tp     The template.
+ * @param[in]     code   The operation.
+ * @param[in]     group  Subexpression or -1.
+ * @param[in]     dom    Day-of-month of a date indicator.
+ * @param[in]     str    The operation's string. Copied.
+ * @param[in]     len    Length of `str`.
+ * @retval        0      Success.
+ * @retval        -1     Out of memory.
+ */
+static int
+tmpl_add(
+        tmpl* const             tp,
+        const topcode           code,
+        const int               group,
+        const int               dom,
+        const char* const       str,
+        const size_t            len)
+{
+        tmplop*         ops = realloc(tp->ops, (tp->nops+1) * sizeof(tmplop));
+        tmplop*         op;
+
+        if (ops == NULL)
+                return -1;
+        tp->ops = ops;
+
+        op = ops + tp->nops;
+        op->str = malloc(len+1);
+        if (op->str == NULL)
+                return -1;
+        (void)memcpy(op->str, str, len);
+        op->str[len] = 0;
+        op->len = len;
+        op->code = code;
+        op->group = group;
+        op->dom = dom;
+        tp->nops++;
+
+        return 0;
+}
+
+
+/**
+ * Parses a date indicator, "(DD:select)", whose day-of-month is either two
+ * literal digits or a subexpression.
+ *
+ * @param[in]  items   The items starting with a '('.
+ * @param[in]  nitems  Number of items.
+ * @param[out] group   Subexpression of the day-of-month or -1.
+ * @param[out] dom     Literal day-of-month.
+ * @param[out] select  The select in lower case. Must have room for 6 bytes.
+ * @retval     0       `items` doesn't start with such an indicator.
+ * @retval     -1      `items` starts with a date indicator that can't be
+ *                     compiled.
+ * @return             Number of items of the date indicator.
+ */
+static int
+tmpl_date(
+        const int* const        items,
+        const int               nitems,
+        int* const              group,
+        int* const              dom,
+        char* const             select)
+{
+        int     i = 1;
+        int     n = 0;
+
+        if (nitems > 2 && TMPL_IS_GROUP(items[1])) {
+                *group = TMPL_GROUP_NO(items[1]);
+                *dom = 0;
+                i = 2;
+        }
+        else if (nitems > 3 && items[1] >= 0 && isdigit(items[1]) &&
+                items[2] >= 0 && isdigit(items[2])) {
+                *group = -1;
+                *dom = (items[1] - '0') * 10 + items[2] - '0';
+                i = 3;
+        }
+        else {
+                return 0;
+        }
+
+        if (items[i++] != ':')
+                return 0;
+
+        for (; i < nitems && items[i] != ')'; i++) {
+                if (TMPL_IS_GROUP(items[i]) || items[i] == '%')
+                        return 0;
+                if (n == 5)
+                        return -1;      /* date_sub() would overflow */
+                select[n++] = (char)tolower(items[i]);
+        }
+        select[n] = 0;
+
+        if (i == nitems)
+                return 0;
+
+        /* A bad literal day-of-month is left to date_sub() to report */
+        return (*dom > 31) ? -1 : i + 1;
+}
+
+
+/**
+ * Compiles the arguments of an entry into a template.
+ *
+ * @param[in] private  The arguments.
+ * @param[in] nsub     Number of subexpressions of the entry's regular
+ *                     expression.
+ * @retval    NULL     The arguments can't be compiled or out of memory. The
+ *                     separate substitution passes must be used.
+ * @return             The template. The caller should free_tmpl() it.
+ */
+static tmpl *
+tmpl_compile(const char* const private, const size_t nsub)
+{
+        const size_t    size = strlen(private);
+        int*            items = malloc((size+1) * sizeof(int));
+        char*           run = malloc(size+1);   /* pending literal text */
+        size_t          runlen = 0;
+        bool            isTime = false;         /* run has strftime(3) spec? */
+        tmpl*           tp = calloc(1, sizeof(tmpl));
+        int             nitems;
+        int             i;
+        int             status = -1;
+
+        if (items == NULL || run == NULL || tp == NULL)
+                goto done;
+
+        nitems = tmpl_items(private, nsub, items);
+        if (nitems < 0)
+                goto done;
+
+#define TMPL_FLUSH() \
+        if (runlen) { \
+                if (tmpl_add(tp, isTime ? TOP_TIME : TOP_TEXT, -1, 0, run, \
+                        runlen)) \
+                    goto done; \
+                runlen = 0; \
+                isTime = false; \
+        }
+
+        for (i = 0; i < nitems; ) {
+                const int       item = items[i];
+
+                if (TMPL_IS_GROUP(item)) {
+                        TMPL_FLUSH();
+                        if (tmpl_add(tp, TOP_GROUP, TMPL_GROUP_NO(item), 0, "",
+                                0))
+                            goto done;
+                        i++;
+                }
+                else if (item == '(') {
+                        int     group;
+                        int     dom;
+                        char    select[6];
+                        int     n = tmpl_date(items+i, nitems-i, &group, &dom,
+                                select);
+
+                        if (n < 0)
+                                goto done;
+                        if (n > 0) {
+                                TMPL_FLUSH();
+                                if (tmpl_add(tp, TOP_DATE, group, dom, select,
+                                        strlen(select)))
+                                    goto done;
+                                i += n;
+                        }
+                        else if (nitems - i >= 5 && items[i+1] == 's' &&
+                                items[i+2] == 'e' && items[i+3] == 'q' &&
+                                items[i+4] == ')') {
+                                TMPL_FLUSH();
+                                if (tmpl_add(tp, TOP_SEQ, -1, 0, "", 0))
+                                    goto done;
+                                i += 5;
+                        }
+                        else {
+                                /*
+                                 * A parenthesis that isn't an indicator must
+                                 * not be able to become one at run-time.
+                                 */
+                                int     j;
+
+                                for (j = i + 1; j < nitems && items[j] != ')';
+                                        j++) {
+                                    if (TMPL_IS_GROUP(items[j]) ||
+                                            items[j] == '%' || items[j] == '(')
+                                        goto done;
+                                }
+                                run[runlen++] = '(';
+                                i++;
+                        }
+                }
+                else if (item == '%') {
+                        /*
+                         * The conversion specification must be entirely
+                         * literal so that it's passed to strftime(3) intact.
+                         */
+                        int     j = i + 1;
+
+                        while (j < nitems && items[j] >= 0 &&
+                                strchr("_-0^#", items[j]) != NULL)
+                            j++;
+                        while (j < nitems && items[j] >= 0 && isdigit(items[j]))
+                            j++;
+                        if (j < nitems && (items[j] == 'E' || items[j] == 'O'))
+                            j++;
+                        if (j == nitems || TMPL_IS_GROUP(items[j]) ||
+                                items[j] == '(')
+                            goto done;
+
+                        for (; i <= j; i++)
+                            run[runlen++] = (char)items[i];
+                        isTime = true;
+                }
+                else {
+                        run[runlen++] = (char)item;
+                        i++;
+                }
+        }
+        TMPL_FLUSH();
+#undef TMPL_FLUSH
+
+        status = 0;
+
+done:
+        free(items);
+        free(run);
+        if (status) {
+                free_tmpl(tp);
+                tp = NULL;
+        }
+        return tp;
+}
+
+/* End compiled substitution templates */
+
+
 /* Begin readPatFile */
 /*
  * static global for syntax error reporting
@@ -389,6 +1296,9 @@ new_palt_fromStr(char *buf)
                 (void) strcpy(pal->private, tabtoks[3]);
         }
 
+        if(pal->private != NULL)
+                pal->tmpl = tmpl_compile(pal->private, pal->prog.re_nsub);
+
         return pal;
 err:
         free_palt(pal);
@@ -421,15 +1331,19 @@ readPatFile(const char *path)
         status = -1;
     }
     else {
-        palt*   pal = NULL;
-        palt*   begin = NULL;
-        palt*   othr = NULL;
+        palt*       pal = NULL;
+        palt*       begin = NULL;
+        palt*       othr = NULL;
+        prefilter*  pf = new_prefilter();
+        paindex*    idx = new_paindex();
+        int         nanchored = 0;
 
         linenumber = 1;
-        status = 0;
+        status = (pf == NULL || idx == NULL) ? -2 : 0;
 
-        for (;;) {
+        while (status >= 0) {
             char        buf[512];
+            char        anchor[PATSZ];
             int         len = pal_line(buf, sizeof(buf), fp);
 
             if (len <= -2) {
@@ -445,6 +1359,23 @@ readPatFile(const char *path)
                 break;
             }
 
+            if (pf_anchor(pal->pattern, anchor) > 0) {
+                if ((pal->anchor = pf_add(pf, anchor)) < 0) {
+                    log_flush_error();
+                    free_palt(pal);
+                    status = -2;
+                    break;
+                }
+                nanchored++;
+            }
+
+            if (pi_add(idx, pal)) {
+                log_flush_error();
+                free_palt(pal);
+                status = -2;
+                break;
+            }
+
             if (begin == NULL) {
                 begin = pal;
             }
@@ -457,6 +1388,11 @@ readPatFile(const char *path)
             status++;
         }
 
+        if (status >= 0 && pf_build(pf)) {
+            log_flush_error();
+            status = -2;
+        }
+
         if (status < 0) {
             log_error_q("Error in configuration-file \"%s\"", path);
 
@@ -468,6 +1404,8 @@ readPatFile(const char *path)
                 free_palt(pal);
                 pal = othr;
             }
+            free_prefilter(pf);
+            free_paindex(idx);
         }
         else {
             /*
@@ -480,7 +1418,13 @@ readPatFile(const char *path)
             }
 
             paList = begin;
+            free_prefilter(paFilter);
+            paFilter = pf;
+            free_paindex(paIndex);
+            paIndex = idx;
 
+            log_debug("%d of %d entries have literal anchors", nanchored,
+                    status);
             log_info_q("Successfully read configuration-file \"%s\"", path);
         }
 
@@ -634,6 +1578,121 @@ seq_sub(
     }
 }
 
+/**
+ * Formats one date component for a date indicator with a valid day-of-month.
+ * The product-time is first moved to the recent day having the given
+ * day-of-month (unless that's zero).
+ *
+ * @param[out] ostring      Output buffer. Must be large enough for the
+ *                          formatted component and a terminating NUL.
+ * @param[in]  prodClock    UTC-based product-time (might be "now").
+ * @param[in]  utcProdTime  Broken-down `prodClock`.
+ * @param[in]  dom          Day-of-month of the date indicator: 0 through 31.
+ * @param[in]  select       Lower-case time component code: "yyyy", "mmm", etc.
+ * @return                  Number of bytes by which the caller should advance
+ *                          in the output. 0 if `select` is unknown.
+ */
+static int
+date_component(
+    char* const                 ostring,
+    const time_t                prodClock,
+    const struct tm* const      utcProdTime,
+    const int                   dom,
+    const char* const           select)
+{
+    /* Adjusted, UTC-based, product-time structure: */
+    struct tm           adjProdTime = *utcProdTime;
+    static char*        months[] = {
+        "jan","feb","mar","apr","may","jun",
+        "jul","aug","sep","oct","nov","dec"};
+
+    if (dom) {
+        /*
+         * The matched substring in the product-identifier is a valid
+         * day-of-month.  Adjust the product-time so that it falls on
+         * the specified day.
+         */
+        struct tm       tmTime = *utcProdTime;
+        time_t          prodMonthClock;
+
+        tmTime.tm_mday = dom;           /* set day to specified */
+        prodMonthClock = utcToEpochTime(&tmTime);
+
+        if (prodMonthClock != -1) {
+            time_t      prevMonthClock;
+
+            tmTime.tm_mon--;            /* set month to previous */
+            prevMonthClock = utcToEpochTime(&tmTime);
+
+            if (prevMonthClock != -1) {
+                time_t      nextMonthClock;
+
+                tmTime.tm_mon += 2;     /* set month to next */
+                nextMonthClock = utcToEpochTime(&tmTime);
+
+                if (nextMonthClock != -1) {
+                    /*
+                     * Of the three time candidates, use the one
+                     * closest to the product-time that's not too far
+                     * in the future.
+                     */
+#                   define SECONDS_PER_DAY (60*60*24)
+                    time_t              maxTime =
+                        prodClock + (3*SECONDS_PER_DAY)/2;
+                    time_t              adjClock = 
+                        nextMonthClock < maxTime
+                            ? nextMonthClock
+                            : prodMonthClock < maxTime
+                                ? prodMonthClock
+                                : prevMonthClock;
+                    if (gmtime_r(&adjClock, &adjProdTime) == NULL)
+                        log_error_q("gmtime_r() failure");
+                }               /* valid "nextMonthClock" */
+            }                   /* valid "prevMonthClock" */
+        }                       /* valid "prodMonthClock" */
+    }                           /* "adjProdTime" needs adjusting */
+
+    int year;
+    int month;
+
+    if (strcmp(select,"yyyy") == 0) {
+        year = adjProdTime.tm_year + 1900;
+        (void) sprintf(ostring,"%d",year);
+        return 4;
+    }
+    if (strcmp(select,"yy") == 0) {
+        year = adjProdTime.tm_year;
+        (void) sprintf(ostring,"%02d", year % 100);
+        return 2;
+    }
+    if (strcmp(select,"mm") == 0) {
+        month = adjProdTime.tm_mon + 1;
+        (void) sprintf(ostring,"%02d",month);
+        return 2;
+    }
+    if (strcmp(select,"mmm") == 0) {
+        month = adjProdTime.tm_mon;
+        (void) sprintf(ostring,"%s",months[month]);
+        return 3;
+    }
+    if (strcmp(select,"dd") == 0) {
+        (void) sprintf(ostring,"%02d",(int)adjProdTime.tm_mday);
+        return 2;
+    }
+    if (strcmp(select,"ddd") == 0) {
+        int     doy = adjProdTime.tm_yday + 1;
+        (void) sprintf(ostring,"%03d",doy);
+        return 3;
+    }
+    if (strcmp(select,"hh") == 0) {
+        (void) sprintf(ostring,"%02d",adjProdTime.tm_hour);
+        return 2;
+    }
+
+    log_error_q("unknown date indicator: %s",select);
+    return 0;
+}
+
 /*
         from  ldm3/dd_regexp.c,v 1.24 1991/03/02 17:32:08
   Substitutes date components in a string containing date indicators.
@@ -754,98 +1813,9 @@ date_sub(
             ostring += strlen(select);
         }
         else {
-            /* Adjusted, UTC-based, product-time structure: */
-            struct tm           adjProdTime = utcProdTime;
-            static char*        months[] = {
-                "jan","feb","mar","apr","may","jun",
-                "jul","aug","sep","oct","nov","dec"};
-
-            if (dom) {
-                /*
-                 * The matched substring in the product-identifier is a valid
-                 * day-of-month.  Adjust the product-time so that it falls on
-                 * the specified day.
-                 */
-                struct tm       tmTime = utcProdTime;
-                time_t          prodMonthClock;
-
-                tmTime.tm_mday = dom;           /* set day to specified */
-                prodMonthClock = utcToEpochTime(&tmTime);
-
-                if (prodMonthClock != -1) {
-                    time_t      prevMonthClock;
-
-                    tmTime.tm_mon--;            /* set month to previous */
-                    prevMonthClock = utcToEpochTime(&tmTime);
-
-                    if (prevMonthClock != -1) {
-                        time_t      nextMonthClock;
-
-                        tmTime.tm_mon += 2;     /* set month to next */
-                        nextMonthClock = utcToEpochTime(&tmTime);
-
-                        if (nextMonthClock != -1) {
-                            /*
-                             * Of the three time candidates, use the one
-                             * closest to the product-time that's not too far
-                             * in the future.
-                             */
-#                           define SECONDS_PER_DAY (60*60*24)
-                            time_t              maxTime =
-                                prodClock + (3*SECONDS_PER_DAY)/2;
-                            time_t              adjClock = 
-                                nextMonthClock < maxTime
-                                    ? nextMonthClock
-                                    : prodMonthClock < maxTime
-                                        ? prodMonthClock
-                                        : prevMonthClock;
-                            if (gmtime_r(&adjClock, &adjProdTime) == NULL)
-                                log_error_q("gmtime_r() failure");
-                        }               /* valid "nextMonthClock" */
-                    }                   /* valid "prevMonthClock" */
-                }                       /* valid "prodMonthClock" */
-            }                           /* "adjProdTime" needs adjusting */
-
-            int year;
-            int month;
-
-            if (strcmp(select,"yyyy") == 0) {
-                year = adjProdTime.tm_year + 1900;
-                (void) sprintf(ostring,"%d",year);
-                ostring += 4;
-            }
-            else if (strcmp(select,"yy") == 0) {
-                year = adjProdTime.tm_year;
-                (void) sprintf(ostring,"%02d", year % 100);
-                ostring += 2;
-            }
-            else if (strcmp(select,"mm") == 0) {
-                month = adjProdTime.tm_mon + 1;
-                (void) sprintf(ostring,"%02d",month);
-                ostring += 2;
-            }
-            else if (strcmp(select,"mmm") == 0) {
-                month = adjProdTime.tm_mon;
-                (void) sprintf(ostring,"%s",months[month]);
-                ostring += 3;
-            }
-            else if (strcmp(select,"dd") == 0) {
-                (void) sprintf(ostring,"%02d",(int)adjProdTime.tm_mday);
-                ostring += 2;
-            }
-            else if (strcmp(select,"ddd") == 0) {
-                int     doy = adjProdTime.tm_yday + 1;
-                (void) sprintf(ostring,"%03d",doy);
-                ostring += 3;
-            }
-            else if (strcmp(select,"hh") == 0) {
-                (void) sprintf(ostring,"%02d",adjProdTime.tm_hour);
-                ostring += 2;
-            }
-            else {
-                log_error_q("unknown date indicator: %s",select);
-            }
-        }                               /* good date indicator */
+            ostring += date_component(ostring, prodClock, &utcProdTime, dom,
+                    select);
+        }
     }                                   /* date substitution loop */
 
     (void)strcpy(ostring, is);          /* copy rest of input to output */
@@ -1163,11 +2133,119 @@ regsub(const palt* const pal, const char *ident, char *dest, size_t size)
 }
 
 
+/**
+ * Expands the compiled arguments of an entry for a data-product in a single
+ * pass. The result is identical to that of regsub(), gm_strftime(),
+ * date_sub(), and seq_sub() in succession.
+ *
+ * @param[in]  pal    The pattern/action entry. `pal->tmpl != NULL`.
+ * @param[in]  info   Metadata of the data-product that matched the entry.
+ * @param[out] buf    The output buffer.
+ * @param[in]  size   Size of the output buffer in bytes.
+ * @retval     true   Success. `buf` is NUL-terminated.
+ * @retval     false  The result could differ from that of the separate passes
+ *                    (e.g., a subexpression matched a '%') or the output buffer
+ *                    is too small. The separate passes must be used.
+ */
+static bool
+tmpl_expand(
+        const palt* const       pal,
+        const prod_info* const  info,
+        char* const             buf,
+        const size_t            size)
+{
+    const tmpl* const   tp = pal->tmpl;
+    const time_t        arrival = info->arrival.tv_sec;
+    struct tm           utcProdTime;
+    bool                haveTime = false;
+    char*               out = buf;
+    char* const         end = buf + size - 1;   /* leaves room for NUL */
+
+    for (int i = 0; i < tp->nops; i++) {
+        const tmplop* const     op = tp->ops + i;
+        const char*             str = op->str;
+        size_t                  len = op->len;
+        char                    tmp[32];
+        const regmatch_t*       match;
+
+        switch (op->code) {
+        case TOP_TEXT:
+            break;
+
+        case TOP_TIME:
+            len = gm_strftime(out, end - out + 1, op->str, arrival);
+            if (len == 0)
+                return false;
+            out += len;
+            continue;
+
+        case TOP_GROUP:
+            match = &pal->pmatchp[op->group];
+            if (match->rm_so < 0 || match->rm_eo <= match->rm_so) {
+                len = 0;
+            }
+            else {
+                str = &info->ident[match->rm_so];
+                len = match->rm_eo - match->rm_so;
+                /* The later passes would've interpreted these: */
+                for (size_t j = 0; j < len; j++)
+                    if (str[j] == '%' || str[j] == '(' || str[j] == ')')
+                        return false;
+            }
+            break;
+
+        case TOP_DATE: {
+            int dom = op->dom;
+
+            if (op->group >= 0) {
+                match = &pal->pmatchp[op->group];
+                if (match->rm_so < 0 || match->rm_eo - match->rm_so != 2)
+                    return false;
+                str = &info->ident[match->rm_so];
+                if (!isdigit((unsigned char)str[0]) ||
+                        !isdigit((unsigned char)str[1]))
+                    return false;
+                dom = (str[0] - '0') * 10 + str[1] - '0';
+                if (dom > 31)
+                    return false;       /* date_sub() reports it */
+            }
+            if (!haveTime) {
+                if (gmtime_r(&arrival, &utcProdTime) == NULL)
+                    return false;
+                haveTime = true;
+            }
+            tmp[0] = 0;
+            len = date_component(tmp, arrival, &utcProdTime, dom, op->str);
+            if (len > strlen(tmp))
+                len = strlen(tmp);
+            str = tmp;
+            break;
+        }
+
+        case TOP_SEQ:
+            len = snprintf(tmp, sizeof(tmp), "%u", info->seqno);
+            str = tmp;
+            break;
+        }
+
+        if (len > end - out)
+            return false;
+        (void)memcpy(out, str, len);
+        out += len;
+    }
+
+    *out = 0;
+    return true;
+}
+
+
 /*
- * Apply the action in pal to prod
+ * Apply the action in pal to prod, which was inserted into the product-queue
+ * at time *inserted
  */
 static int
-prodAction(product *prod, palt *pal, const void *xprod, size_t xlen)
+prodAction(product *prod, palt *pal, const void *xprod, size_t xlen,
+        const timestampt *inserted)
 {
     int         argc;
     int         status;
@@ -1197,21 +2275,28 @@ prodAction(product *prod, palt *pal, const void *xprod, size_t xlen)
 #define OUTBUF          bufs[!inBuf]
 #define SWITCH_BUFS     (inBuf = !inBuf)
 
-        regsub(pal, prod->info.ident, OUTBUF, sizeof(OUTBUF));
-        OUTBUF[sizeof(OUTBUF)-1] = 0;
-        SWITCH_BUFS;
-
-        gm_strftime(OUTBUF, sizeof(OUTBUF), INBUF, prod->info.arrival.tv_sec);
-        OUTBUF[sizeof(OUTBUF)-1] = 0;
-        SWITCH_BUFS;
-
-        date_sub(INBUF, OUTBUF, prod->info.arrival.tv_sec);
-        OUTBUF[sizeof(OUTBUF)-1] = 0;
-        SWITCH_BUFS;
-
-        seq_sub(INBUF, OUTBUF, sizeof(OUTBUF), prod->info.seqno);
-        OUTBUF[sizeof(OUTBUF)-1] = 0;
-        SWITCH_BUFS;
+        if (pal->tmpl != NULL &&
+                tmpl_expand(pal, &prod->info, OUTBUF, sizeof(OUTBUF))) {
+            SWITCH_BUFS;
+        }
+        else {
+            regsub(pal, prod->info.ident, OUTBUF, sizeof(OUTBUF));
+            OUTBUF[sizeof(OUTBUF)-1] = 0;
+            SWITCH_BUFS;
+
+            gm_strftime(OUTBUF, sizeof(OUTBUF), INBUF,
+                    prod->info.arrival.tv_sec);
+            OUTBUF[sizeof(OUTBUF)-1] = 0;
+            SWITCH_BUFS;
+
+            date_sub(INBUF, OUTBUF, prod->info.arrival.tv_sec);
+            OUTBUF[sizeof(OUTBUF)-1] = 0;
+            SWITCH_BUFS;
+
+            seq_sub(INBUF, OUTBUF, sizeof(OUTBUF), prod->info.seqno);
+            OUTBUF[sizeof(OUTBUF)-1] = 0;
+            SWITCH_BUFS;
+        }
 
         log_debug("%s: {cmd: \"%s\", ident: \"%s\"}",
                 s_actiont(&pal->action), INBUF, prod->info.ident);
@@ -1221,7 +2306,13 @@ prodAction(product *prod, palt *pal, const void *xprod, size_t xlen)
         if (argc < ARRAYLEN(argv))
         {
             argv[argc] = NULL;
-            status = (*pal->action.prod_action)(prod, argc, argv, xprod, xlen);
+            /*
+             * Products that aren't in the product-queue (e.g., "_BEGIN_")
+             * can't be handed to a worker process.
+             */
+            status = (wrk_isActive() && xprod != NULL)
+                ? wrk_submit(&prod->info, inserted, &pal->action, argc, argv)
+                : (*pal->action.prod_action)(prod, argc, argv, xprod, xlen);
             if (status)
                 log_add("Couldn't process product: "
                         "feedtype=%s, pattern=\"%s\", action=%s, "
@@ -1308,10 +2399,65 @@ processProduct(
 
 #else
 
+/**
+ * Applies an entry of the pattern / action table to a data-product if the
+ * entry matches it. The entry is removed from the table if its action failed
+ * and is transient.
+ *
+ * @param[in]     pal        The entry
+ * @param[in]     prod_par   Data-product parameters
+ * @param[in]     queue_par  Product-queue parameters
+ * @param[in,out] didMatch   Whether or not a previous entry matched the
+ *                           product. Set to `true` if this entry matches.
+ * @retval        true       The entry matched and its action failed
+ * @retval        false      Otherwise
+ */
+static bool
+processEntry(
+        palt* const restrict              pal,
+        const prod_par_t* const restrict  prod_par,
+        const queue_par_t* const restrict queue_par,
+        bool* const restrict              didMatch)
+{
+    const prod_info* const infop = &prod_par->info;
+    bool                   failed = false;
+
+    /*
+     * If the feedtype matches AND ((the product ID contains the entry's
+     * anchor AND matches the regular expression) OR (the pattern is
+     * "_ELSE_" AND nothing has been done to this product yet AND the first
+     * char of the ident isn't '_'))
+     */
+    if ((infop->feedtype & pal->feedtype) && (
+            (pf_mightMatch(paFilter, pal)
+             && regexec(&pal->prog, infop->ident, pal->prog.re_nsub +1,
+                    pal->pmatchp, 0) == 0)
+            || (strcmp(pal->pattern, "^_ELSE_$") == 0
+                    && !*didMatch && infop->ident[0] != '_'))) {
+        /* A match, do something */
+        *didMatch = true;
+        product prod;
+        prod.info = *infop;
+        prod.data = prod_par->data;
+        if (prodAction(&prod, pal, prod_par->encoded, prod_par->size,
+                &queue_par->inserted)) {
+            log_flush_error();
+            if (pal->action.flags & LDM_ACT_TRANSIENT) {
+                /* connection closed, don't try again */
+                remove_palt(pal);
+            }
+            failed = true;
+        }
+    }
+
+    return failed;
+}
+
 /**
  * Loop thru the pattern / action table, applying actions to matching product.
- * If no processing error occurs, then the global variable `palt_last_insertion`
- * is set.
+ * A product with a single feedtype bit only visits the entries indexed under
+ * that bit. If no processing error occurs, then the global variable
+ * `palt_last_insertion` is set.
  *
  * @param[in] prod_par   Data-product parameters
  * @param[in] queue_par  Product-queue parameters
@@ -1324,38 +2470,32 @@ processProduct(
         void* const restrict              opt_arg)
 {
     const prod_info* const infop = &prod_par->info;
-    void* const            datap = prod_par->data;
-    palt*                  next;
+    const pabucket* const  bucket = pi_bucket(paIndex, infop->feedtype);
     bool                   didMatch = false;
     bool                   errorOccurred = false;
 
     log_info_q("%s", s_prod_info(NULL, 0, infop, log_is_enabled_debug));
 
-    for (palt* pal = paList; pal != NULL; pal = next) {
-        next = pal->next;
-        /*
-         * If the feedtype matches AND ((the product ID matches the regular
-         * expression) OR (the pattern is "_ELSE_" AND nothing has been done to
-         * this product yet AND the first char of the ident isn't '_'))
-         */
-        if ((infop->feedtype & pal->feedtype) && (
-                (regexec(&pal->prog, infop->ident, pal->prog.re_nsub +1,
-                        pal->pmatchp, 0) == 0)
-                || (strcmp(pal->pattern, "^_ELSE_$") == 0
-                        && !didMatch && infop->ident[0] != '_'))) {
-            /* A match, do something */
-            didMatch = true;
-            product prod;
-            prod.info = *infop;
-            prod.data = (void*)datap; /* cast away const */
-            if (prodAction(&prod, pal, prod_par->encoded, prod_par->size)) {
-                log_flush_error();
-                if (pal->action.flags & LDM_ACT_TRANSIENT) {
-                    /* connection closed, don't try again */
-                    remove_palt(pal);
-                }
+    if (paFilter)
+        pf_scan(paFilter, infop->ident);
+
+    if (bucket) {
+        for (int i = 0; i < bucket->count; ) {
+            palt* const pal = bucket->entries[i];
+
+            if (processEntry(pal, prod_par, queue_par, &didMatch))
+                errorOccurred = true;
+            if (i < bucket->count && bucket->entries[i] == pal)
+                i++; // Otherwise, the entry was removed
+        }
+    }
+    else {
+        palt* next;
+
+        for (palt* pal = paList; pal != NULL; pal = next) {
+            next = pal->next;
+            if (processEntry(pal, prod_par, queue_par, &didMatch))
                 errorOccurred = true;
-            }
         }
     }
     if (didMatch)
@@ -1413,4 +2553,196 @@ dummyprod(char *ident)
         processProduct(&prod_par, &queue_par, &noError);
 #endif
 }
+
+
+#ifdef TEST_TMPL_EXPAND
+/*
+ * Compares tmpl_expand() with the separate substitution passes.
+ */
+
+int pipe_timeo = 60;    /* defined by pqact.c, which isn't linked */
+
+/*
+ * Expands the arguments of an entry by the separate passes, as prodAction()
+ * does when the arguments aren't compiled.
+ */
+static void
+passes_expand(
+        const palt* const       pal,
+        const prod_info* const  info,
+        char* const             buf,
+        const size_t            size)
+{
+    static char tmp[_POSIX_ARG_MAX];
+
+    regsub(pal, info->ident, tmp, sizeof(tmp));
+    tmp[sizeof(tmp)-1] = 0;
+    gm_strftime(buf, size, tmp, info->arrival.tv_sec);
+    buf[size-1] = 0;
+    date_sub(buf, tmp, info->arrival.tv_sec);
+    tmp[sizeof(tmp)-1] = 0;
+    seq_sub(tmp, buf, size, info->seqno);
+    buf[size-1] = 0;
+}
+
+/*
+ * Returns the entry for a pattern and arguments that are compiled into a
+ * template, with its subexpressions matched against an identifier.
+ */
+static palt*
+new_matched_palt(
+        const char* const       pattern,
+        const char* const       args,
+        const char* const       ident)
+{
+    char    line[512];
+
+    (void)snprintf(line, sizeof(line), "ANY\t%s\tFILE\t%s", pattern, args);
+    palt* const pal = new_palt_fromStr(line);
+    log_assert(pal != NULL);
+    log_assert(pal->tmpl != NULL);
+    log_assert(regexec(&pal->prog, ident, pal->prog.re_nsub+1, pal->pmatchp,
+            0) == 0);
+    return pal;
+}
+
+/*
+ * Verifies that tmpl_expand() falls back to the separate passes for an
+ * identifier that's only known at run-time.
+ */
+static void
+check_fallback(
+        const char* const       pattern,
+        const char* const       args,
+        const char* const       ident)
+{
+    static char buf[_POSIX_ARG_MAX];
+    palt* const pal = new_matched_palt(pattern, args, ident);
+    prod_info   info;
+
+    (void)memset(&info, 0, sizeof(info));
+    info.ident = (char*)ident;
+    info.arrival.tv_sec = 1193875200;   /* 2007-11-01 */
+    log_assert(!tmpl_expand(pal, &info, buf, sizeof(buf)));
+    free_palt(pal);
+}
+
+int
+main(
+        int   ac,
+        char* av[])
+{
+    static const char*  frags[] = {"a", "B", "/", " ", "(", ")", ":", "%",
+            "%Y", "%m", "%d", "%H", "%%", "%j", "%-d", "%E", "%5", "%Ey",
+            "(seq)", "(01:yyyy)", "(\\1:yy)", "(\\2:mmm)", "(45:dd)",
+            "(07:ddd)", "(00:hh)", "(\\1:zz)", "(31:mm)", "(12:YYYY)",
+            "(\\1:verylong)", "\\1", "\\2", "\\3", "&", "\\(1)",
+            "\\(12)", "\\(x", "\\\\", "\\&", "\\", "(s", "eq)",
+            "(01:", "yyyy)", "0", "1", "9", "seq", "(%d:yy)", "(\\1)",
+            "%(seq)", "(01:a(b)", "((01:yy)", "\\(2)", "%_3d", "%#b",
+            "(0\\1:yy)", "%\\1"};
+    static const char*  pats[] = {"(..)(.*)", "^([0-9]+) (.*)", "(.)(.)(.)",
+            "^(.*)$", "([A-Z]+)([0-9]*)", "(x)?(.*)", "^(..) ([^ ]*) (..)"};
+    static const char   alpha[] = "0123456789012345ABCxyz %()seq:/";
+    static char         args[512];
+    static char         ident[64];
+    static char         expanded[_POSIX_ARG_MAX];
+    static char         passed[_POSIX_ARG_MAX];
+    unsigned long       n = ac > 1 ? strtoul(av[1], NULL, 0) : 10000;
+    unsigned long       ncompared = 0;
+
+    (void)log_init(av[0]);
+
+    /* A subexpression that matches a '%', '(', or ')' */
+    check_fallback("^(.*)$", "/data/\\1", "a%Yb");
+    check_fallback("^(.*)$", "/data/\\1", "(seq)");
+    check_fallback("^(.*)$", "/data/\\1", "(01:yy)");
+    check_fallback("^(.)(.*)$", "/data/\\2", "a)");
+
+    /* A day-of-month subexpression that isn't two digits or is over 31 */
+    check_fallback("^([0-9]*) ", "(\\1:yyyy)", "7 x");
+    check_fallback("^([0-9]*) ", "(\\1:yyyy)", "123 x");
+    check_fallback("^(..) ", "(\\1:yyyy)", "1a x");
+    check_fallback("^([0-9]*) ", "(\\1:yyyy)", "45 x");
+
+    /* Output that overflows the buffer */
+    {
+        palt* const pal = new_matched_palt("^(.*)$",
+                "/data/%Y%m%d/\\1.(seq)", "ident");
+        prod_info   info;
+        size_t      size;
+
+        (void)memset(&info, 0, sizeof(info));
+        info.ident = "ident";
+        info.seqno = 12345;
+        info.arrival.tv_sec = 1193875200;
+        log_assert(tmpl_expand(pal, &info, expanded, sizeof(expanded)));
+        passes_expand(pal, &info, passed, sizeof(passed));
+        log_assert(strcmp(expanded, passed) == 0);
+        size = strlen(expanded);
+        log_assert(tmpl_expand(pal, &info, expanded, size+1));
+        for (size_t i = 1; i <= size; i++)
+            log_assert(!tmpl_expand(pal, &info, expanded, i));
+        free_palt(pal);
+    }
+
+    /*
+     * Whatever's expanded must be identical to the result of the passes, which
+     * log every invalid date indicator.
+     */
+    (void)log_set_level(LOG_LEVEL_FATAL);
+    srandom(42);
+    for (unsigned long i = 0; i < n; i++) {
+        const int   nfrags = 1 + random() % 8;
+        char        line[1024];
+
+        args[0] = 0;
+        for (int j = 0; j < nfrags; j++)
+            (void)strcat(args, frags[random() % ARRAYLEN(frags)]);
+        (void)snprintf(line, sizeof(line), "ANY\t%s\tFILE\t%s",
+                pats[random() % ARRAYLEN(pats)], args);
+
+        palt* const pal = new_palt_fromStr(line);
+        if (pal == NULL)
+            continue;
+
+        for (int k = 0; pal->tmpl != NULL && k < 20; k++) {
+            const int   len = 2 + random() % 10;
+            prod_info   info;
+
+            for (int j = 0; j < len; j++)
+                ident[j] = alpha[random() % (sizeof(alpha)-1)];
+            if (random() % 2) {
+                ident[0] = '0' + random() % 4;
+                ident[1] = '0' + random() % 10;
+            }
+            ident[len] = 0;
+            if (regexec(&pal->prog, ident, pal->prog.re_nsub+1, pal->pmatchp,
+                    0))
+                continue;
+
+            (void)memset(&info, 0, sizeof(info));
+            info.ident = ident;
+            info.seqno = random();
+            info.arrival.tv_sec = 946684800 + random() % 1000000000L;
+            if (!tmpl_expand(pal, &info, expanded, sizeof(expanded)))
+                continue;
+
+            passes_expand(pal, &info, passed, sizeof(passed));
+            if (strcmp(expanded, passed)) {
+                log_fatal("Mismatch: args=\"%s\", pattern=\"%s\", "
+                        "ident=\"%s\", arrival=%ld: passes=\"%s\", "
+                        "template=\"%s\"", pal->private, pal->pattern,
+                        ident, (long)info.arrival.tv_sec, passed, expanded);
+                exit(1);
+            }
+            ncompared++;
+        }
+        free_palt(pal);
+    }
+    log_assert(ncompared > 0);
+
+    exit(0);
+}
+#endif
 #endif
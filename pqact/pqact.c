@@ -51,6 +51,7 @@
 #include "timestamp.h"
 #include "log.h"
 #include "RegularExpressions.h"
+#include "worker.h"
 
 #ifdef NO_ATEXIT
 #include "atexit.h"
@@ -82,6 +83,13 @@ static key_t                 semkey;
 #endif /* !DEFAULT_PIPE_TIMEO */
 int pipe_timeo = DEFAULT_PIPE_TIMEO;
 
+/*
+ * Interval, in seconds, between logging the backlog of worker processes
+ */
+#ifndef WORKER_STATS_INTERVAL
+#define WORKER_STATS_INTERVAL 60
+#endif
+
 /**
  * Configures the standard I/O file descriptors for subsequent execution of
  * child processes. The standard input, output, and error file descriptors are
@@ -111,6 +119,14 @@ cleanup(void)
 {
     log_notice_q("Exiting");
 
+    /*
+     * Let the worker processes, if any, execute their queued actions so that
+     * the saved insertion-time doesn't skip any. The wait is bounded so that
+     * a stuck output can't prevent termination.
+     */
+    wrk_logStats(LOG_LEVEL_INFO);
+    wrk_stop();
+
     if (done) {
         /*
          * This function wasn't called by a signal handler, so these can be
@@ -121,6 +137,18 @@ cleanup(void)
         if (pq)
             (void)pq_close(pq);
 
+        /*
+         * Data-products whose jobs a worker didn't execute are processed
+         * again by the next session.
+         */
+        const timestampt unexecuted = wrk_getUnexecuted();
+        if (!tvIsNone(unexecuted) && (tvIsNone(palt_last_insertion) ||
+                tvCmp(unexecuted, palt_last_insertion, <))) {
+            log_notice("Processing will resume before the oldest product "
+                    "whose actions weren't all executed");
+            palt_last_insertion = unexecuted;
+        }
+
         if (tvIsNone(palt_last_insertion)) {
             log_notice("No product was processed");
         }
@@ -270,6 +298,8 @@ usage(
         log_error_q(
 "\t-o offset    Start with products arriving \"offset\" seconds before now (default: 0)");
         log_error_q(
+"\t-w workers   Execute actions in \"workers\" processes (default: 0)");
+        log_error_q(
 "\tconfig_file  Pathname of configuration-file (default: " "\"%s\")",
                 getPqactConfigPath());
         exit(EXIT_FAILURE);
@@ -288,6 +318,7 @@ main(int ac, char *av[])
         prod_class_t clss;
         int          toffset = TOFFSET_NONE;
         unsigned     queue_size = 5000;
+        unsigned     nworkers = 0;
         const char*  progname = basename(av[0]);
 
         /*
@@ -325,7 +356,7 @@ main(int ac, char *av[])
 
             opterr = 1;
 
-            while ((ch = getopt(ac, av, "vxel:d:f:q:o:p:i:t:")) != EOF) {
+            while ((ch = getopt(ac, av, "vxel:d:f:q:o:p:i:t:w:")) != EOF) {
                 switch (ch) {
                 case 'v':
                         if (!log_is_enabled_info)
@@ -391,6 +422,18 @@ main(int ac, char *av[])
                 case 'p':
                         spec.pattern = optarg;
                         break;
+                case 'w': {
+                        char* end;
+                        unsigned long n = strtoul(optarg, &end, 10);
+                        if (*end != 0 || n > 1024)
+                        {
+                                log_error_q("invalid number of workers %s",
+                                        optarg);
+                                usage(progname);
+                        }
+                        nworkers = n;
+                        break;
+                }
                 default:
                         usage(progname);
                         break;
@@ -629,6 +672,22 @@ main(int ac, char *av[])
          */
         dummyprod("_BEGIN_");
 
+        /*
+         * Only insertions of interest will end a wait on the product-queue.
+         */
+        pq_setWakeClass(pq, &clss);
+
+        /*
+         * Start the worker processes, if any. They inherit the data directory.
+         */
+        if (wrk_start(nworkers, pqfname)) {
+                log_add("Couldn't start worker processes");
+                log_flush_error();
+                exit(EXIT_FAILURE);
+                /*NOTREACHED*/
+        }
+        time_t statsTime = time(NULL);
+
 
         /*
          * Main loop
@@ -640,6 +699,12 @@ main(int ac, char *av[])
                 hupped = 0;
             }
 
+            /*
+             * Obtained before scanning so that an insertion during the scan
+             * isn't missed by pq_waitForNewer().
+             */
+            const unsigned insertSeq = pq_getInsertSeq(pq);
+
 #if 0
             status = pq_sequence(pq, TV_GT, &clss, processProduct,
                     &palt_processing_error);
@@ -661,6 +726,12 @@ main(int ac, char *av[])
                      * Perform a non-blocking sync on all open file descriptors.
                      */
                     fl_sync(FALSE);
+
+                    if (wrk_isActive() && log_is_enabled_info &&
+                            time(NULL) - statsTime >= WORKER_STATS_INTERVAL) {
+                        wrk_logStats(LOG_LEVEL_INFO);
+                        statsTime = time(NULL);
+                    }
                 }
                 else if (status == EAGAIN || status == EACCES) {
                     log_debug("Hit a lock");
@@ -689,7 +760,7 @@ main(int ac, char *av[])
                     /*NOTREACHED*/
                 }
 
-                (void)pq_suspend(interval);
+                (void)pq_waitForNewer(pq, insertSeq, interval);
             }                           /* No data-product processed */
 
             (void)exitIfDone(0);
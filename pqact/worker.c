@@ -0,0 +1,749 @@
+/*
+ *   Copyright 2026, University Corporation for Atmospheric Research
+ *   See ../COPYRIGHT file for copying and redistribution conditions.
+ */
+
+/*
+ * Pool of worker processes that execute the actions of pqact(1).
+ *
+ * The pqact(1) process matches data-products against the pattern/action
+ * entries and substitutes the arguments of the matching entries' actions. The
+ * resulting jobs -- the product's signature, the name of the action, and its
+ * arguments -- are written to a pipe of the worker that's responsible for the
+ * job's output. The output is identified like the "filel" module does (the
+ * pathname of a file, the command of a decoder), so it's always handled by the
+ * same worker and the products written to it stay in order. A worker obtains
+ * the product from its own, read-only handle of the product-queue.
+ *
+ * Processes are used rather than threads because the "filel" and "pbuf"
+ * modules keep their open outputs in a process-wide list and time-out writes
+ * to decoders with SIGALRM.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "action.h"
+#include "filel.h"
+#include "globals.h"
+#include "ldm.h"
+#include "ldmfork.h"
+#include "ldmprint.h"
+#include "log.h"
+#include "pq.h"
+#include "timestamp.h"
+#include "worker.h"
+
+/*
+ * Maximum size, in bytes, of the strings of a job: the name of the action
+ * followed by its arguments, each NUL-terminated.
+ */
+#define WRK_STRINGS_MAX (2*_POSIX_ARG_MAX)
+
+/*
+ * Capacity, in bytes, requested for a job pipe
+ */
+#define WRK_PIPE_SIZE (1024*1024)
+
+/*
+ * Interval, in seconds, between non-blocking syncs of an idle worker's
+ * outputs
+ */
+#define WRK_SYNC_INTERVAL 15
+
+/*
+ * Amount of time, in seconds, that a job may wait before the worker warns
+ * about it. Also the minimum interval between such warnings.
+ */
+#define WRK_LAG_WARN 60
+
+/*
+ * Amount of time, in seconds, that wrk_stop() lets the workers execute their
+ * queued jobs before it terminates them
+ */
+#define WRK_STOP_TIMEOUT 30
+
+/*
+ * Header of a job in a job pipe. Followed by `size` bytes of strings.
+ */
+typedef struct {
+    signaturet      signature;  /* of the data-product */
+    timestampt      inserted;   /* insertion-time of the data-product */
+    struct timeval  queued;     /* when the job was submitted */
+    uint32_t        argc;       /* number of action arguments */
+    uint32_t        size;       /* size of the strings in bytes */
+} JobHdr;
+
+/*
+ * Statistics of a worker. Written by the worker and read by pqact(1).
+ */
+typedef struct {
+    volatile uint64_t   done;       /* jobs executed */
+    volatile uint64_t   failed;     /* jobs whose action failed */
+    volatile uint64_t   missing;    /* jobs whose product left the queue */
+    volatile uint64_t   maxWait;    /* longest wait of a job in ms */
+    /*
+     * Insertion-time of the data-product of the job being (or last) executed
+     * or TS_NONE. Jobs are executed in order of submission; so, every job of
+     * an earlier data-product has been executed.
+     */
+    timestampt          begun;
+} WorkerStats;
+
+typedef struct {
+    pid_t           pid;        /* of the worker or 0 */
+    int             fd;         /* write end of the job pipe or -1 */
+    uint64_t        submitted;  /* jobs submitted */
+    timestampt      first;      /* insertion-time of first job or TS_NONE */
+} Worker;
+
+/*
+ * Job being executed by a worker
+ */
+typedef struct {
+    const actiont*  action;
+    int             argc;
+    char**          argv;
+    bool            failed;
+} Job;
+
+static Worker*          workers = NULL;
+static WorkerStats*     stats = NULL;   /* shared with the workers */
+static unsigned         nworkers = 0;
+static const char*      queuePath = NULL;
+/*
+ * Insertion-time before which every job that a worker didn't execute (because
+ * it terminated) was submitted or TS_NONE
+ */
+static timestampt       unexecuted = {-1, -1}; /* TS_NONE */
+
+
+/*
+ * Writes a buffer to the non-blocking write end of a job pipe, resuming after
+ * interruptions and partial writes. While the pipe is full, waits for the
+ * worker unless termination has been requested so that a worker that's stuck
+ * on its output can't keep pqact(1) from terminating. Returns 0 or an `errno`
+ * error-code.
+ */
+static int
+wrk_write(
+    const int           fd,
+    const void*         buf,
+    size_t              nbytes)
+{
+    const char* cp = buf;
+
+    while (nbytes > 0) {
+        const ssize_t nwrote = write(fd, cp, nbytes);
+
+        if (nwrote == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                return errno;
+            if (done)
+                return ECANCELED;
+
+            struct pollfd pfd;
+
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            (void)poll(&pfd, 1, 1000);
+            continue;
+        }
+        cp += nwrote;
+        nbytes -= nwrote;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Reads a buffer from a file-descriptor, resuming after interruptions and
+ * partial reads. Returns 1 on success, 0 on end-of-file before any byte, and
+ * -1 on failure.
+ */
+static int
+wrk_read(
+    const int           fd,
+    void*               buf,
+    const size_t        nbytes)
+{
+    char*   cp = buf;
+    size_t  nread = 0;
+
+    while (nread < nbytes) {
+        const ssize_t n = read(fd, cp + nread, nbytes - nread);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            log_add_syserr("Couldn't read job pipe");
+            return -1;
+        }
+        if (n == 0) {
+            if (nread == 0)
+                return 0;
+            log_add("Job pipe closed in the middle of a job");
+            return -1;
+        }
+        nread += n;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Applies the action of a job to a data-product. Called by
+ * pq_processProduct().
+ */
+static int
+wrk_apply(
+    const prod_info* const      info,
+    const void* const           data,
+    void* const                 xprod,
+    const size_t                size,
+    void* const                 arg)
+{
+    Job* const  job = (Job*)arg;
+    product     prod;
+
+    prod.info = *info;
+    prod.data = (void*)data; /* cast away const */
+
+    if ((*job->action->prod_action)(&prod, job->argc, job->argv, xprod,
+            size)) {
+        log_add("Couldn't process product: feedtype=%s, action=%s",
+                s_feedtypet(info->feedtype), job->action->name);
+        log_flush_error();
+        job->failed = true;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Executes a job read from the job pipe.
+ */
+static void
+wrk_execute(
+    const unsigned      index,
+    const JobHdr* const hdr,
+    char* const         strings)
+{
+    static char*        argv[1 + _POSIX_ARG_MAX/2];
+    static time_t       lastWarning;
+    WorkerStats* const  ws = stats + index;
+    char*               cp = strings + strlen(strings) + 1;
+    actiont             action;
+    struct timeval      now;
+
+    (void)gettimeofday(&now, NULL);
+    long long waited = (now.tv_sec - hdr->queued.tv_sec) * 1000LL +
+            (now.tv_usec - hdr->queued.tv_usec) / 1000;
+    if (waited < 0)
+        waited = 0; /* system clock was set back */
+    if (waited > ws->maxWait)
+        ws->maxWait = waited;
+    ws->begun = hdr->inserted;
+
+    if (hdr->argc >= sizeof(argv)/sizeof(argv[0]) ||
+            atoaction(strings, &action)) {
+        log_error_q("Invalid job: action=\"%s\", argc=%lu", strings,
+                (unsigned long)hdr->argc);
+        __sync_fetch_and_add(&ws->failed, 1);
+    }
+    else {
+        Job job = {&action, (int)hdr->argc, argv, false};
+
+        for (int i = 0; i < job.argc; i++) {
+            argv[i] = cp;
+            cp += strlen(cp) + 1;
+        }
+        argv[job.argc] = NULL;
+
+        if (waited >= WRK_LAG_WARN*1000 &&
+                now.tv_sec - lastWarning >= WRK_LAG_WARN) {
+            log_warning_q("Worker %u is %lu s behind on output \"%s\"",
+                    index, (unsigned long)(waited / 1000),
+                    job.argc ? argv[job.argc-1] : action.name);
+            lastWarning = now.tv_sec;
+        }
+
+        int status = pq_processProduct(pq, hdr->signature, wrk_apply, &job);
+
+        if (status == PQ_NOTFOUND) {
+            char buf[2*sizeof(signaturet)+1];
+            log_warning_q("Data-product %s left the product-queue before "
+                    "action %s could be executed",
+                    s_signaturet(buf, sizeof(buf), hdr->signature),
+                    action.name);
+            __sync_fetch_and_add(&ws->missing, 1);
+        }
+        else if (status || job.failed) {
+            log_flush_error();
+            __sync_fetch_and_add(&ws->failed, 1);
+        }
+    }
+
+    __sync_fetch_and_add(&ws->done, 1);
+}
+
+
+/*
+ * Terminates a worker if pqact(1) sent the signal. Other senders (e.g., the
+ * LDM server signaling its process-group) are ignored so that the queued jobs
+ * are executed.
+ */
+static void
+wrk_terminate(
+    const int           sig,
+    siginfo_t* const    info,
+    void* const         context)
+{
+    if (info != NULL && info->si_pid == getppid())
+        _exit(EXIT_FAILURE);
+}
+
+
+/*
+ * Executes jobs from a job pipe until the pipe is closed. Runs in the worker
+ * process and doesn't return.
+ */
+static void
+wrk_run(
+    const unsigned      index,
+    const int           fd)
+{
+    static char         strings[WRK_STRINGS_MAX];
+    struct sigaction    sigact;
+    int                 status;
+
+    /*
+     * The worker stops when pqact(1) closes the job pipe so that the queued
+     * jobs are executed. Only pqact(1) may terminate it sooner (see
+     * wrk_stop()).
+     */
+    (void)sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = 0;
+    sigact.sa_handler = SIG_IGN;
+    (void)sigaction(SIGINT, &sigact, NULL);
+    (void)sigaction(SIGHUP, &sigact, NULL);
+    sigact.sa_flags = SA_SIGINFO;
+    sigact.sa_sigaction = wrk_terminate;
+    (void)sigaction(SIGTERM, &sigact, NULL);
+
+    (void)pq_close(pq);
+    pq = NULL;
+    status = pq_open(queuePath, PQ_READONLY, &pq);
+    if (status) {
+        log_error_q("Worker %u couldn't open product-queue \"%s\": %s", index,
+                queuePath, status > 0 ? strerror(status) : "invalid");
+        _exit(EXIT_FAILURE);
+    }
+    log_info_q("Worker %u started", index);
+
+    for (;;) {
+        struct pollfd   pfd;
+        JobHdr          hdr;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        status = poll(&pfd, 1, WRK_SYNC_INTERVAL*1000);
+        if (status == -1) {
+            if (errno != EINTR) {
+                log_syserr("Worker %u couldn't poll job pipe", index);
+                break;
+            }
+        }
+        else if (status == 0) {
+            fl_sync(false);
+        }
+        else {
+            status = wrk_read(fd, &hdr, sizeof(hdr));
+            if (status == 1) {
+                if (hdr.size == 0 || hdr.size > sizeof(strings)) {
+                    log_add("Invalid job size: %lu",
+                            (unsigned long)hdr.size);
+                    status = -1;
+                }
+                else {
+                    status = wrk_read(fd, strings, hdr.size);
+                }
+            }
+            if (status != 1) {
+                if (status)
+                    log_flush_error();
+                break;
+            }
+            strings[hdr.size-1] = 0;
+            wrk_execute(index, &hdr, strings);
+        }
+
+        while (reap(-1, WNOHANG) > 0)
+            /*EMPTY*/;
+    }
+
+    fl_closeAll();
+    while (reap(-1, WNOHANG) > 0)
+        /*EMPTY*/;
+    (void)pq_close(pq);
+    log_info_q("Worker %u stopped", index);
+    log_fini();
+    _exit(status == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+/*
+ * Starts (or restarts) a worker process.
+ *
+ * Returns:
+ *      0       Success
+ *      -1      Failure. log_add() called.
+ */
+static int
+wrk_spawn(
+    const unsigned      index)
+{
+    int     fds[2];
+    pid_t   pid;
+
+    if (pipe(fds)) {
+        log_add_syserr("Couldn't create job pipe for worker %u", index);
+        return -1;
+    }
+#ifdef F_SETPIPE_SZ
+    (void)fcntl(fds[1], F_SETPIPE_SZ, WRK_PIPE_SIZE);
+#endif
+    /* Decoders mustn't keep a job pipe open */
+    if (ensure_close_on_exec(fds[0]) || ensure_close_on_exec(fds[1])) {
+        (void)close(fds[0]);
+        (void)close(fds[1]);
+        return -1;
+    }
+    /* See wrk_write() */
+    if (fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK) == -1) {
+        log_add_syserr("Couldn't make job pipe of worker %u non-blocking",
+                index);
+        (void)close(fds[0]);
+        (void)close(fds[1]);
+        return -1;
+    }
+
+    workers[index].submitted = 0;
+    workers[index].first = TS_NONE;
+    stats[index].done = 0;
+    stats[index].begun = TS_NONE;
+
+    pid = ldmfork();
+    if (pid == -1) {
+        log_add("Couldn't start worker %u", index);
+        (void)close(fds[0]);
+        (void)close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        /* Only pqact(1) may keep a job pipe open for writing */
+        (void)close(fds[1]);
+        for (unsigned i = 0; i < nworkers; i++)
+            if (workers[i].fd >= 0)
+                (void)close(workers[i].fd);
+        wrk_run(index, fds[0]);
+        /*NOTREACHED*/
+    }
+
+    (void)close(fds[0]);
+    workers[index].pid = pid;
+    workers[index].fd = fds[1];
+
+    return 0;
+}
+
+
+/*
+ * Accounts for the jobs that a terminated worker didn't execute so that
+ * wrk_getUnexecuted() returns a time before the oldest of them. Returns the
+ * number of such jobs.
+ */
+static uint64_t
+wrk_account(
+    const unsigned      index)
+{
+    const Worker* const worker = workers + index;
+    const uint64_t      nlost = worker->submitted - stats[index].done;
+
+    if (nlost > 0) {
+        /* The job being executed when the worker terminated is included */
+        timestampt before = tvIsNone(stats[index].begun)
+                ? worker->first
+                : stats[index].begun;
+
+        timestamp_decr(&before);
+        if (tvIsNone(unexecuted) || tvCmp(before, unexecuted, <))
+            unexecuted = before;
+    }
+
+    return nlost;
+}
+
+
+/*
+ * Returns the index of the worker responsible for the output of an action.
+ * Outputs are identified like the "filel" module does: a file by its pathname
+ * and a decoder by its command-line.
+ */
+static unsigned
+wrk_select(
+    const actiont* const    action,
+    const int               argc,
+    char* const* const      argv)
+{
+    uint32_t    hash = 2166136261u;     /* FNV-1a */
+    int         first = 0;
+
+    if (argc <= 0 || strcmp(action->name, "dbfile") == 0)
+        return 0;
+    if (strcmp(action->name, "file") == 0 ||
+            strcmp(action->name, "stdiofile") == 0)
+        first = argc - 1;
+
+    for (int i = first; i < argc; i++) {
+        for (const unsigned char* cp = (const unsigned char*)argv[i]; *cp;
+                cp++)
+            hash = (hash ^ *cp) * 16777619u;
+        hash = (hash ^ ' ') * 16777619u;
+    }
+
+    return hash % nworkers;
+}
+
+
+int
+wrk_start(
+    const unsigned          count,
+    const char* const       pqPath)
+{
+    if (count == 0)
+        return 0;
+
+    /* Shared by the workers. "/dev/zero" because MAP_ANONYMOUS isn't POSIX */
+    const int zeroFd = open("/dev/zero", O_RDWR);
+
+    workers = calloc(count, sizeof(Worker));
+    stats = zeroFd == -1
+            ? MAP_FAILED
+            : mmap(NULL, count*sizeof(WorkerStats), PROT_READ|PROT_WRITE,
+                    MAP_SHARED, zeroFd, 0);
+    if (zeroFd != -1)
+        (void)close(zeroFd);
+    if (workers == NULL || stats == MAP_FAILED) {
+        log_add_syserr("Couldn't allocate %u workers", count);
+        free(workers);
+        workers = NULL;
+        if (stats != MAP_FAILED)
+            (void)munmap(stats, count*sizeof(WorkerStats));
+        stats = NULL;
+        return -1;
+    }
+    (void)memset(stats, 0, count*sizeof(WorkerStats));
+
+    queuePath = pqPath;
+    nworkers = count;
+    for (unsigned i = 0; i < count; i++)
+        workers[i].fd = -1;
+
+    for (unsigned i = 0; i < count; i++) {
+        if (wrk_spawn(i)) {
+            wrk_stop();
+            return -1;
+        }
+    }
+    log_notice_q("Started %u worker processes", count);
+
+    return 0;
+}
+
+
+bool
+wrk_isActive(void)
+{
+    return nworkers > 0;
+}
+
+
+int
+wrk_submit(
+    const prod_info* const      info,
+    const timestampt* const     inserted,
+    const actiont* const        action,
+    const int                   argc,
+    char* const* const          argv)
+{
+    static char     buf[sizeof(JobHdr) + WRK_STRINGS_MAX];
+    JobHdr* const   hdr = (JobHdr*)buf;
+    char*           cp = buf + sizeof(JobHdr);
+    char* const     end = buf + sizeof(buf);
+
+    if (strcmp(action->name, "noop") == 0)
+        return 0;
+
+    for (int i = -1; i < argc; i++) {
+        const char*  str = i < 0 ? action->name : argv[i];
+        const size_t len = strlen(str) + 1;
+
+        if (len > (size_t)(end - cp)) {
+            log_add("Arguments of action %s are too long", action->name);
+            return -1;
+        }
+        (void)memcpy(cp, str, len);
+        cp += len;
+    }
+
+    (void)memcpy(hdr->signature, info->signature, sizeof(signaturet));
+    hdr->inserted = *inserted;
+    (void)gettimeofday(&hdr->queued, NULL);
+    hdr->argc = argc;
+    hdr->size = cp - buf - sizeof(JobHdr);
+
+    const unsigned  index = wrk_select(action, argc, argv);
+    Worker* const   worker = workers + index;
+    int             status = worker->fd < 0
+            ? EPIPE
+            : wrk_write(worker->fd, buf, cp - buf);
+
+    if (status == EPIPE) {
+        /* The worker terminated. Its queued jobs are lost. */
+        if (worker->fd >= 0)
+            (void)close(worker->fd);
+        worker->fd = -1;
+        (void)waitpid(worker->pid, NULL, WNOHANG);
+
+        const uint64_t nlost = wrk_account(index);
+
+        log_warning_q("Worker %u terminated. %llu unexecuted jobs are lost. "
+                "Restarting it.", index, (unsigned long long)nlost);
+        status = wrk_spawn(index)
+                ? EPIPE
+                : wrk_write(worker->fd, buf, cp - buf);
+    }
+    if (status) {
+        log_add_errno(status, "Couldn't submit job to worker %u", index);
+        return -1;
+    }
+
+    if (worker->submitted++ == 0)
+        worker->first = *inserted;
+
+    return 0;
+}
+
+
+void
+wrk_logStats(
+    const log_level_t   level)
+{
+    for (unsigned i = 0; i < nworkers; i++) {
+        const WorkerStats* const ws = stats + i;
+        const uint64_t           done = ws->done;
+
+        log_log(level, "Worker %u (pid %ld): %llu queued, %llu done, "
+                "%llu failed, %llu missed, max wait %.3f s", i,
+                (long)workers[i].pid,
+                (unsigned long long)(workers[i].submitted - done),
+                (unsigned long long)done, (unsigned long long)ws->failed,
+                (unsigned long long)ws->missing, ws->maxWait / 1e3);
+    }
+}
+
+
+void
+wrk_stop(void)
+{
+    struct timespec deadline;
+    unsigned        nrunning = 0;
+
+    /* Closing the job pipes makes the workers stop after their last job */
+    for (unsigned i = 0; i < nworkers; i++) {
+        if (workers[i].fd >= 0) {
+            (void)close(workers[i].fd);
+            workers[i].fd = -1;
+        }
+        if (workers[i].pid > 0)
+            nrunning++;
+    }
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += WRK_STOP_TIMEOUT;
+
+    while (nrunning > 0) {
+        struct timespec now;
+
+        nrunning = 0;
+        for (unsigned i = 0; i < nworkers; i++) {
+            if (workers[i].pid > 0) {
+                const pid_t wpid = waitpid(workers[i].pid, NULL, WNOHANG);
+
+                if (wpid == 0 || (wpid == -1 && errno == EINTR)) {
+                    nrunning++;
+                }
+                else {
+                    workers[i].pid = 0;
+                }
+            }
+        }
+        (void)clock_gettime(CLOCK_MONOTONIC, &now);
+        if (nrunning == 0 || now.tv_sec > deadline.tv_sec ||
+                (now.tv_sec == deadline.tv_sec &&
+                 now.tv_nsec >= deadline.tv_nsec))
+            break;
+
+        const struct timespec pause = {0, 100000000}; /* 0.1 s */
+        (void)nanosleep(&pause, NULL);
+    }
+
+    /* Workers that are still busy (e.g., on a stuck output) are terminated */
+    for (unsigned i = 0; i < nworkers; i++) {
+        if (workers[i].pid > 0) {
+            const uint64_t done = stats[i].done;
+
+            log_warning_q("Worker %u (pid %ld) didn't finish within %d s. "
+                    "Terminating it. %llu unexecuted jobs are dropped.", i,
+                    (long)workers[i].pid, WRK_STOP_TIMEOUT,
+                    (unsigned long long)(workers[i].submitted - done));
+            (void)kill(workers[i].pid, SIGTERM);
+            while (waitpid(workers[i].pid, NULL, 0) == -1 && errno == EINTR)
+                /*EMPTY*/;
+            workers[i].pid = 0;
+        }
+        /* Includes workers that exited early */
+        (void)wrk_account(i);
+    }
+    nworkers = 0;
+}
+
+
+timestampt
+wrk_getUnexecuted(void)
+{
+    return unexecuted;
+}
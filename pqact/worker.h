@@ -0,0 +1,106 @@
+/*
+ *   Copyright 2026, University Corporation for Atmospheric Research
+ *   See ../COPYRIGHT file for copying and redistribution conditions.
+ */
+
+/*
+ * Pool of worker processes that execute the actions of pqact(1) so that a
+ * slow output doesn't stall the others. Every output (file, pipe decoder,
+ * etc.) is always handled by the same worker, so the products written to it
+ * stay in order.
+ */
+
+#ifndef WORKER_H_INCLUDED
+#define WORKER_H_INCLUDED
+
+#include <stdbool.h>
+
+#include "ldm.h"
+#include "action.h"
+#include "log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Starts the worker processes. Each opens the product-queue read-only.
+ *
+ * @param[in] count   Number of worker processes. 0 means the actions will be
+ *                    executed by the calling process.
+ * @param[in] pqPath  Pathname of the product-queue.
+ * @retval    0       Success
+ * @retval    -1      Failure. log_add() called.
+ */
+int
+wrk_start(
+    unsigned                    count,
+    const char* const           pqPath);
+
+/**
+ * Indicates whether or not actions are executed by worker processes.
+ *
+ * @retval true   Actions are executed by worker processes
+ * @retval false  Actions are executed by the calling process
+ */
+bool
+wrk_isActive(void);
+
+/**
+ * Queues an action on a data-product for execution by the worker responsible
+ * for the action's output. The data-product must be in the product-queue: the
+ * worker obtains it by its signature.
+ *
+ * @param[in] info      Metadata of the data-product
+ * @param[in] inserted  Insertion-time of the data-product in the
+ *                      product-queue
+ * @param[in] action    The action
+ * @param[in] argc      Number of arguments of the action
+ * @param[in] argv      Arguments of the action
+ * @retval    0         Success
+ * @retval    -1        Failure. log_add() called.
+ */
+int
+wrk_submit(
+    const prod_info* const      info,
+    const timestampt* const     inserted,
+    const actiont* const        action,
+    const int                   argc,
+    char* const* const          argv);
+
+/**
+ * Logs the backlog of every worker.
+ *
+ * @param[in] level  Logging level
+ */
+void
+wrk_logStats(
+    const log_level_t           level);
+
+/**
+ * Stops the worker processes after they've executed all queued actions. A
+ * worker that hasn't finished within a time-limit (e.g., because its output is
+ * stuck) is terminated and the number of its dropped actions is logged. Safe
+ * to call from a signal handler and if wrk_start() wasn't called.
+ */
+void
+wrk_stop(void);
+
+/**
+ * Returns the insertion-time before which every data-product was completely
+ * processed by the workers. Only meaningful after wrk_stop(). Jobs that a
+ * worker didn't execute -- because it terminated or was terminated by
+ * wrk_stop() -- must be done again by the next invocation of pqact(1).
+ *
+ * @retval TS_NONE  Every submitted job was executed
+ * @return          Insertion-time from which processing should resume (i.e.,
+ *                  one that precedes that of the oldest unexecuted job)
+ */
+timestampt
+wrk_getUnexecuted(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -56,6 +56,8 @@ usage(const char *av0) /*  id string */
         (void)fprintf(stderr,
 "\t-v           Verbose\n");
         (void)fprintf(stderr,
+"\t-s           Also scan the indexes for consistency\n");
+        (void)fprintf(stderr,
 "\t-l dest      Log to `dest`. One of: \"\" (system logging daemon), \"-\"\n"
 "\t             (standard error), or file `dest`. Default is \"%s\"\n",
                 log_get_default_destination());
@@ -94,6 +96,57 @@ set_sigactions(void)
 }
 
 
+/*
+ * Scans the indexes of a product-queue for consistency. The product-queue
+ * isn't locked during the scan (see pq_scan()).
+ *
+ * Returns:
+ *      0       The indexes are consistent.
+ *      1       System failure.  See error-message.
+ *      4       The product-queue is internally inconsistent.
+ */
+static int
+scan(const char* const path)
+{
+        pqueue*       pq;
+        pq_scan_stats stats;
+        int           status = pq_open(path, PQ_READONLY, &pq);
+
+        if (status) {
+                if (PQ_CORRUPT == status) {
+                    log_error_q("Product-queue \"%s\" is inconsistent", path);
+                    return 4;
+                }
+                log_error_q("pq_open() failure: %s: %s", path,
+                        strerror(status));
+                return 1;
+        }
+
+        status = pq_scan(pq, 0, &stats);
+        (void)pq_close(pq);
+        if (status) {
+                log_error_q("pq_scan() failure: %s: %s", path,
+                        strerror(status));
+                return 1;
+        }
+
+        log_info_q("Scanned %lu products in %u thread(s)",
+                (unsigned long)stats.nprods, stats.nthreads);
+        if (!stats.countsAgree || stats.badTimes || stats.badRegions ||
+                stats.badSigs) {
+                log_error_q("Product-queue \"%s\" is inconsistent: "
+                        "countsAgree=%d, badTimes=%lu, badRegions=%lu, "
+                        "badSigs=%lu", path, stats.countsAgree,
+                        (unsigned long)stats.badTimes,
+                        (unsigned long)stats.badRegions,
+                        (unsigned long)stats.badSigs);
+                return 4;
+        }
+
+        return 0;
+}
+
+
 /*
  * Returns:
  *      0       Success.  Write-count of product-queue is zero.
@@ -102,7 +155,8 @@ set_sigactions(void)
  *              if "-F" option used.
  *      3       Write-count of product-queue is greater than zero.  Not possible
  *              if "-F" option used.
- *      4       The product-queue is internally inconsistent.
+ *      4       The product-queue is internally inconsistent (possibly
+ *              detected by the "-s" option).
  */
 int main(int ac, char *av[])
 {
@@ -110,6 +164,7 @@ int main(int ac, char *av[])
         int status = 0;
         unsigned write_count;
         int force = 0;
+        int scanIndexes = 0;
 
         /*
          * Set up error logging.
@@ -127,11 +182,14 @@ int main(int ac, char *av[])
             pqfname = getQueuePath();
             opterr = 1;
 
-            while ((ch = getopt(ac, av, "Fvxl:q:")) != EOF)
+            while ((ch = getopt(ac, av, "Fsvxl:q:")) != EOF)
                     switch (ch) {
                     case 'F':
                             force = 1;
                             break;
+                    case 's':
+                            scanIndexes = 1;
+                            break;
                     case 'v':
                             if (!log_is_enabled_info)
                                 (void)log_set_level(LOG_LEVEL_INFO);
@@ -216,5 +274,11 @@ int main(int ac, char *av[])
 
         log_info_q("The writer-counter of the product-queue is %u", write_count);
 
+        if (scanIndexes) {
+            status = scan(pqfname);
+            if (status)
+                return status;
+        }
+
         return write_count == 0 ? 0 : 3;
 }
@@ -33,10 +33,15 @@ Options:\n\
         -v           Verbose logging\n\
         -c           Clobber existing product-queue if it exists\n\
         -f           Fast creation. Won't fill-in file blocks.\n\
+        -H           Back the memory-mapping with huge pages\n\
+        -I           Interleave the memory-mapping across NUMA nodes\n\
         -l dest      Log to `dest`. One of: \"\" (system logging daemon),\n\
                      \"-\" (standard error), or file `dest`. Default is\n\
                      \"%s\"\n\
         -S nproducts Maximum number of product to hold\n\
+        -t           Add a time-ring index for faster cursor positioning\n\
+        -z           Store data-products compressed when that saves space\n\
+        -n nshards   Number of independently-locked shards. Default is 1.\n\
         -s byteSize  Maximum number of bytes to hold\n\
        (default pqfname is \"%s\")\n\
 "
@@ -55,6 +60,7 @@ int main(int ac, char *av[])
         int pflags = PQ_NOCLOBBER;
         off_t initialsz = 0;
         size_t nproducts = 0;
+        unsigned nshards = 1;
         pqueue *pq = NULL;
         int errnum = 0;
 
@@ -73,7 +79,7 @@ int main(int ac, char *av[])
         extern char     *optarg;
         extern int       optind;
 
-        while ((ch = getopt(ac, av, "xvcfq:s:S:l:")) != EOF)
+        while ((ch = getopt(ac, av, "xvcfHItzn:q:s:S:l:")) != EOF)
                 switch (ch) {
                 case 'v':
                         if (!log_is_enabled_info)
@@ -85,6 +91,30 @@ int main(int ac, char *av[])
                 case 'f':
                         pflags |= PQ_SPARSE;
                         break;
+                case 'H':
+                        pflags |= PQ_HUGEPAGES;
+                        break;
+                case 'I':
+                        pflags |= PQ_INTERLEAVE;
+                        break;
+                case 't':
+                        pflags |= PQ_TIMERING;
+                        break;
+                case 'z':
+                        pflags |= PQ_COMPRESS;
+                        break;
+                case 'n': {
+                        char *end;
+                        const unsigned long n = strtoul(optarg, &end, 0);
+                        if(*end != 0 || n == 0 || n > PQ_MAX_SHARDS)
+                        {
+                                fprintf(stderr, "Illegal nshards \"%s\"\n",
+                                        optarg);
+                                usage(av[0]);
+                        }
+                        nshards = (unsigned)n;
+                        break;
+                }
                 case 's':
                         sopt = optarg;
                         break;
@@ -196,13 +226,14 @@ int main(int ac, char *av[])
         }
 
 
-        log_info_q("Creating %s, %ld bytes, %ld products.\n",
-                pqfname, (long)initialsz, (long)nproducts);
+        log_info_q("Creating %s, %ld bytes, %ld products, %u shard(s).\n",
+                pqfname, (long)initialsz, (long)nproducts, nshards);
 
-        errnum = pq_create(pqfname, 0666, pflags,
-                0, initialsz, nproducts, &pq);
+        errnum = pq_createSharded(pqfname, 0666, pflags,
+                0, initialsz, nproducts, nshards, &pq);
         if(errnum)
         {
+                log_flush_error();
                 fprintf(stderr, "%s: create \"%s\" failed: %s\n",
                         av[0], pqfname, strerror(errnum));
                 exit(1);
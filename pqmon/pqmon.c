@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <rpc/rpc.h>
 #include <signal.h>
 #include <unistd.h>
@@ -65,6 +66,12 @@ usage(const char *av0) /*  id string */
         (void)fprintf(stderr,
 "\t             (\"interval\" of 0 means exit at end of queue)\n");
         (void)fprintf(stderr,
+"\t-f           Also report products by feedtype and age\n");
+        (void)fprintf(stderr,
+"\t-t           Also report the activity of writers per second\n");
+        (void)fprintf(stderr,
+"\t-r           Also report registered readers, slowest first\n");
+        (void)fprintf(stderr,
 "Output defaults to standard output\n");
         exit(1);
 }
@@ -220,6 +227,148 @@ xsuspend(unsigned int maxsleep)
 
 
 
+/*
+ * Logs the products of a product-queue by feedtype and by age. The indexes
+ * are scanned without holding the product-queue's lock (see pq_scan()).
+ *
+ * Returns:
+ *      0       Success
+ *      else    <errno.h> error-code. Error-message logged.
+ */
+static int
+logFeeds(pqueue* const pq)
+{
+        pq_scan_stats stats;
+        int           status = pq_scan(pq, 0, &stats);
+
+        if (status)
+                return status;
+
+        log_notice_q("feedtype     nprods      nbytes  ages: <1s <2s <4s ...");
+        for (int i = 0; i <= PQ_SCAN_NFEEDS; i++) {
+                const pq_feed_stats* const feed = i < PQ_SCAN_NFEEDS
+                        ? stats.feeds + i
+                        : &stats.unknown;
+                char                       ages[PQ_SCAN_NAGES*21];
+                int                        nages = PQ_SCAN_NAGES;
+                size_t                     len = 0;
+
+                if (feed->nprods == 0)
+                        continue;
+                while (nages > 1 && feed->ages[nages-1] == 0)
+                        nages--;
+                for (int j = 0; j < nages; j++)
+                        len += snprintf(ages + len, sizeof(ages) - len, " %llu",
+                                (unsigned long long)feed->ages[j]);
+                log_notice_q("%-10s %8llu %11llu %s",
+                        i < PQ_SCAN_NFEEDS
+                                ? s_feedtypet((feedtypet)1 << i)
+                                : "unknown",
+                        (unsigned long long)feed->nprods,
+                        (unsigned long long)feed->nbytes, ages);
+        }
+
+        return 0;
+}
+
+
+/*
+ * Logs the activity of the writers of a product-queue during each complete
+ * second since the last call. The product-queue isn't locked (see
+ * pq_getTelemetry()).
+ *
+ * Arguments:
+ *      pq      The product-queue
+ *      last    The last second that was logged. Set on return.
+ * Returns:
+ *      0       Success
+ *      else    <errno.h> error-code.
+ */
+static int
+logTelemetry(
+        pqueue* const  pq,
+        int64_t* const last)
+{
+        pq_telemetry slots[PQ_TELEMETRY_SIZE];
+        unsigned     nslots;
+        int          status = pq_getTelemetry(pq, slots, &nslots);
+
+        if (status)
+                return status;
+
+        const int64_t now = time(NULL);
+        bool          logged = false;
+
+        for (unsigned i = 0; i < nslots; i++) {
+                const pq_telemetry* const slot = slots + i;
+
+                if (slot->second <= *last || slot->second >= now)
+                        continue;   /* already logged or incomplete */
+                if (!logged) {
+                        log_notice_q("second   ninsert    insbytes nevict  "
+                                "evictbytes minres  nlocks avgwait maxwait");
+                        logged = true;
+                }
+
+                const time_t second = (time_t)slot->second;
+                struct tm    tm;
+                char         hms[9];
+
+                (void)strftime(hms, sizeof(hms), "%H:%M:%S",
+                        gmtime_r(&second, &tm));
+                log_notice_q("%s %7lu %11llu %6lu %11llu %6.1f %7lu %7lu %7lu",
+                        hms, (unsigned long)slot->ninserted,
+                        (unsigned long long)slot->insertedBytes,
+                        (unsigned long)slot->nevicted,
+                        (unsigned long long)slot->evictedBytes,
+                        slot->minResidenceMs/1000.0,
+                        (unsigned long)slot->nlocks,
+                        slot->nlocks
+                                ? (unsigned long)(slot->lockWaitUs/slot->nlocks)
+                                : 0ul,
+                        (unsigned long)slot->maxLockWaitUs);
+                *last = slot->second;
+        }
+
+        return 0;
+}
+
+
+/*
+ * Logs the registered readers of a product-queue, slowest first. The
+ * product-queue isn't locked (see pq_getReaders()).
+ *
+ * Returns:
+ *      0       Success
+ *      else    <errno.h> error-code.
+ */
+static int
+logReaders(pqueue* const pq)
+{
+        pq_reader readers[PQ_MAX_READERS];
+        unsigned  nreaders;
+        int       status = pq_getReaders(pq, readers, &nreaders);
+
+        if (status)
+                return status;
+
+        log_notice_q("reader       lag  nmissed");
+        for (unsigned i = 0; i < nreaders; i++) {
+                if (readers[i].lag < 0) {
+                        log_notice_q("%6ld         ? %8lu", (long)readers[i].pid,
+                                (unsigned long)readers[i].nmissed);
+                }
+                else {
+                        log_notice_q("%6ld %9.1f %8lu", (long)readers[i].pid,
+                                readers[i].lag,
+                                (unsigned long)readers[i].nmissed);
+                }
+        }
+
+        return 0;
+}
+
+
 int
 main(int ac, char *av[])
 {
@@ -229,6 +378,10 @@ main(int ac, char *av[])
     int         interval = DEFAULT_INTERVAL;
     int         list_extents = 0;
     int         extended = 0;
+    int         feeds = 0;
+    int         telemetry = 0;
+    int         readers = 0;
+    int64_t     lastSecond = 0;
 
     /*
      * Set up default logging before calling anything that might log.
@@ -246,7 +399,7 @@ main(int ac, char *av[])
 
         opterr = 1;
 
-        while ((ch = getopt(ac, av, "Sevxl:q:o:i:")) != EOF)
+        while ((ch = getopt(ac, av, "Sefrvtxl:q:o:i:")) != EOF)
             switch (ch) {
             case 'v':
                 if (!log_is_enabled_info)
@@ -279,6 +432,15 @@ main(int ac, char *av[])
                 extended = 1;
                 break;
             }
+            case 'f':
+                feeds = 1;
+                break;
+            case 't':
+                telemetry = 1;
+                break;
+            case 'r':
+                readers = 1;
+                break;
             case 'S': {
                 printSizePar = 1;
                 break;
@@ -346,6 +508,13 @@ main(int ac, char *av[])
     }
 
     if (!printSizePar) {
+        const int mapMode = pq_getMapMode(pq);
+
+        if (mapMode)
+            log_notice_q("Memory-mapping:%s%s%s",
+                (mapMode & PQ_MAP_HUGETLBFS) ? " hugetlbfs" : "",
+                (mapMode & PQ_MAP_THP) ? " transparent-huge-pages" : "",
+                (mapMode & PQ_MAP_INTERLEAVE) ? " NUMA-interleaved" : "");
         if (extended) {
             log_notice_q("nprods nfree  nempty      nbytes  maxprods  maxfree  "
                 "minempty    maxext    age    maxbytes");
@@ -470,6 +639,21 @@ main(int ac, char *av[])
                    strerror(status), status);
                 exit(1);
             }
+            if (feeds && (status = logFeeds(pq))) {
+                log_error_q("pq_scan() failed: %s (errno = %d)",
+                   strerror(status), status);
+                exit(1);
+            }
+            if (telemetry && (status = logTelemetry(pq, &lastSecond))) {
+                log_error_q("pq_getTelemetry() failed: %s (errno = %d)",
+                   strerror(status), status);
+                exit(1);
+            }
+            if (readers && (status = logReaders(pq))) {
+                log_error_q("pq_getReaders() failed: %s (errno = %d)",
+                   strerror(status), status);
+                exit(1);
+            }
         }
         
         if(interval == 0)
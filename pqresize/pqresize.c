@@ -0,0 +1,193 @@
+/**
+ * Resizes an LDM product-queue while it's in use.
+ *
+ * Copyright 2018, University Corporation for Atmospheric Research
+ * All rights reserved. See file COPYRIGHT in the top-level source-directory for
+ * copying and redistribution conditions.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ldm.h"
+#include "globals.h"
+#include "log.h"
+#include "pq.h"
+
+
+static void
+usage(const char *av0)
+{
+#define USAGE_FMT "\
+Usage: %s [options] [-s <datasz>[k|m|g]] [-S <nproducts>]\n\
+Options:\n\
+        -v           Verbose logging\n\
+        -x           Debug logging\n\
+        -f           Fast growth. Won't fill-in file blocks.\n\
+        -l dest      Log to `dest`. One of: \"\" (system logging daemon),\n\
+                     \"-\" (standard error), or file `dest`. Default is\n\
+                     \"%s\"\n\
+        -q pqfname   Product-queue. Default is \"%s\".\n\
+        -s datasz    New maximum number of bytes to hold. Default is the\n\
+                     current number.\n\
+        -S nproducts New maximum number of products to hold. Default is the\n\
+                     current number.\n\
+"
+
+        (void)fprintf(stderr, USAGE_FMT, av0, log_get_default_destination(),
+                        getDefaultQueuePath());
+        exit(1);
+}
+
+
+/*
+ * Returns the number of bytes specified by a size-string of the form
+ * <number>[k|m|g] or 0 if the string is invalid.
+ */
+static off_t
+parseSize(const char *const string)
+{
+        char  *cp;
+        off_t size;
+        int   exponent = 0;
+
+        errno = 0;
+        size = strtol(string, &cp, 0);
+        if (errno != 0 || size <= 0)
+                return 0;
+
+        switch (*cp) {
+                case 0:
+                        break;
+                case 'k':
+                case 'K':
+                        exponent = 1;
+                        break;
+                case 'm':
+                case 'M':
+                        exponent = 2;
+                        break;
+                case 'g':
+                case 'G':
+                        exponent = 3;
+                        break;
+                default:
+                        return 0;
+        }
+
+        for (int i = 0; i < exponent; i++) {
+                size *= 1000;
+                if (size <= 0)
+                        return 0; /* overflow */
+        }
+
+        return size;
+}
+
+
+int main(int ac, char *av[])
+{
+        const char *progname = basename(av[0]);
+        int pflags = 0;
+        off_t datasz = 0;
+        size_t nproducts = 0;
+        pqueue *pq = NULL;
+        int status;
+
+        /*
+         * initialize logger
+         */
+        if (log_init(progname)) {
+            log_syserr("Couldn't initialize logging module");
+            exit(1);
+        }
+
+        int ch;
+        extern char     *optarg;
+        extern int       optind;
+
+        while ((ch = getopt(ac, av, "vxfl:q:s:S:")) != EOF)
+                switch (ch) {
+                case 'v':
+                        if (!log_is_enabled_info)
+                            (void)log_set_level(LOG_LEVEL_INFO);
+                        break;
+                case 'x':
+                        (void)log_set_level(LOG_LEVEL_DEBUG);
+                        break;
+                case 'f':
+                        pflags |= PQ_SPARSE;
+                        break;
+                case 'l':
+                        if (log_set_destination(optarg)) {
+                            log_syserr("Couldn't set logging destination to \"%s\"",
+                                    optarg);
+                            usage(progname);
+                        }
+                        break;
+                case 'q':
+                        setQueuePath(optarg);
+                        break;
+                case 's':
+                        datasz = parseSize(optarg);
+                        if (datasz == 0) {
+                                (void)fprintf(stderr, "Illegal size \"%s\"\n",
+                                        optarg);
+                                usage(progname);
+                        }
+                        break;
+                case 'S':
+                        nproducts = (size_t)atol(optarg);
+                        if (nproducts == 0) {
+                                (void)fprintf(stderr,
+                                        "Illegal nproducts \"%s\"\n", optarg);
+                                usage(progname);
+                        }
+                        break;
+                default:
+                        usage(progname);
+                        break;
+                }
+
+        if (optind < ac || (datasz == 0 && nproducts == 0))
+                usage(progname);
+
+        const char* const pqfname = getQueuePath();
+
+        status = pq_open(pqfname, pflags, &pq);
+        if (status) {
+                if (PQ_CORRUPT == status) {
+                        log_error_q("The product-queue \"%s\" is inconsistent",
+                                pqfname);
+                }
+                else {
+                        log_error_q("Couldn't open product-queue \"%s\": %s",
+                                pqfname, strerror(status));
+                }
+                exit(1);
+        }
+
+        if (datasz == 0)
+                datasz = (off_t)pq_getDataSize(pq);
+        if (nproducts == 0)
+                nproducts = pq_getSlotCount(pq);
+
+        log_info_q("Resizing %s to %ld bytes, %lu products",
+                pqfname, (long)datasz, (unsigned long)nproducts);
+
+        status = pq_resize(pq, datasz, nproducts);
+        if (status) {
+                log_error_q("Couldn't resize product-queue \"%s\": %s",
+                        pqfname, status == PQ_CORRUPT
+                                ? "Product-queue is inconsistent"
+                                : strerror(status));
+        }
+
+        (void)pq_close(pq);
+
+        return status ? 1 : 0;
+}
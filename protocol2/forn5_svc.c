@@ -450,7 +450,7 @@ forn_5_svc(prod_class_t *want, struct svc_req *rqstp, const char *ident,
             (void) pq_close(pq);
             pq = NULL;
         }
-        status = pq_open(getQueuePath(), PQ_READONLY, &pq);
+        status = pq_open(getQueuePath(), PQ_READONLY | PQ_FASTOPEN, &pq);
         if(status)
         {
                 if (PQ_CORRUPT == status) {
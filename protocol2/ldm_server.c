@@ -467,7 +467,7 @@ hiya_6_svc(
         (void) pq_close(pq);
         pq = NULL;
     }
-    error = pq_open(pqfname, PQ_DEFAULT, &pq);
+    error = pq_open(pqfname, PQ_FASTOPEN, &pq);
     if (error) {
         err_log_and_free(ERR_NEW2(error, NULL,
                 "Couldn't open product-queue \"%s\" for writing: %s",
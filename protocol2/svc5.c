@@ -278,7 +278,7 @@ hiya_5_svc(prod_class_t *offerd, struct svc_req *rqstp)
             pq = NULL;
         }
         {
-            int error = pq_open(pqfname, PQ_DEFAULT, &pq);
+            int error = pq_open(pqfname, PQ_FASTOPEN, &pq);
 
             if (error) {
                 err_log_and_free(
@@ -568,6 +568,8 @@ static up6_error_t up6_run(
                 int pqStatus;       // Product-queue status
                 int sendStatus = 0; // Transmission status. Default success. Necessary in case
                                     // pq_next() doesn't call function argument but returns success
+                // Obtained before scanning so pq_waitForNewer() can't miss an insertion
+                const unsigned insertSeq = pq_getInsertSeq(_pq);
 #if USE_PQ_SEQUENCE
                 sendStatus = pqStatus = pq_sequence(_pq, _mt, _class,
                         _mode == FEED ? pq_sequence_feed : pq_sequence_notify, NULL);
@@ -600,7 +602,8 @@ static up6_error_t up6_run(
                         }
                         else {
                             (void) exitIfDone(0);
-                            (void) pq_suspend(_interval - timeSinceLastSend);
+                            (void) pq_waitForNewer(_pq, insertSeq,
+                                    _interval - timeSinceLastSend);
                         }
                     } /* end-of-queue reached */
                     else {
@@ -702,9 +705,10 @@ static up6_error_t up6_init(
     log_assert(upFilter != NULL);
 
     /*
-     * Open the product-queue read-only.
+     * Open the product-queue read-only. It was validated by the top-level LDM
+     * server when it started; consequently, its indexes are just prefetched.
      */
-    if ((errCode = pq_open(pqPath, PQ_READONLY, &_pq))) {
+    if ((errCode = pq_open(pqPath, PQ_READONLY | PQ_FASTOPEN, &_pq))) {
         if (PQ_CORRUPT == errCode) {
             log_error_q("The product-queue \"%s\" is inconsistent", pqPath);
         }
@@ -771,6 +775,24 @@ static up6_error_t up6_init(
             _mode = mode;
             _isPrimary = isPrimary;
 
+            /*
+             * Let the writers count the products that this feeder misses and
+             * let pqmon(1) list it if so configured. Failure isn't fatal: all
+             * slots being taken is expected when there are many feeders.
+             */
+            if (areFeedersRegistered()) {
+                const int status = pq_registerReader(_pq);
+
+                if (status == ENOSPC) {
+                    log_flush_debug();
+                }
+                else if (status) {
+                    log_add("Couldn't register with product-queue \"%s\"",
+                            pqPath);
+                    log_flush_warning();
+                }
+            }
+
             errCode = UP6_SUCCESS;
         } /* product-queue cursor set */
     } /* product-queue opened */
@@ -456,6 +456,41 @@ isAntiDosEnabled(void)
     return isEnabled;
 }
 
+/**
+ * Indicates whether or not upstream LDM processes register their position in
+ * the product-queue (see `pq_registerReader()`).
+ *
+ * @retval 0  They don't.
+ * @retval 1  They do.
+ */
+int
+areFeedersRegistered(void)
+{
+    static unsigned isEnabled;
+    static int      isSet = 0;
+
+    if (!isSet) {
+        int status = reg_getBool(REG_REGISTER_FEEDERS, &isEnabled);
+
+        if (status) {
+            isEnabled = 0;
+            log_add("Using default value: %s", isEnabled ? "TRUE" : "FALSE");
+            if (status == ENOENT) {
+                log_flush_info();
+                isSet = 1;
+            }
+            else {
+                log_flush_error();
+            }
+        }
+        else {
+            isSet = 1;
+        }
+    }
+
+    return isEnabled;
+}
+
 /**
  * Returns the backlog time-offset for making requests of an upstream LDM.
  *
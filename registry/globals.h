@@ -268,6 +268,16 @@ const char* getRegistryDirPath(void);
 int
 isAntiDosEnabled(void);
 
+/**
+ * Indicates whether or not upstream LDM processes register their position in
+ * the product-queue (see `pq_registerReader()`).
+ *
+ * @retval 0  They don't.
+ * @retval 1  They do.
+ */
+int
+areFeedersRegistered(void);
+
 /**
  * Returns the backlog time-offset for making requests of an upstream LDM.
  *
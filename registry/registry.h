@@ -38,6 +38,8 @@
 #define REG_QUEUE_PATH "/queue/path"
 #define REG_QUEUE_SIZE "/queue/size"
 #define REG_QUEUE_SLOTS "/queue/slots"
+#define REG_QUEUE_HUGE_PAGES "/queue/huge-pages"
+#define REG_QUEUE_NUMA_INTERLEAVE "/queue/numa-interleave"
 #define REG_SCOUR_CONFIG_PATH "/scour/config-path"
 #define REG_SCOUR_EXCLUDE_PATH "/scour/exclude-path"
 #define REG_LDMD_CONFIG_PATH "/server/config-path"
@@ -47,6 +49,7 @@
 #define REG_PORT "/server/port"
 #define REG_TIME_OFFSET "/server/time-offset"
 #define REG_ANTI_DOS "/server/enable-anti-DOS"
+#define REG_REGISTER_FEEDERS "/server/register-feeders"
 #define REG_SURFQUEUE_PATH "/surf-queue/path"
 #define REG_SURFQUEUE_SIZE "/surf-queue/size"
 #define REG_OESS_PATHNAME "/oess-pathname"